@@ -0,0 +1,233 @@
+//================================================================================================//
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "clock_sync.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+//
+// Accuracy of clock synchronization, simulated in virtual time. Device clock runs with offset
+// and drift, link delays are modelled for several kinds of connection. Compares delivery jitter
+// of immediate mode with error of scheduled mode, where message fires at estimated device time.
+//
+
+//------------------------------------------------------------------------------------------------//
+
+static const int64_t kDeviceOffsetUs = 123456789;
+static const double  kDeviceDriftPpm = 40.;
+
+//
+// Same as piano_send: 64 exchanges 20 ms apart, then one exchange per second during playback
+//
+static const size_t  kSyncExchanges  = 64;
+static const int64_t kSyncIntervalUs = 20000;
+static const int64_t kTrackIntervalUs = 1000000;
+
+//
+// Number of simulated note frames for delivery jitter of immediate mode
+//
+static const size_t  kNoteFrames     = 10000;
+static const size_t  kNoteFrameSize  = 10;
+
+//
+// Time after synchronization at which error of scheduled mode is measured
+//
+static const int64_t kHorizonsUs[]   = {0, 10000000, 60000000, 300000000};
+
+//------------------------------------------------------------------------------------------------//
+
+struct link_model_t
+{
+    const char *name;
+
+    //
+    // Fixed latency, mean of exponential queueing delay and period of USB polling
+    //
+    double      base_us;
+    double      queueing_us;
+    double      usb_frame_us;
+
+    //
+    // Rare long delays: scheduler hiccups, other traffic
+    //
+    double      outlier_probability;
+    double      outlier_us;
+
+    //
+    // 0 - no serialization (pty)
+    //
+    uint32_t    baud_rate;
+};
+
+static const link_model_t kModels[] =
+{
+    {"pty",                     20.,   10.,    0., 0.01,  2000.,      0},
+    {"usb uart 115200",        100.,   50., 1000., 0.01,  5000., 115200},
+    {"usb uart 921600",        100.,   50., 1000., 0.01,  5000., 921600},
+    {"usb uart 115200, loaded", 100., 500., 1000., 0.05, 20000., 115200},
+};
+
+//================================================================================================//
+
+class link_t
+{
+  public:
+    link_t(const link_model_t &model, uint32_t seed) : model_(model), random_(seed) {}
+
+    //
+    // Time from first byte sent to the moment receiver handles frame of given size. Receiver
+    // which stamps first byte does not wait for the rest of frame.
+    //
+    double delay_us(size_t size, bool whole_frame)
+    {
+        std::exponential_distribution<double> queueing(1. / model_.queueing_us);
+        std::uniform_real_distribution<double> uniform(0., 1.);
+
+        double delay = model_.base_us + queueing(random_) + uniform(random_) * model_.usb_frame_us;
+        if (whole_frame)
+        {
+            delay += static_cast<double>(size) * byte_us();
+        }
+        if (uniform(random_) < model_.outlier_probability)
+        {
+            delay += uniform(random_) * model_.outlier_us;
+        }
+        return delay;
+    }
+
+    double byte_us() const
+    {
+        return (model_.baud_rate == 0) ? 0. : 10. * 1e6 / model_.baud_rate;
+    }
+
+  private:
+    const link_model_t &model_;
+    std::mt19937        random_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static size_t
+frame_size(piano_proto::message_type_t type)
+{
+    piano_proto::message_t message;
+    message.type                   = type;
+    message.sync.host_send_us      = 1ull << 40;
+    message.sync.device_receive_us = 1ull << 40;
+    message.sync.device_send_us    = 1ull << 40;
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    piano_proto::encode_message(message, frame, sizeof(frame), &size);
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// One exchange at host_us. Device stamps first byte of request, host reads response after its
+// last byte.
+//
+static piano_host::sync_sample_t
+exchange(const piano_host::simulated_clock_t &device,
+         link_t                              *link,
+         double                               host_us,
+         bool                                 correction)
+{
+    size_t response_size = frame_size(piano_proto::MESSAGE_SYNC_RESPONSE);
+    double receive_us    = host_us    + link->delay_us(0, false);
+    double send_us       = receive_us + 30.;
+    double back_us       = send_us    + link->delay_us(response_size, true);
+    if (correction)
+    {
+        back_us -= static_cast<double>(response_size - 1) * link->byte_us();
+    }
+
+    piano_host::sync_sample_t sample = {};
+    sample.host_send_us      = static_cast<int64_t>(host_us);
+    sample.device_receive_us = device.at(static_cast<int64_t>(receive_us));
+    sample.device_send_us    = device.at(static_cast<int64_t>(send_us));
+    sample.host_receive_us   = static_cast<int64_t>(back_us);
+    return sample;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+bench_model(const link_model_t &model,
+            bool                correction,
+            bool                tracking)
+{
+    piano_host::simulated_clock_t device(kDeviceOffsetUs, kDeviceDriftPpm);
+    piano_host::clock_sync_t      sync;
+    link_t                        link(model, 1);
+
+    double host_us = 1e9;
+    for (size_t i = 0; i != kSyncExchanges; ++i, host_us += kSyncIntervalUs)
+    {
+        sync.add(exchange(device, &link, host_us, correction));
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << std::left << std::setw(26) << model.name << std::right
+              << (correction ? " corrected" : "          ")
+              << (tracking   ? " tracking" : " burst   ")
+              << "  schedule err";
+
+    // Tracking keeps adding exchanges until the time message fires
+    double next_us = host_us;
+    for (int64_t horizon : kHorizonsUs)
+    {
+        int64_t at_us = static_cast<int64_t>(host_us) + horizon;
+        for (; tracking && next_us < static_cast<double>(at_us); next_us += kTrackIntervalUs)
+        {
+            sync.add(exchange(device, &link, next_us, correction));
+        }
+        std::cout << " " << std::setw(4) << horizon / 1000000 << "s:"
+                  << std::setw(8) << static_cast<double>(sync.to_device(at_us) - device.at(at_us))
+                  << "us";
+    }
+    std::cout << "  drift err " << std::setw(6) << sync.drift_ppm() - kDeviceDriftPpm << " ppm";
+
+    // Immediate mode: note takes effect when the whole frame is received
+    piano_host::sample_stats_t delivery;
+    for (size_t i = 0; i != kNoteFrames; ++i)
+    {
+        delivery.add(link.delay_us(kNoteFrameSize, true));
+    }
+    std::cout << "  immediate jitter p1-p99 "
+              << std::setw(8) << delivery.percentile(.99) - delivery.percentile(.01) << "us\n";
+}
+
+//================================================================================================//
+
+int
+main()
+{
+    std::cout << "device clock offset " << kDeviceOffsetUs << " us, drift " << kDeviceDriftPpm
+              << " ppm, " << kSyncExchanges << " exchanges every " << kSyncIntervalUs / 1000
+              << " ms, then every " << kTrackIntervalUs / 1000 << " ms when tracking\n";
+    for (const link_model_t &model : kModels)
+    {
+        bench_model(model, false, false);
+        if (model.baud_rate != 0)
+        {
+            bench_model(model, true, false);
+        }
+        bench_model(model, model.baud_rate != 0, true);
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,186 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "device_sim.hh"
+#include "song_image.hh"
+#include "song_delta.hh"
+#include "song_upload.hh"
+
+//================================================================================================//
+
+//
+// Re-upload of edited song against device simulator on pty: edit moves notes of a stretch of
+// song a semitone up, patch against the song on device is sent instead of the whole image.
+// Time should follow length of the stretch, not of the song.
+//
+static const uint32_t kBaudRate  = 115200;
+static const uint64_t kEditsUs[] = {250000, 1000000, 4000000, 16000000, 64000000};
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+compile_edited(const std::vector<piano_midi::timed_event_t> &timeline,
+               uint64_t                                      from_us,
+               uint64_t                                      length_us,
+               std::vector<uint8_t>                         &image)
+{
+    std::vector<piano_midi::timed_event_t> edited   = timeline;
+    std::vector<piano_proto::message_t>    messages = {};
+    for (piano_midi::timed_event_t &event : edited)
+    {
+        if (event.event != piano::EVENT_TEMPO_SET && event.note < 127 &&
+            event.time_us >= from_us && event.time_us - from_us < length_us)
+        {
+            ++event.note;
+        }
+    }
+    piano::status_t status = piano_proto::make_messages(edited, messages);
+    return (status != piano::STATUS_SUCCESS) ? status : piano_proto::compile_song(messages, image);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Upload image as patch against the one device has, signature is replaced with the new one
+//
+static piano::status_t
+upload(int                           fd,
+       const std::vector<uint8_t>   &image,
+       piano_host::song_signature_t *signature,
+       piano_host::upload_result_t  *result)
+{
+    piano::status_t status = piano_host::upload_song(fd, kBaudRate, image, {}, result,
+                                                     signature->blocks.empty() ? nullptr
+                                                                               : signature);
+    piano_host::make_signature(image, piano_host::kDeltaBlockSize, signature);
+    return status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+bench_song(const std::vector<piano_midi::timed_event_t> &timeline)
+{
+    std::vector<uint8_t> original;
+    piano::status_t status = compile_edited(timeline, 0, 0, original);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    int         master = -1;
+    std::string slave  = {};
+    status = piano_host::open_pty(&master, &slave);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate = kBaudRate;
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { simulator.run(&stop); });
+
+    int  fd          = -1;
+    bool low_latency = false;
+    status = piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency);
+
+    piano_host::song_signature_t signature;
+    piano_host::upload_result_t  full;
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = upload(fd, original, &signature, &full);
+        std::cout << std::fixed << std::setprecision(3)
+                  << "  whole song   : " << std::setw(7) << original.size() << " bytes, "
+                  << full.seconds << " s\n";
+    }
+
+    // Edits start at the first note, each one is patched back before the next one
+    uint64_t from_us = 0;
+    for (size_t i = 0; i != timeline.size() && from_us == 0; ++i)
+    {
+        from_us = (timeline[i].event == piano::EVENT_NOTE_ON) ? timeline[i].time_us : 0;
+    }
+    for (uint64_t edit_us : kEditsUs)
+    {
+        std::vector<uint8_t>        edited;
+        piano_host::upload_result_t delta;
+        piano_host::upload_result_t back;
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = compile_edited(timeline, from_us, edit_us, edited);
+        }
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = upload(fd, edited, &signature, &delta);
+        }
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = upload(fd, original, &signature, &back);
+        }
+        if (status != piano::STATUS_SUCCESS)
+        {
+            break;
+        }
+        std::cout << "  edit " << std::setw(6) << std::setprecision(2) << edit_us * 1e-6
+                  << " s: " << std::setw(7) << delta.patch_bytes << " bytes, "
+                  << std::setprecision(3) << delta.seconds << " s, "
+                  << std::setprecision(1) << 100. * delta.seconds / full.seconds
+                  << "% of whole song\n";
+    }
+
+    stop = true;
+    device_thread.join();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    close(master);
+    return status;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        if (piano_midi::load_timeline(argv[i], timeline) != piano::STATUS_SUCCESS ||
+            timeline.empty())
+        {
+            std::cerr << "Error while loading " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        std::cout << argv[i] << ": " << timeline.back().time_us * 1e-6 << " s, baud "
+                  << kBaudRate << ", block " << piano_host::kDeltaBlockSize << " bytes\n";
+        if (bench_song(timeline) != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while uploading " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,127 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "pipeline.hh"
+#include "event_export.hh"
+
+//================================================================================================//
+
+//
+// Export of events of songs in each format: formatting alone on one core, then corpus of
+// kCopies of each song loaded, formatted and written to /dev/null with 1, 2, 4... threads up
+// to one per core. Rates are of output bytes.
+//
+static const size_t kCopies        = 64;
+static const size_t kFormatRepeats = 20;
+static const char  *kNullPath      = "/dev/null";
+static const char  *kFormatNames[] = {"csv", "jsonl", "columnar"};
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+bench_format(const std::vector<std::string> &songs,
+             piano_host::export_format_t     format)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    // Formatting of loaded songs
+    std::vector<char> out      = {};
+    size_t            bytes    = 0;
+    size_t            rows     = 0;
+    double            format_s = 0.;
+    for (const std::string &song : songs)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        if (piano_midi::load_timeline(song.c_str(), timeline) != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while loading " << song << "\n";
+            return EXIT_FAILURE;
+        }
+        out.resize(std::max(out.size(), piano_host::export_bound(format, song, timeline.size())));
+        auto start = clock_t::now();
+        for (size_t repeat = 0; repeat != kFormatRepeats; ++repeat)
+        {
+            bytes += piano_host::format_song(format, song, timeline, out.data());
+        }
+        format_s += std::chrono::duration<double>(clock_t::now() - start).count();
+        rows     += timeline.size() * kFormatRepeats;
+    }
+    std::cout << std::fixed << std::setprecision(1) << kFormatNames[format] << ": format "
+              << static_cast<double>(bytes) / 1e6 / format_s << " MB/s, "
+              << static_cast<double>(rows) / 1e6 / format_s << " M rows/s, "
+              << static_cast<double>(bytes) / static_cast<double>(rows) << " bytes per row\n";
+
+    std::vector<std::string> corpus = {};
+    for (size_t copy = 0; copy != kCopies; ++copy)
+    {
+        corpus.insert(corpus.end(), songs.begin(), songs.end());
+    }
+
+    size_t              cores   = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> threads = {};
+    for (size_t count = 1; count < cores; count *= 2)
+    {
+        threads.push_back(count);
+    }
+    threads.push_back(cores);
+
+    double single_s = 0.;
+    for (size_t count : threads)
+    {
+        piano_host::export_config_t  config = {};
+        piano_host::stage_stats_t    stats  = {};
+        piano_host::stage_stats_t    write  = {};
+        std::vector<piano::status_t> status = {};
+        config.format  = format;
+        config.threads = count;
+
+        auto start = clock_t::now();
+        if (piano_host::export_events(corpus, config, kNullPath, &stats, &write, status) !=
+            piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while writing " << kNullPath << "\n";
+            return EXIT_FAILURE;
+        }
+        double export_s = std::chrono::duration<double>(clock_t::now() - start).count();
+        single_s = (count == 1) ? export_s : single_s;
+        std::cout << "  " << std::setw(3) << count << " threads: " << corpus.size() << " songs, "
+                  << std::setw(7) << static_cast<double>(write.bytes) / 1e6 << " MB in "
+                  << std::setw(7) << export_s * 1e3 << " ms, " << std::setw(7)
+                  << static_cast<double>(write.bytes) / 1e6 / export_s << " MB/s, speedup "
+                  << std::setprecision(2) << single_s / export_s << std::setprecision(1) << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    std::vector<std::string> songs(argv + 1, argv + argc);
+    for (piano_host::export_format_t format : {piano_host::EXPORT_CSV, piano_host::EXPORT_JSONL,
+                                               piano_host::EXPORT_COLUMNAR})
+    {
+        if (bench_format(songs, format) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
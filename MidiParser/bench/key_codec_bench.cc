@@ -0,0 +1,173 @@
+//================================================================================================//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "key_codec.hh"
+#include "protocol.hh"
+
+//================================================================================================//
+
+//
+// 115200 baud 8N1 in bytes per second
+//
+static const double   kLinkBytesPerSecond = 115200. / 10.;
+
+//
+// Frame rates to compare
+//
+static const uint32_t kFrameRates[]       = {50, 100, 200, 1000};
+
+//================================================================================================//
+
+static void
+bench_rate(const std::vector<piano_midi::timed_event_t> &timeline,
+           uint32_t                                      rate)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    // State of keys at every tick of frame clock, including ticks without changes
+    uint64_t period_us = 1000000 / rate;
+    std::vector<piano_proto::key_state_t> states = {};
+    piano_proto::key_state_t state = {};
+    size_t next = 0;
+    for (uint64_t time_us = period_us; next != timeline.size(); time_us += period_us)
+    {
+        for (; next != timeline.size() && timeline[next].time_us < time_us; ++next)
+        {
+            if (timeline[next].event != piano::EVENT_TEMPO_SET)
+            {
+                state.set(timeline[next].note, timeline[next].event == piano::EVENT_NOTE_ON);
+            }
+        }
+        states.push_back(state);
+    }
+
+    std::vector<uint8_t> frames(states.size() * piano_proto::kMaxKeyFrameSize);
+    std::vector<uint8_t> sizes(states.size());
+    piano_proto::key_encoder_t encoder;
+
+    auto   encode_start = clock_t::now();
+    size_t codec_bytes  = 0;
+    for (size_t i = 0; i != states.size(); ++i)
+    {
+        sizes[i] = static_cast<uint8_t>(encoder.encode(states[i], &frames[codec_bytes]));
+        codec_bytes += sizes[i];
+    }
+    auto encode_end = clock_t::now();
+
+    // Ticks which produced a frame and offsets of their frames, ticks without changes send nothing
+    std::vector<size_t> sent    = {};
+    std::vector<size_t> offsets = {};
+    for (size_t i = 0, offset = 0; i != states.size(); offset += sizes[i], ++i)
+    {
+        if (sizes[i] != 0)
+        {
+            sent.push_back(i);
+            offsets.push_back(offset);
+        }
+    }
+    size_t sent_frames = sent.size();
+
+    // Only decode calls are timed, decoded states are checked afterwards
+    piano_proto::key_decoder_t            decoder;
+    std::vector<piano_proto::key_state_t> decoded(sent_frames);
+    std::vector<piano::status_t>          status(sent_frames);
+
+    auto decode_start = clock_t::now();
+    for (size_t j = 0; j != sent_frames; ++j)
+    {
+        status[j] = decoder.decode(&frames[offsets[j]], sizes[sent[j]], &decoded[j]);
+    }
+    auto decode_end = clock_t::now();
+
+    size_t errors = 0;
+    for (size_t j = 0; j != sent_frames; ++j)
+    {
+        errors += (status[j] != piano::STATUS_SUCCESS) || (decoded[j] != states[sent[j]]);
+    }
+
+    // Bytes on wire with protocol framing
+    std::vector<piano_proto::message_t> messages = {};
+    piano_proto::key_encoder_t wire_encoder;
+    piano_proto::make_key_frame_messages(timeline, period_us, wire_encoder, messages);
+    size_t wire_bytes = 0;
+    for (const auto &message : messages)
+    {
+        uint8_t frame[piano_proto::kMaxFrameSize] = {};
+        size_t  frame_size = 0;
+        piano_proto::encode_message(message, frame, sizeof(frame), &frame_size);
+        wire_bytes += frame_size;
+    }
+
+    // Full state sent every tick, as if there was no codec
+    piano_proto::message_t raw_message = {};
+    raw_message.type              = piano_proto::MESSAGE_KEY_FRAME;
+    raw_message.key_frame.time_us = timeline.back().time_us;
+    raw_message.key_frame.size    = piano_proto::kMaxKeyFrameSize;
+    std::fill(raw_message.key_frame.data,
+              raw_message.key_frame.data + piano_proto::kMaxKeyFrameSize,
+              0xff);
+    uint8_t raw_frame[piano_proto::kMaxFrameSize] = {};
+    size_t  raw_frame_size = 0;
+    piano_proto::encode_message(raw_message, raw_frame, sizeof(raw_frame), &raw_frame_size);
+
+    using ns_t = std::chrono::duration<double, std::nano>;
+
+    // Compression ratio is against full bitmap of each frame sent, saving of link against
+    // bitmap of every tick is in link load
+    double raw_bytes  = static_cast<double>(sent_frames * piano_proto::kKeyBitmapSize);
+    double raw_wire   = static_cast<double>(states.size() * raw_frame_size);
+    double duration_s = static_cast<double>(states.size()) / rate;
+    double encode_ns  = std::chrono::duration_cast<ns_t>(encode_end - encode_start).count();
+    double decode_ns  = std::chrono::duration_cast<ns_t>(decode_end - decode_start).count();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "  " << std::setw(4) << rate << " Hz: "
+              << "ratio " << std::setw(7) << raw_bytes / codec_bytes << "x, "
+              << std::setw(5) << static_cast<double>(codec_bytes) / sent_frames << " B/frame, "
+              << "encode " << std::setw(6) << encode_ns / states.size() << " ns/frame, "
+              << "decode " << std::setw(6) << decode_ns / sent_frames << " ns/frame, "
+              << "link load " << std::setw(6)
+              << 100. * wire_bytes / duration_s / kLinkBytesPerSecond << "% "
+              << "(raw " << 100. * raw_wire / duration_s / kLinkBytesPerSecond
+              << "%)" << (errors != 0 ? " DECODE ERRORS" : "") << "\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << argv[0] << ": usage: " << argv[0] << " <file.mid>...\n";
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i != argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        if (piano_midi::load_timeline(argv[i], timeline) != piano::STATUS_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        std::cout << argv[i] << ": " << timeline.size() << " events\n";
+        for (uint32_t rate : kFrameRates)
+        {
+            bench_rate(timeline, rate);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
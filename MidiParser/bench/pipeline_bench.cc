@@ -0,0 +1,167 @@
+//================================================================================================//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "midi_pipeline.hh"
+
+//================================================================================================//
+
+//
+// Synthetic song used to show that memory use of pipeline does not depend on length of song
+//
+static const char    *kSyntheticPath  = "pipeline_bench.mid";
+static const uint32_t kSyntheticNotes = 1000000;
+
+//
+// Note is 8 bytes: on and off events with explicit status
+//
+static const size_t   kNoteSize       = 8;
+
+//================================================================================================//
+
+static long
+max_rss_kb()
+{
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Format 0 song with piano program and given number of notes, written in chunks
+//
+static bool
+write_synthetic(const char *path, uint32_t notes)
+{
+    FILE *file = std::fopen(path, "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Error while creating " << path << "\n";
+        return false;
+    }
+
+    static const uint8_t kTrackStart[] =
+    {
+        0x00, 0xc0, 0x00,                               // program change to piano
+        0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20,       // tempo 500000
+    };
+    static const uint8_t kTrackEnd[] = {0x00, 0xff, 0x2f, 0x00};
+
+    uint32_t length = static_cast<uint32_t>(sizeof(kTrackStart) + notes * kNoteSize +
+                                            sizeof(kTrackEnd));
+    const uint8_t header[] =
+    {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xe0,
+        'M', 'T', 'r', 'k',
+        static_cast<uint8_t>(length >> 24), static_cast<uint8_t>(length >> 16),
+        static_cast<uint8_t>(length >> 8),  static_cast<uint8_t>(length),
+    };
+    std::fwrite(header,      1, sizeof(header),      file);
+    std::fwrite(kTrackStart, 1, sizeof(kTrackStart), file);
+
+    std::vector<uint8_t> chunk = {};
+    for (uint32_t note = 0; note != notes; ++note)
+    {
+        uint8_t key = static_cast<uint8_t>(21 + note % 88);
+        const uint8_t bytes[kNoteSize] = {0x00, 0x90, key, 0x40, 0x3c, 0x80, key, 0x00};
+        chunk.insert(chunk.end(), bytes, bytes + kNoteSize);
+        if (chunk.size() >= 1 << 16)
+        {
+            std::fwrite(chunk.data(), 1, chunk.size(), file);
+            chunk.clear();
+        }
+    }
+    std::fwrite(chunk.data(), 1, chunk.size(), file);
+    std::fwrite(kTrackEnd, 1, sizeof(kTrackEnd), file);
+    return std::fclose(file) == 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Stream song to /dev/null as fast as possible
+//
+static int
+bench_file(const char *path)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd == -1)
+    {
+        std::cerr << "Error while opening /dev/null\n";
+        return EXIT_FAILURE;
+    }
+
+    long rss_before = max_rss_kb();
+    auto start      = clock_t::now();
+
+    piano_host::midi_pipeline_t pipeline(fd, {0, 0.});
+    piano::status_t             status = pipeline.run(path);
+    close(fd);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    double seconds = std::chrono::duration<double>(clock_t::now() - start).count();
+    double events  = static_cast<double>(pipeline.stats(piano_host::STAGE_PARSE).items);
+    std::cout << std::fixed << std::setprecision(1) << path << ": "
+              << pipeline.stats(piano_host::STAGE_READ).bytes << " B file, "
+              << events << " events in " << seconds * 1e3 << " ms ("
+              << events / seconds / 1e6 << " M events/s), max rss "
+              << rss_before << " -> " << max_rss_kb() << " KB\n";
+    pipeline.print_stats(std::cout);
+    std::cout << "\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (bench_file(argv[i]) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!write_synthetic(kSyntheticPath, kSyntheticNotes))
+    {
+        return EXIT_FAILURE;
+    }
+    int result = bench_file(kSyntheticPath);
+
+    // Same song loaded as a whole for comparison of memory use
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (result == EXIT_SUCCESS &&
+        piano_midi::load_timeline(kSyntheticPath, timeline) == piano::STATUS_SUCCESS)
+    {
+        std::cout << "load_timeline of " << kSyntheticPath << ": " << timeline.size()
+                  << " events, max rss " << max_rss_kb() << " KB\n";
+    }
+    std::remove(kSyntheticPath);
+    return result;
+}
+
+//================================================================================================//
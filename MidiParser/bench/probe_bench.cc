@@ -0,0 +1,104 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "device_sim.hh"
+#include "latency_probe.hh"
+
+//================================================================================================//
+
+//
+// Latency of host-device path against device simulator on pty, so that it can be tracked per
+// build without hardware. Simulator models UART speed and device clock.
+//
+static const uint32_t kBaudRates[]    = {0, 115200, 921600};
+static const int64_t  kDeviceOffsetUs = 123456789;
+static const double   kDeviceDriftPpm = 40.;
+
+static const size_t   kSyncExchanges  = 64;
+static const uint64_t kSyncIntervalUs = 2000;
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+bench_link(uint32_t baud_rate,
+           uint8_t  padding)
+{
+    int         master = -1;
+    std::string slave  = {};
+    piano::status_t status = piano_host::open_pty(&master, &slave);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    piano_host::simulator_config_t config = {baud_rate, kDeviceOffsetUs, kDeviceDriftPpm};
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { simulator.run(&stop); });
+
+    int  fd          = -1;
+    bool low_latency = false;
+    status = piano_host::open_serial(slave.c_str(), (baud_rate == 0) ? 115200 : baud_rate,
+                                     &fd, &low_latency);
+
+    piano_host::clock_sync_t   sync;
+    piano_host::probe_result_t result;
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = piano_host::sync_clock(fd, baud_rate, kSyncExchanges, kSyncIntervalUs, &sync);
+    }
+    if (status == piano::STATUS_SUCCESS)
+    {
+        piano_host::probe_config_t probe = {};
+        probe.samples     = 2000;
+        probe.interval_us = 1000;
+        probe.padding     = padding;
+        status = piano_host::probe_latency(fd, baud_rate, probe, &sync, &result);
+    }
+
+    stop = true;
+    device_thread.join();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    close(master);
+
+    std::cout << "baud " << baud_rate << ", padding " << static_cast<unsigned>(padding) << "\n";
+    result.print(std::cout);
+    return status;
+}
+
+//================================================================================================//
+
+int
+main()
+{
+    for (uint32_t baud_rate : kBaudRates)
+    {
+        for (uint8_t padding : {0, 64})
+        {
+            if (bench_link(baud_rate, padding) != piano::STATUS_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,127 @@
+//================================================================================================//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+
+//================================================================================================//
+
+//
+// UART is configured as 8N1, so each byte takes 10 bit times on the wire
+//
+static const double kBaudRate    = 115200.;
+static const double kBitsPerByte = 10.;
+
+//
+// Song is encoded and decoded several times to get stable timings
+//
+static const int    kRepeats     = 50;
+
+//================================================================================================//
+
+static int
+bench_file(const char *path)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(path, timeline) != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<piano_proto::message_t> messages = {};
+    piano_proto::make_messages(timeline, messages);
+
+    std::vector<uint8_t> stream(messages.size() * piano_proto::kMaxFrameSize);
+    size_t stream_size = 0;
+
+    auto encode_start = clock_t::now();
+    for (int repeat = 0; repeat != kRepeats; ++repeat)
+    {
+        stream_size = 0;
+        for (const auto &message : messages)
+        {
+            size_t frame_size = 0;
+            piano_proto::encode_message(message,
+                                        stream.data() + stream_size,
+                                        stream.size() - stream_size,
+                                        &frame_size);
+            stream_size += frame_size;
+        }
+    }
+    auto encode_end = clock_t::now();
+
+    size_t decoded = 0;
+    auto decode_start = clock_t::now();
+    for (int repeat = 0; repeat != kRepeats; ++repeat)
+    {
+        piano_proto::frame_decoder_t decoder;
+        piano_proto::message_t       message = {};
+        for (size_t i = 0; i != stream_size; ++i)
+        {
+            if (decoder.push(stream[i], &message) == piano::STATUS_SUCCESS)
+            {
+                ++decoded;
+            }
+        }
+    }
+    auto decode_end = clock_t::now();
+
+    if (decoded != messages.size() * kRepeats)
+    {
+        std::cerr << path << ": decoded " << decoded << " of " << messages.size() * kRepeats
+                  << " messages\n";
+        return EXIT_FAILURE;
+    }
+
+    double events        = static_cast<double>(timeline.size());
+    double encode_ns     = std::chrono::duration<double, std::nano>(encode_end - encode_start).count();
+    double decode_ns     = std::chrono::duration<double, std::nano>(decode_end - decode_start).count();
+    double bytes_event   = static_cast<double>(stream_size) / events;
+    double link_events_s = kBaudRate / kBitsPerByte / bytes_event;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << path << ":\n"
+              << "  events:              " << timeline.size() << "\n"
+              << "  frames:              " << messages.size() << "\n"
+              << "  wire bytes:          " << stream_size << " (" << bytes_event << " per event)\n"
+              << "  encode:              " << encode_ns / kRepeats / events << " ns/event, "
+                                           << 1e9 * kRepeats * events / encode_ns << " events/s\n"
+              << "  decode:              " << decode_ns / kRepeats / events << " ns/event, "
+                                           << 1e9 * kRepeats * events / decode_ns << " events/s\n"
+              << "  link at 115200 baud: " << link_events_s << " events/s\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << argv[0] << ": usage: " << argv[0] << " <file.mid>...\n";
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    for (int i = 1; i != argc; ++i)
+    {
+        if (bench_file(argv[i]) != EXIT_SUCCESS)
+        {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
+//================================================================================================//
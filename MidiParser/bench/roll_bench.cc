@@ -0,0 +1,120 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "pipeline.hh"
+#include "piano_roll.hh"
+
+//================================================================================================//
+
+//
+// Piano roll of songs at 1080p60 into /dev/null: cost of one frame on one core split into
+// drawing and colour conversion, then whole export with 1, 2, 4... threads up to one per core
+// as frames per second and real time factor.
+//
+static const char  *kNullPath      = "/dev/null";
+static const size_t kSampledFrames = 600;
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+bench_file(const char *name)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(name, timeline) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while loading " << name << "\n";
+        return EXIT_FAILURE;
+    }
+
+    piano_host::roll_config_t   config   = {};
+    piano_host::roll_renderer_t renderer(timeline, config);
+    size_t                      pixels   = static_cast<size_t>(renderer.width()) *
+                                           renderer.height();
+    std::vector<uint8_t>        rgb(pixels * 3);
+    std::vector<uint8_t>        yuv(pixels * 3 / 2);
+    double                      draw_s   = 0.;
+    double                      yuv_s    = 0.;
+    size_t                      step     = std::max<size_t>(renderer.frames() / kSampledFrames, 1);
+    size_t                      sampled  = 0;
+    for (size_t frame = 0; frame < renderer.frames(); frame += step, ++sampled)
+    {
+        auto start = clock_t::now();
+        renderer.render(frame, rgb.data());
+        auto drawn = clock_t::now();
+        piano_host::rgb_to_yuv420(rgb.data(), renderer.width(), renderer.height(), yuv.data());
+        draw_s += std::chrono::duration<double>(drawn - start).count();
+        yuv_s  += std::chrono::duration<double>(clock_t::now() - drawn).count();
+    }
+
+    double song_s = static_cast<double>(renderer.frames()) / config.fps;
+    std::cout << std::fixed << std::setprecision(1) << name << ": " << renderer.frames()
+              << " frames, " << song_s << " s of video\n"
+              << "  per frame: draw " << draw_s * 1e3 / sampled << " ms, yuv "
+              << yuv_s * 1e3 / sampled << " ms, "
+              << sampled / (draw_s + yuv_s) / config.fps << "x real time per core\n";
+
+    size_t              cores   = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> threads = {};
+    for (size_t count = 1; count < cores; count *= 2)
+    {
+        threads.push_back(count);
+    }
+    threads.push_back(cores);
+
+    double single_s = 0.;
+    for (size_t count : threads)
+    {
+        piano_host::stage_stats_t render = {};
+        piano_host::stage_stats_t write  = {};
+        config.threads = count;
+
+        auto start = clock_t::now();
+        if (piano_host::export_roll(timeline, config, kNullPath, &render, &write) !=
+            piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while writing " << kNullPath << "\n";
+            return EXIT_FAILURE;
+        }
+        double export_s = std::chrono::duration<double>(clock_t::now() - start).count();
+        single_s = (count == 1) ? export_s : single_s;
+        std::cout << "  " << std::setw(3) << count << " threads: " << std::setw(7) << export_s
+                  << " s, " << std::setw(6) << static_cast<double>(write.items) / export_s
+                  << " fps, " << std::setw(5) << song_s / export_s << "x real time, speedup "
+                  << std::setprecision(2) << single_s / export_s << std::setprecision(1)
+                  << ", writer waited " << static_cast<double>(write.input_stall_ns) / 1e9
+                  << " s\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (bench_file(argv[i]) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,148 @@
+//================================================================================================//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "device.hh"
+#include "led_pacer.hh"
+#include "device_sim.hh"
+
+//================================================================================================//
+
+//
+// Reception on device while LED strip refreshes, against device simulator on pty. Song is
+// played faster than real time, so that chords come in bursts. Strip refresh in receive loop
+// (as firmware did before UART events and LED task) holds bytes in UART for the whole refresh,
+// with LED thread they wait only for the device loop. LED thread at fixed rate shows fewer
+// frames, each for all notes of its period. Long strip split among 4 strips refreshed at once
+// takes as long as a quarter of it.
+//
+static const uint32_t kBaudRate    = 921600;
+static const double   kSpeed       = 20.;
+static const uint64_t kSongUs      = 60000000;
+
+struct strip_mode_t
+{
+    size_t leds;
+    size_t strips;
+};
+
+static const strip_mode_t kStrips[] = {{1, 1}, {88, 1}, {128, 1}, {128, 4}};
+
+struct refresh_mode_t
+{
+    bool     blocking;
+    uint32_t rate_hz;
+};
+
+static const refresh_mode_t kModes[] = {{true, 0}, {false, 0}, {false, piano_device::kLedRateHz}};
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+bench_receive(const std::vector<piano_proto::message_t> &messages,
+              const strip_mode_t                        &strip,
+              bool                                       blocking,
+              uint32_t                                   rate_hz)
+{
+    int         master = -1;
+    std::string slave  = {};
+    piano::status_t status = piano_host::open_pty(&master, &slave);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate      = kBaudRate;
+    config.led_refresh_us = piano_device::strip_split_t(strip.leds, strip.strips).refresh_us();
+    config.blocking_leds  = blocking;
+    config.led_rate_hz    = rate_hz;
+    config.strip.leds     = strip.leds;
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { simulator.run(&stop); });
+
+    int  fd          = -1;
+    bool low_latency = false;
+    status = piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency);
+    if (status == piano::STATUS_SUCCESS)
+    {
+        piano_host::serial_sender_t sender(fd);
+        status = sender.play(messages, kSpeed);
+    }
+
+    // Device catches up with what is left in modelled UART
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    stop = true;
+    device_thread.join();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    close(master);
+
+    std::cout << strip.leds << " LEDs on " << strip.strips << " strips, refresh "
+              << config.led_refresh_us << " us, " << (blocking ? "in receive loop" : "LED thread");
+    if (rate_hz != 0)
+    {
+        std::cout << " at " << rate_hz << " Hz";
+    }
+    std::cout << "\n";
+    simulator.print_stats(std::cout);
+    return status;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        std::vector<piano_proto::message_t>    messages = {};
+        if (piano_midi::load_timeline(argv[i], timeline) != piano::STATUS_SUCCESS ||
+            piano_proto::make_messages(timeline, messages) != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while loading " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+        while (!messages.empty() && piano_proto::message_time(messages.back()) > kSongUs)
+        {
+            messages.pop_back();
+        }
+
+        std::cout << std::defaultfloat << argv[i] << ": " << messages.size()
+                  << " messages at speed " << kSpeed << ", baud " << kBaudRate << "\n";
+        for (const strip_mode_t &strip : kStrips)
+        {
+            for (const refresh_mode_t &mode : kModes)
+            {
+                if (bench_receive(messages, strip, mode.blocking, mode.rate_hz) !=
+                    piano::STATUS_SUCCESS)
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,353 @@
+//================================================================================================//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "device_sim.hh"
+#include "midi_pipeline.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+//
+// Song split by key over several device simulators on ptys. Unpaced runs show aggregate
+// bandwidth at modelled baud rate, paced runs show skew between devices: every step of the
+// synthetic song changes keys of all shards, so the k-th LED frame of each device belongs to
+// the same step and should be shown at the same time.
+//
+// Song is short, so in lookahead mode drift of device clocks is not fitted yet (see
+// kMinDriftSpanUs) and skew grows with difference of drifts over the song.
+//
+static const uint32_t kBaudRate       = 115200;
+static const size_t   kShardCounts[]  = {1, 2, 4};
+
+//
+// Each device has its own clock
+//
+static const int64_t  kDeviceOffsetUs = 123456789;
+static const double   kDeviceDriftPpm = 40.;
+
+static const size_t   kSyncExchanges   = 64;
+static const uint64_t kSyncIntervalUs  = 5000;
+static const uint64_t kTrackIntervalUs = 1000000;
+static const uint64_t kLookaheadUs     = 100000;
+
+//
+// Synthetic song: chords of 8 keys spread over the piano, 24 ticks (25 ms) apart
+//
+static const char    *kSyntheticPath  = "shard_bench.mid";
+static const uint32_t kChords         = 200;
+static const uint8_t  kChordKeys      = 8;
+static const uint8_t  kChordStride    = 11;
+static const uint8_t  kStepTicks      = 24;
+
+//================================================================================================//
+
+//
+// Format 0 song, chord i is released when chord i + 1 is pressed
+//
+static bool
+write_synthetic(const char *path)
+{
+    std::vector<uint8_t> track =
+    {
+        0x00, 0xc0, 0x00,                               // program change to piano
+        0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20,       // tempo 500000
+    };
+    for (uint32_t chord = 0; chord <= kChords; ++chord)
+    {
+        for (uint8_t i = 0; i != kChordKeys; ++i)
+        {
+            uint8_t delta = (i == 0 && chord != 0) ? kStepTicks : 0;
+            uint8_t base  = static_cast<uint8_t>(21 + i * kChordStride);
+            if (chord != 0)
+            {
+                uint8_t key = static_cast<uint8_t>(base + (chord - 1) % kChordStride);
+                track.insert(track.end(), {delta, 0x80, key, 0x00});
+                delta = 0;
+            }
+            if (chord != kChords)
+            {
+                uint8_t key = static_cast<uint8_t>(base + chord % kChordStride);
+                track.insert(track.end(), {delta, 0x90, key, 0x40});
+            }
+        }
+    }
+    track.insert(track.end(), {0x00, 0xff, 0x2f, 0x00});
+
+    FILE *file = std::fopen(path, "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Error while creating " << path << "\n";
+        return false;
+    }
+    uint32_t length = static_cast<uint32_t>(track.size());
+    const uint8_t header[] =
+    {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xe0,
+        'M', 'T', 'r', 'k',
+        static_cast<uint8_t>(length >> 24), static_cast<uint8_t>(length >> 16),
+        static_cast<uint8_t>(length >> 8),  static_cast<uint8_t>(length),
+    };
+    std::fwrite(header,       1, sizeof(header), file);
+    std::fwrite(track.data(), 1, track.size(),   file);
+    return std::fclose(file) == 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Simulator on pty with host side open, LED frames are logged
+//
+struct device_rig_t
+{
+    int                                             master = -1;
+    int                                             fd     = -1;
+    std::ostringstream                              log;
+    std::unique_ptr<piano_host::device_simulator_t> simulator;
+    std::unique_ptr<piano_host::clock_tracker_t>    clock;
+    std::atomic<bool>                               stop   = {false};
+    std::thread                                     thread;
+
+    piano::status_t open(size_t index)
+    {
+        std::string slave = {};
+        piano::status_t status = piano_host::open_pty(&master, &slave);
+        if (status != piano::STATUS_SUCCESS)
+        {
+            return status;
+        }
+        piano_host::simulator_config_t config =
+        {
+            kBaudRate,
+            kDeviceOffsetUs * static_cast<int64_t>(index + 1),
+            kDeviceDriftPpm * (static_cast<double>(index) - 1.5),
+        };
+        simulator = std::make_unique<piano_host::device_simulator_t>(master, config, &log);
+        thread    = std::thread([this]() { simulator->run(&stop); });
+
+        bool low_latency = false;
+        status = piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency);
+        clock  = std::make_unique<piano_host::clock_tracker_t>(fd, kBaudRate);
+        return status;
+    }
+
+    //
+    // Estimate device clock and switch device to scheduled mode
+    //
+    piano::status_t schedule()
+    {
+        piano::status_t status = clock->synchronize(kSyncExchanges, kSyncIntervalUs);
+        if (status != piano::STATUS_SUCCESS)
+        {
+            return status;
+        }
+        piano_proto::message_t message = {};
+        message.type             = piano_proto::MESSAGE_SCHEDULE;
+        message.schedule.enabled = true;
+
+        piano_host::serial_sender_t sender(fd);
+        status = sender.enqueue(message);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = sender.flush();
+        }
+        clock->start(kTrackIntervalUs);
+        return status;
+    }
+
+    void close_all()
+    {
+        if (clock != nullptr)
+        {
+            clock->stop();
+        }
+        if (thread.joinable())
+        {
+            stop = true;
+            thread.join();
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (master >= 0)
+        {
+            close(master);
+        }
+    }
+
+    //
+    // Host times of logged LED frames
+    //
+    std::vector<int64_t> shown_us() const
+    {
+        std::istringstream   lines(log.str());
+        std::vector<int64_t> times = {};
+        std::string          line  = {};
+        while (std::getline(lines, line))
+        {
+            times.push_back(std::strtoll(line.c_str(), nullptr, 10));
+        }
+        return times;
+    }
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+bench_shards(const char *path,
+             size_t      count,
+             double      speed,
+             bool        lookahead)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::vector<std::unique_ptr<device_rig_t>> rigs   = {};
+    std::vector<piano_host::pipeline_link_t>   links  = {};
+    piano::status_t                            status = piano::STATUS_SUCCESS;
+    for (size_t i = 0; i != count && status == piano::STATUS_SUCCESS; ++i)
+    {
+        rigs.push_back(std::make_unique<device_rig_t>());
+        status = rigs.back()->open(i);
+        if (status == piano::STATUS_SUCCESS && lookahead)
+        {
+            status = rigs.back()->schedule();
+        }
+        links.push_back({rigs.back()->fd, lookahead ? rigs.back()->clock.get() : nullptr});
+    }
+
+    piano_host::pipeline_config_t config = {0, speed};
+    config.lookahead_us = lookahead ? kLookaheadUs : 0;
+    piano_host::midi_pipeline_t pipeline(links, piano_host::key_shards_t::ranges(count, 21, 108),
+                                         config);
+
+    clock_t::time_point start = clock_t::now();
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = pipeline.run(path);
+    }
+
+    // Song is played when the last byte has passed modelled UART, not when host wrote it
+    uint64_t bytes = 0;
+    for (size_t i = 0; i != count && status == piano::STATUS_SUCCESS; ++i)
+    {
+        bytes += pipeline.sender(i).bytes_sent();
+        while (rigs[i]->simulator->bytes_received() < pipeline.sender(i).bytes_sent())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    double seconds = std::chrono::duration<double>(clock_t::now() - start).count();
+
+    // Scheduled frames are shown after lookahead
+    std::this_thread::sleep_for(std::chrono::microseconds(config.lookahead_us));
+    for (auto &rig : rigs)
+    {
+        rig->close_all();
+    }
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    std::cout << count << " devices, "
+              << ((speed == 0.) ? "unpaced" : (lookahead ? "lookahead" : "immediate")) << ": "
+              << bytes << " bytes in " << seconds << " s, "
+              << static_cast<double>(bytes) / seconds / 1024. << " KiB/s\n";
+    if (speed == 0.)
+    {
+        return status;
+    }
+
+    // Skew of the k-th LED frame over devices
+    std::vector<std::vector<int64_t>> shown = {};
+    size_t frames = SIZE_MAX;
+    for (const auto &rig : rigs)
+    {
+        shown.push_back(rig->shown_us());
+        frames = std::min(frames, shown.back().size());
+    }
+    piano_host::sample_stats_t skew;
+    for (size_t k = 0; k != frames && count > 1; ++k)
+    {
+        int64_t first = INT64_MAX;
+        int64_t last  = INT64_MIN;
+        for (const auto &times : shown)
+        {
+            first = std::min(first, times[k]);
+            last  = std::max(last,  times[k]);
+        }
+        skew.add(static_cast<double>(last - first));
+    }
+    for (size_t i = 0; i != count; ++i)
+    {
+        std::cout << "  device " << i << ": " << shown[i].size() << " LED frames, ";
+        pipeline.lateness(i).print(std::cout, "lateness", "us");
+    }
+    if (count > 1)
+    {
+        skew.print(std::cout, "  skew    ", "us");
+    }
+    return status;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    if (!write_synthetic(kSyntheticPath))
+    {
+        return EXIT_FAILURE;
+    }
+    std::cout << "baud " << kBaudRate << ", lookahead " << kLookaheadUs / 1000 << " ms\n";
+
+    std::vector<const char *> paths = {kSyntheticPath};
+    paths.insert(paths.end(), argv + 1, argv + argc);
+    for (const char *path : paths)
+    {
+        std::cout << path << "\n";
+        for (size_t count : kShardCounts)
+        {
+            if (bench_shards(path, count, 0., false) != piano::STATUS_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::cout << kSyntheticPath << " in time\n";
+    for (size_t count : kShardCounts)
+    {
+        for (bool lookahead : {false, true})
+        {
+            if (bench_shards(kSyntheticPath, count, 1., lookahead) != piano::STATUS_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    std::remove(kSyntheticPath);
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
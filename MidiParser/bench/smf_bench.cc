@@ -0,0 +1,195 @@
+//================================================================================================//
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "midi_parser.hh"
+#include "timeline.hh"
+#include "protocol.hh"
+#include "device.hh"
+
+//================================================================================================//
+
+//
+// Playback of MIDI file in place as firmware does it from flash partition: startup time, time
+// per message and heap, compared with parsing the whole file first. Synthetic song shows that
+// heap of playback does not depend on length of file.
+//
+static const size_t   kStartRepeats   = 1000;
+static const uint32_t kSyntheticNotes = 1000000;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Heap in use and its peak, counted by replaced operator new and delete
+//
+static size_t heap_bytes = 0;
+static size_t heap_peak  = 0;
+
+static const size_t kBlockHeader = alignof(std::max_align_t);
+
+void *
+operator new(size_t size)
+{
+    uint8_t *block = static_cast<uint8_t *>(std::malloc(size + kBlockHeader));
+    if (block == nullptr)
+    {
+        std::abort();
+    }
+    *reinterpret_cast<size_t *>(block) = size;
+    heap_bytes += size;
+    heap_peak   = std::max(heap_peak, heap_bytes);
+    return block + kBlockHeader;
+}
+
+void
+operator delete(void *pointer) noexcept
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    uint8_t *block = static_cast<uint8_t *>(pointer) - kBlockHeader;
+    heap_bytes -= *reinterpret_cast<size_t *>(block);
+    std::free(block);
+}
+
+void
+operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+class null_port_t : public piano_device::device_port_t
+{
+  public:
+    int64_t now_us() override                            { return 0; }
+    void    send(const uint8_t *, size_t) override       {}
+    void    show(const piano_device::led_frame_t &) override {}
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Format 0 song with piano program and given number of notes
+//
+static std::vector<uint8_t>
+make_synthetic(uint32_t notes)
+{
+    static const uint8_t kTrackStart[] = {0x00, 0xc0, 0x00};
+    static const uint8_t kTrackEnd[]   = {0x00, 0xff, 0x2f, 0x00};
+
+    uint32_t length = static_cast<uint32_t>(sizeof(kTrackStart) + notes * 8 + sizeof(kTrackEnd));
+    std::vector<uint8_t> file =
+    {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xe0,
+        'M', 'T', 'r', 'k',
+        static_cast<uint8_t>(length >> 24), static_cast<uint8_t>(length >> 16),
+        static_cast<uint8_t>(length >> 8),  static_cast<uint8_t>(length),
+    };
+    file.insert(file.end(), kTrackStart, kTrackStart + sizeof(kTrackStart));
+    for (uint32_t note = 0; note != notes; ++note)
+    {
+        uint8_t key = static_cast<uint8_t>(21 + note % 88);
+        const uint8_t bytes[] = {0x00, 0x90, key, 0x40, 0x3c, 0x80, key, 0x00};
+        file.insert(file.end(), bytes, bytes + sizeof(bytes));
+    }
+    file.insert(file.end(), kTrackEnd, kTrackEnd + sizeof(kTrackEnd));
+    return file;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+bench_file(const char *name, const std::vector<uint8_t> &file)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    // Device is a static object on firmware, its own size is not heap
+    static null_port_t            port;
+    static piano_device::device_t device(&port);
+
+    // Startup: layout, search for piano track, first batch
+    auto start = clock_t::now();
+    for (size_t i = 0; i != kStartRepeats; ++i)
+    {
+        if (device.play_file(file.data(), file.size(), 0) != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while starting " << name << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    double start_us = std::chrono::duration<double, std::micro>(clock_t::now() - start).count() /
+                      kStartRepeats;
+
+    // Playback of the whole file at once
+    size_t heap_before = heap_bytes;
+    heap_peak          = heap_bytes;
+    size_t updates     = 0;
+    start              = clock_t::now();
+    device.play_file(file.data(), file.size(), 0);
+    while (device.has_scheduled())
+    {
+        device.update(device.next_time_us());
+        ++updates;
+    }
+    double play_ms   = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    size_t play_heap = heap_peak - heap_before;
+
+    // The same with the whole file parsed into timeline and messages first
+    heap_before = heap_bytes;
+    heap_peak   = heap_bytes;
+    start       = clock_t::now();
+    std::vector<piano::event_t>            events   = {};
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    if (piano_midi::parse_midi(file.data(), file.size(), events) != piano::STATUS_SUCCESS ||
+        piano_midi::resolve_timeline(events, timeline) != piano::STATUS_SUCCESS ||
+        piano_proto::make_messages(timeline, messages) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while parsing " << name << "\n";
+        return EXIT_FAILURE;
+    }
+    double parse_ms   = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    size_t parse_heap = heap_peak - heap_before;
+
+    std::cout << std::fixed << std::setprecision(1) << name << ": " << file.size() << " B, "
+              << updates << " updates\n"
+              << "  in place:   start " << start_us << " us, playback " << play_ms << " ms ("
+              << play_ms * 1e3 / static_cast<double>(updates) << " us per update), heap "
+              << play_heap << " B\n"
+              << "  parse all:  " << parse_ms << " ms before the first note, heap "
+              << parse_heap << " B\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<uint8_t> file = {};
+        if (piano_midi::read_file(argv[i], file) != piano::STATUS_SUCCESS ||
+            bench_file(argv[i], file) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return bench_file("synthetic", make_synthetic(kSyntheticNotes));
+}
+
+//================================================================================================//
@@ -0,0 +1,319 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "soundfont.hh"
+
+//================================================================================================//
+
+//
+// Sampled piano at 48 kHz from synthetic SoundFont shaped like real ones: every third key is
+// sampled for kSampleS with loop over its last kLoopS, keys in between are resampled. Voices
+// per core is how many held voices one thread renders in real time. Each song opens the font
+// again and reports how much of its sample chunk became resident.
+//
+static const double   kSampleS       = 4.;
+static const double   kLoopS         = 0.5;
+static const uint8_t  kFirstKey      = 21;
+static const uint8_t  kKeys          = 88;
+static const uint8_t  kKeysPerSample = 3;
+static const double   kVoiceS        = 10.;
+static const size_t   kBlock         = 256;
+static const char    *kFontPath      = "soundfont_bench.sf2";
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+put(std::vector<uint8_t> &out,
+    uint64_t              value,
+    size_t                bytes)
+{
+    for (size_t i = 0; i != bytes; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static void
+put_name(std::vector<uint8_t> &out,
+         const std::string    &name)
+{
+    out.insert(out.end(), name.begin(), name.end());
+    out.insert(out.end(), 20 - name.size(), 0);
+}
+
+static void
+put_chunk(std::vector<uint8_t>       &out,
+          const char                 *id,
+          const std::vector<uint8_t> &content)
+{
+    out.insert(out.end(), id, id + 4);
+    put(out, content.size(), 4);
+    out.insert(out.end(), content.begin(), content.end());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// One instrument with a zone per sample in preset of program 0
+//
+static bool
+write_font(const char *path)
+{
+    uint32_t             rate    = piano_audio::kSamplerRate;
+    uint32_t             length  = static_cast<uint32_t>(kSampleS * rate);
+    uint32_t             loop    = static_cast<uint32_t>(kLoopS * rate);
+    std::vector<uint8_t> smpl    = {};
+    std::vector<uint8_t> shdr    = {};
+    std::vector<uint8_t> igen    = {};
+    std::vector<uint8_t> ibag    = {};
+    for (uint8_t key = kFirstKey; key < kFirstKey + kKeys; key += kKeysPerSample)
+    {
+        uint32_t start     = static_cast<uint32_t>(smpl.size() / 2);
+        double   frequency = 440. * std::exp2((key - 69.) / 12.);
+        for (uint32_t i = 0; i != length + 46; ++i)
+        {
+            double t     = static_cast<double>(i) / rate;
+            double value = 0.;
+            for (int k = 1; k <= 6 && i < length; ++k)
+            {
+                value += std::sin(6.283185307179586 * frequency * k * t) / k;
+            }
+            put(smpl, static_cast<uint16_t>(static_cast<int16_t>(8000. * value)), 2);
+        }
+
+        put_name(shdr, "key " + std::to_string(key));
+        put(shdr, start, 4);
+        put(shdr, start + length, 4);
+        put(shdr, start + length - loop, 4);
+        put(shdr, start + length - 1, 4);
+        put(shdr, rate, 4);
+        put(shdr, key, 1);
+        put(shdr, 0, 1);
+        put(shdr, 0, 2);
+        put(shdr, 1, 2);
+
+        // Keys from one below sample to one above, looped, released in 0.3 s
+        uint8_t low  = static_cast<uint8_t>(std::max(key - 1, 0));
+        uint8_t high = static_cast<uint8_t>(std::min(key + 1, 127));
+        put(ibag, igen.size() / 4, 2);
+        put(ibag, 0, 2);
+        for (uint32_t generator : {43u << 16 | high << 8 | low, 54u << 16 | 1u,
+                                   38u << 16 | static_cast<uint16_t>(-2084),
+                                   53u << 16 | static_cast<uint32_t>(shdr.size() / 46 - 1)})
+        {
+            put(igen, generator >> 16, 2);
+            put(igen, generator & 0xffff, 2);
+        }
+    }
+
+    std::vector<uint8_t> phdr = {};
+    std::vector<uint8_t> pbag = {};
+    std::vector<uint8_t> pgen = {};
+    std::vector<uint8_t> inst = {};
+    put_name(phdr, "Grand Piano");
+    put(phdr, 0, 4);
+    put(phdr, 0, 2);
+    put(phdr, 0, 12);
+    put(pbag, 0, 4);
+    put(pgen, 41, 2);
+    put(pgen, 0, 2);
+    put_name(phdr, "EOP");
+    put(phdr, 0, 4);
+    put(phdr, 1, 2);
+    put(phdr, 0, 12);
+    put(pbag, 1, 2);
+    put(pbag, 0, 2);
+    put(pgen, 0, 4);
+    put_name(inst, "Grand Piano");
+    put(inst, 0, 2);
+    put_name(inst, "EOI");
+    put(inst, ibag.size() / 4, 2);
+    put(ibag, igen.size() / 4, 2);
+    put(ibag, 0, 2);
+    put(igen, 0, 4);
+    put_name(shdr, "EOS");
+    shdr.insert(shdr.end(), 26, 0);
+
+    std::vector<uint8_t> info = {'I', 'N', 'F', 'O'};
+    std::vector<uint8_t> sdta = {'s', 'd', 't', 'a'};
+    std::vector<uint8_t> pdta = {'p', 'd', 't', 'a'};
+    put_chunk(info, "ifil", {2, 0, 1, 0});
+    put_chunk(sdta, "smpl", smpl);
+    const char                 *names[]  = {"phdr", "pbag", "pmod", "pgen", "inst", "ibag", "imod",
+                                            "igen", "shdr"};
+    std::vector<uint8_t>        empty(10, 0);
+    const std::vector<uint8_t> *chunks[] = {&phdr, &pbag, &empty, &pgen, &inst, &ibag, &empty,
+                                            &igen, &shdr};
+    for (size_t i = 0; i != 9; ++i)
+    {
+        put_chunk(pdta, names[i], *chunks[i]);
+    }
+    std::vector<uint8_t> body = {'s', 'f', 'b', 'k'};
+    put_chunk(body, "LIST", info);
+    put_chunk(body, "LIST", sdta);
+    put_chunk(body, "LIST", pdta);
+    std::vector<uint8_t> file = {};
+    put_chunk(file, "RIFF", body);
+
+    FILE *out     = std::fopen(path, "wb");
+    bool  written = out != nullptr && std::fwrite(file.data(), 1, file.size(), out) == file.size();
+    if (out != nullptr)
+    {
+        written &= std::fclose(out) == 0;
+    }
+    return written;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Resident size of mapping which holds address, from Rss of its entry in /proc/self/smaps: pages
+// this process touched, whether or not the rest of file is in page cache
+//
+static size_t
+mapping_rss(const void *address)
+{
+    std::ifstream smaps("/proc/self/smaps");
+    std::string   line;
+    bool          found = false;
+    uintptr_t     at    = reinterpret_cast<uintptr_t>(address);
+    while (std::getline(smaps, line))
+    {
+        unsigned long long from = 0;
+        unsigned long long to   = 0;
+        if (std::sscanf(line.c_str(), "%llx-%llx ", &from, &to) == 2 && line.find(' ') != 0)
+        {
+            found = from <= at && at < to;
+        } else if (found && line.compare(0, 4, "Rss:") == 0)
+        {
+            return std::strtoull(line.c_str() + 4, nullptr, 10) * 1024;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+bench_voices(const piano_audio::soundfont_t &font,
+             const piano_audio::sf_preset_t &preset)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    for (size_t voices : {size_t(1), size_t(16), piano_audio::kSamplerVoices})
+    {
+        piano_audio::sampler_t sampler(font, preset, piano_audio::kSamplerRate);
+        for (size_t i = 0; i != voices; ++i)
+        {
+            sampler.note_on(static_cast<uint8_t>(kFirstKey + i * kKeys / voices), 100);
+        }
+
+        std::vector<float> out(kBlock);
+        size_t             blocks = static_cast<size_t>(kVoiceS * piano_audio::kSamplerRate /
+                                                        kBlock);
+        auto               start  = clock_t::now();
+        for (size_t block = 0; block != blocks; ++block)
+        {
+            std::fill(out.begin(), out.end(), 0.f);
+            sampler.render(out.data(), out.size());
+        }
+        double render_s = std::chrono::duration<double>(clock_t::now() - start).count();
+        double audio_s  = static_cast<double>(blocks * kBlock) / piano_audio::kSamplerRate;
+        std::cout << std::fixed << std::setprecision(1) << "  " << std::setw(2) << voices
+                  << " voices: " << std::setw(7) << audio_s / render_s << "x real time, "
+                  << std::setw(6) << std::setprecision(0)
+                  << static_cast<double>(voices) * audio_s / render_s << " voices per core, "
+                  << std::setprecision(1) << render_s * 1e9 / (blocks * kBlock * voices)
+                  << " ns per voice sample\n";
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+bench_song(const char *name)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(name, timeline) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while loading " << name << "\n";
+        return EXIT_FAILURE;
+    }
+
+    piano_audio::soundfont_t font;
+    if (font.open(kFontPath) != piano::STATUS_SUCCESS || font.piano_preset() == nullptr)
+    {
+        std::cerr << "Error while opening " << kFontPath << "\n";
+        return EXIT_FAILURE;
+    }
+    size_t resident_before = mapping_rss(font.samples());
+
+    std::vector<float> samples = {};
+    auto start = clock_t::now();
+    piano_audio::render_song(timeline, font, *font.piano_preset(), piano_audio::kSamplerRate,
+                             samples);
+    double render_s = std::chrono::duration<double>(clock_t::now() - start).count();
+    double song_s   = static_cast<double>(samples.size()) / piano_audio::kSamplerRate;
+    std::cout << std::fixed << std::setprecision(1) << name << ": " << song_s << " s in "
+              << render_s * 1e3 << " ms, " << song_s / render_s << "x real time, resident "
+              << resident_before / 1024 << " -> " << mapping_rss(font.samples()) / 1024 << " of "
+              << font.mapped_bytes() / 1024 << " KiB of samples\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    if (!write_font(kFontPath))
+    {
+        std::cerr << "Error while writing " << kFontPath << "\n";
+        return EXIT_FAILURE;
+    }
+
+    piano_audio::soundfont_t font;
+    if (font.open(kFontPath) != piano::STATUS_SUCCESS || font.piano_preset() == nullptr)
+    {
+        std::cerr << "Error while opening " << kFontPath << "\n";
+        unlink(kFontPath);
+        return EXIT_FAILURE;
+    }
+    std::cout << "synthetic font: " << font.piano_preset()->zones.size() << " zones, "
+              << font.mapped_bytes() / 1024 << " KiB of samples\n";
+    bench_voices(font, *font.piano_preset());
+
+    int result = EXIT_SUCCESS;
+    for (int i = 1; i < argc && result == EXIT_SUCCESS; ++i)
+    {
+        result = bench_song(argv[i]);
+    }
+    unlink(kFontPath);
+    return result;
+}
+
+//================================================================================================//
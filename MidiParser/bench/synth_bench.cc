@@ -0,0 +1,99 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "synth.hh"
+
+//================================================================================================//
+
+//
+// Offline rendering of songs at 44.1 kHz: real time factor (seconds of song per second of
+// rendering) for 1, 2, 4... threads up to one per core, and speedup over one thread. The best
+// of kRepeats runs is kept.
+//
+static const size_t kRepeats = 3;
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+bench_file(const char *name)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(name, timeline) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while loading " << name << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<piano_audio::note_span_t> spans = {};
+    piano_audio::make_note_spans(timeline, piano_audio::kDefaultSampleRate, spans);
+
+    size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> threads = {};
+    for (size_t count = 1; count < cores; count *= 2)
+    {
+        threads.push_back(count);
+    }
+    threads.push_back(cores);
+
+    double             single_s = 0.;
+    std::vector<float> samples  = {};
+    for (size_t count : threads)
+    {
+        piano_audio::synth_config_t config = {};
+        config.threads = count;
+
+        double best_s = 0.;
+        for (size_t repeat = 0; repeat != kRepeats; ++repeat)
+        {
+            auto start = clock_t::now();
+            piano_audio::render_song(timeline, config, samples);
+            double render_s = std::chrono::duration<double>(clock_t::now() - start).count();
+            best_s = (repeat == 0) ? render_s : std::min(best_s, render_s);
+        }
+        single_s = (count == 1) ? best_s : single_s;
+
+        double song_s = static_cast<double>(samples.size()) / piano_audio::kDefaultSampleRate;
+        if (count == 1)
+        {
+            std::cout << std::fixed << std::setprecision(1) << name << ": " << spans.size()
+                      << " notes, " << song_s << " s of audio\n";
+        }
+        std::cout << "  " << std::setw(3) << count << " threads: " << std::setw(8)
+                  << best_s * 1e3 << " ms, " << std::setw(7) << song_s / best_s
+                  << "x real time, speedup " << std::setprecision(2) << single_s / best_s
+                  << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (bench_file(argv[i]) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
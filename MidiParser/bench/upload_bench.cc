@@ -0,0 +1,115 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "device_sim.hh"
+#include "song_image.hh"
+#include "song_upload.hh"
+
+//================================================================================================//
+
+//
+// Song upload against device simulator on pty: throughput compared with the line limit of
+// modelled UART, with damaged bytes on the line to show the cost of retransmission
+//
+static const uint32_t kBaudRates[]  = {115200, 921600};
+static const double   kErrorRates[] = {0., 1e-4, 1e-3};
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+bench_upload(const std::vector<uint8_t> &image,
+             uint32_t                    baud_rate,
+             double                      error_rate)
+{
+    int         master = -1;
+    std::string slave  = {};
+    piano::status_t status = piano_host::open_pty(&master, &slave);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate  = baud_rate;
+    config.error_rate = error_rate;
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { simulator.run(&stop); });
+
+    int  fd          = -1;
+    bool low_latency = false;
+    status = piano_host::open_serial(slave.c_str(), baud_rate, &fd, &low_latency);
+
+    piano_host::upload_result_t result;
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = piano_host::upload_song(fd, baud_rate, image, {}, &result);
+    }
+
+    stop = true;
+    device_thread.join();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    close(master);
+
+    std::cout << std::defaultfloat << "baud " << baud_rate << ", byte error rate " << error_rate
+              << "\n";
+    result.print(std::cout, baud_rate);
+    return status;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        std::vector<piano_proto::message_t>    messages = {};
+        std::vector<uint8_t>                   image    = {};
+        if (piano_midi::load_timeline(argv[i], timeline) != piano::STATUS_SUCCESS ||
+            piano_proto::make_messages(timeline, messages) != piano::STATUS_SUCCESS ||
+            piano_proto::compile_song(messages, image) != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while compiling " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        // Frame overhead alone: chunk header, crc16, COBS and delimiter
+        size_t chunk_frame = piano_proto::kUploadChunkSize + 2 + 1 + 2 + 1 + 1;
+        std::cout << argv[i] << ": image " << image.size() << " bytes, frame efficiency "
+                  << 100. * piano_proto::kUploadChunkSize / chunk_frame << "%\n";
+        for (uint32_t baud_rate : kBaudRates)
+        {
+            for (double error_rate : kErrorRates)
+            {
+                if (bench_upload(image, baud_rate, error_rate) != piano::STATUS_SUCCESS)
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,354 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "clock_sync.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Exchange is given up if response does not come within this time
+//
+static const int64_t kSyncTimeoutUs = 100000;
+
+//
+// UART frame of one byte: start bit, 8 data bits, stop bit
+//
+static const double  kBitsPerByte   = 10.;
+
+//================================================================================================//
+
+int64_t
+host_time_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//================================================================================================//
+
+void
+clock_sync_t::add(const sync_sample_t &sample)
+{
+    samples_[next_] = sample;
+    next_  = (next_ + 1) % kSyncWindow;
+    count_ = std::min(count_ + 1, kSyncWindow);
+    fit();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+clock_sync_t::clear()
+{
+    count_        = 0;
+    next_         = 0;
+    estimate_     = {};
+    min_delay_us_ = 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+clock_estimate_t::to_device(int64_t host_us) const
+{
+    double host = static_cast<double>(host_us);
+    return static_cast<int64_t>(host + offset_us + drift * (host - reference_us));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+clock_estimate_t::to_host(int64_t device_us) const
+{
+    double device = static_cast<double>(device_us);
+    return static_cast<int64_t>((device - offset_us + drift * reference_us) / (1. + drift));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+clock_sync_t::fit()
+{
+    // Indices of exchanges sorted by delay, the fastest ones are used
+    size_t order[kSyncWindow] = {};
+    for (size_t i = 0; i != count_; ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order, order + count_, [this](size_t lhs, size_t rhs)
+    {
+        return samples_[lhs].delay_us() < samples_[rhs].delay_us();
+    });
+    min_delay_us_ = samples_[order[0]].delay_us();
+
+    size_t selected = std::max(kMinSyncSamples,
+                               static_cast<size_t>(static_cast<double>(count_) * kSyncSelection));
+    selected = std::min(selected, count_);
+
+    // Offset is measured at the middle of exchange on host side
+    double mean_x = 0.;
+    double mean_y = 0.;
+    for (size_t i = 0; i != selected; ++i)
+    {
+        const sync_sample_t &sample = samples_[order[i]];
+        mean_x += static_cast<double>(sample.host_send_us + sample.host_receive_us) / 2.;
+        mean_y += static_cast<double>(sample.offset_us());
+    }
+    mean_x /= static_cast<double>(selected);
+    mean_y /= static_cast<double>(selected);
+
+    double covariance = 0.;
+    double variance   = 0.;
+    double first_x    = 0.;
+    double last_x     = 0.;
+    for (size_t i = 0; i != selected; ++i)
+    {
+        const sync_sample_t &sample = samples_[order[i]];
+        double x = static_cast<double>(sample.host_send_us + sample.host_receive_us) / 2. - mean_x;
+        double y = static_cast<double>(sample.offset_us()) - mean_y;
+        covariance += x * y;
+        variance   += x * x;
+        first_x     = std::min(first_x, x);
+        last_x      = std::max(last_x,  x);
+    }
+
+    // Short span keeps the previous drift, it is still better than noise
+    estimate_.reference_us = mean_x;
+    estimate_.offset_us    = mean_y;
+    if (last_x - first_x >= static_cast<double>(kMinDriftSpanUs) && variance > 0.)
+    {
+        estimate_.drift = covariance / variance;
+    }
+}
+
+//================================================================================================//
+
+//
+// Wait for response to request sent at host_send_us
+//
+static status_t
+receive_response(int            fd,
+                 uint32_t       baud_rate,
+                 int64_t        host_send_us,
+                 sync_sample_t *sample)
+{
+    piano_proto::frame_decoder_t decoder;
+    piano_proto::message_t       message;
+    uint8_t                      buffer[256] = {};
+
+    int64_t deadline_us = host_send_us + kSyncTimeoutUs;
+    int64_t now_us      = host_time_us();
+    while (now_us < deadline_us)
+    {
+        pollfd request = {fd, POLLIN, 0};
+        int    ready   = poll(&request, 1, static_cast<int>((deadline_us - now_us + 999) / 1000));
+        if (ready < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+
+        ssize_t size = (ready == 0) ? 0 : read(fd, buffer, sizeof(buffer));
+        now_us = host_time_us();
+        if (size < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+
+        for (ssize_t i = 0; i != size; ++i)
+        {
+            if (decoder.push(buffer[i], &message) != STATUS_SUCCESS ||
+                message.type != piano_proto::MESSAGE_SYNC_RESPONSE ||
+                message.sync.host_send_us != static_cast<uint64_t>(host_send_us))
+            {
+                continue;
+            }
+            // Frame is encoded again only to know its size on the wire
+            int64_t transfer_us = 0;
+            if (baud_rate != 0)
+            {
+                uint8_t frame[piano_proto::kMaxFrameSize] = {};
+                size_t  size = 0;
+                piano_proto::encode_message(message, frame, sizeof(frame), &size);
+                transfer_us = static_cast<int64_t>(static_cast<double>(size - 1) * kBitsPerByte *
+                                                   1e6 / baud_rate);
+            }
+
+            sample->host_send_us      = host_send_us;
+            sample->device_receive_us = static_cast<int64_t>(message.sync.device_receive_us);
+            sample->device_send_us    = static_cast<int64_t>(message.sync.device_send_us);
+            sample->host_receive_us   = now_us - transfer_us;
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_SYNC_TIMEOUT;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Send one request and wait for its response
+//
+static status_t
+exchange(int            fd,
+         uint32_t       baud_rate,
+         sync_sample_t *sample)
+{
+    piano_proto::message_t request;
+    request.type = piano_proto::MESSAGE_SYNC_REQUEST;
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+
+    // Timestamp is taken as close to write as possible
+    int64_t host_send_us = host_time_us();
+    request.sync.host_send_us = static_cast<uint64_t>(host_send_us);
+    piano_proto::encode_message(request, frame, sizeof(frame), &size);
+    if (write(fd, frame, size) != static_cast<ssize_t>(size))
+    {
+        return STATUS_SERIAL_WRITE_ERROR;
+    }
+    return receive_response(fd, baud_rate, host_send_us, sample);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+sync_clock(int           fd,
+           uint32_t      baud_rate,
+           size_t        exchanges,
+           uint64_t      interval_us,
+           clock_sync_t *sync)
+{
+    size_t completed = 0;
+    for (size_t i = 0; i != exchanges; ++i)
+    {
+        sync_sample_t sample = {};
+        status_t      status = exchange(fd, baud_rate, &sample);
+        if (status == STATUS_SUCCESS)
+        {
+            sync->add(sample);
+            ++completed;
+        } else if (status != STATUS_SYNC_TIMEOUT)
+        {
+            return status;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+    }
+
+    if (completed < kMinSyncSamples)
+    {
+        std::cerr << "Device answered " << completed << " of " << exchanges
+                  << " clock sync requests\n";
+        return STATUS_SYNC_TIMEOUT;
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+status_t
+clock_tracker_t::synchronize(size_t   exchanges,
+                             uint64_t interval_us)
+{
+    clock_sync_t sync = this->sync();
+    status_t status = sync_clock(fd_, baud_rate_, exchanges, interval_us, &sync);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    sync_ = sync;
+    return status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+clock_tracker_t::start(uint64_t interval_us)
+{
+    stop();
+    stop_   = false;
+    thread_ = std::thread(&clock_tracker_t::run, this, interval_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+clock_tracker_t::stop()
+{
+    stop_ = true;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+clock_estimate_t
+clock_tracker_t::estimate() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sync_.estimate();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+clock_sync_t
+clock_tracker_t::sync() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sync_;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+clock_tracker_t::run(uint64_t interval_us)
+{
+    // Lost exchanges are skipped, estimate stays valid until the next one
+    while (!stop_)
+    {
+        sync_sample_t sample = {};
+        status_t      status = exchange(fd_, baud_rate_, &sample);
+        if (status == STATUS_SUCCESS)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sync_.add(sample);
+        } else if (status != STATUS_SYNC_TIMEOUT)
+        {
+            break;
+        }
+
+        int64_t wake_us = host_time_us() + static_cast<int64_t>(interval_us);
+        while (!stop_ && host_time_us() < wake_us)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
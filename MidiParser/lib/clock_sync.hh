@@ -0,0 +1,223 @@
+//================================================================================================//
+
+#ifndef __CLOCK_SYNC_HH__
+#define __CLOCK_SYNC_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+
+//================================================================================================//
+
+//
+// Estimation of device clock from host clock with NTP-style exchanges:
+//
+//     host  t1 ---- MESSAGE_SYNC_REQUEST ----> t2  device
+//     host  t4 <--- MESSAGE_SYNC_RESPONSE ---- t3  device
+//
+// Each exchange gives offset ((t2 - t1) + (t3 - t4)) / 2, which is exact if both directions
+// take the same time, and round trip delay (t4 - t1) - (t3 - t2). Delays on the link are mostly
+// queueing, so exchanges with the smallest delay are the most symmetric ones: estimator keeps
+// a window of recent exchanges, selects the fastest of them and fits offset and drift by
+// least squares.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Number of recent exchanges kept by estimator
+//
+static const size_t kSyncWindow      = 64;
+
+//
+// Part of window with the smallest delay used for fit, at least kMinSyncSamples exchanges
+//
+static const double kSyncSelection   = 0.25;
+static const size_t kMinSyncSamples  = 4;
+
+//
+// Drift is estimated only from exchanges which span at least this time. Over shorter span
+// delay jitter gives larger error than drift of crystals itself (tens of ppm).
+//
+static const int64_t kMinDriftSpanUs = 10000000;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Time of host clock (steady clock) in microseconds, the clock estimator works with
+//
+int64_t host_time_us();
+
+//------------------------------------------------------------------------------------------------//
+
+struct sync_sample_t
+{
+    int64_t host_send_us      = 0;
+    int64_t device_receive_us = 0;
+    int64_t device_send_us    = 0;
+    int64_t host_receive_us   = 0;
+
+    int64_t offset_us() const
+    {
+        return ((device_receive_us - host_send_us) + (device_send_us - host_receive_us)) / 2;
+    }
+
+    int64_t delay_us() const
+    {
+        return (host_receive_us - host_send_us) - (device_send_us - device_receive_us);
+    }
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Maps host time to device time as
+//
+//     device = host + offset + drift * (host - reference)
+//
+struct clock_estimate_t
+{
+    double reference_us = 0.;
+    double offset_us    = 0.;
+    double drift        = 0.;
+
+    int64_t to_device(int64_t host_us)   const;
+    int64_t to_host  (int64_t device_us) const;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+class clock_sync_t
+{
+  public:
+    void add(const sync_sample_t &sample);
+    void clear();
+
+    bool synchronized() const { return count_ >= kMinSyncSamples; }
+
+    const clock_estimate_t &estimate() const { return estimate_; }
+
+    int64_t to_device(int64_t host_us)   const { return estimate_.to_device(host_us); }
+    int64_t to_host  (int64_t device_us) const { return estimate_.to_host(device_us);  }
+
+    double  offset_us()    const { return estimate_.offset_us;   }
+    double  drift_ppm()    const { return estimate_.drift * 1e6; }
+
+    //
+    // Smallest round trip delay in window, half of it bounds error of offset
+    //
+    int64_t min_delay_us() const { return min_delay_us_; }
+
+    size_t  count()        const { return count_;        }
+
+  private:
+    void fit();
+
+    sync_sample_t    samples_[kSyncWindow] = {};
+    size_t           count_                = 0;
+    size_t           next_                 = 0;
+    clock_estimate_t estimate_             = {};
+    int64_t          min_delay_us_         = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Clock of simulated device: runs with given offset and drift from host clock. Used to measure
+// accuracy of synchronization on host and by device simulator.
+//
+class simulated_clock_t
+{
+  public:
+    simulated_clock_t(int64_t offset_us = 0, double drift_ppm = 0.)
+        : offset_us_(offset_us), drift_(drift_ppm * 1e-6) {}
+
+    //
+    // Device time at given host time
+    //
+    int64_t at(int64_t host_us) const
+    {
+        return host_us + offset_us_ + static_cast<int64_t>(drift_ * static_cast<double>(host_us));
+    }
+
+    int64_t now_us() const { return at(host_time_us()); }
+
+  private:
+    int64_t offset_us_ = 0;
+    double  drift_     = 0.;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Run exchanges with device on fd, interval_us apart, and add them to sync. Exchanges without
+// answer within timeout are skipped, fails if less than kMinSyncSamples were completed.
+//
+// Both sides stamp the first byte of frame they send or receive, except host receiving response:
+// it is read after the last byte. If baud_rate is not 0, transfer time of the rest of response
+// is subtracted, otherwise it shows up as offset error of half of it. Linux only.
+//
+piano::status_t sync_clock(int           fd,
+                           uint32_t      baud_rate,
+                           size_t        exchanges,
+                           uint64_t      interval_us,
+                           clock_sync_t *sync);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Keeps device clock estimate up to date during playback: exchanges continue in background
+// thread, estimate may be read from any thread. Sync requests are written with single write,
+// which is not interleaved with writes of other threads on tty or pipe.
+//
+class clock_tracker_t
+{
+  public:
+    clock_tracker_t(int fd, uint32_t baud_rate) : fd_(fd), baud_rate_(baud_rate) {}
+    ~clock_tracker_t() { stop(); }
+
+    clock_tracker_t(const clock_tracker_t &)            = delete;
+    clock_tracker_t &operator=(const clock_tracker_t &) = delete;
+
+    //
+    // Initial exchanges in calling thread, see sync_clock
+    //
+    piano::status_t synchronize(size_t exchanges, uint64_t interval_us);
+
+    //
+    // One exchange every interval_us until stop
+    //
+    void start(uint64_t interval_us);
+    void stop();
+
+    clock_estimate_t estimate() const;
+    clock_sync_t     sync()     const;
+
+  private:
+    void run(uint64_t interval_us);
+
+    int                fd_        = -1;
+    uint32_t           baud_rate_ = 0;
+    mutable std::mutex mutex_;
+    clock_sync_t       sync_;
+    std::thread        thread_;
+    std::atomic<bool>  stop_      = {false};
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __CLOCK_SYNC_HH__
+
+//================================================================================================//
@@ -0,0 +1,445 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "song_store.hh"
+#include "led_render.hh"
+#include "device.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+void
+device_t::receive(const uint8_t *data,
+                  size_t         size,
+                  int64_t        receive_us)
+{
+    // Handling received frames, see protocol.hh
+    bool                   changed = false;
+    piano_proto::message_t message;
+    for (size_t i = 0; i != size; ++i)
+    {
+        if (decoder_.idle())
+        {
+            frame_us_ = receive_us;
+        }
+        piano::status_t status = decoder_.push(data[i], &message);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            ++counters_.messages;
+            changed |= handle_message(message, frame_us_);
+        } else if (status != piano::STATUS_PROTOCOL_PENDING)
+        {
+            ++counters_.frame_errors;
+        }
+    }
+
+    if (changed)
+    {
+        show_keys();
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::update(int64_t now_us)
+{
+    // Lateness of the earliest due item, the rest of them are played by the same update
+    int64_t due_us = playback_time_us();
+    if (due_us <= now_us)
+    {
+        add_lateness(now_us - due_us);
+    }
+
+    bool changed = false;
+    while (queue_.due(now_us))
+    {
+        changed |= apply_message(queue_.top());
+        queue_.pop();
+    }
+
+    piano_proto::message_t record;
+    while (player_.due(now_us, &record))
+    {
+        changed |= apply_message(record);
+    }
+    while (file_.due(now_us, &record))
+    {
+        changed |= apply_message(record);
+    }
+
+    if (changed)
+    {
+        show_keys();
+    }
+
+    // Reports missed while device was busy are not made up for
+    if (telemetry_period_us_ != 0 && telemetry_next_us_ <= now_us)
+    {
+        send_telemetry(now_us);
+        telemetry_next_us_ += telemetry_period_us_;
+        if (telemetry_next_us_ <= now_us)
+        {
+            telemetry_next_us_ = now_us + telemetry_period_us_;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+device_t::next_time_us() const
+{
+    int64_t time_us = playback_time_us();
+    if (telemetry_period_us_ != 0)
+    {
+        time_us = std::min(time_us, telemetry_next_us_);
+    }
+    return time_us;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+device_t::playback_time_us() const
+{
+    int64_t time_us = INT64_MAX;
+    if (!queue_.empty())
+    {
+        time_us = queue_.next_time();
+    }
+    if (player_.playing())
+    {
+        time_us = std::min(time_us, player_.next_time_us());
+    }
+    if (file_.playing())
+    {
+        time_us = std::min(time_us, file_.next_time_us());
+    }
+    return time_us;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+piano::status_t
+device_t::play_file(const uint8_t *file,
+                    size_t         size,
+                    int64_t        start_us)
+{
+    player_.stop();
+    return file_.start(file, size, start_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+piano::status_t
+device_t::play_song(const uint8_t *image,
+                    size_t         size,
+                    int64_t        start_us)
+{
+    file_.stop();
+    return player_.start(image, size, start_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+device_t::handle_message(const piano_proto::message_t &message,
+                         int64_t                       receive_us)
+{
+    switch (message.type)
+    {
+        case piano_proto::MESSAGE_SYNC_REQUEST:
+        {
+            send_sync_response(message.sync.host_send_us, receive_us);
+            return false;
+        }
+        case piano_proto::MESSAGE_PING:
+        {
+            send_echo(message.ping, receive_us);
+            return false;
+        }
+        case piano_proto::MESSAGE_SCHEDULE:
+        {
+            scheduled_ = message.schedule.enabled;
+            if (!scheduled_)
+            {
+                queue_.clear();
+            }
+            return false;
+        }
+        case piano_proto::MESSAGE_RESET:
+        {
+            scheduled_ = false;
+            queue_.clear();
+            player_.stop();
+            file_.stop();
+            return apply_message(message);
+        }
+        case piano_proto::MESSAGE_UPLOAD_BEGIN:
+        case piano_proto::MESSAGE_PATCH_BEGIN:
+        {
+            size_t                    capacity = 0;
+            uint8_t                  *storage  = port_->song_storage(&capacity);
+            piano_proto::upload_ack_t ack;
+            if (message.type == piano_proto::MESSAGE_UPLOAD_BEGIN)
+            {
+                song_.begin(message.upload_begin, storage, capacity, &ack);
+            } else
+            {
+                song_.begin_patch(message.patch_begin, storage, capacity, &ack);
+            }
+
+            // Upload goes to the free slot and leaves the stored song playing. Free slot may
+            // still hold the song stored before, which plays on after a newer one came, then it
+            // stops before chunks overwrite it.
+            if (song_.overwrites(player_.image()))
+            {
+                player_.stop();
+            }
+            send_upload_ack(ack);
+            return false;
+        }
+        case piano_proto::MESSAGE_UPLOAD_CHUNK:
+        {
+            piano_proto::upload_ack_t ack;
+            song_.chunk(message.upload_chunk, &ack);
+            send_upload_ack(ack);
+            return false;
+        }
+        case piano_proto::MESSAGE_TELEMETRY:
+        {
+            // Period is kept by MESSAGE_RESET, host stops reports explicitly
+            telemetry_period_us_ = static_cast<int64_t>(
+                std::min<uint64_t>(message.telemetry_request.period_us, INT64_MAX / 2));
+            if (telemetry_period_us_ != 0)
+            {
+                int64_t now_us = port_->now_us();
+                send_telemetry(now_us);
+                telemetry_next_us_ = now_us + telemetry_period_us_;
+            }
+            return false;
+        }
+        case piano_proto::MESSAGE_PLAY:
+        {
+            player_.stop();
+            file_.stop();
+            if (message.play.play && song_.complete())
+            {
+                int64_t start_us = (message.play.start_us == 0)
+                                 ? receive_us : static_cast<int64_t>(message.play.start_us);
+                player_.start(song_.data(), song_.size(), start_us);
+            }
+            return false;
+        }
+        case piano_proto::MESSAGE_NOTE_BATCH:
+        case piano_proto::MESSAGE_KEY_FRAME:
+        {
+            // In scheduled mode time of message is device time, late messages are played at once
+            int64_t time_us = static_cast<int64_t>(piano_proto::message_time(message));
+            int64_t now_us  = scheduled_ ? port_->now_us() : 0;
+            if (!scheduled_ || time_us <= now_us)
+            {
+                if (scheduled_)
+                {
+                    add_lateness(now_us - time_us);
+                }
+                return apply_message(message);
+            }
+
+            // Earliest message is played early if queue is full, so that order is kept
+            bool changed = false;
+            if (queue_.full())
+            {
+                changed = apply_message(queue_.top());
+                queue_.pop();
+            }
+            queue_.push(time_us, message);
+            counters_.schedule_high = std::max(counters_.schedule_high,
+                                               static_cast<uint32_t>(queue_.size()));
+            return changed;
+        }
+        default:
+        {
+            // Tempo and timestamps do not change LEDs
+            return false;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+device_t::apply_message(const piano_proto::message_t &message)
+{
+    switch (message.type)
+    {
+        case piano_proto::MESSAGE_RESET:
+        {
+            memset(keys_, 0, sizeof(keys_));
+            leds_.clear();
+            return true;
+        }
+        case piano_proto::MESSAGE_NOTE_BATCH:
+        {
+            for (uint8_t i = 0; i != message.note_batch.count; ++i)
+            {
+                const piano_proto::note_t &note = message.note_batch.notes[i];
+                keys_[note.note] = note.on;
+                leds_.set_key(note.note, note.on ? std::max<uint8_t>(note.velocity, 1) : 0);
+            }
+            return true;
+        }
+        case piano_proto::MESSAGE_KEY_FRAME:
+        {
+            // Frames after lost one are skipped until keyframe comes
+            piano_proto::key_state_t state = {};
+            if (key_decoder_.decode(message.key_frame.data,
+                                    message.key_frame.size,
+                                    &state) != piano::STATUS_SUCCESS)
+            {
+                return false;
+            }
+            // Only keys which changed are rendered, held keys keep colour of their velocity
+            for (size_t i = 0; i != piano_proto::kKeysNumber; ++i)
+            {
+                bool on = state.test(static_cast<uint8_t>(i));
+                if (keys_[i] != on)
+                {
+                    keys_[i] = on;
+                    leds_.set_key(static_cast<uint8_t>(i), on ? kKeyFrameVelocity : 0);
+                }
+            }
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::send_sync_response(uint64_t host_send_us,
+                             int64_t  receive_us)
+{
+    piano_proto::message_t response;
+    response.type                   = piano_proto::MESSAGE_SYNC_RESPONSE;
+    response.sync.host_send_us      = host_send_us;
+    response.sync.device_receive_us = static_cast<uint64_t>(receive_us);
+
+    // Send time is taken right before frame goes to UART
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    response.sync.device_send_us = static_cast<uint64_t>(port_->now_us());
+    if (piano_proto::encode_message(response, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS)
+    {
+        port_->send(frame, size);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::send_echo(const piano_proto::ping_t &ping,
+                    int64_t                    receive_us)
+{
+    piano_proto::message_t echo;
+    echo.type                   = piano_proto::MESSAGE_ECHO;
+    echo.ping                   = {};
+    echo.ping.sequence          = ping.sequence;
+    echo.ping.host_send_us      = ping.host_send_us;
+    echo.ping.device_receive_us = static_cast<uint64_t>(receive_us);
+    echo.ping.device_shown_us   = static_cast<uint64_t>(receive_us);
+
+    // Refresh returns when strip has been written, or when frame is handed to LED task on ports
+    // which refresh strip on their own
+    if (ping.show)
+    {
+        show_keys();
+        echo.ping.device_shown_us = static_cast<uint64_t>(port_->now_us());
+    }
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    echo.ping.device_send_us = static_cast<uint64_t>(port_->now_us());
+    if (piano_proto::encode_message(echo, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS)
+    {
+        port_->send(frame, size);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::send_upload_ack(const piano_proto::upload_ack_t &ack)
+{
+    piano_proto::message_t message;
+    message.type       = piano_proto::MESSAGE_UPLOAD_ACK;
+    message.upload_ack = ack;
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    if (piano_proto::encode_message(message, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS)
+    {
+        port_->send(frame, size);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::send_telemetry(int64_t now_us)
+{
+    piano_proto::message_t report;
+    report.type      = piano_proto::MESSAGE_TELEMETRY_REPORT;
+    report.telemetry = counters_;
+    port_->telemetry(&report.telemetry);
+    report.telemetry.device_us = static_cast<uint64_t>(now_us);
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    if (piano_proto::encode_message(report, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS)
+    {
+        port_->send(frame, size);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::add_lateness(int64_t late_us)
+{
+    uint32_t late = static_cast<uint32_t>(std::min<int64_t>(late_us, UINT32_MAX));
+    ++counters_.late_count;
+    counters_.late_sum_us += late;
+    counters_.late_max_us  = std::max(counters_.late_max_us, late);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_t::show_keys()
+{
+    port_->show(leds_.frame());
+}
+
+//================================================================================================//
+
+} // ! namespace piano_device
+
+//================================================================================================//
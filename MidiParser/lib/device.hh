@@ -0,0 +1,177 @@
+//================================================================================================//
+
+#ifndef __DEVICE_HH__
+#define __DEVICE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "timer_queue.hh"
+#include "song_store.hh"
+#include "smf_player.hh"
+#include "led_render.hh"
+
+//================================================================================================//
+
+//
+// Portable part of firmware: decoding of frames, immediate and scheduled playback and
+// rendering of LED frames. It does not touch hardware, everything platform specific goes
+// through device_port_t, so the same code runs on ESP32 and in device simulator on host.
+//
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Messages waiting for their time in scheduled mode
+//
+static const size_t kScheduleCapacity = 32;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Platform of device: clock, transmitting side of UART and LED strip
+//
+class device_port_t
+{
+  public:
+    virtual ~device_port_t() = default;
+
+    //
+    // Device clock in microseconds, host estimates it with sync exchanges
+    //
+    virtual int64_t now_us() = 0;
+
+    virtual void send(const uint8_t *data, size_t size) = 0;
+
+    //
+    // Must not wait for strip refresh: device calls it while UART bytes are coming. Firmware
+    // hands frame to LED task, frames which come during refresh replace each other.
+    //
+    virtual void show(const led_frame_t &frame) = 0;
+
+    //
+    // Memory for uploaded song, kSongStorageSize, see song_store_t. Devices without it reject
+    // uploads.
+    //
+    virtual uint8_t *song_storage(size_t *capacity)
+    {
+        *capacity = 0;
+        return nullptr;
+    }
+
+    //
+    // Fill counters of telemetry report which belong to platform: UART, LED strip and load of
+    // tasks. Called from receiving task, counters of other tasks must be read without locks.
+    //
+    virtual void telemetry(piano_proto::telemetry_t *) {}
+};
+
+//------------------------------------------------------------------------------------------------//
+
+class device_t
+{
+  public:
+    explicit device_t(device_port_t *port, const pixel_map_t &pixels = kPianoPixels)
+        : port_(port), leds_(pixels) {}
+
+    //
+    // Bytes received from UART, receive_us is time of their first byte. Messages are stamped
+    // with time of the chunk their first byte came in. Shows new LED frame if state of keys
+    // changed.
+    //
+    void receive(const uint8_t *data, size_t size, int64_t receive_us);
+
+    //
+    // Play MIDI file stored on device, e.g. mapped from flash, from device time start_us. It
+    // replaces uploaded song being played, MESSAGE_PLAY and MESSAGE_RESET stop it.
+    //
+    piano::status_t play_file(const uint8_t *file, size_t size, int64_t start_us);
+
+    //
+    // Play compiled song stored on device in place, e.g. song of bank in flash (song_bank.hh),
+    // from device time start_us. Stops as file does.
+    //
+    piano::status_t play_song(const uint8_t *image, size_t size, int64_t start_us);
+
+    //
+    // Play scheduled messages, records of uploaded song and messages of file which are due at
+    // now_us, send telemetry report if it is due
+    //
+    void update(int64_t now_us);
+
+    //
+    // Time of the next scheduled message, song record, message of file or telemetry report,
+    // has_scheduled must be true
+    //
+    bool    has_scheduled()  const
+    {
+        return !queue_.empty() || player_.playing() || file_.playing() || telemetry_period_us_ != 0;
+    }
+    int64_t next_time_us()   const;
+
+    bool                  scheduled()    const { return scheduled_;         }
+    bool                  playing()      const { return player_.playing();  }
+    bool                  playing_file() const { return file_.playing();    }
+    const song_store_t   &song()         const { return song_;              }
+    const bool           *keys()         const { return keys_;              }
+    const led_frame_t    &leds()         const { return leds_.frame();      }
+
+    //
+    // Counters device keeps itself, see telemetry_t; platform ones are left 0
+    //
+    const piano_proto::telemetry_t &counters() const { return counters_; }
+
+  private:
+    //
+    // Both return true if state of keys changed
+    //
+    bool handle_message(const piano_proto::message_t &message, int64_t receive_us);
+    bool apply_message(const piano_proto::message_t &message);
+
+    void send_sync_response(uint64_t host_send_us, int64_t receive_us);
+    void send_echo(const piano_proto::ping_t &ping, int64_t receive_us);
+    void send_upload_ack(const piano_proto::upload_ack_t &ack);
+    void send_telemetry(int64_t now_us);
+    void show_keys();
+
+    //
+    // Time of the next scheduled message, song record or message of file, INT64_MAX if none
+    //
+    int64_t playback_time_us() const;
+    void    add_lateness(int64_t late_us);
+
+    device_port_t                *port_        = nullptr;
+    piano_proto::frame_decoder_t  decoder_;
+    piano_proto::key_decoder_t    key_decoder_;
+    bool                          keys_[piano_proto::kKeysNumber] = {};
+    led_renderer_t                leds_;
+    bool                          scheduled_   = false;
+    int64_t                       frame_us_    = 0;
+
+    piano::timer_queue_t<piano_proto::message_t, kScheduleCapacity> queue_;
+
+    song_store_t                  song_;
+    song_player_t                 player_;
+    smf_player_t                  file_;
+
+    piano_proto::telemetry_t      counters_;
+    int64_t                       telemetry_period_us_ = 0;
+    int64_t                       telemetry_next_us_   = 0;
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __DEVICE_HH__
+
+//================================================================================================//
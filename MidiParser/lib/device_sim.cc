@@ -0,0 +1,385 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "device.hh"
+#include "device_sim.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Longest sleep of simulator when nothing is expected, bounds reaction to stop flag
+//
+static const int64_t kIdleWaitUs = 10000;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Share of run time task was busy and latency of its work
+//
+static void
+print_load(std::ostream                 &out,
+           const char                   *name,
+           const piano::task_counters_t &load,
+           int64_t                       run_us)
+{
+    double busy    = (run_us > 0) ? 100. * load.busy_us / static_cast<double>(run_us) : 0.;
+    double mean_us = (load.latency_count == 0) ? 0.
+                   : static_cast<double>(load.latency_sum_us) / load.latency_count;
+    out << name << ": " << load.runs << " runs, busy " << std::fixed << std::setprecision(1)
+        << busy << "%, latency mean " << mean_us << "us max " << load.latency_max_us << "us\n"
+        << std::defaultfloat;
+}
+
+//================================================================================================//
+
+uart_line_t::uart_line_t(uint32_t baud_rate)
+    : byte_us_((baud_rate == 0) ? 0. : 10. * 1e6 / baud_rate)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+uart_line_t::push(const uint8_t *data,
+                  size_t         size,
+                  int64_t        now_us)
+{
+    free_us_ = std::max(free_us_, static_cast<double>(now_us));
+    for (size_t i = 0; i != size; ++i)
+    {
+        free_us_ += byte_us_;
+        bytes_.push_back({static_cast<int64_t>(free_us_), data[i]});
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+uart_line_t::pop(int64_t  now_us,
+                 uint8_t *dst,
+                 size_t   capacity,
+                 int64_t *first_us)
+{
+    size_t count = 0;
+    while (count != capacity && !bytes_.empty() && bytes_.front().done_us <= now_us)
+    {
+        if (count == 0)
+        {
+            *first_us = bytes_.front().done_us;
+        }
+        dst[count++] = bytes_.front().value;
+        bytes_.pop_front();
+    }
+    return count;
+}
+
+//================================================================================================//
+
+device_simulator_t::device_simulator_t(int                       master,
+                                       const simulator_config_t &config,
+                                       std::ostream             *log)
+    : master_(master),
+      clock_(config.clock_offset_us, config.clock_drift_ppm),
+      device_(this, piano_device::pixel_map_t(config.strip)),
+      rx_(config.baud_rate),
+      tx_(config.baud_rate),
+      log_(log),
+      error_rate_(config.error_rate),
+      random_(config.error_seed),
+      song_(piano_device::kSongStorageSize),
+      led_refresh_us_(config.led_refresh_us),
+      blocking_leds_(config.blocking_leds),
+      leds_(config.led_rate_hz)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+device_simulator_t::run(const std::atomic<bool> *stop)
+{
+    // Strip is refreshed by its own thread, unless it is instant or blocks device loop
+    std::thread leds;
+    if (led_thread())
+    {
+        leds = std::thread([this, stop]() { refresh_leds(stop); });
+    }
+
+    uint8_t  buffer[kSimulatorRxBuffer] = {};
+    status_t status   = STATUS_SUCCESS;
+    int64_t  start_us = host_time_us();
+    while (status == STATUS_SUCCESS && !stop->load())
+    {
+        // Host is not read while modelled UART is behind, so that it feels the baud rate
+        int64_t  now_us  = host_time_us();
+        int64_t  wait_us = std::max<int64_t>(wake_us(now_us) - now_us, 0);
+        short    events  = (rx_.size() < kSimulatorRxBuffer) ? POLLIN : 0;
+        pollfd   request = {master_, events, 0};
+        timespec timeout = {static_cast<time_t>(wait_us / 1000000),
+                            static_cast<long>(wait_us % 1000000 * 1000)};
+        if (ppoll(&request, 1, &timeout, nullptr) < 0 && errno != EINTR)
+        {
+            std::cerr << "Error while waiting for pty: " << std::strerror(errno) << "\n";
+            status = STATUS_SERIAL_READ_ERROR;
+            break;
+        }
+
+        // Nobody has slave open (EIO), poll would return at once until host opens it
+        ssize_t size = 0;
+        if (request.revents & (POLLIN | POLLHUP))
+        {
+            size = read(master_, buffer, kSimulatorRxBuffer - rx_.size());
+        }
+        if (size < 0 && errno == EIO)
+        {
+            usleep(static_cast<useconds_t>(kIdleWaitUs));
+        } else if (size < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            std::cerr << "Error while reading pty: " << std::strerror(errno) << "\n";
+            status = STATUS_SERIAL_READ_ERROR;
+            break;
+        } else if (size > 0)
+        {
+            rx_.push(buffer, static_cast<size_t>(size), host_time_us());
+            rx_high_ = std::max(rx_high_, rx_.size());
+        }
+
+        // Device gets bytes as its UART driver would, stamped with arrival of the first one
+        now_us = host_time_us();
+        int64_t first_us = 0;
+        size_t  count    = 0;
+        int64_t busy_us  = now_us;
+        while ((count = rx_.pop(now_us, buffer, sizeof(buffer), &first_us)) != 0)
+        {
+            for (size_t i = 0; error_rate_ > 0. && i != count; ++i)
+            {
+                if (std::uniform_real_distribution<double>(0., 1.)(random_) < error_rate_)
+                {
+                    buffer[i] ^= static_cast<uint8_t>(1u << (random_() % 8));
+                }
+            }
+            bytes_received_ += count;
+            receive_delay_us_.add(static_cast<double>(now_us - first_us));
+            device_task_.add_latency(now_us - first_us);
+            device_.receive(buffer, count, clock_.at(first_us));
+        }
+        device_.update(clock_.at(now_us));
+        device_task_.add_run(host_time_us() - busy_us);
+
+        count = tx_.pop(now_us, buffer, sizeof(buffer), &first_us);
+        if (count != 0 && write(master_, buffer, count) != static_cast<ssize_t>(count))
+        {
+            std::cerr << "Error while writing pty: " << std::strerror(errno) << "\n";
+            status = STATUS_SERIAL_WRITE_ERROR;
+        }
+    }
+
+    if (leds.joinable())
+    {
+        leds_ready_.notify_one();
+        leds.join();
+    }
+    run_us_ = host_time_us() - start_us;
+    return status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::refresh_leds(const std::atomic<bool> *stop)
+{
+    int64_t wait_us = -1;
+    while (!stop->load())
+    {
+        int64_t now_us = host_time_us();
+        if (leds_.poll(now_us, &wait_us))
+        {
+            leds_task_.add_latency(now_us - leds_.published_us());
+            std::this_thread::sleep_for(std::chrono::microseconds(led_refresh_us_));
+            log_frame(leds_.frame());
+            leds_task_.add_run(host_time_us() - now_us);
+            continue;
+        }
+
+        // Frame is held back until its period is over, or there is none until device shows one
+        if (wait_us >= 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(std::min(wait_us, kIdleWaitUs)));
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(leds_mutex_);
+        leds_ready_.wait_for(lock, std::chrono::microseconds(kIdleWaitUs),
+                             [this]() { return leds_.pending(); });
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+device_simulator_t::led_thread() const
+{
+    return (led_refresh_us_ > 0 || leds_.period_us() > 0) && !blocking_leds_;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+device_simulator_t::wake_us(int64_t now_us) const
+{
+    int64_t wake = now_us + kIdleWaitUs;
+    if (!rx_.empty())
+    {
+        wake = std::min(wake, rx_.next_us());
+    }
+    if (!tx_.empty())
+    {
+        wake = std::min(wake, tx_.next_us());
+    }
+    // Drift of device clock over the wait is far below microsecond
+    if (device_.has_scheduled())
+    {
+        wake = std::min(wake, now_us + device_.next_time_us() - clock_.at(now_us));
+    }
+    return wake;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+int64_t
+device_simulator_t::now_us()
+{
+    return clock_.now_us();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::send(const uint8_t *data,
+                         size_t         size)
+{
+    bytes_sent_ += size;
+    tx_.push(data, size, host_time_us());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::show(const piano_device::led_frame_t &frame)
+{
+    if (led_thread())
+    {
+        leds_.publish(frame, host_time_us());
+
+        // Mutex is taken so that LED thread does not miss the wakeup between check and wait
+        {
+            std::lock_guard<std::mutex> lock(leds_mutex_);
+        }
+        leds_ready_.notify_one();
+        return;
+    }
+
+    // Refresh in device loop, UART bytes wait meanwhile
+    int64_t start_us = host_time_us();
+    if (led_refresh_us_ > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(led_refresh_us_));
+    }
+    log_frame(frame);
+    leds_task_.add_run(host_time_us() - start_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::log_frame(const piano_device::led_frame_t &frame)
+{
+    ++frames_shown_;
+    if (log_ == nullptr)
+    {
+        return;
+    }
+
+    int64_t host_us = host_time_us();
+    *log_ << host_us << " " << clock_.at(host_us) << " " << std::hex << std::setfill('0');
+    for (size_t i = 0; i != frame.size; ++i)
+    {
+        const uint8_t *grb = &frame.grb[i * piano_device::kBytesPerLed];
+        *log_ << std::setw(2) << static_cast<unsigned>(grb[1])
+              << std::setw(2) << static_cast<unsigned>(grb[0])
+              << std::setw(2) << static_cast<unsigned>(grb[2]);
+    }
+    *log_ << std::dec << std::setfill(' ') << "\n";
+}
+
+//------------------------------------------------------------------------------------------------//
+
+uint8_t *
+device_simulator_t::song_storage(size_t *capacity)
+{
+    *capacity = song_.size();
+    return song_.data();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::telemetry(piano_proto::telemetry_t *report)
+{
+    // Host blocks in write instead of overrunning modelled UART
+    piano::task_counters_t strip  = leds_task_.snapshot();
+    piano::task_counters_t parser = device_task_.snapshot();
+    report->uart_overruns  = 0;
+    report->rx_queue_high  = static_cast<uint32_t>(rx_high_);
+    report->frames_shown   = static_cast<uint32_t>(frames_shown());
+    report->frames_dropped = static_cast<uint32_t>(frames_dropped());
+    report->strip_busy_us  = strip.busy_us;
+    report->strip_max_us   = strip.busy_max_us;
+    report->parser_busy_us = parser.busy_us;
+    report->parser_max_us  = parser.busy_max_us;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+device_simulator_t::print_stats(std::ostream &out) const
+{
+    out << "received " << bytes_received() << " bytes, sent " << bytes_sent() << " bytes, "
+        << frames_shown() << " LED frames, " << leds_.replaced() << " replaced by newer ones, "
+        << leds_.unchanged() << " unchanged\n";
+    receive_delay_us_.print(out, "UART wait", "us");
+    print_load(out, "device loop", device_load(), run_us_);
+    if (led_thread())
+    {
+        print_load(out, "LED thread", leds_load(), run_us_);
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
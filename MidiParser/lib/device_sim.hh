@@ -0,0 +1,217 @@
+//================================================================================================//
+
+#ifndef __DEVICE_SIM_HH__
+#define __DEVICE_SIM_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "device.hh"
+#include "clock_sync.hh"
+#include "led_pacer.hh"
+#include "task_stats.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Bytes the simulator reads from pty ahead of the modelled UART. When it is full the host
+// blocks in write, as it does when USB bridge does not take more data.
+//
+static const size_t kSimulatorRxBuffer = 4096;
+
+//------------------------------------------------------------------------------------------------//
+
+struct simulator_config_t
+{
+    //
+    // Speed of modelled UART in both directions, 0 - bytes pass at once
+    //
+    uint32_t baud_rate       = 0;
+
+    //
+    // Device clock, see simulated_clock_t
+    //
+    int64_t  clock_offset_us = 0;
+    double   clock_drift_ppm = 0.;
+
+    //
+    // Probability that byte from host is damaged on the line, device sees it with one bit
+    // flipped. Seed makes damage reproducible.
+    //
+    double   error_rate      = 0.;
+    uint32_t error_seed      = 1;
+
+    //
+    // Time LED strip takes to refresh, 0 - at once. Frames go to LED thread through led_pacer_t
+    // as in firmware, frames shown while strip refreshes replace each other. With blocking_leds
+    // refresh stops device loop instead, as led_strip_refresh called from receive loop does.
+    //
+    int64_t  led_refresh_us  = 0;
+    bool     blocking_leds   = false;
+
+    //
+    // Most LED frames per second LED thread shows, see led_pacer_t. 0 - every change. LED thread
+    // runs if either refresh time or rate is set.
+    //
+    uint32_t led_rate_hz     = 0;
+
+    //
+    // LEDs of strip, each logged frame has as many
+    //
+    piano_device::strip_layout_t strip = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// One direction of UART: byte is available on the other side 10 bit times after the previous
+// one, or after it was written if line was idle
+//
+class uart_line_t
+{
+  public:
+    explicit uart_line_t(uint32_t baud_rate);
+
+    void push(const uint8_t *data, size_t size, int64_t now_us);
+
+    //
+    // Take bytes which have been transferred by now_us. Returns their number, first_us is time
+    // when the first of them arrived.
+    //
+    size_t pop(int64_t now_us, uint8_t *dst, size_t capacity, int64_t *first_us);
+
+    bool    empty()   const { return bytes_.empty();      }
+    size_t  size()    const { return bytes_.size();       }
+    int64_t next_us() const { return bytes_.front().done_us; }
+
+  private:
+    struct byte_t
+    {
+        int64_t done_us;
+        uint8_t value;
+    };
+
+    double             byte_us_ = 0.;
+    double             free_us_ = 0.;
+    std::deque<byte_t> bytes_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Firmware logic (piano_device::device_t) on master side of pty, with modelled UART and device
+// clock. Each LED frame device would show is written to log as line
+//
+//     <host_us> <device_us> <rrggbb>...
+//
+// where host_us is host_time_us(), the same clock piano_send and tests use, taken when strip
+// refresh is over, and colours of all LEDs of strip follow each other without spaces.
+//
+class device_simulator_t : private piano_device::device_port_t
+{
+  public:
+    device_simulator_t(int master, const simulator_config_t &config, std::ostream *log = nullptr);
+
+    //
+    // Serve pty until stop is set. Returns error if pty fails, hangup of slave is not an error:
+    // host may open it again.
+    //
+    piano::status_t run(const std::atomic<bool> *stop);
+
+    const piano_device::device_t &device() const { return device_; }
+
+    //
+    // Counters may be read while simulator runs
+    //
+    uint64_t bytes_received() const { return bytes_received_.load(std::memory_order_relaxed); }
+    uint64_t bytes_sent()     const { return bytes_sent_.load(std::memory_order_relaxed);     }
+    uint64_t frames_shown()   const { return frames_shown_.load(std::memory_order_relaxed);   }
+    uint64_t frames_dropped() const { return leds_.replaced() + leds_.unchanged();           }
+
+    //
+    // Load of device loop (latency: bytes waiting in modelled UART) and of LED thread
+    // (latency: frame waiting for strip), as on device cores. Without LED thread strip refresh
+    // is counted in both loads.
+    //
+    piano::task_counters_t device_load() const { return device_task_.snapshot(); }
+    piano::task_counters_t leds_load()   const { return leds_task_.snapshot();   }
+
+    //
+    // Time bytes waited in modelled UART after they arrived until device took them, valid
+    // after run returns
+    //
+    const sample_stats_t &receive_delay_us() const { return receive_delay_us_; }
+
+    void print_stats(std::ostream &out) const;
+
+  private:
+    int64_t now_us() override;
+    void    send(const uint8_t *data, size_t size) override;
+    void    show(const piano_device::led_frame_t &frame) override;
+    uint8_t *song_storage(size_t *capacity) override;
+    void    telemetry(piano_proto::telemetry_t *report) override;
+
+    //
+    // Host time of the next thing simulator has to do
+    //
+    int64_t wake_us(int64_t now_us) const;
+
+    //
+    // LED thread: refresh strip with the latest frame until stop is set. Without refresh time
+    // and rate frames are logged at once from device loop.
+    //
+    void refresh_leds(const std::atomic<bool> *stop);
+    bool led_thread() const;
+    void log_frame(const piano_device::led_frame_t &frame);
+
+    int                    master_         = -1;
+    simulated_clock_t      clock_;
+    piano_device::device_t device_;
+    uart_line_t            rx_;
+    uart_line_t            tx_;
+    std::ostream          *log_            = nullptr;
+    double                 error_rate_     = 0.;
+    std::mt19937           random_;
+    std::vector<uint8_t>   song_;           // kSongStorageSize, as on device
+    int64_t                led_refresh_us_ = 0;
+    bool                   blocking_leds_  = false;
+    sample_stats_t         receive_delay_us_;
+    size_t                 rx_high_        = 0;
+
+    piano_device::led_pacer_t                   leds_;
+    std::mutex                                  leds_mutex_;
+    std::condition_variable                     leds_ready_;
+
+    std::atomic<uint64_t>  bytes_received_ = {0};
+    std::atomic<uint64_t>  bytes_sent_     = {0};
+    std::atomic<uint64_t>  frames_shown_   = {0};
+    piano::task_stats_t    device_task_;
+    piano::task_stats_t    leds_task_;
+    int64_t                run_us_         = 0;
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __DEVICE_SIM_HH__
+
+//================================================================================================//
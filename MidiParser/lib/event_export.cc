@@ -0,0 +1,364 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "midi_file.hh"
+#include "event_export.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Most bytes of CSV or JSON row besides song: keys, separators, event name and numbers of at
+// most 20 digits
+//
+static const size_t kMaxRowBytes      = 160;
+
+//
+// Size of format buffers at start. Buffer grows when a song needs more and keeps its size for
+// the next ones.
+//
+static const size_t kBufferBytes      = 4 << 20;
+
+static const char   kCsvHeader[]      = "song,index,time_us,event,note,velocity,tempo\n";
+
+//------------------------------------------------------------------------------------------------//
+
+static const char *
+event_name(event_num_t event)
+{
+    switch (event)
+    {
+        case EVENT_NOTE_ON:   { return "note_on";  }
+        case EVENT_NOTE_OFF:  { return "note_off"; }
+        case EVENT_TEMPO_SET: { return "tempo";    }
+    }
+    return "unknown";
+}
+
+//------------------------------------------------------------------------------------------------//
+
+template <size_t N>
+static inline char *
+put_text(char       *out,
+         const char (&text)[N])
+{
+    std::memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+static inline char *
+put_text(char              *out,
+         const std::string &text)
+{
+    std::memcpy(out, text.data(), text.size());
+    return out + text.size();
+}
+
+static inline char *
+put_number(char     *out,
+           uint64_t  value)
+{
+    return std::to_chars(out, out + 20, value).ptr;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Song as CSV field, quoted with inner quotes doubled if it has separators in it
+//
+static std::string
+csv_field(const std::string &song)
+{
+    if (song.find_first_of(",\"\r\n") == std::string::npos)
+    {
+        return song;
+    }
+    std::string field = "\"";
+    for (char c : song)
+    {
+        field += (c == '"') ? "\"\"" : std::string(1, c);
+    }
+    return field + "\"";
+}
+
+//
+// Song as JSON string with quotes, backslashes and control characters escaped
+//
+static std::string
+json_string(const std::string &song)
+{
+    std::string field = "\"";
+    for (char c : song)
+    {
+        if (c == '"' || c == '\\')
+        {
+            field += '\\';
+            field += c;
+        } else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+            field += escape;
+        } else
+        {
+            field += c;
+        }
+    }
+    return field + "\"";
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static inline size_t
+align8(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static inline char *
+put_le(char     *out,
+       uint64_t  value,
+       size_t    bytes)
+{
+    for (size_t i = 0; i != bytes; ++i)
+    {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+    return out + bytes;
+}
+
+//
+// Zeros up to the next multiple of 8 bytes from start of block
+//
+static inline char *
+pad8(char *start,
+     char *out)
+{
+    size_t padding = align8(static_cast<size_t>(out - start)) - static_cast<size_t>(out - start);
+    std::memset(out, 0, padding);
+    return out + padding;
+}
+
+//================================================================================================//
+
+size_t
+export_bound(export_format_t    format,
+             const std::string &song,
+             size_t             rows)
+{
+    switch (format)
+    {
+        case EXPORT_CSV:   { return rows * (csv_field(song).size() + kMaxRowBytes);   }
+        case EXPORT_JSONL: { return rows * (json_string(song).size() + kMaxRowBytes); }
+        case EXPORT_COLUMNAR:
+        {
+            return align8(4 + song.size()) + 8 + align8(rows * 8) + 3 * align8(rows) +
+                   align8(rows * 4);
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+format_song(export_format_t                               format,
+            const std::string                            &song,
+            const std::vector<piano_midi::timed_event_t> &timeline,
+            char                                         *out)
+{
+    char *start = out;
+    if (format == EXPORT_COLUMNAR)
+    {
+        // Column by column, each a pass over events
+        out = put_le(out, song.size(), 4);
+        out = put_text(out, song);
+        out = put_le(pad8(start, out), timeline.size(), 8);
+        for (const piano_midi::timed_event_t &event : timeline)
+        {
+            out = put_le(out, event.time_us, 8);
+        }
+        for (const piano_midi::timed_event_t &event : timeline)
+        {
+            *out++ = static_cast<char>(event.event);
+        }
+        out = pad8(start, out);
+        for (const piano_midi::timed_event_t &event : timeline)
+        {
+            *out++ = static_cast<char>(event.note);
+        }
+        out = pad8(start, out);
+        for (const piano_midi::timed_event_t &event : timeline)
+        {
+            *out++ = static_cast<char>(event.velocity);
+        }
+        out = pad8(start, out);
+        for (const piano_midi::timed_event_t &event : timeline)
+        {
+            out = put_le(out, event.tempo, 4);
+        }
+        return static_cast<size_t>(pad8(start, out) - start);
+    }
+
+    bool        csv   = format == EXPORT_CSV;
+    std::string field = csv ? csv_field(song) : json_string(song);
+    for (size_t index = 0; index != timeline.size(); ++index)
+    {
+        const piano_midi::timed_event_t &event = timeline[index];
+        const char                      *name  = event_name(event.event);
+        bool                             tempo = event.event == EVENT_TEMPO_SET;
+        if (csv)
+        {
+            out    = put_text(out, field);
+            *out++ = ',';
+            out    = put_number(out, index);
+            *out++ = ',';
+            out    = put_number(out, event.time_us);
+            *out++ = ',';
+            out    = std::copy(name, name + std::strlen(name), out);
+            *out++ = ',';
+            if (tempo)
+            {
+                out = put_number(put_text(out, ",,"), event.tempo);
+            } else
+            {
+                out    = put_number(out, event.note);
+                *out++ = ',';
+                out    = put_number(out, event.velocity);
+                *out++ = ',';
+            }
+        } else
+        {
+            out = put_text(put_text(out, "{\"song\":"), field);
+            out = put_number(put_text(out, ",\"index\":"), index);
+            out = put_number(put_text(out, ",\"time_us\":"), event.time_us);
+            out = put_text(out, ",\"event\":\"");
+            out = std::copy(name, name + std::strlen(name), out);
+            if (tempo)
+            {
+                out = put_number(put_text(out, "\",\"tempo\":"), event.tempo);
+            } else
+            {
+                out = put_number(put_text(out, "\",\"note\":"), event.note);
+                out = put_number(put_text(out, ",\"velocity\":"), event.velocity);
+            }
+            *out++ = '}';
+        }
+        *out++ = '\n';
+    }
+    return static_cast<size_t>(out - start);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Formatted rows of one song, size bytes of data are used
+//
+struct export_chunk_t
+{
+    std::vector<char> data = {};
+    size_t            size = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+export_events(const std::vector<std::string> &paths,
+              const export_config_t          &config,
+              const char                     *path,
+              stage_stats_t                  *format_stats,
+              stage_stats_t                  *write_stats,
+              std::vector<status_t>          &song_status)
+{
+    format_stats->name = "format";
+    write_stats->name  = "write";
+    song_status.assign(paths.size(), STATUS_SUCCESS);
+
+    // Header of file: names of CSV columns, magic of columnar file
+    int          fd  = (std::strcmp(path, "-") == 0) ? STDOUT_FILENO
+                                                     : ::open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                                                              0644);
+    struct iovec iov = {nullptr, 0};
+    if (config.format == EXPORT_CSV)
+    {
+        iov = {const_cast<char *>(kCsvHeader), sizeof(kCsvHeader) - 1};
+    } else if (config.format == EXPORT_COLUMNAR)
+    {
+        iov = {const_cast<char *>(kColumnarMagic), sizeof(kColumnarMagic)};
+    }
+    if (fd < 0 || !write_all(fd, &iov, 1))
+    {
+        if (fd > STDOUT_FILENO)
+        {
+            ::close(fd);
+        }
+        return STATUS_FILE_ERROR;
+    }
+
+    // Songs are loaded and formatted by threads, timeline of each thread is reused
+    size_t                                              threads = worker_threads(config.threads,
+                                                                                 paths.size());
+    std::vector<std::vector<piano_midi::timed_event_t>> timelines(threads);
+    auto format = [&](size_t lane, size_t song, export_chunk_t &chunk)
+    {
+        std::vector<piano_midi::timed_event_t> &timeline = timelines[lane];
+        timeline.clear();
+        song_status[song] = piano_midi::load_timeline(paths[song].c_str(), timeline);
+        chunk.size        = 0;
+        if (song_status[song] == STATUS_SUCCESS)
+        {
+            size_t bound = export_bound(config.format, paths[song], timeline.size());
+            if (chunk.data.size() < bound)
+            {
+                chunk.data.resize(bound);
+            }
+            chunk.size = format_song(config.format, paths[song], timeline, chunk.data.data());
+        }
+        format_stats->bytes += chunk.size;
+    };
+    auto write = [&](size_t, export_chunk_t &chunk)
+    {
+        struct iovec rows = {chunk.data.data(), chunk.size};
+        if (!write_all(fd, &rows, 1))
+        {
+            return false;
+        }
+        write_stats->bytes += chunk.size;
+        return true;
+    };
+
+    export_chunk_t prototype = {};
+    prototype.data.resize(kBufferBytes);
+    status_t status = run_ordered(paths.size(), threads, prototype, format, write, format_stats,
+                                  write_stats) ? STATUS_SUCCESS : STATUS_FILE_ERROR;
+    if (fd > STDOUT_FILENO && ::close(fd) != 0)
+    {
+        status = STATUS_FILE_ERROR;
+    }
+    return status;
+}
+
+} // ! namespace piano_host
+
+//================================================================================================//
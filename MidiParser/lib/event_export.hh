@@ -0,0 +1,104 @@
+//================================================================================================//
+
+#ifndef __EVENT_EXPORT_HH__
+#define __EVENT_EXPORT_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "pipeline.hh"
+
+//================================================================================================//
+
+//
+// Export of parsed events of a corpus of songs for data tools. Each event is a row with song,
+// its index in song, time, kind of event, note, velocity and tempo. Songs are loaded and
+// formatted by several threads into buffers of their own, writer puts them out in corpus order
+// straight from those buffers, so output does not depend on number of threads.
+//
+// Numbers are formatted with std::to_chars, without locale and allocation.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+enum export_format_t
+{
+    //
+    // Header line, then song,index,time_us,event,note,velocity,tempo per event. Song is quoted
+    // when it needs to be, fields which do not apply to event are empty.
+    //
+    EXPORT_CSV,
+
+    //
+    // Object per line with the same keys, without those which do not apply to event
+    //
+    EXPORT_JSONL,
+
+    //
+    // Little-endian binary: kColumnarMagic, then block per song. Block is u32 length of song
+    // name and the name, u64 rows, then columns time_us u64, event u8, note u8, velocity u8,
+    // tempo u32 of rows each. Name and every column are padded with zeros to 8 bytes, so
+    // columns of mapped file are aligned.
+    //
+    EXPORT_COLUMNAR,
+};
+
+static const char kColumnarMagic[8] = {'P', 'I', 'A', 'N', 'O', 'E', 'V', '1'};
+
+//------------------------------------------------------------------------------------------------//
+
+struct export_config_t
+{
+    export_format_t format  = EXPORT_CSV;
+
+    //
+    // Threads loading and formatting songs, 0 - one per core
+    //
+    size_t          threads = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Most bytes format_song may take for song with rows events
+//
+size_t export_bound(export_format_t format, const std::string &song, size_t rows);
+
+//
+// Rows of one song in format, without header of file. Returns bytes written to out, which has
+// room for export_bound of them.
+//
+size_t format_song(export_format_t                               format,
+                   const std::string                            &song,
+                   const std::vector<piano_midi::timed_event_t> &timeline,
+                   char                                         *out);
+
+//
+// Load songs of paths and write their events to path ("-" is stdout). Status of loading each
+// song goes to song_status, songs which fail to load have no rows. Returns STATUS_FILE_ERROR
+// if output can't be written. Stats of format threads add up in format_stats.
+//
+piano::status_t export_events(const std::vector<std::string> &paths,
+                              const export_config_t          &config,
+                              const char                     *path,
+                              stage_stats_t                  *format_stats,
+                              stage_stats_t                  *write_stats,
+                              std::vector<piano::status_t>   &song_status);
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __EVENT_EXPORT_HH__
+
+//================================================================================================//
@@ -0,0 +1,207 @@
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "key_codec.hh"
+
+//================================================================================================//
+
+namespace piano_proto
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+static const uint8_t kSequenceMask = 0x3f;
+static const uint8_t kKindShift    = 6;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Write body of frame for bitmap and return kind of body used (list or bitmap)
+//
+static size_t write_body(const key_state_t &bits, uint8_t *dst, bool *is_list);
+
+//
+// Read body of frame, returns false if body is malformed
+//
+static bool read_body(const uint8_t *src, size_t size, bool is_list, key_state_t *bits);
+
+//================================================================================================//
+
+static size_t
+write_body(const key_state_t &bits,
+           uint8_t           *dst,
+           bool              *is_list)
+{
+    size_t count = __builtin_popcountll(bits.words[0]) + __builtin_popcountll(bits.words[1]);
+    if (count <= kKeyBitmapSize)
+    {
+        *is_list = true;
+        size_t  size = 0;
+        int     last = -1;
+        for (int word = 0; word != 2; ++word)
+        {
+            uint64_t value = bits.words[word];
+            while (value != 0)
+            {
+                int key = word * 64 + __builtin_ctzll(value);
+                dst[size++] = static_cast<uint8_t>(key - last - 1);
+                last  = key;
+                value &= value - 1;
+            }
+        }
+        return size;
+    }
+
+    *is_list = false;
+    for (size_t i = 0; i != kKeyBitmapSize; ++i)
+    {
+        dst[i] = static_cast<uint8_t>(bits.words[i / 8] >> (8 * (i % 8)));
+    }
+    return kKeyBitmapSize;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+read_body(const uint8_t *src,
+          size_t         size,
+          bool           is_list,
+          key_state_t   *bits)
+{
+    *bits = key_state_t();
+    if (is_list)
+    {
+        if (size > kKeyBitmapSize)
+        {
+            return false;
+        }
+        int key = -1;
+        for (size_t i = 0; i != size; ++i)
+        {
+            key += src[i] + 1;
+            if (key >= static_cast<int>(kKeysNumber))
+            {
+                return false;
+            }
+            bits->set(static_cast<uint8_t>(key), true);
+        }
+        return true;
+    }
+
+    if (size != kKeyBitmapSize)
+    {
+        return false;
+    }
+    for (size_t i = 0; i != kKeyBitmapSize; ++i)
+    {
+        bits->words[i / 8] |= static_cast<uint64_t>(src[i]) << (8 * (i % 8));
+    }
+    return true;
+}
+
+//================================================================================================//
+
+key_encoder_t::key_encoder_t(uint32_t keyframe_interval)
+    : keyframe_interval_(keyframe_interval)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+key_encoder_t::encode(const key_state_t &state,
+                      uint8_t           *dst)
+{
+    bool keyframe = force_keyframe_ || (since_keyframe_ + 1 >= keyframe_interval_);
+    if (!keyframe && state == previous_)
+    {
+        return 0;
+    }
+
+    key_state_t bits = state;
+    if (!keyframe)
+    {
+        bits.words[0] ^= previous_.words[0];
+        bits.words[1] ^= previous_.words[1];
+    }
+
+    bool   is_list = false;
+    size_t size    = 1 + write_body(bits, dst + 1, &is_list);
+
+    uint8_t kind = keyframe ? (is_list ? KEY_FRAME_KEYFRAME_LIST : KEY_FRAME_KEYFRAME_BITMAP)
+                            : (is_list ? KEY_FRAME_DELTA_LIST    : KEY_FRAME_DELTA_BITMAP);
+    dst[0] = static_cast<uint8_t>((kind << kKindShift) | (sequence_ & kSequenceMask));
+
+    sequence_       = (sequence_ + 1) & kSequenceMask;
+    since_keyframe_ = keyframe ? 0 : since_keyframe_ + 1;
+    force_keyframe_ = false;
+    previous_       = state;
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+key_encoder_t::request_keyframe()
+{
+    force_keyframe_ = true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+key_decoder_t::decode(const uint8_t *src,
+                      size_t         size,
+                      key_state_t   *state)
+{
+    if (size == 0)
+    {
+        return STATUS_CODEC_FORMAT_ERROR;
+    }
+
+    uint8_t kind     = src[0] >> kKindShift;
+    uint8_t sequence = src[0] & kSequenceMask;
+    bool    keyframe = (kind == KEY_FRAME_KEYFRAME_LIST) || (kind == KEY_FRAME_KEYFRAME_BITMAP);
+    bool    is_list  = (kind == KEY_FRAME_KEYFRAME_LIST) || (kind == KEY_FRAME_DELTA_LIST);
+
+    key_state_t bits = {};
+    if (!read_body(src + 1, size - 1, is_list, &bits))
+    {
+        return STATUS_CODEC_FORMAT_ERROR;
+    }
+
+    if (keyframe)
+    {
+        state_        = bits;
+        synchronized_ = true;
+    } else
+    {
+        if (!synchronized_ || sequence != expected_)
+        {
+            synchronized_ = false;
+            return STATUS_CODEC_DESYNC;
+        }
+        state_.words[0] ^= bits.words[0];
+        state_.words[1] ^= bits.words[1];
+    }
+
+    expected_ = (sequence + 1) & kSequenceMask;
+    *state    = state_;
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_proto
+
+//================================================================================================//
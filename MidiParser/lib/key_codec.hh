@@ -0,0 +1,144 @@
+//================================================================================================//
+
+#ifndef __KEY_CODEC_HH__
+#define __KEY_CODEC_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+
+//================================================================================================//
+
+//
+// Codec of full keyboard state. Each frame is XOR of current and previous states, written
+// either as a list of changed key positions or as raw 16 byte bitmap, whichever is shorter.
+//
+// Frame layout:
+//
+//     header | body
+//
+//  - header bits 7-6 are kind of frame (key_frame_kind_t), bits 5-0 are sequence number
+//  - list body is gap encoded positions: first position, then (position - previous - 1)
+//    for each next one. Positions are below 128, so each gap takes exactly one byte.
+//  - bitmap body is 16 bytes, bit (key % 8) of byte (key / 8) is set for key
+//
+// Keyframes carry state itself instead of difference, decoder that lost a frame (sequence
+// number is not the expected one) ignores deltas until the next keyframe.
+//
+namespace piano_proto
+{
+
+//================================================================================================//
+
+static const size_t   kKeysNumber              = 128;
+static const size_t   kKeyBitmapSize           = kKeysNumber / 8;
+
+//
+// Worst case is header with bitmap body
+//
+static const size_t   kMaxKeyFrameSize         = 1 + kKeyBitmapSize;
+
+//
+// Keyframe is sent every kDefaultKeyframeInterval frames by default
+//
+static const uint32_t kDefaultKeyframeInterval = 64;
+
+//------------------------------------------------------------------------------------------------//
+
+enum key_frame_kind_t : uint8_t
+{
+    KEY_FRAME_DELTA_LIST      = 0x0,
+    KEY_FRAME_DELTA_BITMAP    = 0x1,
+    KEY_FRAME_KEYFRAME_LIST   = 0x2,
+    KEY_FRAME_KEYFRAME_BITMAP = 0x3,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Bitmap of pressed keys
+//
+struct key_state_t
+{
+    uint64_t words[2] = {};
+
+    bool test(uint8_t key) const
+    {
+        return (words[(key >> 6) & 1] >> (key & 63)) & 1;
+    }
+
+    void set(uint8_t key, bool on)
+    {
+        uint64_t mask = uint64_t(1) << (key & 63);
+        words[(key >> 6) & 1] = on ? (words[(key >> 6) & 1] | mask)
+                                   : (words[(key >> 6) & 1] & ~mask);
+    }
+
+    bool operator==(const key_state_t &other) const
+    {
+        return words[0] == other.words[0] && words[1] == other.words[1];
+    }
+
+    bool operator!=(const key_state_t &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+//================================================================================================//
+
+class key_encoder_t
+{
+  public:
+    explicit key_encoder_t(uint32_t keyframe_interval = kDefaultKeyframeInterval);
+
+    //
+    // Encode state to dst, which must hold kMaxKeyFrameSize bytes. Returns size of frame or
+    // zero if state did not change and keyframe is not due, nothing has to be sent then.
+    //
+    size_t encode(const key_state_t &state, uint8_t *dst);
+
+    //
+    // Next frame will be a keyframe, used when receiver is known to be out of sync
+    //
+    void request_keyframe();
+
+  private:
+    key_state_t previous_          = {};
+    uint32_t    keyframe_interval_ = kDefaultKeyframeInterval;
+    uint32_t    since_keyframe_    = 0;
+    uint8_t     sequence_          = 0;
+    bool        force_keyframe_    = true;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+class key_decoder_t
+{
+  public:
+    //
+    // Apply frame to current state. Returns STATUS_CODEC_DESYNC when frame is skipped because
+    // some previous frame was lost, state is left unchanged then.
+    //
+    piano::status_t decode(const uint8_t *src, size_t size, key_state_t *state);
+
+    bool synchronized() const { return synchronized_; }
+
+  private:
+    key_state_t state_        = {};
+    uint8_t     expected_     = 0;
+    bool        synchronized_ = false;
+};
+
+} // ! namespace piano_proto
+
+//================================================================================================//
+
+#endif // ! __KEY_CODEC_HH__
+
+//================================================================================================//
@@ -0,0 +1,182 @@
+//================================================================================================//
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "clock_sync.hh"
+#include "latency_probe.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Ping is counted as lost if echo does not come within this time
+//
+static const int64_t kEchoTimeoutUs = 100000;
+
+//================================================================================================//
+
+//
+// Wait for echo of ping with given sequence. host_receive_us is time echo was read.
+//
+static status_t
+receive_echo(int                  fd,
+             uint32_t             sequence,
+             int64_t              deadline_us,
+             piano_proto::ping_t *echo,
+             size_t              *echo_size,
+             int64_t             *host_receive_us)
+{
+    piano_proto::frame_decoder_t decoder;
+    piano_proto::message_t       message;
+    uint8_t                      buffer[256] = {};
+
+    int64_t now_us = host_time_us();
+    while (now_us < deadline_us)
+    {
+        pollfd request = {fd, POLLIN, 0};
+        int    ready   = poll(&request, 1, static_cast<int>((deadline_us - now_us + 999) / 1000));
+        if (ready < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+
+        ssize_t size = (ready == 0) ? 0 : read(fd, buffer, sizeof(buffer));
+        now_us = host_time_us();
+        if (size < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+
+        // Echoes of lost pings may still come, they are skipped
+        for (ssize_t i = 0; i != size; ++i)
+        {
+            if (decoder.push(buffer[i], &message) != STATUS_SUCCESS ||
+                message.type != piano_proto::MESSAGE_ECHO ||
+                message.ping.sequence != sequence)
+            {
+                continue;
+            }
+            uint8_t frame[piano_proto::kMaxFrameSize] = {};
+            piano_proto::encode_message(message, frame, sizeof(frame), echo_size);
+
+            *echo            = message.ping;
+            *host_receive_us = now_us;
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_SYNC_TIMEOUT;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+probe_latency(int                   fd,
+              uint32_t              baud_rate,
+              const probe_config_t &config,
+              clock_sync_t         *sync,
+              probe_result_t       *result)
+{
+    double byte_us = (baud_rate == 0) ? 0. : 10. * 1e6 / baud_rate;
+
+    piano_proto::message_t ping;
+    ping.type         = piano_proto::MESSAGE_PING;
+    ping.ping         = {};
+    ping.ping.show    = config.show;
+    ping.ping.padding = config.padding;
+
+    for (size_t i = 0; i != config.samples; ++i)
+    {
+        uint8_t frame[piano_proto::kMaxFrameSize] = {};
+        size_t  size = 0;
+
+        // Timestamp is taken as close to write as possible
+        int64_t host_send_us   = host_time_us();
+        ping.ping.sequence     = static_cast<uint32_t>(i);
+        ping.ping.host_send_us = static_cast<uint64_t>(host_send_us);
+        status_t status = piano_proto::encode_message(ping, frame, sizeof(frame), &size);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        if (write(fd, frame, size) != static_cast<ssize_t>(size))
+        {
+            return STATUS_SERIAL_WRITE_ERROR;
+        }
+
+        piano_proto::ping_t echo            = {};
+        size_t              echo_size       = 0;
+        int64_t             host_receive_us = 0;
+        status = receive_echo(fd, ping.ping.sequence, host_send_us + kEchoTimeoutUs,
+                              &echo, &echo_size, &host_receive_us);
+        if (status == STATUS_SYNC_TIMEOUT)
+        {
+            ++result->lost;
+            continue;
+        } else if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        // Echo is read after its last byte, time of its first byte is used for one-way latency
+        double        transfer_us = static_cast<double>(echo_size - 1) * byte_us;
+        sync_sample_t sample      = {};
+        sample.host_send_us      = host_send_us;
+        sample.device_receive_us = static_cast<int64_t>(echo.device_receive_us);
+        sample.device_send_us    = static_cast<int64_t>(echo.device_send_us);
+        sample.host_receive_us   = host_receive_us - static_cast<int64_t>(transfer_us);
+        sync->add(sample);
+
+        const clock_estimate_t &clock = sync->estimate();
+        int64_t device_receive_us = clock.to_host(sample.device_receive_us);
+        int64_t device_shown_us   = clock.to_host(static_cast<int64_t>(echo.device_shown_us));
+        int64_t device_send_us    = clock.to_host(sample.device_send_us);
+
+        result->round_trip_us.add(static_cast<double>(host_receive_us - host_send_us));
+        result->uplink_us.add(static_cast<double>(device_receive_us - host_send_us));
+        result->led_us.add(static_cast<double>(device_shown_us - host_send_us));
+        result->downlink_us.add(static_cast<double>(sample.host_receive_us - device_send_us));
+        result->device_us.add(static_cast<double>(sample.device_send_us -
+                                                  sample.device_receive_us));
+
+        std::this_thread::sleep_for(std::chrono::microseconds(config.interval_us));
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+probe_result_t::print(std::ostream &out) const
+{
+    round_trip_us.print(out, "round trip", "us");
+    uplink_us.print    (out, "uplink    ", "us");
+    led_us.print       (out, "to LED    ", "us");
+    downlink_us.print  (out, "downlink  ", "us");
+    device_us.print    (out, "on device ", "us");
+    out << "lost       : " << lost << " of " << round_trip_us.count() + lost << "\n";
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
@@ -0,0 +1,90 @@
+//================================================================================================//
+
+#ifndef __LATENCY_PROBE_HH__
+#define __LATENCY_PROBE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "clock_sync.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+//
+// Latency of host-device link measured with MESSAGE_PING / MESSAGE_ECHO. Round trip is measured
+// on host clock alone, one-way latencies need device times mapped to host clock, so estimate
+// of device clock must be ready before probe. Each echo is also a sync exchange and keeps the
+// estimate up to date during probe.
+//
+// One-way latencies are measured between the first byte of frame on both sides, the fastest
+// uplink and downlink are equal by construction of estimate, their spread is what matters.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+struct probe_config_t
+{
+    size_t   samples     = 1000;
+    uint64_t interval_us = 5000;
+
+    //
+    // Device refreshes LED strip before echo, see MESSAGE_PING
+    //
+    bool     show        = true;
+    uint8_t  padding     = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct probe_result_t
+{
+    //
+    // Host send to host receive of echo
+    //
+    sample_stats_t round_trip_us;
+
+    //
+    // Host send to device receive, to LED refresh done and device send to host receive
+    //
+    sample_stats_t uplink_us;
+    sample_stats_t led_us;
+    sample_stats_t downlink_us;
+
+    //
+    // Time from device receive to device send, includes the rest of ping on the wire
+    //
+    sample_stats_t device_us;
+
+    size_t         lost = 0;
+
+    void print(std::ostream &out) const;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Send config.samples pings interval_us apart and collect latencies. Pings without echo within
+// timeout are counted as lost. sync must be synchronized, see sync_clock.
+//
+piano::status_t probe_latency(int                   fd,
+                              uint32_t              baud_rate,
+                              const probe_config_t &config,
+                              clock_sync_t         *sync,
+                              probe_result_t       *result);
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __LATENCY_PROBE_HH__
+
+//================================================================================================//
@@ -0,0 +1,82 @@
+//================================================================================================//
+
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "led_render.hh"
+#include "led_pacer.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+static bool
+same_frame(const led_frame_t &left,
+           const led_frame_t &right)
+{
+    return left.size == right.size &&
+           std::memcmp(left.grb, right.grb, left.size * kBytesPerLed) == 0;
+}
+
+//================================================================================================//
+
+led_pacer_t::led_pacer_t(uint32_t rate_hz)
+    : period_us_((rate_hz == 0) ? 0 : 1000000 / static_cast<int64_t>(rate_hz))
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+led_pacer_t::publish(const led_frame_t &frame,
+                     int64_t            now_us)
+{
+    stamped_frame_t stamped;
+    stamped.frame        = frame;
+    stamped.published_us = now_us;
+    if (!frames_.publish(stamped))
+    {
+        replaced_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+led_pacer_t::poll(int64_t  now_us,
+                  int64_t *wait_us)
+{
+    *wait_us = -1;
+    if (!frames_.pending())
+    {
+        return false;
+    }
+
+    // Frames coalesce in back buffer until period since the last refresh is over
+    if (refreshed_ && now_us - refresh_us_ < period_us_)
+    {
+        *wait_us = refresh_us_ + period_us_ - now_us;
+        return false;
+    }
+
+    frames_.take(&next_);
+    if (refreshed_ && same_frame(next_.frame, shown_.frame))
+    {
+        unchanged_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    shown_      = next_;
+    refreshed_  = true;
+    refresh_us_ = now_us;
+    return true;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_device
+
+//================================================================================================//
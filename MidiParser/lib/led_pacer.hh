@@ -0,0 +1,95 @@
+//================================================================================================//
+
+#ifndef __LED_PACER_HH__
+#define __LED_PACER_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "led_render.hh"
+#include "mailbox.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Default rate of LED frames on device, strip of 128 LEDs takes most of the period
+//
+static const uint32_t kLedRateHz = 200;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// LED frames from device loop to task which refreshes strip. Device publishes every frame into
+// back buffer, LED task swaps buffers and refreshes strip at most once per period, and only if
+// the frame differs from the one strip shows: notes within one period make one refresh, note
+// pressed and released within it none. The first change after idle is shown at once.
+//
+class led_pacer_t
+{
+  public:
+    //
+    // rate_hz 0 - refresh on every change, as fast as strip takes it
+    //
+    explicit led_pacer_t(uint32_t rate_hz = kLedRateHz);
+
+    //
+    // Called by device loop, never waits. Time is kept with frame to measure how long it took
+    // to reach strip.
+    //
+    void publish(const led_frame_t &frame, int64_t now_us);
+
+    //
+    // Called by LED task. Returns true if strip has to be refreshed with frame() now. Otherwise
+    // wait_us is how long to sleep before the next call, -1 - until the next publish.
+    //
+    bool poll(int64_t now_us, int64_t *wait_us);
+
+    //
+    // Frame was published and not taken by poll yet
+    //
+    bool               pending()      const { return frames_.pending();   }
+
+    const led_frame_t &frame()        const { return shown_.frame;        }
+    int64_t            published_us() const { return shown_.published_us; }
+    int64_t            period_us()    const { return period_us_;           }
+
+    //
+    // Frames replaced in back buffer by newer ones, and frames dropped as the same as shown,
+    // may be read from any thread. 32 bit to stay lock-free on Xtensa.
+    //
+    uint32_t replaced()  const { return replaced_.load(std::memory_order_relaxed);  }
+    uint32_t unchanged() const { return unchanged_.load(std::memory_order_relaxed); }
+
+  private:
+    struct stamped_frame_t
+    {
+        led_frame_t frame;
+        int64_t     published_us = 0;
+    };
+
+    int64_t                           period_us_  = 0;
+    piano::mailbox_t<stamped_frame_t> frames_;
+    stamped_frame_t                   next_;
+    stamped_frame_t                   shown_;
+    bool                              refreshed_  = false;
+    int64_t                           refresh_us_ = 0;
+    std::atomic<uint32_t>             replaced_   = {0};
+    std::atomic<uint32_t>             unchanged_  = {0};
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __LED_PACER_HH__
+
+//================================================================================================//
@@ -0,0 +1,110 @@
+//================================================================================================//
+
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "key_codec.hh"
+#include "led_render.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+static constexpr double
+constexpr_sqrt(double value)
+{
+    double root = (value > 1.) ? value : 1.;
+    for (int i = 0; i != 32; ++i)
+    {
+        root = (root + value / root) / 2.;
+    }
+    return root;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Gamma correction: LED brightness grows with duty cycle far faster than eye sees it, so
+// channel is raised to power 2.5 (x^2 * sqrt(x)), generated at compile time
+//
+struct gamma_table_t
+{
+    constexpr gamma_table_t() : values()
+    {
+        for (uint32_t i = 0; i != 256; ++i)
+        {
+            double x  = i / 255.;
+            values[i] = static_cast<uint8_t>(255. * x * x * constexpr_sqrt(x) + 0.5);
+        }
+    }
+
+    uint8_t values[256];
+};
+
+static constexpr gamma_table_t kGamma = gamma_table_t();
+
+//
+// GRB bytes of pressed key for each velocity: blue for soft, green in the middle, red for
+// loud, scaled to kLedBrightness and gamma corrected. Velocity 0 is dark.
+//
+struct palette_t
+{
+    constexpr palette_t() : grb()
+    {
+        for (uint32_t velocity = 1; velocity != 128; ++velocity)
+        {
+            // Position between blue and red, 0..2
+            double t     = 2. * (velocity - 1) / 126.;
+            double red   = (t > 1.) ? t - 1. : 0.;
+            double green = (t > 1.) ? 2. - t : t;
+            double blue  = (t < 1.) ? 1. - t : 0.;
+
+            grb[velocity][0] = kGamma.values[static_cast<uint8_t>(green * kLedBrightness + 0.5)];
+            grb[velocity][1] = kGamma.values[static_cast<uint8_t>(red   * kLedBrightness + 0.5)];
+            grb[velocity][2] = kGamma.values[static_cast<uint8_t>(blue  * kLedBrightness + 0.5)];
+        }
+    }
+
+    uint8_t grb[128][kBytesPerLed];
+};
+
+static constexpr palette_t kPalette = palette_t();
+
+//================================================================================================//
+
+led_renderer_t::led_renderer_t(const pixel_map_t &pixels)
+    : pixels_(pixels)
+{
+    frame_.size = pixels_.leds;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+led_renderer_t::set_key(uint8_t note,
+                        uint8_t velocity)
+{
+    uint8_t pixel = pixels_.pixels[note & 0x7f];
+    if (pixel != kNoPixel)
+    {
+        std::memcpy(&frame_.grb[pixel * kBytesPerLed], kPalette.grb[velocity & 0x7f], kBytesPerLed);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+led_renderer_t::clear()
+{
+    std::memset(frame_.grb, 0, frame_.size * kBytesPerLed);
+}
+
+//================================================================================================//
+
+} // ! namespace piano_device
+
+//================================================================================================//
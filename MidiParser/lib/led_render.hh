@@ -0,0 +1,204 @@
+//================================================================================================//
+
+#ifndef __LED_RENDER_HH__
+#define __LED_RENDER_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "key_codec.hh"
+
+//================================================================================================//
+
+//
+// LED frames of device: strip of WS2812 LEDs, one per key, kept as GRB bytes in the order they go
+// to the wire. Renderer updates only pixels of keys which changed, each with lookups in tables
+// generated at compile time.
+//
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Strip has one LED per key. Piano strip has 88 LEDs from A0 (note 21), the longest one covers
+// all notes of MIDI.
+//
+static const size_t  kMaxLeds          = piano_proto::kKeysNumber;
+static const size_t  kPianoLeds        = 88;
+static const uint8_t kPianoFirstNote   = 21;
+static const size_t  kBytesPerLed      = 3;
+
+//
+// WS2812 takes 24 bits of 1.25 us per LED, then line is held low to latch colours. Strip of n
+// LEDs can't be refreshed more often than once in strip_refresh_us(n).
+//
+static const int64_t kLedBitsUs        = 30;
+static const int64_t kLedResetUs       = 280;
+
+//
+// Brightness of the loudest key before gamma correction, and velocity of keys pressed by key
+// frames which do not carry it
+//
+static const uint8_t kLedBrightness    = 160;
+static const uint8_t kKeyFrameVelocity = 80;
+
+//
+// Pixel of notes outside of strip
+//
+static const uint8_t kNoPixel          = 0xff;
+
+//
+// Most strips refreshed in parallel, ESP32-S3 has 4 RMT TX channels
+//
+static const size_t  kMaxStrips        = 4;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// LED i of strip shows note first_note + i, notes outside of strip are not shown
+//
+struct strip_layout_t
+{
+    size_t  leds       = kPianoLeds;
+    uint8_t first_note = kPianoFirstNote;
+};
+
+//
+// Strip as it goes to the wire: green, red and blue byte of each LED
+//
+struct led_frame_t
+{
+    size_t  size                         = 0;
+    uint8_t grb[kMaxLeds * kBytesPerLed] = {};
+};
+
+//
+// Pixel of each note, kNoPixel for notes outside of strip. Layouts longer than kMaxLeds are
+// cut to it. Constant layout gives table generated at compile time.
+//
+struct pixel_map_t
+{
+    constexpr explicit pixel_map_t(const strip_layout_t &layout)
+        : leds((layout.leds < kMaxLeds) ? layout.leds : kMaxLeds), pixels()
+    {
+        for (size_t note = 0; note != piano_proto::kKeysNumber; ++note)
+        {
+            pixels[note] = (note >= layout.first_note && note - layout.first_note < leds)
+                         ? static_cast<uint8_t>(note - layout.first_note)
+                         : kNoPixel;
+        }
+    }
+
+    size_t  leds;
+    uint8_t pixels[piano_proto::kKeysNumber];
+};
+
+static constexpr pixel_map_t kPianoPixels = pixel_map_t(strip_layout_t{});
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Keeps LED frame for state of keys. Pressed key is lit with colour of its velocity, from blue
+// for soft through green to red for loud, gamma corrected.
+//
+class led_renderer_t
+{
+  public:
+    explicit led_renderer_t(const pixel_map_t &pixels = kPianoPixels);
+
+    //
+    // Velocity 0 - key is released
+    //
+    void set_key(uint8_t note, uint8_t velocity);
+
+    //
+    // All keys are released
+    //
+    void clear();
+
+    const led_frame_t &frame() const { return frame_; }
+
+  private:
+    pixel_map_t pixels_;
+    led_frame_t frame_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+constexpr int64_t
+strip_refresh_us(size_t leds)
+{
+    return kLedResetUs + kLedBitsUs * static_cast<int64_t>(leds);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// LEDs [first, first + leds) of frame, shown by one physical strip
+//
+struct strip_segment_t
+{
+    size_t first = 0;
+    size_t leds  = 0;
+};
+
+//
+// Frame cut into consecutive segments of nearly equal length, one per strip, so that keys are
+// split into ranges and strips are refreshed at the same time: refresh takes as long as the
+// longest segment, not the whole frame. Segments are parts of frame buffer in wire order, each
+// strip sends its part in place. The first segments are one LED longer if LEDs are not divided
+// evenly. Number of strips is cut to 1..kMaxStrips and to number of LEDs.
+//
+struct strip_split_t
+{
+    constexpr strip_split_t(size_t leds, size_t strips)
+        : count(), segments()
+    {
+        count = (strips == 0) ? 1 : (strips < kMaxStrips) ? strips : kMaxStrips;
+        count = (count < leds || leds == 0) ? count : leds;
+        size_t first = 0;
+        for (size_t i = 0; i != count; ++i)
+        {
+            segments[i].first = first;
+            segments[i].leds  = leds / count + ((i < leds % count) ? 1 : 0);
+            first            += segments[i].leds;
+        }
+    }
+
+    //
+    // Bytes of segment i in frame, frame shorter than split gives shorter segments
+    //
+    const uint8_t *data(const led_frame_t &frame, size_t i) const
+    {
+        return &frame.grb[first_led(frame, i) * kBytesPerLed];
+    }
+    size_t size(const led_frame_t &frame, size_t i) const
+    {
+        size_t last = segments[i].first + segments[i].leds;
+        return (((last < frame.size) ? last : frame.size) - first_led(frame, i)) * kBytesPerLed;
+    }
+
+    constexpr int64_t refresh_us() const { return strip_refresh_us(segments[0].leds); }
+
+    size_t          count;
+    strip_segment_t segments[kMaxStrips];
+
+  private:
+    size_t first_led(const led_frame_t &frame, size_t i) const
+    {
+        return (segments[i].first < frame.size) ? segments[i].first : frame.size;
+    }
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __LED_RENDER_HH__
+
+//================================================================================================//
@@ -0,0 +1,81 @@
+//================================================================================================//
+
+#ifndef __MAILBOX_HH__
+#define __MAILBOX_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+
+//================================================================================================//
+
+namespace piano
+{
+
+//================================================================================================//
+
+//
+// Latest value from one producer to one consumer thread (triple buffer). Neither side ever
+// waits: producer overwrites value consumer has not taken yet, consumer gets only the newest
+// one. Used for LED frames, where a frame behind the current state is of no use.
+//
+template <typename T>
+class mailbox_t
+{
+  public:
+    //
+    // Called by producer only. Returns false if it replaced value which was not taken.
+    //
+    bool publish(const T &value)
+    {
+        slots_[back_] = value;
+        uint8_t previous = middle_.exchange(static_cast<uint8_t>(back_ | kFresh),
+                                            std::memory_order_acq_rel);
+        back_ = previous & kIndex;
+        return (previous & kFresh) == 0;
+    }
+
+    //
+    // Called by consumer only. Returns false if nothing was published since the last take.
+    //
+    bool take(T *value)
+    {
+        if (!pending())
+        {
+            return false;
+        }
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndex;
+        *value = slots_[front_];
+        return true;
+    }
+
+    //
+    // Value was published and not taken yet
+    //
+    bool pending() const
+    {
+        return (middle_.load(std::memory_order_acquire) & kFresh) != 0;
+    }
+
+  private:
+    static const uint8_t kIndex = 0x3;
+    static const uint8_t kFresh = 0x4;
+
+    //
+    // Each slot is owned by one side at a time: back_ by producer, front_ by consumer, the
+    // third one is in middle_ with a flag telling whether it was written after the last take
+    //
+    T                    slots_[3];
+    uint8_t              back_   = 0;
+    uint8_t              front_  = 1;
+    std::atomic<uint8_t> middle_ = {2};
+};
+
+} // ! namespace piano
+
+//================================================================================================//
+
+#endif // ! __MAILBOX_HH__
+
+//================================================================================================//
@@ -0,0 +1,130 @@
+//================================================================================================//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_parser.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+
+//================================================================================================//
+
+namespace piano_midi
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+status_t
+read_file(const char           *path,
+          std::vector<uint8_t> &data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        std::cerr << "Error while opening " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char *>(data.data()), data.size()))
+    {
+        std::cerr << "Error while reading " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+load_timeline(const char                 *path,
+              std::vector<timed_event_t> &timeline)
+{
+    std::vector<uint8_t> data = {};
+    status_t status = read_file(path, data);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    std::vector<event_t> events = {};
+    status = parse_midi(data.data(), data.size(), events);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    return resolve_timeline(events, timeline);
+}
+
+//================================================================================================//
+
+file_source_t::~file_source_t()
+{
+    if (fd_ != -1)
+    {
+        close(fd_);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+file_source_t::open(const char *path)
+{
+    if (fd_ != -1)
+    {
+        close(fd_);
+    }
+
+    fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info = {};
+    if (fd_ == -1 || fstat(fd_, &info) != 0)
+    {
+        std::cerr << "Error while opening " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+    size_ = static_cast<uint64_t>(info.st_size);
+
+    // Tracks are read front to back
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+file_source_t::read_at(uint64_t offset,
+                       uint8_t *dst,
+                       size_t   size)
+{
+    size_t done = 0;
+    while (done != size)
+    {
+        ssize_t result = pread(fd_, dst + done, size - done, static_cast<off_t>(offset + done));
+        if (result <= 0)
+        {
+            break;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return done;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_midi
+
+//================================================================================================//
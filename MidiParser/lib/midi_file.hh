@@ -0,0 +1,63 @@
+//================================================================================================//
+
+#ifndef __MIDI_FILE_HH__
+#define __MIDI_FILE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "midi_stream.hh"
+
+//================================================================================================//
+
+namespace piano_midi
+{
+
+//
+// Read whole file to memory
+//
+piano::status_t read_file(const char *path, std::vector<uint8_t> &data);
+
+//
+// Read and parse MIDI file, then resolve its timeline
+//
+piano::status_t load_timeline(const char *path, std::vector<timed_event_t> &timeline);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Source over file opened for reading, bytes are read with pread so that file is never loaded
+// as a whole
+//
+class file_source_t : public byte_source_t
+{
+  public:
+    file_source_t() = default;
+    ~file_source_t() override;
+
+    file_source_t(const file_source_t &)            = delete;
+    file_source_t &operator=(const file_source_t &) = delete;
+
+    piano::status_t open(const char *path);
+
+    size_t   read_at(uint64_t offset, uint8_t *dst, size_t size) override;
+    uint64_t size() const override { return size_; }
+
+  private:
+    int      fd_   = -1;
+    uint64_t size_ = 0;
+};
+
+} // ! namespace piano_midi
+
+//================================================================================================//
+
+#endif // ! __MIDI_FILE_HH__
+
+//================================================================================================//
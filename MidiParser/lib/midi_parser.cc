@@ -496,7 +496,8 @@ parse_midi(const uint8_t        *midi_data,
             events.push_back(event_t((midi_event == MIDI_EVENT_NOTE_ON) ? EVENT_NOTE_ON
                                                                         : EVENT_NOTE_OFF,
                                      note,
-                                     current_time));
+                                     current_time,
+                                     velocity));
         }
     }
 
@@ -0,0 +1,573 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "midi_stream.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "pipeline.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "midi_pipeline.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+using clock_t = std::chrono::steady_clock;
+
+//------------------------------------------------------------------------------------------------//
+
+static const char *const kStageNames[STAGES_NUMBER] = {"read", "parse", "encode", "transmit"};
+
+//================================================================================================//
+
+key_shards_t
+key_shards_t::ranges(size_t  count,
+                     uint8_t first,
+                     uint8_t last)
+{
+    key_shards_t shards = {};
+    shards.count = count;
+    size_t keys  = static_cast<size_t>(last - first) + 1;
+    for (size_t key = 0; key != piano_proto::kKeysNumber; ++key)
+    {
+        size_t position = std::min<size_t>(key - std::min<size_t>(key, first), keys - 1);
+        shards.shard[key] = static_cast<uint8_t>(position * count / keys);
+    }
+    return shards;
+}
+
+//================================================================================================//
+
+midi_pipeline_t::midi_pipeline_t(int                      fd,
+                                 const pipeline_config_t &config)
+    : midi_pipeline_t({{fd, config.clock}}, key_shards_t{}, config)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+midi_pipeline_t::midi_pipeline_t(const std::vector<pipeline_link_t> &links,
+                                 const key_shards_t                 &shards,
+                                 const pipeline_config_t            &config)
+    : config_(config), shards_(shards)
+{
+    for (size_t stage = 0; stage != STAGES_NUMBER; ++stage)
+    {
+        stats_[stage].name = kStageNames[stage];
+    }
+    for (const pipeline_link_t &link : links)
+    {
+        links_.push_back(std::make_unique<link_state_t>(link));
+        links_.back()->stats.name = kStageNames[STAGE_TRANSMIT];
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+midi_pipeline_t::run(const char *path)
+{
+    status_t status = source_.open(path);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    status = piano_midi::read_midi_layout(source_, &layout_);
+    if (status != STATUS_SUCCESS)
+    {
+        std::cerr << "Error while reading layout of " << path << "\n";
+        return status;
+    }
+
+    // Channels are allocated once, nothing is allocated while song is streamed
+    blocks_.clear();
+    for (size_t track = 0; track != layout_.tracks.size(); ++track)
+    {
+        blocks_.push_back(std::make_unique<block_channel_t>());
+    }
+    events_  = std::make_unique<event_channel_t>();
+    status_  = STATUS_SUCCESS;
+    for (auto &link : links_)
+    {
+        link->frames = std::make_unique<frame_channel_t>();
+    }
+
+    // In lookahead mode the first frame is sent at once and played lookahead_us later. Devices
+    // without clock get frames when they are played, so that all devices stay aligned.
+    bool lookahead = false;
+    for (const auto &link : links_)
+    {
+        lookahead |= link->link.clock != nullptr && config_.speed > 0.;
+    }
+    if (lookahead)
+    {
+        start_us_ = host_time_us() + static_cast<int64_t>(config_.lookahead_us);
+    } else
+    {
+        start_us_ = host_time_us();
+    }
+
+    void (midi_pipeline_t::*const stages[STAGE_TRANSMIT])() =
+    {
+        &midi_pipeline_t::read_stage,
+        &midi_pipeline_t::parse_stage,
+        &midi_pipeline_t::encode_stage,
+    };
+
+    auto timed = [](stage_stats_t *stats, auto function)
+    {
+        auto start = clock_t::now();
+        function();
+        stats->wall_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start).count());
+    };
+
+    std::vector<std::thread> threads = {};
+    for (size_t stage = 0; stage != STAGE_TRANSMIT; ++stage)
+    {
+        threads.emplace_back([this, stage, timed, function = stages[stage]]()
+        {
+            timed(&stats_[stage], [&]() { (this->*function)(); });
+        });
+    }
+    for (auto &link : links_)
+    {
+        threads.emplace_back([this, timed, link = link.get()]()
+        {
+            timed(&link->stats, [&]() { transmit_stage(link); });
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Times are summed too, so busy time of transmit is the total of all its threads
+    stage_stats_t &transmit = stats_[STAGE_TRANSMIT];
+    for (auto &link : links_)
+    {
+        transmit.items           += link->stats.items;
+        transmit.bytes           += link->stats.bytes;
+        transmit.wall_ns         += link->stats.wall_ns;
+        transmit.input_stall_ns  += link->stats.input_stall_ns;
+        transmit.output_stall_ns += link->stats.output_stall_ns;
+    }
+    return status_;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::print_stats(std::ostream &out) const
+{
+    for (const auto &stats : stats_)
+    {
+        print_stage_stats(out, stats);
+    }
+    for (size_t link = 0; link != links_.size(); ++link)
+    {
+        if (links_.size() > 1)
+        {
+            out << "device " << link << ":\n";
+            print_stage_stats(out, links_[link]->stats);
+        }
+        links_[link]->sender.print_stats(out);
+        if (links_[link]->lateness.count() != 0)
+        {
+            links_[link]->lateness.print(out, "frame lateness", "us");
+        }
+    }
+}
+
+//================================================================================================//
+
+size_t
+midi_pipeline_t::block_stream_t::read(uint8_t *dst,
+                                      size_t   capacity)
+{
+    if (pos_ == block_.size)
+    {
+        // End of track or cancelled pipeline, both are end of stream for parser
+        if (!channel_->pop(&block_, stats_))
+        {
+            return 0;
+        }
+        pos_ = 0;
+        stats_->bytes += block_.size;
+    }
+
+    size_t size = std::min<size_t>(capacity, block_.size - pos_);
+    std::memcpy(dst, block_.data + pos_, size);
+    pos_ += size;
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::read_stage()
+{
+    stage_stats_t &stats  = stats_[STAGE_READ];
+    size_t         tracks = layout_.tracks.size();
+    size_t         active = tracks;
+
+    std::vector<uint64_t> offsets(tracks);
+    std::vector<uint64_t> left   (tracks);
+    for (size_t track = 0; track != tracks; ++track)
+    {
+        offsets[track] = layout_.tracks[track].offset;
+        left   [track] = layout_.tracks[track].length;
+        if (left[track] == 0)
+        {
+            blocks_[track]->close();
+            --active;
+        }
+    }
+
+    // Tracks are read round robin, so that parser merging them by time is not starved
+    auto     block   = std::make_unique<block_t>();
+    unsigned attempt = 0;
+    while (active != 0 && status_ == STATUS_SUCCESS)
+    {
+        bool progress = false;
+        for (size_t track = 0; track != tracks; ++track)
+        {
+            block_channel_t &channel = *blocks_[track];
+            if (left[track] == 0 || channel.size() == channel.capacity())
+            {
+                continue;
+            }
+
+            size_t size = static_cast<size_t>(std::min<uint64_t>(kReadBlockSize, left[track]));
+            block->size = static_cast<uint32_t>(source_.read_at(offsets[track], block->data, size));
+            if (block->size != size)
+            {
+                std::cerr << "Error while reading track " << track << "\n";
+                fail(STATUS_FILE_ERROR);
+                return;
+            }
+
+            // Does not wait, there is free space and this thread is the only producer
+            channel.push(*block, &stats);
+            offsets[track] += size;
+            left   [track] -= size;
+            stats.items    += 1;
+            stats.bytes    += size;
+            if (left[track] == 0)
+            {
+                channel.close();
+                --active;
+            }
+            progress = true;
+        }
+
+        if (progress)
+        {
+            attempt = 0;
+            continue;
+        }
+
+        auto start = clock_t::now();
+        backoff(&attempt);
+        stats.output_stall_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start).count());
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::parse_stage()
+{
+    stage_stats_t &stats = stats_[STAGE_PARSE];
+
+    std::vector<block_stream_t>              streams = {};
+    std::vector<piano_midi::byte_stream_t *> pointers(blocks_.size());
+    streams.reserve(blocks_.size());
+    for (size_t track = 0; track != blocks_.size(); ++track)
+    {
+        streams.emplace_back(blocks_[track].get(), &stats);
+        pointers[track] = &streams[track];
+    }
+
+    piano_midi::midi_stream_t stream = {};
+    status_t status = stream.open(layout_, pointers.data());
+
+    piano_midi::timed_event_t event = {};
+    while (status == STATUS_SUCCESS && (status = stream.next(&event)) == STATUS_SUCCESS)
+    {
+        stats.items += 1;
+        if (!events_->push(event, &stats))
+        {
+            return;
+        }
+    }
+
+    if (status != STATUS_MIDI_STREAM_END)
+    {
+        fail(status);
+        return;
+    }
+    events_->close();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::encode_stage()
+{
+    stage_stats_t &stats     = stats_[STAGE_ENCODE];
+    uint64_t       period_us = config_.frame_rate != 0 ? 1000000 / config_.frame_rate : 0;
+    size_t         shards    = links_.size();
+
+    // Each device has its own batches and key frames
+    std::vector<piano_proto::batch_builder_t> builders(shards);
+    std::vector<piano_proto::key_encoder_t>   encoders(shards);
+    std::vector<piano_proto::key_state_t>     states  (shards);
+    piano_proto::message_t                    ready[2] = {};
+    piano_midi::timed_event_t                 event    = {};
+
+    auto push_ready = [&](size_t shard, size_t number)
+    {
+        for (size_t i = 0; i != number; ++i)
+        {
+            if (push_frame(links_[shard].get(), ready[i]) != STATUS_SUCCESS)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Key frame at frame_us contains all events before it, same as make_key_frame_messages
+    uint64_t frame_us  = 0;
+    bool     has_frame = false;
+    auto push_key_frames = [&]()
+    {
+        for (size_t shard = 0; shard != shards; ++shard)
+        {
+            piano_proto::message_t message = {};
+            message.type              = piano_proto::MESSAGE_KEY_FRAME;
+            message.key_frame.time_us = frame_us;
+            message.key_frame.size    = static_cast<uint8_t>(
+                encoders[shard].encode(states[shard], message.key_frame.data));
+            if (message.key_frame.size != 0 &&
+                push_frame(links_[shard].get(), message) != STATUS_SUCCESS)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Batch of shard is complete when song moves on, even if the shard gets no more events
+    uint64_t batch_us = 0;
+    while (events_->pop(&event, &stats))
+    {
+        stats.items += 1;
+        if (period_us == 0)
+        {
+            for (size_t shard = 0; shards > 1 && event.time_us != batch_us && shard != shards;
+                 ++shard)
+            {
+                if (!push_ready(shard, builders[shard].finish(ready)))
+                {
+                    return;
+                }
+            }
+            batch_us = event.time_us;
+
+            for (size_t shard = 0; shard != shards; ++shard)
+            {
+                if (event.event != EVENT_TEMPO_SET && shards_.shard[event.note & 0x7f] != shard)
+                {
+                    continue;
+                }
+                if (!push_ready(shard, builders[shard].add(event, ready)))
+                {
+                    return;
+                }
+            }
+            continue;
+        }
+
+        if (!has_frame || event.time_us >= frame_us)
+        {
+            if (has_frame && !push_key_frames())
+            {
+                return;
+            }
+            frame_us  = (event.time_us / period_us + 1) * period_us;
+            has_frame = true;
+        }
+        if (event.event != EVENT_TEMPO_SET)
+        {
+            states[shards_.shard[event.note & 0x7f]].set(event.note, event.event == EVENT_NOTE_ON);
+        }
+    }
+
+    if (status_ != STATUS_SUCCESS)
+    {
+        return;
+    }
+
+    for (size_t shard = 0; period_us == 0 && shard != shards; ++shard)
+    {
+        if (!push_ready(shard, builders[shard].finish(ready)))
+        {
+            return;
+        }
+    }
+    if (period_us != 0 && has_frame && !push_key_frames())
+    {
+        return;
+    }
+    for (auto &link : links_)
+    {
+        link->frames->close();
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+midi_pipeline_t::push_frame(link_state_t                 *link,
+                            const piano_proto::message_t &message)
+{
+    stage_stats_t &stats = stats_[STAGE_ENCODE];
+
+    frame_t frame = {};
+    size_t  size  = 0;
+    frame.time_us = piano_proto::message_time(message);
+
+    // Device plays scheduled message at device time, not at song time
+    piano_proto::message_t scheduled = message;
+    if (link->link.clock != nullptr && config_.speed > 0.)
+    {
+        double host_us = static_cast<double>(start_us_) +
+                         static_cast<double>(frame.time_us) / config_.speed;
+        piano_proto::set_message_time(&scheduled,
+                                      static_cast<uint64_t>(link->link.clock->estimate().to_device(
+                                          static_cast<int64_t>(host_us))));
+    }
+    status_t status = piano_proto::encode_message(scheduled, frame.data, sizeof(frame.data), &size);
+    if (status != STATUS_SUCCESS)
+    {
+        fail(status);
+        return status;
+    }
+    frame.size   = static_cast<uint32_t>(size);
+    stats.bytes += size;
+    return link->frames->push(frame, &stats) ? STATUS_SUCCESS : status_.load();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::transmit_stage(link_state_t *link)
+{
+    stage_stats_t   &stats  = link->stats;
+    serial_sender_t &sender = link->sender;
+    frame_channel_t &frames = *link->frames;
+    double           speed  = config_.speed;
+    auto             start  = clock_t::time_point(std::chrono::microseconds(start_us_));
+
+    // Frames are sent ahead of time in lookahead mode
+    double ahead = (link->link.clock != nullptr) ? static_cast<double>(config_.lookahead_us) : 0.;
+    auto elapsed_us = [&]()
+    {
+        return std::chrono::duration<double, std::micro>(clock_t::now() - start).count();
+    };
+
+    frame_t frame     = {};
+    bool    has_frame = frames.pop(&frame, &stats);
+    while (has_frame)
+    {
+        // Waiting for time of frame is counted as waiting for input
+        double now_us = 0.;
+        if (speed > 0.)
+        {
+            double due_us = static_cast<double>(frame.time_us) / speed - ahead;
+            auto   wait   = clock_t::now();
+            std::this_thread::sleep_until(start + std::chrono::duration<double, std::micro>(due_us));
+            stats.input_stall_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - wait).count());
+
+            now_us = elapsed_us();
+            link->lateness.add(now_us - due_us);
+        }
+
+        // Everything already encoded and due within coalescing window goes with one writev
+        do
+        {
+            status_t status = sender.enqueue_frame(frame.data, frame.size);
+            if (status != STATUS_SUCCESS)
+            {
+                fail(status);
+                return;
+            }
+            stats.items += 1;
+            stats.bytes += frame.size;
+            has_frame = frames.try_pop(&frame);
+        }
+        while (has_frame &&
+               (speed <= 0. ||
+                static_cast<double>(frame.time_us) / speed - ahead <= now_us + kCoalesceWindowUs));
+
+        status_t status = sender.flush();
+        if (status != STATUS_SUCCESS)
+        {
+            fail(status);
+            return;
+        }
+
+        if (!has_frame)
+        {
+            has_frame = frames.pop(&frame, &stats);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+midi_pipeline_t::fail(status_t status)
+{
+    status_t expected = STATUS_SUCCESS;
+    status_.compare_exchange_strong(expected, status);
+
+    for (auto &channel : blocks_)
+    {
+        channel->cancel();
+    }
+    events_->cancel();
+    for (auto &link : links_)
+    {
+        link->frames->cancel();
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
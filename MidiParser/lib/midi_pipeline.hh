@@ -0,0 +1,243 @@
+//================================================================================================//
+
+#ifndef __MIDI_PIPELINE_HH__
+#define __MIDI_PIPELINE_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "midi_stream.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "pipeline.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Size of file block read at once and number of blocks buffered for each track
+//
+static const size_t kReadBlockSize    = 4096;
+static const size_t kTrackChannelSize = 4;
+
+//
+// Number of parsed events and encoded frames between stages
+//
+static const size_t kEventChannelSize = 1024;
+static const size_t kFrameChannelSize = 64;
+
+//------------------------------------------------------------------------------------------------//
+
+enum pipeline_stage_t
+{
+    STAGE_READ     = 0,
+    STAGE_PARSE    = 1,
+    STAGE_ENCODE   = 2,
+    STAGE_TRANSMIT = 3,
+    STAGES_NUMBER  = 4,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct pipeline_config_t
+{
+    //
+    // 0 - send note batches, otherwise sample keys with this rate and send key frames
+    //
+    uint32_t frame_rate = 0;
+
+    //
+    // 0 - send as fast as link accepts, otherwise in time with song, > 1 plays faster
+    //
+    double   speed      = 1.;
+
+    //
+    // Lookahead mode: frames are sent lookahead_us before they are due and stamped with device
+    // time, device queues them and plays on schedule (see MESSAGE_SCHEDULE). Used when clock
+    // is set and speed is not 0. Estimate of clock is taken for each frame, so it may be
+    // tracked during playback.
+    //
+    const clock_tracker_t *clock        = nullptr;
+    uint64_t               lookahead_us = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Assignment of keys to devices, each device gets only transitions of its own keys. Tempo goes
+// to all of them.
+//
+struct key_shards_t
+{
+    size_t  count                           = 1;
+    uint8_t shard[piano_proto::kKeysNumber] = {};
+
+    //
+    // count contiguous ranges of nearly equal size over keys first..last, keys below and above
+    // go to the first and the last shard
+    //
+    static key_shards_t ranges(size_t count, uint8_t first = 0, uint8_t last = 127);
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Connection to one device
+//
+struct pipeline_link_t
+{
+    int                    fd    = -1;
+
+    //
+    // Clock of this device in lookahead mode, see pipeline_config_t
+    //
+    const clock_tracker_t *clock = nullptr;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Streams MIDI file to device: read -> parse -> encode -> transmit, each stage in its own thread.
+// First frames are sent while the rest of file is still being read, memory use does not depend
+// on length of song. Sends the same frames as make_messages/make_key_frame_messages followed by
+// serial_sender_t::play.
+//
+// Song may be split over several devices by key (see key_shards_t): frames of each device are
+// encoded separately and sent by its own transmit thread, all devices are paced from the same
+// start time, in lookahead mode each one is stamped with its own clock.
+//
+class midi_pipeline_t
+{
+  public:
+    //
+    // One device, config.clock is its clock
+    //
+    midi_pipeline_t(int fd, const pipeline_config_t &config);
+
+    //
+    // Device per shard, links.size() must be equal to shards.count. config.clock is not used.
+    //
+    midi_pipeline_t(const std::vector<pipeline_link_t> &links,
+                    const key_shards_t                 &shards,
+                    const pipeline_config_t            &config);
+
+    piano::status_t run(const char *path);
+
+    //
+    // Transmit stage is sum over links, see link_stats
+    //
+    const stage_stats_t   &stats(pipeline_stage_t stage) const { return stats_[stage]; }
+
+    size_t                 links()                       const { return links_.size(); }
+    const stage_stats_t   &link_stats(size_t link)       const { return links_[link]->stats;  }
+    const serial_sender_t &sender(size_t link = 0)       const { return links_[link]->sender; }
+
+    //
+    // Delay of frames after their time in song, in microseconds. Not collected if speed is 0.
+    //
+    const sample_stats_t  &lateness(size_t link = 0) const { return links_[link]->lateness; }
+
+    void print_stats(std::ostream &out) const;
+
+  private:
+    struct block_t
+    {
+        uint32_t size = 0;
+        uint8_t  data[kReadBlockSize];
+    };
+
+    struct frame_t
+    {
+        uint64_t time_us = 0;
+        uint32_t size    = 0;
+        uint8_t  data[piano_proto::kMaxFrameSize];
+    };
+
+    using block_channel_t = channel_t<block_t, kTrackChannelSize>;
+    using event_channel_t = channel_t<piano_midi::timed_event_t, kEventChannelSize>;
+    using frame_channel_t = channel_t<frame_t, kFrameChannelSize>;
+
+    //
+    // Encoded frames and transmission of one device
+    //
+    struct link_state_t
+    {
+        explicit link_state_t(const pipeline_link_t &link) : link(link), sender(link.fd) {}
+
+        pipeline_link_t                  link;
+        serial_sender_t                  sender;
+        std::unique_ptr<frame_channel_t> frames;
+        stage_stats_t                    stats;
+        sample_stats_t                   lateness;
+    };
+
+    //
+    // Track bytes which come from block channel
+    //
+    class block_stream_t : public piano_midi::byte_stream_t
+    {
+      public:
+        block_stream_t(block_channel_t *channel, stage_stats_t *stats)
+            : channel_(channel), stats_(stats) {}
+
+        size_t read(uint8_t *dst, size_t capacity) override;
+
+      private:
+        block_channel_t *channel_ = nullptr;
+        stage_stats_t   *stats_   = nullptr;
+        block_t          block_   = {};
+        size_t           pos_     = 0;
+    };
+
+    void            read_stage();
+    void            parse_stage();
+    void            encode_stage();
+    void            transmit_stage(link_state_t *link);
+
+    piano::status_t push_frame(link_state_t *link, const piano_proto::message_t &message);
+
+    //
+    // Remember the first error and stop all stages
+    //
+    void            fail(piano::status_t status);
+
+    pipeline_config_t                             config_;
+    key_shards_t                                  shards_;
+    std::vector<std::unique_ptr<link_state_t>>    links_;
+    piano_midi::file_source_t                     source_;
+    piano_midi::midi_layout_t                     layout_;
+    std::vector<std::unique_ptr<block_channel_t>> blocks_;
+    std::unique_ptr<event_channel_t>              events_;
+    std::atomic<piano::status_t>                  status_ = {piano::STATUS_SUCCESS};
+
+    //
+    // Host time at which song starts, see host_time_us
+    //
+    int64_t                                       start_us_ = 0;
+    stage_stats_t                                 stats_[STAGES_NUMBER];
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __MIDI_PIPELINE_HH__
+
+//================================================================================================//
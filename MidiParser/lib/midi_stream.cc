@@ -0,0 +1,586 @@
+//================================================================================================//
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "midi_stream.hh"
+
+//================================================================================================//
+
+namespace piano_midi
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+//
+// Header of any chunk: identifier and big endian length
+//
+static const size_t kChunkHeaderSize = 8;
+
+//
+// Values of MIDI file format used by streaming parser, see midi_parser.cc for description
+//
+static const uint8_t kStatusMeta        = 0xff;
+static const uint8_t kStatusSysEx       = 0xf0;
+static const uint8_t kStatusSysExEscape = 0xf7;
+static const uint8_t kMetaTempo         = 0x51;
+static const uint8_t kPianoProgramLast  = 7;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Find next chunk with identifier starting from offset, skipping all other chunks
+//
+static status_t find_chunk(byte_source_t &source,
+                           uint64_t      *offset,
+                           const char    *identifier,
+                           uint32_t      *length);
+
+//
+// Check if track has program change to piano before its end
+//
+static status_t has_piano_program(byte_source_t &source, const midi_track_t &track, bool *result);
+
+//================================================================================================//
+
+size_t
+memory_source_t::read_at(uint64_t offset,
+                         uint8_t *dst,
+                         size_t   size)
+{
+    if (offset >= size_)
+    {
+        return 0;
+    }
+    size = static_cast<size_t>(std::min<uint64_t>(size, size_ - offset));
+    std::memcpy(dst, data_ + offset, size);
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+source_stream_t::read(uint8_t *dst,
+                      size_t   capacity)
+{
+    size_t size = static_cast<size_t>(std::min<uint64_t>(capacity, end_ - offset_));
+    size = source_->read_at(offset_, dst, size);
+    offset_ += size;
+    return size;
+}
+
+//================================================================================================//
+
+static status_t
+find_chunk(byte_source_t &source,
+           uint64_t      *offset,
+           const char    *identifier,
+           uint32_t      *length)
+{
+    uint8_t header[kChunkHeaderSize] = {};
+    while (true)
+    {
+        if (source.read_at(*offset, header, sizeof(header)) != sizeof(header))
+        {
+            return STATUS_MIDI_TRUNCATED_ERROR;
+        }
+        *length = (static_cast<uint32_t>(header[4]) << 24) |
+                  (static_cast<uint32_t>(header[5]) << 16) |
+                  (static_cast<uint32_t>(header[6]) <<  8) |
+                  (static_cast<uint32_t>(header[7]));
+        *offset += sizeof(header);
+        if (std::memcmp(header, identifier, 4) == 0)
+        {
+            return STATUS_SUCCESS;
+        }
+        *offset += *length;
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static status_t
+has_piano_program(byte_source_t      &source,
+                  const midi_track_t &track,
+                  bool               *result)
+{
+    source_stream_t stream(&source, track.offset, track.length);
+    track_cursor_t  cursor;
+    cursor.attach(&stream, track.length, 0);
+
+    *result = false;
+    track_event_t event = {};
+    while (true)
+    {
+        status_t status = cursor.next(&event);
+        if (status == STATUS_MIDI_STREAM_END)
+        {
+            return STATUS_SUCCESS;
+        }
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        if (event.kind == TRACK_EVENT_PROGRAM && event.program <= kPianoProgramLast)
+        {
+            *result = true;
+            return STATUS_SUCCESS;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+read_midi_layout(byte_source_t &source,
+                 midi_layout_t *layout,
+                 size_t         max_tracks)
+{
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    status_t status = find_chunk(source, &offset, "MThd", &length);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    if (length != 6)
+    {
+        return STATUS_MIDI_HEADER_LENGTH_ERROR;
+    }
+
+    uint8_t header[6] = {};
+    if (source.read_at(offset, header, sizeof(header)) != sizeof(header))
+    {
+        return STATUS_MIDI_TRUNCATED_ERROR;
+    }
+    offset += sizeof(header);
+
+    layout->format   = static_cast<uint16_t>((header[0] << 8) | header[1]);
+    uint16_t ntracks = static_cast<uint16_t>((header[2] << 8) | header[3]);
+    layout->tickdiv  = static_cast<uint16_t>((header[4] << 8) | header[5]);
+    if (layout->format >= 3)
+    {
+        return STATUS_MIDI_HEADER_FORMAT_ERROR;
+    }
+    if (layout->format == 0 && ntracks != 1)
+    {
+        return STATUS_MIDI_HEADER_NTRACKS_ERROR;
+    }
+
+    layout->tracks.clear();
+    for (uint16_t track = 0; track != ntracks; ++track)
+    {
+        midi_track_t chunk = {};
+        status = find_chunk(source, &offset, "MTrk", &chunk.length);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        chunk.offset = offset;
+        offset      += chunk.length;
+        if (layout->tracks.size() == max_tracks)
+        {
+            return STATUS_MIDI_HEADER_NTRACKS_ERROR;
+        }
+
+        // Format 1 tracks after the first one with piano are not played
+        if (layout->format == 1)
+        {
+            bool has_piano = false;
+            status = has_piano_program(source, chunk, &has_piano);
+            if (status != STATUS_SUCCESS)
+            {
+                return status;
+            }
+            layout->tracks.push_back(chunk);
+            if (has_piano)
+            {
+                break;
+            }
+            continue;
+        }
+        layout->tracks.push_back(chunk);
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+void
+track_cursor_t::attach(byte_stream_t *stream,
+                       uint32_t       length,
+                       uint64_t       start_ticks)
+{
+    stream_         = stream;
+    left_           = length;
+    ticks_          = start_ticks;
+    running_status_ = 0;
+    window_pos_     = 0;
+    window_size_    = 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+track_cursor_t::refill()
+{
+    if (left_ == 0)
+    {
+        return false;
+    }
+    size_t size = stream_->read(window_, std::min<size_t>(sizeof(window_), left_));
+    if (size == 0)
+    {
+        return false;
+    }
+    window_pos_  = 0;
+    window_size_ = static_cast<uint16_t>(size);
+    left_       -= static_cast<uint32_t>(size);
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+track_cursor_t::read_byte(uint8_t *byte)
+{
+    if (window_pos_ == window_size_ && !refill())
+    {
+        return false;
+    }
+    *byte = window_[window_pos_++];
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+track_cursor_t::read_var_len(uint64_t *value)
+{
+    uint64_t result = 0;
+    uint8_t  byte   = 0;
+    do
+    {
+        if (!read_byte(&byte))
+        {
+            return false;
+        }
+        result = (result << 7) | (byte & 0x7f);
+    } while (byte & 0x80);
+    *value = result;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+track_cursor_t::skip(uint64_t size)
+{
+    while (size != 0)
+    {
+        if (window_pos_ == window_size_ && !refill())
+        {
+            return false;
+        }
+        uint64_t step = std::min<uint64_t>(size, window_size_ - window_pos_);
+        window_pos_ += static_cast<uint16_t>(step);
+        size        -= step;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+track_cursor_t::next(track_event_t *event)
+{
+    while (window_pos_ != window_size_ || left_ != 0)
+    {
+        uint64_t delta = 0;
+        uint8_t  byte  = 0;
+        if (!read_var_len(&delta) || !read_byte(&byte))
+        {
+            return STATUS_MIDI_TRUNCATED_ERROR;
+        }
+        ticks_ += delta;
+
+        // Running status: byte is already the first data byte of event
+        uint8_t status     = byte;
+        bool    has_first  = false;
+        if ((byte & 0x80) == 0)
+        {
+            status    = running_status_;
+            has_first = true;
+        } else
+        {
+            running_status_ = byte;
+        }
+
+        auto read_data = [&](uint8_t *value)
+        {
+            if (has_first)
+            {
+                has_first = false;
+                *value    = byte;
+                return true;
+            }
+            return read_byte(value);
+        };
+
+        if (status == kStatusMeta)
+        {
+            uint8_t  meta   = 0;
+            uint64_t length = 0;
+            if (!read_data(&meta) || !read_var_len(&length))
+            {
+                return STATUS_MIDI_TRUNCATED_ERROR;
+            }
+            if (meta == kMetaTempo && length >= 3)
+            {
+                uint8_t tempo[3] = {};
+                if (!read_byte(&tempo[0]) || !read_byte(&tempo[1]) || !read_byte(&tempo[2]) ||
+                    !skip(length - 3))
+                {
+                    return STATUS_MIDI_TRUNCATED_ERROR;
+                }
+                event->ticks = ticks_;
+                event->kind  = TRACK_EVENT_TEMPO;
+                event->tempo = (static_cast<uint32_t>(tempo[0]) << 16) |
+                               (static_cast<uint32_t>(tempo[1]) <<  8) |
+                               (static_cast<uint32_t>(tempo[2]));
+                return STATUS_SUCCESS;
+            }
+            if (!skip(length))
+            {
+                return STATUS_MIDI_TRUNCATED_ERROR;
+            }
+            continue;
+        }
+
+        if (status == kStatusSysEx || status == kStatusSysExEscape)
+        {
+            uint64_t length = 0;
+            if (has_first)
+            {
+                // Length was taken as running status data byte, same as parse_midi does
+                length = byte;
+            } else if (!read_var_len(&length))
+            {
+                return STATUS_MIDI_TRUNCATED_ERROR;
+            }
+            if (!skip(length))
+            {
+                return STATUS_MIDI_TRUNCATED_ERROR;
+            }
+            continue;
+        }
+
+        uint8_t kind    = status & 0xf0;
+        uint8_t channel = status & 0x0f;
+        uint8_t first   = 0;
+        uint8_t second  = 0;
+        switch (kind)
+        {
+            case 0x80:
+            case 0x90:
+            {
+                if (!read_data(&first) || !read_data(&second))
+                {
+                    return STATUS_MIDI_TRUNCATED_ERROR;
+                }
+                event->ticks    = ticks_;
+                event->kind     = (kind == 0x90 && second != 0) ? TRACK_EVENT_NOTE_ON
+                                                                : TRACK_EVENT_NOTE_OFF;
+                event->channel  = channel;
+                event->note     = first;
+                event->velocity = second;
+                return STATUS_SUCCESS;
+            }
+            case 0xc0:
+            {
+                if (!read_data(&first))
+                {
+                    return STATUS_MIDI_TRUNCATED_ERROR;
+                }
+                event->ticks   = ticks_;
+                event->kind    = TRACK_EVENT_PROGRAM;
+                event->channel = channel;
+                event->program = first;
+                return STATUS_SUCCESS;
+            }
+            case 0xa0:
+            case 0xb0:
+            case 0xe0:
+            {
+                if (!read_data(&first) || !read_data(&second))
+                {
+                    return STATUS_MIDI_TRUNCATED_ERROR;
+                }
+                continue;
+            }
+            case 0xd0:
+            {
+                if (!read_data(&first))
+                {
+                    return STATUS_MIDI_TRUNCATED_ERROR;
+                }
+                continue;
+            }
+            default:
+            {
+                return STATUS_MIDI_EVENT_ERROR;
+            }
+        }
+    }
+    return STATUS_MIDI_STREAM_END;
+}
+
+//================================================================================================//
+
+status_t
+midi_stream_t::open(const midi_layout_t  &layout,
+                    byte_stream_t *const *streams)
+{
+    tracks_     = std::vector<track_state_t>(layout.tracks.size());
+    streams_    = streams;
+    format_     = layout.format;
+    tickdiv_    = layout.tickdiv;
+    current_    = 0;
+    last_ticks_ = 0;
+    tempo_      = static_cast<double>(kDefaultTempo);
+    time_us_    = 0.;
+
+    for (size_t i = 0; i != tracks_.size(); ++i)
+    {
+        tracks_[i].length = layout.tracks[i].length;
+        // Format 2 tracks are played one after another, so they are started lazily
+        if (format_ == 2 && i != 0)
+        {
+            continue;
+        }
+        tracks_[i].cursor.attach(streams[i], tracks_[i].length, 0);
+        status_t status = advance(i);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+midi_stream_t::advance(size_t track)
+{
+    track_state_t &state = tracks_[track];
+    status_t status = state.cursor.next(&state.head);
+    state.has_head = (status == STATUS_SUCCESS);
+    return (status == STATUS_MIDI_STREAM_END) ? STATUS_SUCCESS : status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+midi_stream_t::next(timed_event_t *event)
+{
+    while (true)
+    {
+        // Track with the earliest head, ties are resolved in order of tracks
+        size_t track = tracks_.size();
+        if (format_ == 2)
+        {
+            while (current_ != tracks_.size() && !tracks_[current_].has_head)
+            {
+                if (++current_ == tracks_.size())
+                {
+                    break;
+                }
+                // Next track starts where the previous one ended
+                tracks_[current_].cursor.attach(streams_[current_],
+                                                tracks_[current_].length,
+                                                tracks_[current_ - 1].cursor.ticks());
+                status_t status = advance(current_);
+                if (status != STATUS_SUCCESS)
+                {
+                    return status;
+                }
+            }
+            track = current_;
+        } else
+        {
+            for (size_t i = 0; i != tracks_.size(); ++i)
+            {
+                if (tracks_[i].has_head &&
+                    (track == tracks_.size() || tracks_[i].head.ticks < tracks_[track].head.ticks))
+                {
+                    track = i;
+                }
+            }
+        }
+        if (track == tracks_.size())
+        {
+            return STATUS_MIDI_STREAM_END;
+        }
+
+        track_state_t &state = tracks_[track];
+        track_event_t  head  = state.head;
+        status_t       status = advance(track);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        if (head.kind == TRACK_EVENT_PROGRAM)
+        {
+            if (head.program <= kPianoProgramLast)
+            {
+                state.piano_chanel = std::min(head.channel, state.piano_chanel);
+                state.has_piano    = true;
+            }
+            continue;
+        }
+        if (head.kind != TRACK_EVENT_TEMPO &&
+            (!state.has_piano || head.channel != state.piano_chanel))
+        {
+            continue;
+        }
+
+        // Same computation as translate_time and resolve_timeline
+        double delta_time = static_cast<double>(head.ticks - last_ticks_) /
+                            static_cast<double>(tickdiv_);
+        last_ticks_ = head.ticks;
+        time_us_   += tempo_ * delta_time;
+
+        *event = timed_event_t();
+        event->time_us = static_cast<uint64_t>(time_us_);
+        if (head.kind == TRACK_EVENT_TEMPO)
+        {
+            event->event = EVENT_TEMPO_SET;
+            event->tempo = head.tempo;
+            tempo_       = static_cast<double>(head.tempo);
+        } else
+        {
+            event->event    = (head.kind == TRACK_EVENT_NOTE_ON) ? EVENT_NOTE_ON : EVENT_NOTE_OFF;
+            event->note     = head.note;
+            event->velocity = head.velocity;
+        }
+        return STATUS_SUCCESS;
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_midi
+
+//================================================================================================//
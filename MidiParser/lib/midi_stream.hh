@@ -0,0 +1,241 @@
+//================================================================================================//
+
+#ifndef __MIDI_STREAM_HH__
+#define __MIDI_STREAM_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+
+//================================================================================================//
+
+//
+// Streaming version of parse_midi. Tracks are decoded incrementally through small windows and
+// merged by time, so memory use depends on number of tracks, not on length of file. Produces
+// the same timeline as parse_midi followed by resolve_timeline, events with equal time may
+// come in different order.
+//
+namespace piano_midi
+{
+
+//================================================================================================//
+
+//
+// Size of window each track is decoded through
+//
+static const size_t kTrackWindowSize = 256;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Random access to MIDI file: file, memory or flash mapping
+//
+class byte_source_t
+{
+  public:
+    virtual ~byte_source_t() = default;
+
+    //
+    // Read size bytes at offset, returns number of bytes read (less at the end of source)
+    //
+    virtual size_t   read_at(uint64_t offset, uint8_t *dst, size_t size) = 0;
+    virtual uint64_t size() const = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Source over memory, used for mmap'ed files and flash partitions
+//
+class memory_source_t : public byte_source_t
+{
+  public:
+    memory_source_t(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+    size_t   read_at(uint64_t offset, uint8_t *dst, size_t size) override;
+    uint64_t size() const override { return size_; }
+
+  private:
+    const uint8_t *data_ = nullptr;
+    size_t         size_ = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Sequential bytes of one track
+//
+class byte_stream_t
+{
+  public:
+    virtual ~byte_stream_t() = default;
+
+    //
+    // Read up to capacity bytes, returns 0 only at the end of stream
+    //
+    virtual size_t read(uint8_t *dst, size_t capacity) = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Sequential reading of range of source
+//
+class source_stream_t : public byte_stream_t
+{
+  public:
+    source_stream_t() = default;
+    source_stream_t(byte_source_t *source, uint64_t offset, uint64_t length)
+        : source_(source), offset_(offset), end_(offset + length) {}
+
+    size_t read(uint8_t *dst, size_t capacity) override;
+
+  private:
+    byte_source_t *source_ = nullptr;
+    uint64_t       offset_ = 0;
+    uint64_t       end_    = 0;
+};
+
+//================================================================================================//
+
+struct midi_track_t
+{
+    uint64_t offset = 0;
+    uint32_t length = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Everything needed to start streaming, read from header and chunk headers
+//
+struct midi_layout_t
+{
+    uint16_t format  = 0;
+    uint16_t tickdiv = 0;
+
+    //
+    // Data of tracks which take part in playback. For format 1 these are tracks up to the
+    // first one with piano program, the rest is skipped by parse_midi too.
+    //
+    std::vector<midi_track_t> tracks = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Read header and locate track chunks. Files with more than max_tracks tracks to play are
+// rejected, so that memory of layout and stream is bounded on device.
+//
+piano::status_t read_midi_layout(byte_source_t &source,
+                                 midi_layout_t *layout,
+                                 size_t         max_tracks = SIZE_MAX);
+
+//================================================================================================//
+
+enum track_event_kind_t : uint8_t
+{
+    TRACK_EVENT_NOTE_ON  = 0x1,
+    TRACK_EVENT_NOTE_OFF = 0x2,
+    TRACK_EVENT_TEMPO    = 0x3,
+    TRACK_EVENT_PROGRAM  = 0x4,
+};
+
+struct track_event_t
+{
+    uint64_t           ticks    = 0;
+    track_event_kind_t kind     = TRACK_EVENT_NOTE_OFF;
+    uint8_t            channel  = 0;
+    uint8_t            note     = 0;
+    uint8_t            velocity = 0;
+    uint8_t            program  = 0;
+    uint32_t           tempo    = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Decoder of one track chunk, returns only events interesting for player
+//
+class track_cursor_t
+{
+  public:
+    void attach(byte_stream_t *stream, uint32_t length, uint64_t start_ticks);
+
+    //
+    // Returns STATUS_MIDI_STREAM_END after the last event of track
+    //
+    piano::status_t next(track_event_t *event);
+
+    uint64_t ticks() const { return ticks_; }
+
+  private:
+    bool     refill();
+    bool     read_byte(uint8_t *byte);
+    bool     read_var_len(uint64_t *value);
+    bool     skip(uint64_t size);
+
+    byte_stream_t *stream_         = nullptr;
+    uint32_t       left_           = 0;
+    uint64_t       ticks_          = 0;
+    uint8_t        running_status_ = 0;
+    uint16_t       window_pos_     = 0;
+    uint16_t       window_size_    = 0;
+    uint8_t        window_[kTrackWindowSize] = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Merges tracks by time and applies piano channel selection of parse_midi
+//
+class midi_stream_t
+{
+  public:
+    //
+    // streams[i] gives bytes of layout.tracks[i]
+    //
+    piano::status_t open(const midi_layout_t &layout, byte_stream_t *const *streams);
+
+    //
+    // Returns STATUS_MIDI_STREAM_END after the last event
+    //
+    piano::status_t next(timed_event_t *event);
+
+  private:
+    struct track_state_t
+    {
+        track_cursor_t cursor;
+        uint32_t       length       = 0;
+        track_event_t  head         = {};
+        bool           has_head     = false;
+        uint8_t        piano_chanel = 0xff;
+        bool           has_piano    = false;
+    };
+
+    piano::status_t advance(size_t track);
+
+    std::vector<track_state_t> tracks_     = {};
+    byte_stream_t *const      *streams_    = nullptr;
+    uint16_t                   format_     = 0;
+    uint16_t                   tickdiv_    = 0;
+    size_t                     current_    = 0;
+    uint64_t                   last_ticks_ = 0;
+    double                     tempo_      = 0.;
+    double                     time_us_    = 0.;
+};
+
+} // ! namespace piano_midi
+
+//================================================================================================//
+
+#endif // ! __MIDI_STREAM_HH__
+
+//================================================================================================//
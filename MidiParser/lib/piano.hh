@@ -5,6 +5,10 @@
 
 //================================================================================================//
 
+#include <cstdint>
+
+//================================================================================================//
+
 namespace piano
 {
 
@@ -17,6 +21,31 @@ enum status_t
     STATUS_MIDI_HEADER_FORMAT_ERROR  = 0x2,
     STATUS_MIDI_HEADER_NTRACKS_ERROR = 0x3,
     STATUS_MIDI_EVENT_ERROR          = 0x4,
+    STATUS_FILE_ERROR                = 0x5,
+    STATUS_MIDI_STREAM_END           = 0x6,
+    STATUS_MIDI_TRUNCATED_ERROR      = 0x7,
+
+    STATUS_PROTOCOL_PENDING          = 0x10,
+    STATUS_PROTOCOL_OVERFLOW         = 0x11,
+    STATUS_PROTOCOL_FRAMING_ERROR    = 0x12,
+    STATUS_PROTOCOL_CRC_ERROR        = 0x13,
+    STATUS_PROTOCOL_MESSAGE_ERROR    = 0x14,
+
+    STATUS_CODEC_FORMAT_ERROR        = 0x20,
+    STATUS_CODEC_DESYNC              = 0x21,
+
+    STATUS_SERIAL_OPEN_ERROR         = 0x30,
+    STATUS_SERIAL_CONFIG_ERROR       = 0x31,
+    STATUS_SERIAL_WRITE_ERROR        = 0x32,
+    STATUS_SERIAL_READ_ERROR         = 0x33,
+
+    STATUS_SYNC_TIMEOUT              = 0x40,
+
+    STATUS_UPLOAD_TIMEOUT            = 0x50,
+    STATUS_UPLOAD_REJECTED           = 0x51,
+    STATUS_SONG_FORMAT_ERROR         = 0x52,
+
+    STATUS_SOUNDFONT_FORMAT_ERROR    = 0x60,
 };
 
 //------------------------------------------------------------------------------------------------//
@@ -32,11 +61,12 @@ enum event_num_t
 
 struct event_t
 {
-    event_t (event_num_t event, uint8_t note, uint64_t current_ticks)
+    event_t (event_num_t event, uint8_t note, uint64_t current_ticks, uint8_t velocity = 0)
     {
         event_ = event;
         data_.note = note;
         time_.current_ticks = current_ticks;
+        velocity_ = velocity;
     }
 
     event_t (event_num_t event, uint32_t tempo, uint64_t current_ticks)
@@ -44,6 +74,7 @@ struct event_t
         event_ = EVENT_TEMPO_SET;
         data_.tempo = tempo;
         time_.current_ticks = current_ticks;
+        velocity_ = 0;
     }
 
     event_num_t  event_;
@@ -57,6 +88,7 @@ struct event_t
         uint64_t current_ticks;
         double   delta_time;
     } time_;
+    uint8_t      velocity_;
 };
 
 //================================================================================================//
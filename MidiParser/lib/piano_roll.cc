@@ -0,0 +1,429 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "synth.hh"
+#include "piano_roll.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+static const uint8_t  kFirstNote        = 21;
+static const uint8_t  kLastNote         = 108;
+static const uint32_t kWhiteKeys        = 52;
+static const bool     kBlackKey[12]     = {false, true, false, true, false, false,
+                                           true, false, true, false, true, false};
+
+//
+// Keyboard takes 1/kKeyboardShare of frame height, black keys are narrower and shorter than
+// white ones by these ratios
+//
+static const uint32_t kKeyboardShare    = 6;
+static const double   kBlackKeyWidth    = 0.6;
+static const double   kBlackKeyHeight   = 0.62;
+
+//------------------------------------------------------------------------------------------------//
+
+struct rgb_t
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+static const rgb_t kRollColour   = {22, 22, 28};
+static const rgb_t kLaneColour   = {16, 16, 20};    // lanes of black keys
+static const rgb_t kOctaveColour = {46, 46, 56};    // left edge of each C lane
+static const rgb_t kWhiteColour  = {236, 236, 232};
+static const rgb_t kBlackColour  = {24, 24, 24};
+static const rgb_t kGapColour    = {84, 84, 84};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Colour of each velocity as on LED strip, without gamma of LEDs since video is already gamma
+// encoded. Notes of black keys are darker to tell them from neighbouring white ones.
+//
+struct roll_palette_t
+{
+    constexpr roll_palette_t() : white(), black()
+    {
+        for (uint32_t velocity = 1; velocity != 128; ++velocity)
+        {
+            double t     = 2. * (velocity - 1) / 126.;
+            double red   = (t > 1.) ? t - 1. : 0.;
+            double green = (t > 1.) ? 2. - t : t;
+            double blue  = (t < 1.) ? 1. - t : 0.;
+            white[velocity] = {static_cast<uint8_t>(40. + red   * 215. + 0.5),
+                               static_cast<uint8_t>(40. + green * 215. + 0.5),
+                               static_cast<uint8_t>(40. + blue  * 215. + 0.5)};
+            black[velocity] = {static_cast<uint8_t>(white[velocity].r * 0.7),
+                               static_cast<uint8_t>(white[velocity].g * 0.7),
+                               static_cast<uint8_t>(white[velocity].b * 0.7)};
+        }
+    }
+
+    rgb_t white[128];
+    rgb_t black[128];
+};
+
+static constexpr roll_palette_t kPalette = roll_palette_t();
+
+//------------------------------------------------------------------------------------------------//
+
+static inline void
+put_pixel(uint8_t *pixel,
+          rgb_t    colour)
+{
+    pixel[0] = colour.r;
+    pixel[1] = colour.g;
+    pixel[2] = colour.b;
+}
+
+//================================================================================================//
+
+roll_renderer_t::roll_renderer_t(const std::vector<piano_midi::timed_event_t> &timeline,
+                                 const roll_config_t                          &config)
+    : width_(std::max<uint32_t>(config.width & ~1u, 2)),
+      height_(std::max<uint32_t>(config.height & ~1u, 2)),
+      fps_(std::max<uint32_t>(config.fps, 1)),
+      window_us_(std::max<int64_t>(static_cast<int64_t>(config.window_s * 1e6), 1)),
+      keyboard_top_(height_ - std::max<uint32_t>(height_ / kKeyboardShare, 1)),
+      frames_(1)
+{
+    // Times of spans in microseconds
+    std::vector<piano_audio::note_span_t> spans = {};
+    piano_audio::make_note_spans(timeline, 1000000, spans);
+    int64_t last_us = 0;
+    for (const piano_audio::note_span_t &span : spans)
+    {
+        bars_.push_back({span.on, span.off, span.note, span.velocity});
+        longest_us_ = std::max(longest_us_, span.off - span.on);
+        last_us     = std::max(last_us, span.off);
+    }
+    frames_ = static_cast<size_t>((last_us * fps_ + 999999) / 1000000) + 1;
+
+    // White keys split width evenly, black keys sit on the edge between two white ones
+    uint32_t white = 0;
+    for (uint32_t note = kFirstNote; note <= kLastNote; ++note)
+    {
+        if (!kBlackKey[note % 12])
+        {
+            key_x0_[note] = white * width_ / kWhiteKeys;
+            key_x1_[note] = (white + 1) * width_ / kWhiteKeys;
+            ++white;
+            continue;
+        }
+        double edge = static_cast<double>(white) * width_ / kWhiteKeys;
+        double half = kBlackKeyWidth * width_ / kWhiteKeys / 2.;
+        key_x0_[note] = static_cast<uint32_t>(std::max(edge - half, 0.) + 0.5);
+        key_x1_[note] = static_cast<uint32_t>(edge + half + 0.5);
+    }
+
+    roll_row_.resize(static_cast<size_t>(width_) * 3);
+    for (uint32_t x = 0; x != width_; ++x)
+    {
+        put_pixel(&roll_row_[x * 3], kRollColour);
+    }
+    for (uint32_t note = kFirstNote; note <= kLastNote; ++note)
+    {
+        for (uint32_t x = key_x0_[note]; kBlackKey[note % 12] && x < key_x1_[note]; ++x)
+        {
+            put_pixel(&roll_row_[x * 3], kLaneColour);
+        }
+        if (note % 12 == 0)
+        {
+            put_pixel(&roll_row_[key_x0_[note] * 3], kOctaveColour);
+        }
+    }
+
+    // Keyboard at rest, black keys drawn over white ones
+    uint32_t rows        = height_ - keyboard_top_;
+    uint32_t black_rows  = static_cast<uint32_t>(rows * kBlackKeyHeight);
+    keyboard_.resize(static_cast<size_t>(width_) * rows * 3);
+    keyboard_keys_.assign(static_cast<size_t>(width_) * rows, 0);
+    for (bool black_pass : {false, true})
+    {
+        for (uint32_t note = kFirstNote; note <= kLastNote; ++note)
+        {
+            if (kBlackKey[note % 12] != black_pass || key_x1_[note] <= key_x0_[note])
+            {
+                continue;
+            }
+            // Right column of white key is gap to the next one
+            uint32_t x1 = black_pass ? key_x1_[note] : key_x1_[note] - 1;
+            for (uint32_t y = 0; y != (black_pass ? black_rows : rows); ++y)
+            {
+                for (uint32_t x = key_x0_[note]; x != x1; ++x)
+                {
+                    put_pixel(&keyboard_[(y * width_ + x) * 3],
+                              black_pass ? kBlackColour : kWhiteColour);
+                    keyboard_keys_[y * width_ + x] = static_cast<uint8_t>(note);
+                }
+                if (!black_pass)
+                {
+                    put_pixel(&keyboard_[(y * width_ + x1) * 3], kGapColour);
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+roll_renderer_t::render(size_t   frame,
+                        uint8_t *rgb) const
+{
+    int64_t now    = static_cast<int64_t>(frame) * 1000000 / fps_;
+    size_t  stride = static_cast<size_t>(width_) * 3;
+    for (uint32_t y = 0; y != keyboard_top_; ++y)
+    {
+        std::memcpy(rgb + y * stride, roll_row_.data(), stride);
+    }
+    std::memcpy(rgb + keyboard_top_ * stride, keyboard_.data(), keyboard_.size());
+
+    // Bars between now and window ahead, the first that may still sound found by press time.
+    // Notes of black keys are drawn after the others, over them.
+    uint8_t held[128] = {};
+    auto    first     = std::lower_bound(bars_.begin(), bars_.end(), now - longest_us_,
+                                         [](const bar_t &bar, int64_t on_us)
+                                         {
+                                             return bar.on_us < on_us;
+                                         });
+    for (bool black_pass : {false, true})
+    {
+        for (auto bar = first; bar != bars_.end() && bar->on_us < now + window_us_; ++bar)
+        {
+            if (bar->off_us <= now || kBlackKey[bar->note % 12] != black_pass ||
+                key_x1_[bar->note] <= key_x0_[bar->note])
+            {
+                continue;
+            }
+            if (bar->on_us <= now)
+            {
+                held[bar->note] = bar->velocity;
+            }
+
+            // Row of time t is keyboard_top_ - (t - now) / window_us_ * keyboard_top_, with gap
+            // at the bottom of notes still falling
+            int64_t top    = keyboard_top_ - (bar->off_us - now) * keyboard_top_ / window_us_;
+            int64_t bottom = keyboard_top_ - (bar->on_us  - now) * keyboard_top_ / window_us_;
+            top    = std::max<int64_t>(top, 0);
+            bottom = std::min<int64_t>(bottom, keyboard_top_) - ((bar->on_us > now) ? 1 : 0);
+            if (top >= bottom)
+            {
+                continue;
+            }
+
+            uint32_t x0     = key_x0_[bar->note];
+            uint32_t x1     = key_x1_[bar->note];
+            rgb_t    colour = black_pass ? kPalette.black[bar->velocity & 0x7f]
+                                         : kPalette.white[bar->velocity & 0x7f];
+            if (x1 - x0 > 2)
+            {
+                ++x0;
+                --x1;
+            }
+            uint8_t *row = rgb + static_cast<size_t>(top) * stride + x0 * 3;
+            for (uint32_t x = x0; x != x1; ++x)
+            {
+                put_pixel(row + (x - x0) * 3, colour);
+            }
+            for (int64_t y = top + 1; y < bottom; ++y)
+            {
+                std::memcpy(row + (y - top) * stride, row, (x1 - x0) * 3);
+            }
+        }
+    }
+
+    // Held keys take colour of their velocity
+    uint32_t rows = height_ - keyboard_top_;
+    for (uint32_t note = kFirstNote; note <= kLastNote; ++note)
+    {
+        for (uint32_t y = 0; held[note] != 0 && y != rows; ++y)
+        {
+            const uint8_t *keys = &keyboard_keys_[y * width_];
+            uint8_t       *row  = rgb + (keyboard_top_ + y) * stride;
+            for (uint32_t x = key_x0_[note]; x != key_x1_[note]; ++x)
+            {
+                if (keys[x] == note)
+                {
+                    put_pixel(row + x * 3, kPalette.white[held[note] & 0x7f]);
+                }
+            }
+        }
+    }
+}
+
+//================================================================================================//
+
+void
+rgb_to_yuv420(const uint8_t *rgb,
+              uint32_t       width,
+              uint32_t       height,
+              uint8_t       *yuv)
+{
+    // BT.601 in 16-bit fixed point, chroma of 2x2 pixels from sum of their components
+    size_t   stride = static_cast<size_t>(width) * 3;
+    uint8_t *luma   = yuv;
+    uint8_t *cb     = yuv + static_cast<size_t>(width) * height;
+    uint8_t *cr     = cb + static_cast<size_t>(width / 2) * (height / 2);
+    auto     chroma = [](int32_t value)
+    {
+        return static_cast<uint8_t>(std::min(std::max(((value + (1 << 17)) >> 18) + 128, 0), 255));
+    };
+
+    for (uint32_t y = 0; y + 1 < height; y += 2)
+    {
+        const uint8_t *top    = rgb + y * stride;
+        const uint8_t *bottom = top + stride;
+        uint8_t       *luma0  = luma + static_cast<size_t>(y) * width;
+        uint8_t       *luma1  = luma0 + width;
+        uint8_t       *u      = cb + static_cast<size_t>(y / 2) * (width / 2);
+        uint8_t       *v      = cr + static_cast<size_t>(y / 2) * (width / 2);
+
+        // Most of piano roll repeats row pair above it: background and bars are vertical runs
+        if (y != 0 && std::memcmp(top, top - 2 * stride, 2 * stride) == 0)
+        {
+            std::memcpy(luma0, luma0 - 2 * width, 2 * width);
+            std::memcpy(u, u - width / 2, width / 2);
+            std::memcpy(v, v - width / 2, width / 2);
+            continue;
+        }
+
+        for (uint32_t x = 0; x + 1 < width; x += 2)
+        {
+            int32_t r = 0;
+            int32_t g = 0;
+            int32_t b = 0;
+            for (uint32_t i = 0; i != 4; ++i)
+            {
+                const uint8_t *pixel = ((i < 2) ? top : bottom) + (x + (i & 1)) * 3;
+                uint8_t       *out   = ((i < 2) ? luma0 : luma1) + x + (i & 1);
+                *out = static_cast<uint8_t>((19595 * pixel[0] + 38470 * pixel[1] +
+                                             7471 * pixel[2] + 32768) >> 16);
+                r += pixel[0];
+                g += pixel[1];
+                b += pixel[2];
+            }
+            u[x / 2] = chroma(-11059 * r - 21709 * g + 32768 * b);
+            v[x / 2] = chroma(32768 * r - 27439 * g - 5329 * b);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+export_roll(const std::vector<piano_midi::timed_event_t> &timeline,
+            const roll_config_t                          &config,
+            const char                                   *path,
+            stage_stats_t                                *render_stats,
+            stage_stats_t                                *write_stats)
+{
+    render_stats->name = "render";
+    write_stats->name  = "write";
+
+    roll_renderer_t renderer(timeline, config);
+    bool            y4m    = config.format == VIDEO_Y4M;
+    size_t          pixels = static_cast<size_t>(renderer.width()) * renderer.height();
+    size_t          bytes  = y4m ? pixels * 3 / 2 : pixels * 3;
+    size_t          frames = renderer.frames();
+
+    // Y4M stream is one file with its own header, PPM frames are files with a header each
+    int    fd     = -1;
+    char   header[64];
+    size_t header_length = 0;
+    if (y4m)
+    {
+        fd = (std::strcmp(path, "-") == 0) ? STDOUT_FILENO
+                                           : ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int          length = std::snprintf(header, sizeof(header),
+                                            "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg "
+                                            "XCOLORRANGE=FULL\n",
+                                            renderer.width(), renderer.height(), config.fps);
+        struct iovec iov    = {header, static_cast<size_t>(length)};
+        if (fd < 0 || !write_all(fd, &iov, 1))
+        {
+            if (fd > STDOUT_FILENO)
+            {
+                ::close(fd);
+            }
+            return STATUS_FILE_ERROR;
+        }
+        std::strcpy(header, "FRAME\n");
+    } else
+    {
+        std::snprintf(header, sizeof(header), "P6\n%u %u\n255\n", renderer.width(),
+                      renderer.height());
+    }
+    header_length = std::strlen(header);
+
+    // Y4M frames are rendered as RGB first, into buffer of each thread
+    size_t                            threads = worker_threads(config.threads, frames);
+    std::vector<std::vector<uint8_t>> rgb(threads, std::vector<uint8_t>(y4m ? pixels * 3 : 0));
+    auto render = [&](size_t lane, size_t frame, std::vector<uint8_t> &buffer)
+    {
+        if (y4m)
+        {
+            renderer.render(frame, rgb[lane].data());
+            rgb_to_yuv420(rgb[lane].data(), renderer.width(), renderer.height(), buffer.data());
+        } else
+        {
+            renderer.render(frame, buffer.data());
+        }
+        render_stats->bytes += bytes;
+    };
+    auto write = [&](size_t frame, std::vector<uint8_t> &buffer)
+    {
+        struct iovec iov[2] = {{header, header_length}, {buffer.data(), bytes}};
+        bool         written = false;
+        if (y4m)
+        {
+            written = write_all(fd, iov, 2);
+        } else
+        {
+            std::string name = std::string(path) + std::to_string(1000000 + frame).substr(1) +
+                               ".ppm";
+            int         file = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            written = file >= 0 && write_all(file, iov, 2);
+            written = (file >= 0 && ::close(file) == 0) && written;
+        }
+        write_stats->bytes += written ? header_length + bytes : 0;
+        return written;
+    };
+
+    // Frames are written straight from buffers of render threads
+    status_t status = run_ordered(frames, threads, std::vector<uint8_t>(bytes), render, write,
+                                  render_stats, write_stats) ? STATUS_SUCCESS : STATUS_FILE_ERROR;
+    if (fd > STDOUT_FILENO && ::close(fd) != 0)
+    {
+        status = STATUS_FILE_ERROR;
+    }
+    return status;
+}
+
+} // ! namespace piano_host
+
+//================================================================================================//
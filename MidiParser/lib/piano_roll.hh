@@ -0,0 +1,154 @@
+//================================================================================================//
+
+#ifndef __PIANO_ROLL_HH__
+#define __PIANO_ROLL_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "pipeline.hh"
+
+//================================================================================================//
+
+//
+// Preview videos of songs: piano roll where notes fall onto 88-key keyboard at the bottom of
+// frame, reaching it when they are pressed. Keys light up while held, notes and keys take the
+// colour of velocity as LEDs of device do.
+//
+// Frame depends only on its time, so frames are rendered by several threads at once, each into
+// its own buffers. Writer takes them in order and writes each straight from buffer of render
+// thread, then hands buffer back.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+enum video_format_t
+{
+    //
+    // YUV4MPEG2 stream of 4:2:0 frames in full range, read by ffmpeg and most players
+    //
+    VIDEO_Y4M,
+
+    //
+    // Binary PPM file per frame, path is prefix of numbered files
+    //
+    VIDEO_PPM,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct roll_config_t
+{
+    //
+    // Size of frame, rounded down to even for chroma of Y4M
+    //
+    uint32_t       width    = 1920;
+    uint32_t       height   = 1080;
+    uint32_t       fps      = 60;
+
+    //
+    // Time of note falling from the top of frame to keyboard
+    //
+    double         window_s = 3.;
+
+    //
+    // Threads rendering frames, 0 - one per core
+    //
+    size_t         threads  = 0;
+    video_format_t format   = VIDEO_Y4M;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Frames of one song. Rendering does not change renderer, so any thread may render any frame.
+//
+class roll_renderer_t
+{
+  public:
+    roll_renderer_t(const std::vector<piano_midi::timed_event_t> &timeline,
+                    const roll_config_t                          &config);
+
+    //
+    // Frames until the last key is released
+    //
+    size_t frames() const { return frames_; }
+
+    uint32_t width() const  { return width_; }
+    uint32_t height() const { return height_; }
+
+    //
+    // RGB bytes of frame, width * height * 3
+    //
+    void render(size_t frame, uint8_t *rgb) const;
+
+    //
+    // Columns [x0, x1) of key and rows where keyboard starts, for tests
+    //
+    uint32_t key_x0(uint8_t note) const   { return key_x0_[note]; }
+    uint32_t key_x1(uint8_t note) const   { return key_x1_[note]; }
+    uint32_t keyboard_top() const         { return keyboard_top_; }
+
+  private:
+    struct bar_t
+    {
+        int64_t on_us;
+        int64_t off_us;
+        uint8_t note;
+        uint8_t velocity;
+    };
+
+    uint32_t             width_;
+    uint32_t             height_;
+    uint32_t             fps_;
+    int64_t              window_us_;
+    uint32_t             keyboard_top_;
+    size_t               frames_;
+    std::vector<bar_t>   bars_;
+    int64_t              longest_us_ = 0;
+    uint32_t             key_x0_[128] = {};
+    uint32_t             key_x1_[128] = {};
+
+    //
+    // Background of one row of roll, and keyboard at rest with key owning each of its pixels
+    //
+    std::vector<uint8_t> roll_row_;
+    std::vector<uint8_t> keyboard_;
+    std::vector<uint8_t> keyboard_keys_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// 4:2:0 planes of RGB frame, BT.601 full range: width * height luma bytes, then a quarter of
+// that of each chroma plane
+//
+void rgb_to_yuv420(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *yuv);
+
+//
+// Render frames of song on config.threads and write them to path: Y4M stream ("-" is stdout)
+// or PPM files <path>000000.ppm... Stats of render threads add up in render_stats. Returns
+// STATUS_FILE_ERROR if output can't be written.
+//
+piano::status_t export_roll(const std::vector<piano_midi::timed_event_t> &timeline,
+                            const roll_config_t                          &config,
+                            const char                                   *path,
+                            stage_stats_t                                *render_stats,
+                            stage_stats_t                                *write_stats);
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __PIANO_ROLL_HH__
+
+//================================================================================================//
@@ -0,0 +1,134 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "pipeline.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Number of attempts of each kind before switching to the next one
+//
+static const unsigned kSpinAttempts  = 64;
+static const unsigned kYieldAttempts = 128;
+
+//
+// Sleep between attempts after yielding did not help
+//
+static const auto     kBackoffSleep  = std::chrono::microseconds(50);
+
+//================================================================================================//
+
+void
+backoff(unsigned *attempt)
+{
+    if (*attempt < kSpinAttempts)
+    {
+        ++*attempt;
+        return;
+    }
+    if (*attempt < kSpinAttempts + kYieldAttempts)
+    {
+        ++*attempt;
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(kBackoffSleep);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+write_all(int           fd,
+          struct iovec *iov,
+          int           count)
+{
+    while (count != 0)
+    {
+        // writev of nothing but empty entries writes nothing and returns 0
+        if (iov->iov_len == 0)
+        {
+            ++iov;
+            --count;
+            continue;
+        }
+        ssize_t written = ::writev(fd, iov, count);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        size_t left = static_cast<size_t>(written);
+        while (count != 0 && left >= iov->iov_len)
+        {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count != 0)
+        {
+            iov->iov_base  = static_cast<uint8_t *>(iov->iov_base) + left;
+            iov->iov_len  -= left;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+worker_threads(size_t requested,
+               size_t count)
+{
+    size_t threads = (requested != 0) ? requested
+                   : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    return std::max<size_t>(std::min(threads, count), 1);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+print_stage_stats(std::ostream        &out,
+                  const stage_stats_t &stats)
+{
+    double wall_ms   = static_cast<double>(stats.wall_ns)         / 1e6;
+    double input_ms  = static_cast<double>(stats.input_stall_ns)  / 1e6;
+    double output_ms = static_cast<double>(stats.output_stall_ns) / 1e6;
+    double busy_ms   = std::max(wall_ms - input_ms - output_ms, 0.);
+    double items     = static_cast<double>(stats.items);
+
+    out << std::fixed << std::setprecision(1)
+        << std::left << std::setw(9) << stats.name << std::right
+        << " items "  << std::setw(9)  << stats.items
+        << " bytes "  << std::setw(10) << stats.bytes
+        << " busy "   << std::setw(8)  << busy_ms   << " ms"
+        << " ("       << std::setw(12) << (busy_ms > 0. ? 1e3 * items / busy_ms : 0.) << " items/s)"
+        << " input stall "  << std::setw(8) << input_ms  << " ms"
+        << " output stall " << std::setw(8) << output_ms << " ms\n";
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
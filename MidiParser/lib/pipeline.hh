@@ -0,0 +1,276 @@
+//================================================================================================//
+
+#ifndef __PIPELINE_HH__
+#define __PIPELINE_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <sys/uio.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "spsc_queue.hh"
+
+//================================================================================================//
+
+//
+// Building blocks of staged pipelines: each stage runs in its own thread and is connected to
+// the next one by bounded lock-free channel. Full channel stops producer (backpressure), so
+// memory use of pipeline does not depend on amount of data passing through it.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Counters of one stage. Updated by stage thread, may be read by any thread.
+//
+struct stage_stats_t
+{
+    const char           *name            = "";
+    std::atomic<uint64_t> items           = {0};
+    std::atomic<uint64_t> bytes           = {0};
+    std::atomic<uint64_t> wall_ns         = {0};
+
+    //
+    // Time spent waiting for input and waiting for space in output channel
+    //
+    std::atomic<uint64_t> input_stall_ns  = {0};
+    std::atomic<uint64_t> output_stall_ns = {0};
+};
+
+//
+// One line per stage: items, rate over busy time, stalls
+//
+void print_stage_stats(std::ostream &out, const stage_stats_t &stats);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Waiting strategy for empty or full channel: spin first, then yield, then sleep
+//
+void backoff(unsigned *attempt);
+
+//
+// Write all of iov to fd with writev, resuming after short writes and signals. Entries of iov
+// are used up. Returns false if fd can't be written.
+//
+bool write_all(int fd, struct iovec *iov, int count);
+
+//
+// Threads to make count items with: requested number, one per core if it is 0, at most one per
+// item and at least one
+//
+size_t worker_threads(size_t requested, size_t count);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Channel between two stages. Producer closes it when it is done, any side cancels it on error.
+//
+template <typename T, size_t CAPACITY>
+class channel_t
+{
+  public:
+    //
+    // Wait until there is space for item, returns false if channel was cancelled
+    //
+    bool push(const T &item, stage_stats_t *stats)
+    {
+        if (queue_.try_push(item))
+        {
+            return true;
+        }
+
+        auto     start   = std::chrono::steady_clock::now();
+        unsigned attempt = 0;
+        bool     pushed  = false;
+        while (!cancelled_.load(std::memory_order_relaxed) && !(pushed = queue_.try_push(item)))
+        {
+            backoff(&attempt);
+        }
+        stats->output_stall_ns += elapsed_ns(start);
+        return pushed;
+    }
+
+    //
+    // Wait for item, returns false when channel is closed and empty or cancelled
+    //
+    bool pop(T *item, stage_stats_t *stats)
+    {
+        if (queue_.try_pop(item))
+        {
+            return true;
+        }
+
+        auto     start   = std::chrono::steady_clock::now();
+        unsigned attempt = 0;
+        bool     popped  = false;
+        while (!cancelled_.load(std::memory_order_relaxed))
+        {
+            // Closing happens after the last push, so queue is checked once more after it
+            bool closed = closed_.load(std::memory_order_acquire);
+            if ((popped = queue_.try_pop(item)) || closed)
+            {
+                break;
+            }
+            backoff(&attempt);
+        }
+        stats->input_stall_ns += elapsed_ns(start);
+        return popped;
+    }
+
+    bool   try_pop(T *item) { return queue_.try_pop(item); }
+
+    //
+    // Exact for producer: push will not wait if size() is less than capacity()
+    //
+    size_t size() const { return queue_.size(); }
+
+    static constexpr size_t capacity() { return CAPACITY; }
+
+    void close()  { closed_.store(true, std::memory_order_release);    }
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  private:
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start).count());
+    }
+
+    piano::spsc_queue_t<T, CAPACITY> queue_;
+    std::atomic<bool>                closed_    = {false};
+    std::atomic<bool>                cancelled_ = {false};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Buffers each maker thread of run_ordered fills ahead of writer
+//
+static const size_t kOrderedBuffers = 3;
+
+//
+// Items 0..count are made by threads in parallel and written by calling thread in order of
+// index, straight from buffers of the thread which made them. Thread i makes items i,
+// i + threads..., so writer knows which lane has the next one. Each thread has kOrderedBuffers
+// copies of prototype: empty ones go back to it through free channel, made ones to writer
+// through done.
+//
+//     make(lane, index, buffer)    fill buffer with item, lane is the number of thread
+//     write(index, buffer)         returns false on error, then threads are stopped
+//
+// Items and wall time of both stages are counted here, bytes by make and write. Returns false
+// if write failed.
+//
+template <typename BUFFER, typename MAKE, typename WRITE>
+bool
+run_ordered(size_t         count,
+            size_t         threads,
+            const BUFFER  &prototype,
+            const MAKE    &make,
+            const WRITE   &write,
+            stage_stats_t *make_stats,
+            stage_stats_t *write_stats)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    struct lane_t
+    {
+        channel_t<BUFFER *, 4> free    = {};
+        channel_t<BUFFER *, 4> done    = {};
+        std::vector<BUFFER>    buffers = {};
+    };
+    static_assert(kOrderedBuffers <= channel_t<BUFFER *, 4>::capacity(),
+                  "free channel holds all buffers of lane");
+
+    std::vector<lane_t> lanes(threads);
+    for (lane_t &lane : lanes)
+    {
+        lane.buffers.assign(kOrderedBuffers, prototype);
+        for (BUFFER &buffer : lane.buffers)
+        {
+            lane.free.push(&buffer, make_stats);
+        }
+    }
+
+    auto worker = [&](size_t lane_index)
+    {
+        lane_t &lane  = lanes[lane_index];
+        auto    start = clock_t::now();
+        for (size_t index = lane_index; index < count; index += threads)
+        {
+            BUFFER *buffer = nullptr;
+            if (!lane.free.pop(&buffer, make_stats))
+            {
+                break;
+            }
+            make(lane_index, index, *buffer);
+            make_stats->items += 1;
+            if (!lane.done.push(buffer, make_stats))
+            {
+                break;
+            }
+        }
+        lane.done.close();
+        make_stats->wall_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start).count());
+    };
+    std::vector<std::thread> pool = {};
+    for (size_t i = 0; i != threads; ++i)
+    {
+        pool.emplace_back(worker, i);
+    }
+
+    bool written = true;
+    auto start   = clock_t::now();
+    for (size_t index = 0; index != count; ++index)
+    {
+        lane_t &lane   = lanes[index % threads];
+        BUFFER *buffer = nullptr;
+        if (!lane.done.pop(&buffer, write_stats) || !write(index, *buffer))
+        {
+            written = false;
+            break;
+        }
+        write_stats->items += 1;
+        lane.free.push(buffer, write_stats);
+    }
+    write_stats->wall_ns += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start).count());
+
+    // After error writer returns no more buffers, threads waiting for them stop on cancel
+    for (lane_t &lane : lanes)
+    {
+        if (!written)
+        {
+            lane.free.cancel();
+            lane.done.cancel();
+        }
+    }
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+    return written;
+}
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __PIPELINE_HH__
+
+//================================================================================================//
@@ -0,0 +1,977 @@
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "key_codec.hh"
+#include "protocol.hh"
+
+//================================================================================================//
+
+namespace piano_proto
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+//
+// Table for CRC-16/CCITT-FALSE (polynomial 0x1021), generated at compile time
+//
+struct crc16_table_t
+{
+    constexpr crc16_table_t() : values()
+    {
+        for (uint32_t i = 0; i != 256; ++i)
+        {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int bit = 0; bit != 8; ++bit)
+            {
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                                     : static_cast<uint16_t>(crc << 1);
+            }
+            values[i] = crc;
+        }
+    }
+
+    uint16_t values[256];
+};
+
+static constexpr crc16_table_t kCrc16Table = crc16_table_t();
+
+//
+// Table for CRC-32 (reflected polynomial 0xedb88320)
+//
+struct crc32_table_t
+{
+    constexpr crc32_table_t() : values()
+    {
+        for (uint32_t i = 0; i != 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit != 8; ++bit)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+            }
+            values[i] = crc;
+        }
+    }
+
+    uint32_t values[256];
+};
+
+static constexpr crc32_table_t kCrc32Table = crc32_table_t();
+
+//
+// Counters of MESSAGE_TELEMETRY_REPORT in order of payload
+//
+static uint32_t telemetry_t::*const kTelemetryCounters[] =
+{
+    &telemetry_t::messages,       &telemetry_t::frame_errors,   &telemetry_t::uart_overruns,
+    &telemetry_t::rx_queue_high,  &telemetry_t::schedule_high,  &telemetry_t::late_count,
+    &telemetry_t::late_sum_us,    &telemetry_t::late_max_us,    &telemetry_t::frames_shown,
+    &telemetry_t::frames_dropped, &telemetry_t::strip_busy_us,  &telemetry_t::strip_max_us,
+    &telemetry_t::parser_busy_us, &telemetry_t::parser_max_us,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Write payload of message after type byte, returns payload size
+//
+static status_t write_payload(const message_t &message, uint8_t *payload, size_t *size);
+
+//
+// Little endian u32 of upload messages
+//
+static size_t   write_u32(uint32_t value, uint8_t *dst);
+static bool     read_u32(const uint8_t *&pos, const uint8_t *end, uint32_t *value);
+
+//
+// Raw frame: type | payload | crc16, raw must hold kMaxRawFrameSize bytes
+//
+static status_t write_raw(const message_t &message, uint8_t *raw, size_t *raw_size);
+
+//================================================================================================//
+
+uint16_t
+crc16(const uint8_t *data,
+      size_t         size,
+      uint16_t       crc)
+{
+    for (size_t i = 0; i != size; ++i)
+    {
+        crc = static_cast<uint16_t>((crc << 8) ^ kCrc16Table.values[((crc >> 8) ^ data[i]) & 0xff]);
+    }
+    return crc;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+uint32_t
+crc32(const uint8_t *data,
+      size_t         size,
+      uint32_t       crc)
+{
+    crc = ~crc;
+    for (size_t i = 0; i != size; ++i)
+    {
+        crc = (crc >> 8) ^ kCrc32Table.values[(crc ^ data[i]) & 0xff];
+    }
+    return ~crc;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+write_varint(uint64_t value,
+             uint8_t *dst)
+{
+    size_t size = 0;
+    while (value >= 0x80)
+    {
+        dst[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    dst[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+read_varint(const uint8_t *&pos,
+            const uint8_t  *end,
+            uint64_t       *value)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (pos == end)
+        {
+            return false;
+        }
+        uint8_t byte = *(pos++);
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static size_t
+write_u32(uint32_t value,
+          uint8_t *dst)
+{
+    for (size_t i = 0; i != 4; ++i)
+    {
+        dst[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    return 4;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+read_u32(const uint8_t *&pos,
+         const uint8_t  *end,
+         uint32_t       *value)
+{
+    if (end - pos < 4)
+    {
+        return false;
+    }
+    *value = static_cast<uint32_t>(pos[0])       | static_cast<uint32_t>(pos[1]) << 8 |
+             static_cast<uint32_t>(pos[2]) << 16 | static_cast<uint32_t>(pos[3]) << 24;
+    pos += 4;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+cobs_encode(const uint8_t *src,
+            size_t         size,
+            uint8_t       *dst)
+{
+    size_t  code_pos = 0;
+    size_t  out      = 1;
+    uint8_t code     = 1;
+    for (size_t i = 0; i != size; ++i)
+    {
+        if (src[i] == 0)
+        {
+            dst[code_pos] = code;
+            code_pos      = out++;
+            code          = 1;
+            continue;
+        }
+
+        dst[out++] = src[i];
+        if (++code == 0xff)
+        {
+            dst[code_pos] = code;
+            code_pos      = out++;
+            code          = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+cobs_decode(const uint8_t *src,
+            size_t         size,
+            uint8_t       *dst,
+            size_t        *decoded)
+{
+    size_t in  = 0;
+    size_t out = 0;
+    while (in != size)
+    {
+        uint8_t code = src[in++];
+        if (code == 0 || in + code - 1 > size)
+        {
+            return STATUS_PROTOCOL_FRAMING_ERROR;
+        }
+        for (uint8_t i = 1; i != code; ++i)
+        {
+            dst[out++] = src[in++];
+        }
+        // Block shorter than maximum means zero byte, except the last one
+        if (code != 0xff && in != size)
+        {
+            dst[out++] = 0;
+        }
+    }
+    *decoded = out;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static status_t
+write_payload(const message_t &message,
+              uint8_t         *payload,
+              size_t          *size)
+{
+    size_t pos = 0;
+    switch (message.type)
+    {
+        case MESSAGE_RESET:
+        {
+            break;
+        }
+        case MESSAGE_NOTE_BATCH:
+        {
+            const note_batch_t &batch = message.note_batch;
+            if (batch.count > kMaxBatchNotes)
+            {
+                return STATUS_PROTOCOL_OVERFLOW;
+            }
+            pos += write_varint(batch.time_us, payload + pos);
+            payload[pos++] = batch.count;
+            for (uint8_t i = 0; i != batch.count; ++i)
+            {
+                const note_t &note = batch.notes[i];
+                payload[pos++] = static_cast<uint8_t>((note.note & 0x7f) | (note.on ? 0x80 : 0x00));
+                if (note.on)
+                {
+                    payload[pos++] = note.velocity;
+                }
+            }
+            break;
+        }
+        case MESSAGE_TEMPO:
+        {
+            pos += write_varint(message.tempo.time_us, payload + pos);
+            pos += write_varint(message.tempo.tempo,   payload + pos);
+            break;
+        }
+        case MESSAGE_TIMESTAMP:
+        {
+            pos += write_varint(message.timestamp.time_us, payload + pos);
+            break;
+        }
+        case MESSAGE_KEY_FRAME:
+        {
+            if (message.key_frame.size > kMaxKeyFrameSize)
+            {
+                return STATUS_PROTOCOL_OVERFLOW;
+            }
+            pos += write_varint(message.key_frame.time_us, payload + pos);
+            std::memcpy(payload + pos, message.key_frame.data, message.key_frame.size);
+            pos += message.key_frame.size;
+            break;
+        }
+        case MESSAGE_SYNC_REQUEST:
+        {
+            pos += write_varint(message.sync.host_send_us, payload + pos);
+            break;
+        }
+        case MESSAGE_SYNC_RESPONSE:
+        {
+            pos += write_varint(message.sync.host_send_us,      payload + pos);
+            pos += write_varint(message.sync.device_receive_us, payload + pos);
+            pos += write_varint(message.sync.device_send_us,    payload + pos);
+            break;
+        }
+        case MESSAGE_SCHEDULE:
+        {
+            payload[pos++] = message.schedule.enabled ? 1 : 0;
+            break;
+        }
+        case MESSAGE_PING:
+        {
+            const ping_t &ping = message.ping;
+            payload[pos++] = ping.show ? 1 : 0;
+            pos += write_varint(ping.sequence,     payload + pos);
+            pos += write_varint(ping.host_send_us, payload + pos);
+            if (pos + ping.padding > kMaxPayloadSize)
+            {
+                return STATUS_PROTOCOL_OVERFLOW;
+            }
+            std::memset(payload + pos, 0, ping.padding);
+            pos += ping.padding;
+            break;
+        }
+        case MESSAGE_ECHO:
+        {
+            const ping_t &ping = message.ping;
+            pos += write_varint(ping.sequence,          payload + pos);
+            pos += write_varint(ping.host_send_us,      payload + pos);
+            pos += write_varint(ping.device_receive_us, payload + pos);
+            pos += write_varint(ping.device_shown_us,   payload + pos);
+            pos += write_varint(ping.device_send_us,    payload + pos);
+            break;
+        }
+        case MESSAGE_UPLOAD_BEGIN:
+        {
+            pos += write_varint(message.upload_begin.size, payload + pos);
+            pos += write_u32(message.upload_begin.crc32,   payload + pos);
+            break;
+        }
+        case MESSAGE_PATCH_BEGIN:
+        {
+            const patch_begin_t &begin = message.patch_begin;
+            pos += write_varint(begin.size,       payload + pos);
+            pos += write_u32(begin.crc32,         payload + pos);
+            pos += write_u32(begin.base_crc32,    payload + pos);
+            pos += write_varint(begin.block_size, payload + pos);
+            pos += write_varint(begin.patch_size, payload + pos);
+            break;
+        }
+        case MESSAGE_UPLOAD_CHUNK:
+        {
+            const upload_chunk_t &chunk = message.upload_chunk;
+            if (chunk.size > kUploadChunkSize)
+            {
+                return STATUS_PROTOCOL_OVERFLOW;
+            }
+            pos += write_varint(chunk.sequence, payload + pos);
+            std::memcpy(payload + pos, chunk.data, chunk.size);
+            pos += chunk.size;
+            break;
+        }
+        case MESSAGE_UPLOAD_ACK:
+        {
+            const upload_ack_t &ack = message.upload_ack;
+            pos += write_u32(ack.crc32,    payload + pos);
+            pos += write_varint(ack.next,  payload + pos);
+            pos += write_u32(ack.mask,     payload + pos);
+            payload[pos++] = ack.window;
+            payload[pos++] = ack.state;
+            break;
+        }
+        case MESSAGE_PLAY:
+        {
+            payload[pos++] = message.play.play ? 1 : 0;
+            pos += write_varint(message.play.start_us, payload + pos);
+            break;
+        }
+        case MESSAGE_TELEMETRY:
+        {
+            pos += write_varint(message.telemetry_request.period_us, payload + pos);
+            break;
+        }
+        case MESSAGE_TELEMETRY_REPORT:
+        {
+            pos += write_varint(message.telemetry.device_us, payload + pos);
+            for (uint32_t telemetry_t::*counter : kTelemetryCounters)
+            {
+                pos += write_varint(message.telemetry.*counter, payload + pos);
+            }
+            break;
+        }
+        default:
+        {
+            return STATUS_PROTOCOL_MESSAGE_ERROR;
+        }
+    }
+    *size = pos;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static status_t
+write_raw(const message_t &message,
+          uint8_t         *raw,
+          size_t          *raw_size)
+{
+    raw[0] = message.type;
+
+    size_t   payload_size = 0;
+    status_t status       = write_payload(message, raw + 1, &payload_size);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    size_t   size = 1 + payload_size;
+    uint16_t crc  = crc16(raw, size);
+    raw[size++] = static_cast<uint8_t>(crc & 0xff);
+    raw[size++] = static_cast<uint8_t>(crc >> 8);
+    *raw_size = size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+encode_raw(const message_t &message,
+           uint8_t         *raw,
+           size_t           capacity,
+           size_t          *raw_size)
+{
+    if (capacity >= kMaxRawFrameSize)
+    {
+        return write_raw(message, raw, raw_size);
+    }
+
+    uint8_t  buffer[kMaxRawFrameSize] = {};
+    size_t   size   = 0;
+    status_t status = write_raw(message, buffer, &size);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    if (capacity < size)
+    {
+        return STATUS_PROTOCOL_OVERFLOW;
+    }
+    std::memcpy(raw, buffer, size);
+    *raw_size = size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+encode_message(const message_t &message,
+               uint8_t         *frame,
+               size_t           capacity,
+               size_t          *frame_size)
+{
+    uint8_t  raw[kMaxRawFrameSize] = {};
+    size_t   raw_size = 0;
+    status_t status   = write_raw(message, raw, &raw_size);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    if (capacity < raw_size + raw_size / 254 + 2)
+    {
+        return STATUS_PROTOCOL_OVERFLOW;
+    }
+    size_t size = cobs_encode(raw, raw_size, frame);
+    frame[size++] = kFrameDelimiter;
+    *frame_size = size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+decode_message(const uint8_t *raw,
+               size_t         size,
+               message_t     *message)
+{
+    if (size < 3)
+    {
+        return STATUS_PROTOCOL_FRAMING_ERROR;
+    }
+    uint16_t crc = static_cast<uint16_t>(raw[size - 2] | (raw[size - 1] << 8));
+    if (crc16(raw, size - 2) != crc)
+    {
+        return STATUS_PROTOCOL_CRC_ERROR;
+    }
+
+    const uint8_t *pos = raw + 1;
+    const uint8_t *end = raw + size - 2;
+    uint64_t       value = 0;
+    switch (raw[0])
+    {
+        case MESSAGE_RESET:
+        {
+            message->type = MESSAGE_RESET;
+            break;
+        }
+        case MESSAGE_NOTE_BATCH:
+        {
+            message->type = MESSAGE_NOTE_BATCH;
+            note_batch_t &batch = message->note_batch;
+            if (!read_varint(pos, end, &batch.time_us) || pos == end)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            batch.count = *(pos++);
+            if (batch.count > kMaxBatchNotes)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            for (uint8_t i = 0; i != batch.count; ++i)
+            {
+                if (pos == end)
+                {
+                    return STATUS_PROTOCOL_MESSAGE_ERROR;
+                }
+                note_t &note = batch.notes[i];
+                note.note     = *pos & 0x7f;
+                note.on       = (*(pos++) & 0x80) != 0;
+                note.velocity = 0;
+                if (note.on)
+                {
+                    if (pos == end)
+                    {
+                        return STATUS_PROTOCOL_MESSAGE_ERROR;
+                    }
+                    note.velocity = *(pos++);
+                }
+            }
+            break;
+        }
+        case MESSAGE_TEMPO:
+        {
+            message->type = MESSAGE_TEMPO;
+            if (!read_varint(pos, end, &message->tempo.time_us) ||
+                !read_varint(pos, end, &value))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->tempo.tempo = static_cast<uint32_t>(value);
+            break;
+        }
+        case MESSAGE_TIMESTAMP:
+        {
+            message->type = MESSAGE_TIMESTAMP;
+            if (!read_varint(pos, end, &message->timestamp.time_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            break;
+        }
+        case MESSAGE_KEY_FRAME:
+        {
+            message->type = MESSAGE_KEY_FRAME;
+            if (!read_varint(pos, end, &message->key_frame.time_us) ||
+                static_cast<size_t>(end - pos) > kMaxKeyFrameSize)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->key_frame.size = static_cast<uint8_t>(end - pos);
+            std::memcpy(message->key_frame.data, pos, message->key_frame.size);
+            pos = end;
+            break;
+        }
+        case MESSAGE_SYNC_REQUEST:
+        {
+            message->type = MESSAGE_SYNC_REQUEST;
+            message->sync = {};
+            if (!read_varint(pos, end, &message->sync.host_send_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            break;
+        }
+        case MESSAGE_SYNC_RESPONSE:
+        {
+            message->type = MESSAGE_SYNC_RESPONSE;
+            if (!read_varint(pos, end, &message->sync.host_send_us)      ||
+                !read_varint(pos, end, &message->sync.device_receive_us) ||
+                !read_varint(pos, end, &message->sync.device_send_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            break;
+        }
+        case MESSAGE_SCHEDULE:
+        {
+            message->type = MESSAGE_SCHEDULE;
+            if (pos == end || *pos > 1)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->schedule.enabled = *(pos++) != 0;
+            break;
+        }
+        case MESSAGE_PING:
+        {
+            message->type = MESSAGE_PING;
+            message->ping = {};
+            if (pos == end || *pos > 1)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->ping.show = *(pos++) != 0;
+            if (!read_varint(pos, end, &value) ||
+                !read_varint(pos, end, &message->ping.host_send_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->ping.sequence = static_cast<uint32_t>(value);
+            message->ping.padding  = static_cast<uint8_t>(end - pos);
+            pos = end;
+            break;
+        }
+        case MESSAGE_ECHO:
+        {
+            message->type = MESSAGE_ECHO;
+            message->ping = {};
+            if (!read_varint(pos, end, &value)                           ||
+                !read_varint(pos, end, &message->ping.host_send_us)      ||
+                !read_varint(pos, end, &message->ping.device_receive_us) ||
+                !read_varint(pos, end, &message->ping.device_shown_us)   ||
+                !read_varint(pos, end, &message->ping.device_send_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->ping.sequence = static_cast<uint32_t>(value);
+            break;
+        }
+        case MESSAGE_UPLOAD_BEGIN:
+        {
+            message->type = MESSAGE_UPLOAD_BEGIN;
+            if (!read_varint(pos, end, &value) ||
+                !read_u32(pos, end, &message->upload_begin.crc32))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->upload_begin.size = static_cast<uint32_t>(value);
+            break;
+        }
+        case MESSAGE_PATCH_BEGIN:
+        {
+            message->type = MESSAGE_PATCH_BEGIN;
+            patch_begin_t &begin = message->patch_begin;
+            uint64_t       block = 0;
+            uint64_t       patch = 0;
+            if (!read_varint(pos, end, &value)             ||
+                !read_u32(pos, end, &begin.crc32)          ||
+                !read_u32(pos, end, &begin.base_crc32)     ||
+                !read_varint(pos, end, &block)             ||
+                !read_varint(pos, end, &patch))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            begin.size       = static_cast<uint32_t>(value);
+            begin.block_size = static_cast<uint32_t>(block);
+            begin.patch_size = static_cast<uint32_t>(patch);
+            break;
+        }
+        case MESSAGE_UPLOAD_CHUNK:
+        {
+            message->type = MESSAGE_UPLOAD_CHUNK;
+            if (!read_varint(pos, end, &value) ||
+                static_cast<size_t>(end - pos) > kUploadChunkSize)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->upload_chunk.sequence = static_cast<uint32_t>(value);
+            message->upload_chunk.size     = static_cast<uint8_t>(end - pos);
+            std::memcpy(message->upload_chunk.data, pos, message->upload_chunk.size);
+            pos = end;
+            break;
+        }
+        case MESSAGE_UPLOAD_ACK:
+        {
+            message->type = MESSAGE_UPLOAD_ACK;
+            upload_ack_t &ack = message->upload_ack;
+            if (!read_u32(pos, end, &ack.crc32)   ||
+                !read_varint(pos, end, &value)    ||
+                !read_u32(pos, end, &ack.mask)    ||
+                end - pos < 2 || pos[1] > UPLOAD_BASE_MISMATCH)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            ack.next   = static_cast<uint32_t>(value);
+            ack.window = *(pos++);
+            ack.state  = static_cast<upload_state_t>(*(pos++));
+            break;
+        }
+        case MESSAGE_PLAY:
+        {
+            message->type = MESSAGE_PLAY;
+            if (pos == end || *pos > 1)
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            message->play.play = *(pos++) != 0;
+            if (!read_varint(pos, end, &message->play.start_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            break;
+        }
+        case MESSAGE_TELEMETRY:
+        {
+            message->type = MESSAGE_TELEMETRY;
+            if (!read_varint(pos, end, &message->telemetry_request.period_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            break;
+        }
+        case MESSAGE_TELEMETRY_REPORT:
+        {
+            message->type      = MESSAGE_TELEMETRY_REPORT;
+            message->telemetry = {};
+            if (!read_varint(pos, end, &message->telemetry.device_us))
+            {
+                return STATUS_PROTOCOL_MESSAGE_ERROR;
+            }
+            for (uint32_t telemetry_t::*counter : kTelemetryCounters)
+            {
+                if (!read_varint(pos, end, &value) || value > UINT32_MAX)
+                {
+                    return STATUS_PROTOCOL_MESSAGE_ERROR;
+                }
+                message->telemetry.*counter = static_cast<uint32_t>(value);
+            }
+            break;
+        }
+        default:
+        {
+            return STATUS_PROTOCOL_MESSAGE_ERROR;
+        }
+    }
+
+    if (pos != end)
+    {
+        return STATUS_PROTOCOL_MESSAGE_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+uint64_t
+message_time(const message_t &message)
+{
+    switch (message.type)
+    {
+        case MESSAGE_NOTE_BATCH: { return message.note_batch.time_us; }
+        case MESSAGE_TEMPO:      { return message.tempo.time_us;      }
+        case MESSAGE_TIMESTAMP:  { return message.timestamp.time_us;  }
+        case MESSAGE_KEY_FRAME:  { return message.key_frame.time_us;  }
+        default:                 { return 0;                          }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+set_message_time(message_t *message,
+                 uint64_t   time_us)
+{
+    switch (message->type)
+    {
+        case MESSAGE_NOTE_BATCH: { message->note_batch.time_us = time_us; break; }
+        case MESSAGE_TEMPO:      { message->tempo.time_us      = time_us; break; }
+        case MESSAGE_TIMESTAMP:  { message->timestamp.time_us  = time_us; break; }
+        case MESSAGE_KEY_FRAME:  { message->key_frame.time_us  = time_us; break; }
+        default:                 {                                         break; }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+frame_decoder_t::push(uint8_t    byte,
+                      message_t *message)
+{
+    if (byte != kFrameDelimiter)
+    {
+        if (size_ == sizeof(buffer_))
+        {
+            overflow_ = true;
+        } else
+        {
+            buffer_[size_++] = byte;
+        }
+        return STATUS_PROTOCOL_PENDING;
+    }
+
+    // Several delimiters in a row are allowed, they are used to flush garbage on line
+    if (size_ == 0 && !overflow_)
+    {
+        return STATUS_PROTOCOL_PENDING;
+    }
+
+    if (overflow_)
+    {
+        reset();
+        return STATUS_PROTOCOL_OVERFLOW;
+    }
+
+    size_t   raw_size = 0;
+    status_t status   = cobs_decode(buffer_, size_, buffer_, &raw_size);
+    reset();
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    return decode_message(buffer_, raw_size, message);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+frame_decoder_t::reset()
+{
+    size_     = 0;
+    overflow_ = false;
+}
+
+//================================================================================================//
+
+batch_builder_t::batch_builder_t()
+{
+    batch_.type = MESSAGE_NOTE_BATCH;
+    batch_.note_batch.count = 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+batch_builder_t::add(const piano_midi::timed_event_t &event,
+                     message_t                       *ready)
+{
+    size_t count = 0;
+    if (event.event == EVENT_TEMPO_SET)
+    {
+        count += finish(ready);
+        message_t &tempo = ready[count++];
+        tempo.type          = MESSAGE_TEMPO;
+        tempo.tempo.time_us = event.time_us;
+        tempo.tempo.tempo   = event.tempo;
+        return count;
+    }
+
+    if (batch_.note_batch.count == kMaxBatchNotes || batch_.note_batch.time_us != event.time_us)
+    {
+        count += finish(ready);
+        batch_.note_batch.time_us = event.time_us;
+    }
+
+    note_t &note = batch_.note_batch.notes[batch_.note_batch.count++];
+    note.note     = event.note;
+    note.velocity = event.velocity;
+    note.on       = (event.event == EVENT_NOTE_ON);
+    return count;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+batch_builder_t::finish(message_t *ready)
+{
+    if (batch_.note_batch.count == 0)
+    {
+        return 0;
+    }
+    *ready = batch_;
+    batch_.note_batch.count = 0;
+    return 1;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+make_messages(const std::vector<piano_midi::timed_event_t> &timeline,
+              std::vector<message_t>                       &messages)
+{
+    batch_builder_t builder;
+    message_t       ready[2];
+    for (const auto &event : timeline)
+    {
+        size_t count = builder.add(event, ready);
+        messages.insert(messages.end(), ready, ready + count);
+    }
+    size_t count = builder.finish(ready);
+    messages.insert(messages.end(), ready, ready + count);
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+make_key_frame_messages(const std::vector<piano_midi::timed_event_t> &timeline,
+                        uint64_t                                      period_us,
+                        key_encoder_t                                &encoder,
+                        std::vector<message_t>                       &messages)
+{
+    if (period_us == 0)
+    {
+        return STATUS_PROTOCOL_MESSAGE_ERROR;
+    }
+
+    key_state_t state = {};
+    size_t      next  = 0;
+    while (next != timeline.size())
+    {
+        // Frame at time_us contains all events up to time_us, frames without events are skipped
+        uint64_t time_us = (timeline[next].time_us / period_us + 1) * period_us;
+        for (; next != timeline.size() && timeline[next].time_us < time_us; ++next)
+        {
+            const auto &event = timeline[next];
+            if (event.event != EVENT_TEMPO_SET)
+            {
+                state.set(event.note, event.event == EVENT_NOTE_ON);
+            }
+        }
+
+        message_t message = {};
+        message.type              = MESSAGE_KEY_FRAME;
+        message.key_frame.time_us = time_us;
+        message.key_frame.size    = static_cast<uint8_t>(encoder.encode(state,
+                                                                        message.key_frame.data));
+        if (message.key_frame.size != 0)
+        {
+            messages.push_back(message);
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_proto
+
+//================================================================================================//
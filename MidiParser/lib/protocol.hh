@@ -0,0 +1,513 @@
+//================================================================================================//
+
+#ifndef __PROTOCOL_HH__
+#define __PROTOCOL_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "key_codec.hh"
+
+//================================================================================================//
+
+//
+// Binary protocol between host and device. Shared by host tools and ESP firmware, so it does
+// not allocate and does not print anything.
+//
+// Every message is sent as one frame:
+//
+//     COBS( type | payload | crc16 ) | 0x00
+//
+//  - type is one byte, see message_type_t
+//  - payload depends on type, multibyte integers are little endian or LEB128 varints
+//  - crc16 is CRC-16/CCITT-FALSE of type and payload, little endian
+//  - COBS removes all zero bytes from frame, so zero byte always marks end of frame and
+//    receiver resynchronizes on the next delimiter after any error.
+//
+namespace piano_proto
+{
+
+//================================================================================================//
+
+static const uint8_t kFrameDelimiter = 0x00;
+
+//
+// Maximum size of message payload, so that whole raw frame fits into one COBS block
+//
+static const size_t  kMaxPayloadSize = 251;
+
+//
+// type + payload + crc16
+//
+static const size_t  kMaxRawFrameSize = 1 + kMaxPayloadSize + 2;
+
+//
+// COBS overhead is one byte per 254 bytes, plus delimiter
+//
+static const size_t  kMaxFrameSize = kMaxRawFrameSize + kMaxRawFrameSize / 254 + 1 + 1;
+
+//
+// Maximum number of notes in one batch, note on takes two bytes (note and velocity)
+//
+static const size_t  kMaxBatchNotes = 120;
+
+//
+// Song upload: image is split into chunks of this size, device accepts at most kUploadWindow
+// chunks beyond the first missing one. Window of 8 chunks fits into 2 KiB UART buffer of ESP32.
+// Image is at most one song slot of device, see kSongStorageSize in song_store.hh.
+//
+static const size_t  kUploadChunkSize = 200;
+static const size_t  kUploadWindow    = 8;
+static const size_t  kMaxSongSize     = 64 * 1024;
+static const size_t  kMaxSongChunks   = (kMaxSongSize + kUploadChunkSize - 1) / kUploadChunkSize;
+
+//------------------------------------------------------------------------------------------------//
+
+enum message_type_t : uint8_t
+{
+    //
+    // All keys are released. Empty payload.
+    //
+    MESSAGE_RESET      = 0x01,
+
+    //
+    // Notes changed at the same moment.
+    //   varint time_us | u8 count | count * (u8 note [| u8 velocity if bit 7 of note is set])
+    // Bit 7 of note byte means Note On, velocity follows only for Note On.
+    //
+    MESSAGE_NOTE_BATCH = 0x02,
+
+    //
+    // Tempo change, informational for device.
+    //   varint time_us | varint tempo (microseconds per quarter note)
+    //
+    MESSAGE_TEMPO      = 0x03,
+
+    //
+    // Current song position of the host.
+    //   varint time_us
+    //
+    MESSAGE_TIMESTAMP  = 0x04,
+
+    //
+    // State of all keys, compressed with key_encoder_t.
+    //   varint time_us | key frame (see key_codec.hh)
+    //
+    MESSAGE_KEY_FRAME  = 0x05,
+
+    //
+    // Clock synchronization request, device answers with MESSAGE_SYNC_RESPONSE at once.
+    //   varint host_send_us
+    //
+    MESSAGE_SYNC_REQUEST  = 0x06,
+
+    //
+    // Answer to MESSAGE_SYNC_REQUEST, sent by device. Host time is copied from request, device
+    // times are taken when request is received and right before response is sent.
+    //   varint host_send_us | varint device_receive_us | varint device_send_us
+    //
+    MESSAGE_SYNC_RESPONSE = 0x07,
+
+    //
+    // Timing of note batches and key frames. When enabled, their time_us is device time at
+    // which they take effect and device queues them until then. Reset disables scheduling.
+    //   u8 enabled
+    //
+    MESSAGE_SCHEDULE      = 0x08,
+
+    //
+    // Latency probe, device answers with MESSAGE_ECHO at once. With bit 0 of flags set device
+    // refreshes LED strip first, so that echo tells when LEDs changed. Padding makes frame
+    // longer to measure cost of each byte, device ignores it.
+    //   u8 flags | varint sequence | varint host_send_us | padding
+    //
+    MESSAGE_PING          = 0x09,
+
+    //
+    // Answer to MESSAGE_PING. Sequence and host time are copied from ping, device times are
+    // taken when ping is received, after LED refresh (receive time without it) and right before
+    // echo is sent.
+    //   varint sequence | varint host_send_us | varint device_receive_us |
+    //   varint device_shown_us | varint device_send_us
+    //
+    MESSAGE_ECHO          = 0x0a,
+
+    //
+    // Start of song upload, see song_image.hh for format of image. Device drops song it has
+    // stored and answers with MESSAGE_UPLOAD_ACK. CRC-32 of image identifies upload.
+    //   varint size | u32 crc32
+    //
+    MESSAGE_UPLOAD_BEGIN  = 0x0b,
+
+    //
+    // Part of image at offset sequence * kUploadChunkSize, all chunks but the last one are
+    // kUploadChunkSize bytes. Device answers every chunk, duplicates too, with MESSAGE_UPLOAD_ACK.
+    //   varint sequence | data
+    //
+    MESSAGE_UPLOAD_CHUNK  = 0x0c,
+
+    //
+    // State of upload sent by device. All chunks below next are received, bit i of mask is set
+    // if chunk next + 1 + i is received. Host may send chunks below next + window. When the
+    // last chunk comes, device checks CRC-32 of whole image and reports the result in state.
+    //   u32 crc32 | varint next | u32 mask | u8 window | u8 state (see upload_state_t)
+    //
+    MESSAGE_UPLOAD_ACK    = 0x0d,
+
+    //
+    // Start or stop playback of uploaded song. Song time 0 is at device time start_us, 0 means
+    // at once.
+    //   u8 play | varint start_us
+    //
+    MESSAGE_PLAY          = 0x0e,
+
+    //
+    // Start of upload of a patch (see song_image.hh) which turns stored song with CRC-32
+    // base_crc32 into new image of given size and crc32. Patch goes in MESSAGE_UPLOAD_CHUNK as
+    // image does, acks carry crc32 of new image.
+    //   varint size | u32 crc32 | u32 base_crc32 | varint block_size | varint patch_size
+    //
+    MESSAGE_PATCH_BEGIN   = 0x0f,
+
+    //
+    // Start sending MESSAGE_TELEMETRY_REPORT every period_us, 0 stops it. Device sends the first
+    // report at once.
+    //   varint period_us
+    //
+    MESSAGE_TELEMETRY     = 0x10,
+
+    //
+    // Load of device, see telemetry_t. Counters are totals since start which wrap at 32 bits,
+    // host takes differences of two reports; maxima are since start.
+    //   varint device_us | 14 * varint counter in order of telemetry_t
+    //
+    MESSAGE_TELEMETRY_REPORT = 0x11,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+enum upload_state_t : uint8_t
+{
+    UPLOAD_IDLE          = 0,
+    UPLOAD_RECEIVING     = 1,
+    UPLOAD_COMPLETE      = 2,
+    UPLOAD_CRC_ERROR     = 3,
+    UPLOAD_TOO_LARGE     = 4,
+
+    //
+    // Patch was made against song which is not on device
+    //
+    UPLOAD_BASE_MISMATCH = 5,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct note_t
+{
+    uint8_t note     = 0;
+    uint8_t velocity = 0;
+    bool    on       = false;
+};
+
+struct note_batch_t
+{
+    uint64_t time_us = 0;
+    uint8_t  count   = 0;
+    note_t   notes[kMaxBatchNotes];
+};
+
+struct tempo_t
+{
+    uint64_t time_us = 0;
+    uint32_t tempo   = 0;
+};
+
+struct timestamp_t
+{
+    uint64_t time_us = 0;
+};
+
+struct key_frame_t
+{
+    uint64_t time_us = 0;
+    uint8_t  size    = 0;
+    uint8_t  data[kMaxKeyFrameSize];
+};
+
+struct sync_t
+{
+    uint64_t host_send_us      = 0;
+    uint64_t device_receive_us = 0;
+    uint64_t device_send_us    = 0;
+};
+
+struct schedule_t
+{
+    bool enabled = false;
+};
+
+//
+// Shared by MESSAGE_PING and MESSAGE_ECHO, each of them carries its own part of fields
+//
+struct ping_t
+{
+    uint32_t sequence          = 0;
+    uint64_t host_send_us      = 0;
+    bool     show              = false;
+    uint8_t  padding           = 0;
+    uint64_t device_receive_us = 0;
+    uint64_t device_shown_us   = 0;
+    uint64_t device_send_us    = 0;
+};
+
+struct upload_begin_t
+{
+    uint32_t size  = 0;
+    uint32_t crc32 = 0;
+};
+
+struct patch_begin_t
+{
+    uint32_t size       = 0;
+    uint32_t crc32      = 0;
+    uint32_t base_crc32 = 0;
+    uint32_t block_size = 0;
+    uint32_t patch_size = 0;
+};
+
+struct upload_chunk_t
+{
+    uint32_t sequence = 0;
+    uint8_t  size     = 0;
+    uint8_t  data[kUploadChunkSize];
+};
+
+struct upload_ack_t
+{
+    uint32_t       crc32  = 0;
+    uint32_t       next   = 0;
+    uint32_t       mask   = 0;
+    uint8_t        window = 0;
+    upload_state_t state  = UPLOAD_IDLE;
+};
+
+struct play_t
+{
+    bool     play     = false;
+    uint64_t start_us = 0;
+};
+
+struct telemetry_request_t
+{
+    uint64_t period_us = 0;
+};
+
+struct telemetry_t
+{
+    uint64_t device_us       = 0;
+
+    //
+    // Receiving side: messages decoded, frames dropped by CRC or framing, bytes lost by UART
+    // driver, most UART events waiting and most messages in schedule queue
+    //
+    uint32_t messages        = 0;
+    uint32_t frame_errors    = 0;
+    uint32_t uart_overruns   = 0;
+    uint32_t rx_queue_high   = 0;
+    uint32_t schedule_high   = 0;
+
+    //
+    // Time scheduled messages and song records were played after their time
+    //
+    uint32_t late_count      = 0;
+    uint32_t late_sum_us     = 0;
+    uint32_t late_max_us     = 0;
+
+    //
+    // LED frames refreshed, replaced or dropped as unchanged before refresh, time strip was
+    // being refreshed and the longest refresh
+    //
+    uint32_t frames_shown    = 0;
+    uint32_t frames_dropped  = 0;
+    uint32_t strip_busy_us   = 0;
+    uint32_t strip_max_us    = 0;
+
+    //
+    // Time receiving task was busy and its longest run
+    //
+    uint32_t parser_busy_us  = 0;
+    uint32_t parser_max_us   = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct message_t
+{
+    message_t () : type(MESSAGE_RESET), timestamp() {}
+
+    message_type_t type;
+    union
+    {
+        note_batch_t        note_batch;
+        tempo_t             tempo;
+        timestamp_t         timestamp;
+        key_frame_t         key_frame;
+        sync_t              sync;
+        schedule_t          schedule;
+        ping_t              ping;
+        upload_begin_t      upload_begin;
+        patch_begin_t       patch_begin;
+        upload_chunk_t      upload_chunk;
+        upload_ack_t        upload_ack;
+        play_t              play;
+        telemetry_request_t telemetry_request;
+        telemetry_t         telemetry;
+    };
+};
+
+//================================================================================================//
+
+//
+// CRC-16/CCITT-FALSE, pass previous result as crc to continue computation
+//
+uint16_t crc16(const uint8_t *data, size_t size, uint16_t crc = 0xffff);
+
+//
+// CRC-32 (IEEE 802.3) of song images. Pass previous result to continue computation.
+//
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+//
+// LEB128 varint. write_varint returns number of written bytes (at most 10), read_varint
+// returns false if value does not end before end.
+//
+size_t write_varint(uint64_t value, uint8_t *dst);
+bool   read_varint (const uint8_t *&pos, const uint8_t *end, uint64_t *value);
+
+//
+// Consistent Overhead Byte Stuffing. dst for encoding must hold size + size / 254 + 1 bytes,
+// decoding may be done in place.
+//
+size_t          cobs_encode(const uint8_t *src, size_t size, uint8_t *dst);
+piano::status_t cobs_decode(const uint8_t *src, size_t size, uint8_t *dst, size_t *decoded);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Encode message to frame including trailing delimiter. kMaxFrameSize is always enough.
+//
+piano::status_t encode_message(const message_t &message,
+                               uint8_t         *frame,
+                               size_t           capacity,
+                               size_t          *frame_size);
+
+//
+// Encode message to raw frame (type | payload | crc16) without COBS, used for records of song
+// image. kMaxRawFrameSize is always enough.
+//
+piano::status_t encode_raw(const message_t &message,
+                           uint8_t         *raw,
+                           size_t           capacity,
+                           size_t          *raw_size);
+
+//
+// Decode raw (already COBS decoded) frame and check its crc
+//
+piano::status_t decode_message(const uint8_t *raw,
+                               size_t         size,
+                               message_t     *message);
+
+//
+// Song time of message, zero for messages without time
+//
+uint64_t message_time(const message_t &message);
+
+//
+// Replace time of message, used to restamp song time as device time. No-op for messages
+// without time.
+//
+void     set_message_time(message_t *message, uint64_t time_us);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Incremental receiver of frames from byte stream
+//
+class frame_decoder_t
+{
+  public:
+    //
+    // Push one received byte. Returns STATUS_SUCCESS when message is decoded,
+    // STATUS_PROTOCOL_PENDING when frame is not finished yet and error status when
+    // finished frame is broken. Decoder is ready for the next frame in any case.
+    //
+    piano::status_t push(uint8_t byte, message_t *message);
+
+    void reset();
+
+    //
+    // No byte of the next frame has been received yet
+    //
+    bool idle() const { return size_ == 0 && !overflow_; }
+
+  private:
+    uint8_t buffer_[kMaxFrameSize] = {};
+    size_t  size_                  = 0;
+    bool    overflow_              = false;
+};
+
+//================================================================================================//
+
+//
+// Incremental grouping of timeline into messages, events at the same time go to one batch
+//
+class batch_builder_t
+{
+  public:
+    batch_builder_t();
+
+    //
+    // Add next event of timeline. Completed messages (at most two) are written to ready,
+    // returns their number.
+    //
+    size_t add(const piano_midi::timed_event_t &event, message_t *ready);
+
+    //
+    // Complete the last batch, returns number of messages written to ready (0 or 1)
+    //
+    size_t finish(message_t *ready);
+
+  private:
+    message_t batch_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Group timeline into messages: events at the same time are sent as one note batch
+//
+piano::status_t make_messages(const std::vector<piano_midi::timed_event_t> &timeline,
+                              std::vector<message_t>                       &messages);
+
+//
+// Sample state of keys every period_us and encode changes as key frames
+//
+piano::status_t make_key_frame_messages(const std::vector<piano_midi::timed_event_t> &timeline,
+                                        uint64_t                                      period_us,
+                                        key_encoder_t                                &encoder,
+                                        std::vector<message_t>                       &messages);
+
+} // ! namespace piano_proto
+
+//================================================================================================//
+
+#endif // ! __PROTOCOL_HH__
+
+//================================================================================================//
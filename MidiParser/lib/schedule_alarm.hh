@@ -0,0 +1,73 @@
+//================================================================================================//
+
+#ifndef __SCHEDULE_ALARM_HH__
+#define __SCHEDULE_ALARM_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Deadline of one-shot timer which wakes device loop for its next scheduled message, so that
+// messages are played at their microsecond instead of the next tick. Keeps only the logic of
+// arming: the timer itself is esp_timer on device and virtual clock in tests.
+//
+class schedule_alarm_t
+{
+  public:
+    //
+    // Called after every pass of device loop with has_scheduled and next_time_us of device.
+    // Returns true if timer has to be restarted to fire in delay_us. Armed timer is kept while
+    // it fires no later than the next message: earlier one wakes the loop for nothing, which
+    // is cheaper than restarting timer on every pass.
+    //
+    // Timer whose deadline has passed without fired() has lost its wake, so it is armed again
+    // rather than kept forever.
+    //
+    bool arm(bool     has_next,
+             int64_t  next_us,
+             int64_t  now_us,
+             int64_t *delay_us)
+    {
+        bool pending = armed_ && deadline_us_ >= now_us;
+        if (!has_next || (pending && deadline_us_ <= next_us))
+        {
+            return false;
+        }
+
+        armed_       = true;
+        deadline_us_ = next_us;
+        *delay_us    = (next_us > now_us) ? next_us - now_us : 0;
+        ++restarts_;
+        return true;
+    }
+
+    //
+    // Timer fired, device loop is woken up
+    //
+    void fired() { armed_ = false; }
+
+    bool     armed()       const { return armed_;       }
+    int64_t  deadline_us() const { return deadline_us_; }
+    uint32_t restarts()    const { return restarts_;    }
+
+  private:
+    bool     armed_       = false;
+    int64_t  deadline_us_ = 0;
+    uint32_t restarts_    = 0;
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __SCHEDULE_ALARM_HH__
+
+//================================================================================================//
@@ -0,0 +1,338 @@
+//================================================================================================//
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/serial.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+using clock_t = std::chrono::steady_clock;
+
+//================================================================================================//
+
+//
+// Translate baud rate to termios constant, returns B0 for unsupported rate
+//
+static speed_t baud_constant(uint32_t baud_rate);
+
+//================================================================================================//
+
+static speed_t
+baud_constant(uint32_t baud_rate)
+{
+    switch (baud_rate)
+    {
+        case 9600:    { return B9600;    }
+        case 19200:   { return B19200;   }
+        case 38400:   { return B38400;   }
+        case 57600:   { return B57600;   }
+        case 115200:  { return B115200;  }
+        case 230400:  { return B230400;  }
+        case 460800:  { return B460800;  }
+        case 921600:  { return B921600;  }
+        case 1000000: { return B1000000; }
+        case 2000000: { return B2000000; }
+        default:      { return B0;       }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+open_serial(const char *path,
+            uint32_t    baud_rate,
+            int        *fd,
+            bool       *low_latency)
+{
+    speed_t speed = baud_constant(baud_rate);
+    if (speed == B0)
+    {
+        std::cerr << "Unsupported baud rate: " << baud_rate << "\n";
+        return STATUS_SERIAL_CONFIG_ERROR;
+    }
+
+    int port = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (port < 0)
+    {
+        std::cerr << "Error while opening " << path << ": " << std::strerror(errno) << "\n";
+        return STATUS_SERIAL_OPEN_ERROR;
+    }
+
+    termios tty = {};
+    if (tcgetattr(port, &tty) != 0)
+    {
+        std::cerr << path << " is not a terminal: " << std::strerror(errno) << "\n";
+        close(port);
+        return STATUS_SERIAL_CONFIG_ERROR;
+    }
+
+    // No line discipline processing, 8N1, reads return whatever is available
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN]  = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(port, TCSANOW, &tty) != 0)
+    {
+        std::cerr << "Error while configuring " << path << ": " << std::strerror(errno) << "\n";
+        close(port);
+        return STATUS_SERIAL_CONFIG_ERROR;
+    }
+    tcflush(port, TCIOFLUSH);
+
+    // Low latency disables driver's receive batching, which is 16 ms on FTDI and CP210x bridges
+    serial_struct serial = {};
+    *low_latency = false;
+    if (ioctl(port, TIOCGSERIAL, &serial) == 0)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        *low_latency = (ioctl(port, TIOCSSERIAL, &serial) == 0);
+    }
+
+    *fd = port;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+open_pty(int         *master,
+         std::string *slave_path)
+{
+    int pty = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (pty < 0 || grantpt(pty) != 0 || unlockpt(pty) != 0)
+    {
+        std::cerr << "Error while creating pseudo-terminal: " << std::strerror(errno) << "\n";
+        if (pty >= 0)
+        {
+            close(pty);
+        }
+        return STATUS_SERIAL_OPEN_ERROR;
+    }
+
+    char name[256] = {};
+    if (ptsname_r(pty, name, sizeof(name)) != 0)
+    {
+        std::cerr << "Error while getting pseudo-terminal name: " << std::strerror(errno) << "\n";
+        close(pty);
+        return STATUS_SERIAL_OPEN_ERROR;
+    }
+
+    // Master side gets bytes exactly as they were written to slave
+    termios tty = {};
+    tcgetattr(pty, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(pty, TCSANOW, &tty);
+
+    *master     = pty;
+    *slave_path = name;
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+serial_sender_t::serial_sender_t(int fd)
+    : fd_(fd),
+      slots_(kMaxQueuedFrames * piano_proto::kMaxFrameSize)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+serial_sender_t::enqueue(const piano_proto::message_t &message)
+{
+    if (queued_ == kMaxQueuedFrames)
+    {
+        status_t status = flush();
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    uint8_t *slot   = &slots_[queued_ * piano_proto::kMaxFrameSize];
+    status_t status = piano_proto::encode_message(message,
+                                                  slot,
+                                                  piano_proto::kMaxFrameSize,
+                                                  &sizes_[queued_]);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    ++queued_;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+serial_sender_t::enqueue_frame(const uint8_t *frame,
+                               size_t         size)
+{
+    if (size > piano_proto::kMaxFrameSize)
+    {
+        return STATUS_PROTOCOL_OVERFLOW;
+    }
+    if (queued_ == kMaxQueuedFrames)
+    {
+        status_t status = flush();
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    std::memcpy(&slots_[queued_ * piano_proto::kMaxFrameSize], frame, size);
+    sizes_[queued_++] = size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+serial_sender_t::flush()
+{
+    if (queued_ == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    iovec vectors[kMaxQueuedFrames] = {};
+    for (size_t i = 0; i != queued_; ++i)
+    {
+        vectors[i].iov_base = &slots_[i * piano_proto::kMaxFrameSize];
+        vectors[i].iov_len  = sizes_[i];
+    }
+
+    auto   start = clock_t::now();
+    size_t first = 0;
+    while (first != queued_)
+    {
+        ssize_t written = writev(fd_, vectors + first, static_cast<int>(queued_ - first));
+        if (written < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            std::cerr << "Error while writing to device: " << std::strerror(errno) << "\n";
+            queued_ = 0;
+            return STATUS_SERIAL_WRITE_ERROR;
+        }
+        bytes_sent_ += static_cast<size_t>(written);
+
+        // Partial write, skipping written vectors and continuing from the middle of frame
+        size_t left = static_cast<size_t>(written);
+        while (first != queued_ && left >= vectors[first].iov_len)
+        {
+            left -= vectors[first].iov_len;
+            ++first;
+        }
+        if (first != queued_)
+        {
+            vectors[first].iov_base = static_cast<uint8_t *>(vectors[first].iov_base) + left;
+            vectors[first].iov_len -= left;
+        }
+    }
+    auto end = clock_t::now();
+
+    int output_queue = 0;
+    if (ioctl(fd_, TIOCOUTQ, &output_queue) == 0)
+    {
+        output_queue_.add(output_queue);
+    }
+    write_latency_.add(std::chrono::duration<double, std::micro>(end - start).count());
+    queue_depth_.add(static_cast<double>(queued_));
+    frames_sent_ += queued_;
+    queued_       = 0;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+serial_sender_t::play(const std::vector<piano_proto::message_t> &messages,
+                      double                                     speed)
+{
+    auto start = clock_t::now();
+    auto time_of = [&](size_t i)
+    {
+        return static_cast<double>(piano_proto::message_time(messages[i])) / speed;
+    };
+
+    size_t next = 0;
+    while (next != messages.size())
+    {
+        double due_us = time_of(next);
+        std::this_thread::sleep_until(start + std::chrono::duration<double, std::micro>(due_us));
+
+        double now_us = std::chrono::duration<double, std::micro>(clock_t::now() - start).count();
+        lateness_.add(now_us - due_us);
+
+        // Everything due until the end of coalescing window goes with one writev
+        while (next != messages.size() && time_of(next) <= now_us + kCoalesceWindowUs)
+        {
+            status_t status = enqueue(messages[next++]);
+            if (status != STATUS_SUCCESS)
+            {
+                return status;
+            }
+        }
+
+        status_t status = flush();
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+serial_sender_t::print_stats(std::ostream &out) const
+{
+    out << "sent " << frames_sent_ << " frames, " << bytes_sent_ << " bytes\n";
+    write_latency_.print(out, "write latency", "us");
+    queue_depth_  .print(out, "queue depth  ", " frames");
+    output_queue_ .print(out, "driver queue ", " B");
+    lateness_     .print(out, "lateness     ", "us");
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
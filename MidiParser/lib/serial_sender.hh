@@ -0,0 +1,134 @@
+//================================================================================================//
+
+#ifndef __SERIAL_SENDER_HH__
+#define __SERIAL_SENDER_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "stats.hh"
+
+//================================================================================================//
+
+//
+// Host side of the device link. Linux only, not compiled into firmware.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+static const uint32_t kDefaultBaudRate   = 115200;
+
+//
+// Maximum number of frames waiting for one writev
+//
+static const size_t   kMaxQueuedFrames   = 64;
+
+//
+// Messages which are due within this window are written with one writev
+//
+static const uint64_t kCoalesceWindowUs  = 1000;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Open tty in raw mode with given baud rate and request low latency mode from driver.
+// Low latency is not supported by pseudo-terminals and USB bridges without it, in this case
+// low_latency is set to false and port is still usable.
+//
+piano::status_t open_serial(const char *path, uint32_t baud_rate, int *fd, bool *low_latency);
+
+//
+// Create pseudo-terminal pair. Device side (simulator, tests) works with master, slave path is
+// opened with open_serial as if it was real device.
+//
+piano::status_t open_pty(int *master, std::string *slave_path);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Encodes messages into preallocated frame slots and writes them with writev, so that
+// frames due at the same time reach the driver in one system call.
+// Does not own file descriptor.
+//
+class serial_sender_t
+{
+  public:
+    explicit serial_sender_t(int fd);
+
+    //
+    // Encode message into queue, queue is flushed first if it is full
+    //
+    piano::status_t enqueue(const piano_proto::message_t &message);
+
+    //
+    // Queue already encoded frame
+    //
+    piano::status_t enqueue_frame(const uint8_t *frame, size_t size);
+
+    size_t queued() const { return queued_; }
+
+    //
+    // Write all queued frames
+    //
+    piano::status_t flush();
+
+    //
+    // Send messages in time with their timestamps, speed > 1 plays faster
+    //
+    piano::status_t play(const std::vector<piano_proto::message_t> &messages, double speed = 1.);
+
+    //
+    // Duration of each writev in microseconds
+    //
+    const sample_stats_t &write_latency() const { return write_latency_; }
+
+    //
+    // Frames written by each writev
+    //
+    const sample_stats_t &queue_depth()   const { return queue_depth_;   }
+
+    //
+    // Bytes waiting in driver output queue after each writev (TIOCOUTQ)
+    //
+    const sample_stats_t &output_queue()  const { return output_queue_;  }
+
+    //
+    // Delay of writev start after time of messages in play, in microseconds
+    //
+    const sample_stats_t &lateness()      const { return lateness_;      }
+
+    size_t bytes_sent()  const { return bytes_sent_;  }
+    size_t frames_sent() const { return frames_sent_; }
+
+    void   print_stats(std::ostream &out) const;
+
+  private:
+    int                  fd_          = -1;
+    std::vector<uint8_t> slots_       = {};
+    size_t               sizes_[kMaxQueuedFrames] = {};
+    size_t               queued_      = 0;
+    size_t               bytes_sent_  = 0;
+    size_t               frames_sent_ = 0;
+    sample_stats_t       write_latency_;
+    sample_stats_t       queue_depth_;
+    sample_stats_t       output_queue_;
+    sample_stats_t       lateness_;
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __SERIAL_SENDER_HH__
+
+//================================================================================================//
@@ -0,0 +1,104 @@
+//================================================================================================//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "midi_stream.hh"
+#include "smf_player.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+piano::status_t
+smf_player_t::start(const uint8_t *file,
+                    size_t         size,
+                    int64_t        start_us)
+{
+    playing_  = false;
+    start_us_ = start_us;
+    source_   = piano_midi::memory_source_t(file, size);
+    layout_.tracks.reserve(kMaxSmfTracks);
+    piano::status_t status = piano_midi::read_midi_layout(source_, &layout_, kMaxSmfTracks);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    for (size_t i = 0; i != layout_.tracks.size(); ++i)
+    {
+        streams_[i]  = piano_midi::source_stream_t(&source_, layout_.tracks[i].offset,
+                                                   layout_.tracks[i].length);
+        pointers_[i] = &streams_[i];
+    }
+    status = stream_.open(layout_, pointers_);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    builder_ = piano_proto::batch_builder_t();
+    next_    = 0;
+    count_   = 0;
+    ended_   = false;
+    playing_ = true;
+    advance();
+    return piano::STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+smf_player_t::due(int64_t                 now_us,
+                  piano_proto::message_t *message)
+{
+    if (!playing_ || next_time_us() > now_us)
+    {
+        return false;
+    }
+    *message = ready_[next_];
+    advance();
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+smf_player_t::advance()
+{
+    if (++next_ < count_)
+    {
+        return;
+    }
+
+    // Batch is complete only when event of later time comes, so builder is fed until it gives
+    // at least one message
+    next_  = 0;
+    count_ = 0;
+    while (count_ == 0)
+    {
+        if (ended_)
+        {
+            playing_ = false;
+            return;
+        }
+
+        piano_midi::timed_event_t event;
+        if (stream_.next(&event) == piano::STATUS_SUCCESS)
+        {
+            count_ = builder_.add(event, ready_);
+        } else
+        {
+            count_ = builder_.finish(ready_);
+            ended_ = true;
+        }
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_device
+
+//================================================================================================//
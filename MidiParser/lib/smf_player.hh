@@ -0,0 +1,88 @@
+//================================================================================================//
+
+#ifndef __SMF_PLAYER_HH__
+#define __SMF_PLAYER_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "midi_stream.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Tracks of MIDI file device plays at most, each takes about 300 bytes of heap while playing
+//
+static const size_t kMaxSmfTracks = 16;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Playback of standard MIDI file in place, e.g. mapped from flash: tracks are decoded through
+// windows of midi_stream_t and grouped into note batches as they are played, so memory does not
+// depend on length of file. Song time 0 is at device time start_us.
+//
+class smf_player_t
+{
+  public:
+    //
+    // File must stay mapped while it plays. Files with more than kMaxSmfTracks tracks to play
+    // are rejected.
+    //
+    piano::status_t start(const uint8_t *file, size_t size, int64_t start_us);
+    void            stop() { playing_ = false; }
+
+    //
+    // Device time of the next message, playing must be true
+    //
+    bool    playing()      const { return playing_; }
+    int64_t next_time_us() const
+    {
+        return start_us_ + static_cast<int64_t>(piano_proto::message_time(ready_[next_]));
+    }
+
+    //
+    // Take the next message if it is due at now_us. Playback stops at the end of file and at
+    // broken event.
+    //
+    bool due(int64_t now_us, piano_proto::message_t *message);
+
+  private:
+    void advance();
+
+    piano_midi::memory_source_t     source_   = {nullptr, 0};
+    piano_midi::midi_layout_t       layout_;
+    piano_midi::source_stream_t     streams_[kMaxSmfTracks];
+    piano_midi::byte_stream_t      *pointers_[kMaxSmfTracks] = {};
+    piano_midi::midi_stream_t       stream_;
+    piano_proto::batch_builder_t    builder_;
+
+    //
+    // Messages completed by builder, ready_[next_] is the next one to play
+    //
+    piano_proto::message_t          ready_[2];
+    size_t                          next_     = 0;
+    size_t                          count_    = 0;
+    bool                            ended_    = false;
+    int64_t                         start_us_ = 0;
+    bool                            playing_  = false;
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __SMF_PLAYER_HH__
+
+//================================================================================================//
@@ -0,0 +1,234 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+#include "song_bank.hh"
+
+//================================================================================================//
+
+namespace piano_proto
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+static void
+put_u32(std::vector<uint8_t> &bank,
+        size_t                pos,
+        uint32_t              value)
+{
+    for (size_t i = 0; i != 4; ++i)
+    {
+        bank[pos + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static uint32_t
+get_u32(const std::vector<uint8_t> &bank,
+        size_t                      pos)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i != 4; ++i)
+    {
+        value |= static_cast<uint32_t>(bank[pos + i]) << (8 * i);
+    }
+    return value;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static size_t
+align(size_t size)
+{
+    return (size + kBankAlign - 1) / kBankAlign * kBankAlign;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Time of the last record of image
+//
+static status_t
+song_duration(const std::vector<uint8_t> &image,
+              uint32_t                   *duration_ms)
+{
+    song_reader_t reader;
+    message_t     message;
+    uint64_t      time_us = 0;
+    status_t      status  = reader.open(image.data(), image.size());
+    while (status == STATUS_SUCCESS && !reader.done())
+    {
+        status  = reader.next(&message);
+        time_us = message_time(message);
+    }
+    *duration_ms = static_cast<uint32_t>(time_us / 1000);
+    return status;
+}
+
+//================================================================================================//
+
+status_t
+build_song_bank(const std::vector<bank_song_t> &songs,
+                std::vector<uint8_t>           &bank)
+{
+    size_t entries = sizeof(bank_header_t);
+    size_t size    = entries + songs.size() * sizeof(bank_entry_t);
+    bank.assign(size, 0);
+    std::memcpy(&bank[0], kBankMagic, sizeof(kBankMagic));
+    bank[sizeof(kBankMagic)] = kBankVersion;
+    put_u32(bank, offsetof(bank_header_t, count), static_cast<uint32_t>(songs.size()));
+
+    for (size_t i = 0; i != songs.size(); ++i)
+    {
+        const bank_song_t &song        = songs[i];
+        uint32_t           duration_ms = 0;
+        if (song_duration(song.image, &duration_ms) != STATUS_SUCCESS)
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+
+        size_t offset = align(bank.size());
+        bank.resize(offset, 0xff);
+        bank.insert(bank.end(), song.image.begin(), song.image.end());
+        if (bank.size() > UINT32_MAX)
+        {
+            return STATUS_PROTOCOL_OVERFLOW;
+        }
+
+        size_t entry = entries + i * sizeof(bank_entry_t);
+        put_u32(bank, entry + offsetof(bank_entry_t, offset),      static_cast<uint32_t>(offset));
+        put_u32(bank, entry + offsetof(bank_entry_t, size),
+                static_cast<uint32_t>(song.image.size()));
+        put_u32(bank, entry + offsetof(bank_entry_t, crc32),
+                crc32(song.image.data(), song.image.size()));
+        put_u32(bank, entry + offsetof(bank_entry_t, duration_ms), duration_ms);
+        std::memcpy(&bank[entry + offsetof(bank_entry_t, name)], song.name.data(),
+                    std::min(song.name.size(), kBankNameSize - 1));
+    }
+
+    put_u32(bank, offsetof(bank_header_t, crc32), crc32(&bank[entries], size - entries));
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+read_song_bank(const std::vector<uint8_t> &bank,
+               std::vector<bank_song_t>   &songs)
+{
+    songs.clear();
+    if (bank.size() < sizeof(bank_header_t) ||
+        std::memcmp(&bank[0], kBankMagic, sizeof(kBankMagic)) != 0 ||
+        bank[sizeof(kBankMagic)] != kBankVersion)
+    {
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+
+    uint64_t count   = get_u32(bank, offsetof(bank_header_t, count));
+    size_t   entries = sizeof(bank_header_t);
+    if (count > (bank.size() - entries) / sizeof(bank_entry_t) ||
+        crc32(&bank[entries], static_cast<size_t>(count) * sizeof(bank_entry_t)) !=
+        get_u32(bank, offsetof(bank_header_t, crc32)))
+    {
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        size_t   entry  = entries + i * sizeof(bank_entry_t);
+        uint64_t offset = get_u32(bank, entry + offsetof(bank_entry_t, offset));
+        uint64_t size   = get_u32(bank, entry + offsetof(bank_entry_t, size));
+        if (offset % kBankAlign != 0 || offset + size > bank.size())
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+
+        const uint8_t *name = &bank[entry + offsetof(bank_entry_t, name)];
+        const uint8_t *end  = std::find(name, name + kBankNameSize, 0);
+        if (end == name + kBankNameSize)
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+
+        bank_song_t song;
+        song.name.assign(name, end);
+        song.image.assign(bank.begin() + static_cast<ptrdiff_t>(offset),
+                          bank.begin() + static_cast<ptrdiff_t>(offset + size));
+        song.duration_ms = get_u32(bank, entry + offsetof(bank_entry_t, duration_ms));
+        if (crc32(song.image.data(), song.image.size()) !=
+            get_u32(bank, entry + offsetof(bank_entry_t, crc32)))
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+        songs.push_back(std::move(song));
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+status_t
+song_bank_t::open(const uint8_t *bank,
+                  size_t         size)
+{
+    bank_    = nullptr;
+    entries_ = nullptr;
+    count_   = 0;
+
+    const bank_header_t *header = reinterpret_cast<const bank_header_t *>(bank);
+    if (reinterpret_cast<uintptr_t>(bank) % kBankAlign != 0 || size < sizeof(bank_header_t) ||
+        std::memcmp(header->magic, kBankMagic, sizeof(kBankMagic)) != 0 ||
+        header->version != kBankVersion ||
+        header->count > (size - sizeof(bank_header_t)) / sizeof(bank_entry_t))
+    {
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+
+    const bank_entry_t *entries = reinterpret_cast<const bank_entry_t *>(header + 1);
+    if (crc32(reinterpret_cast<const uint8_t *>(entries), header->count * sizeof(bank_entry_t)) !=
+        header->crc32)
+    {
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+    for (size_t i = 0; i != header->count; ++i)
+    {
+        const bank_entry_t &entry = entries[i];
+        if (entry.offset % kBankAlign != 0 || entry.offset > size ||
+            entry.size > size - entry.offset || entry.name[kBankNameSize - 1] != 0)
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+    }
+
+    bank_    = bank;
+    entries_ = entries;
+    count_   = header->count;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+song_bank_t::check(size_t i) const
+{
+    return crc32(song(i), entries_[i].size) == entries_[i].crc32;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_proto
+
+//================================================================================================//
@@ -0,0 +1,131 @@
+//================================================================================================//
+
+#ifndef __SONG_BANK_HH__
+#define __SONG_BANK_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+
+//================================================================================================//
+
+//
+// Bank of compiled songs flashed to partition and played by device in place:
+//
+//     bank   = header | entry... | song...
+//     header = magic "PBNK" | u8 version | 3 x u8 0 | u32 count | u32 crc32 of entries
+//     entry  = u32 offset | u32 size | u32 crc32 | u32 duration_ms | name, 32 bytes, 0 padded
+//     song   = image (see song_image.hh) at offset from begin of bank
+//
+// Numbers are little endian as on ESP32. Header, entries and songs start at multiples of
+// kBankAlign and gaps are filled with 0xff as erased flash, so device reads header and
+// entries through structs over mapped flash. Records of songs are still decoded one by one as
+// they are played, as those of uploaded songs. Bank is made the same way from the same songs.
+//
+namespace piano_proto
+{
+
+//================================================================================================//
+
+static const uint8_t kBankMagic[4]  = {'P', 'B', 'N', 'K'};
+static const uint8_t kBankVersion   = 1;
+static const size_t  kBankAlign     = 16;
+static const size_t  kBankNameSize  = 32;
+
+//------------------------------------------------------------------------------------------------//
+
+struct bank_header_t
+{
+    uint8_t  magic[4];
+    uint8_t  version;
+    uint8_t  reserved[3];
+    uint32_t count;
+    uint32_t crc32;
+};
+
+struct bank_entry_t
+{
+    uint32_t offset;
+    uint32_t size;
+    uint32_t crc32;
+    uint32_t duration_ms;
+    char     name[kBankNameSize];
+};
+
+static_assert(sizeof(bank_header_t) == 16 && sizeof(bank_entry_t) == 48,
+              "bank layout has no padding");
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Song of bank on host
+//
+struct bank_song_t
+{
+    std::string          name        = {};
+    std::vector<uint8_t> image       = {};
+    uint32_t             duration_ms = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Make bank of compiled songs. Duration is taken from the last record of each image, names
+// longer than kBankNameSize - 1 are cut. Returns STATUS_SONG_FORMAT_ERROR if an image is broken.
+//
+piano::status_t build_song_bank(const std::vector<bank_song_t> &songs,
+                                std::vector<uint8_t>           &bank);
+
+//
+// Read bank byte by byte into songs, checking every checksum. Host side, independent of
+// song_bank_t.
+//
+piano::status_t read_song_bank(const std::vector<uint8_t> &bank,
+                               std::vector<bank_song_t>   &songs);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Bank read in place, does not copy it: header and entries are checked once by open, each song
+// may be checked before it is played
+//
+class song_bank_t
+{
+  public:
+    //
+    // Bank must be aligned to kBankAlign, as mapped flash is. Returns STATUS_SONG_FORMAT_ERROR
+    // if header or entries are broken or songs are out of bank.
+    //
+    piano::status_t open(const uint8_t *bank, size_t size);
+
+    size_t              count()          const { return count_;              }
+    const bank_entry_t &entry(size_t i)  const { return entries_[i];         }
+    const uint8_t      *song(size_t i)   const { return bank_ + entries_[i].offset; }
+
+    //
+    // CRC-32 of song matches its entry
+    //
+    bool check(size_t i) const;
+
+  private:
+    const uint8_t      *bank_    = nullptr;
+    const bank_entry_t *entries_ = nullptr;
+    size_t              count_   = 0;
+};
+
+} // ! namespace piano_proto
+
+//================================================================================================//
+
+#endif // ! __SONG_BANK_HH__
+
+//================================================================================================//
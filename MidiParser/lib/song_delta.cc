@@ -0,0 +1,340 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "midi_file.hh"
+#include "song_delta.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+static const uint8_t kSignatureMagic[4]   = {'P', 'S', 'I', 'G'};
+static const size_t  kSignatureHeaderSize = sizeof(kSignatureMagic) + 3 * 4;
+static const size_t  kBlockHashSize       = 4 + 8;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Rolling checksum of size bytes: a is sum of bytes, b is sum of a over prefixes, both mod 2^16
+//
+struct weak_hash_t
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    void init(const uint8_t *data, size_t size)
+    {
+        a = b = 0;
+        for (size_t i = 0; i != size; ++i)
+        {
+            a += data[i];
+            b += static_cast<uint32_t>(size - i) * data[i];
+        }
+    }
+
+    //
+    // Slide window of size bytes by one: out leaves it, in enters it
+    //
+    void roll(uint8_t out, uint8_t in, size_t size)
+    {
+        a += static_cast<uint32_t>(in) - out;
+        b += a - static_cast<uint32_t>(size) * out;
+    }
+
+    uint32_t value() const { return (a & 0xffff) | (b << 16); }
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Copies of consecutive blocks are merged into one op
+//
+class patch_writer_t
+{
+  public:
+    explicit patch_writer_t(std::vector<uint8_t> &patch) : patch_(patch) {}
+
+    void copy(size_t block)
+    {
+        if (count_ != 0 && block == first_ + count_)
+        {
+            ++count_;
+            return;
+        }
+        flush();
+        first_ = block;
+        count_ = 1;
+    }
+
+    void literal(const uint8_t *data, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        flush();
+        put_varint(size << 1 | 1);
+        patch_.insert(patch_.end(), data, data + size);
+    }
+
+    void flush()
+    {
+        if (count_ != 0)
+        {
+            put_varint(count_ << 1);
+            put_varint(first_);
+        }
+        count_ = 0;
+    }
+
+    //
+    // Block the pending copy would continue with
+    //
+    size_t next_block() const { return (count_ == 0) ? SIZE_MAX : first_ + count_; }
+
+  private:
+    void put_varint(uint64_t value)
+    {
+        uint8_t bytes[10] = {};
+        patch_.insert(patch_.end(), bytes, bytes + piano_proto::write_varint(value, bytes));
+    }
+
+    std::vector<uint8_t> &patch_;
+    size_t                first_ = 0;
+    size_t                count_ = 0;
+};
+
+//================================================================================================//
+
+static uint64_t
+strong_hash(const uint8_t *data,
+            size_t         size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i != size; ++i)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+put_u32(uint32_t              value,
+        std::vector<uint8_t> &data)
+{
+    for (size_t i = 0; i != 4; ++i)
+    {
+        data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static uint64_t
+get_le(const uint8_t *data,
+       size_t         size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i != size; ++i)
+    {
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+//================================================================================================//
+
+void
+make_signature(const std::vector<uint8_t> &image,
+               uint32_t                    block_size,
+               song_signature_t           *signature)
+{
+    signature->block_size = block_size;
+    signature->size       = static_cast<uint32_t>(image.size());
+    signature->crc32      = piano_proto::crc32(image.data(), image.size());
+    signature->blocks.clear();
+    for (size_t offset = 0; offset < image.size(); offset += block_size)
+    {
+        size_t       size = std::min<size_t>(block_size, image.size() - offset);
+        weak_hash_t  weak;
+        block_hash_t block;
+        weak.init(image.data() + offset, size);
+        block.weak   = weak.value();
+        block.strong = strong_hash(image.data() + offset, size);
+        signature->blocks.push_back(block);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+make_patch(const song_signature_t     &base,
+           const std::vector<uint8_t> &image,
+           std::vector<uint8_t>       &patch)
+{
+    const size_t block_size = base.block_size;
+    const size_t size       = image.size();
+    const uint8_t *data     = image.data();
+
+    // Short last block of base can only match the end of image
+    std::unordered_map<uint32_t, std::vector<size_t>> index;
+    size_t full_blocks = (block_size == 0) ? 0 : base.size / block_size;
+    for (size_t block = 0; block != full_blocks; ++block)
+    {
+        index[base.blocks[block].weak].push_back(block);
+    }
+
+    patch.clear();
+    patch_writer_t writer(patch);
+    weak_hash_t    weak;
+    size_t         pos     = 0;
+    size_t         literal = 0;
+    bool           hashed  = false;
+    while (block_size != 0 && pos + block_size <= size)
+    {
+        if (!hashed)
+        {
+            weak.init(data + pos, block_size);
+            hashed = true;
+        }
+
+        // Block which continues the pending copy is preferred among equal ones
+        size_t match = SIZE_MAX;
+        auto   found = index.find(weak.value());
+        if (found != index.end())
+        {
+            uint64_t strong = strong_hash(data + pos, block_size);
+            for (size_t block : found->second)
+            {
+                if (base.blocks[block].strong == strong &&
+                    (match == SIZE_MAX || block == writer.next_block()))
+                {
+                    match = block;
+                }
+            }
+        }
+
+        if (match != SIZE_MAX)
+        {
+            writer.literal(data + literal, pos - literal);
+            writer.copy(match);
+            pos     += block_size;
+            literal  = pos;
+            hashed   = false;
+            continue;
+        }
+        if (pos + block_size < size)
+        {
+            weak.roll(data[pos], data[pos + block_size], block_size);
+        }
+        ++pos;
+    }
+
+    size_t tail = (block_size == 0) ? 0 : base.size % block_size;
+    if (tail != 0 && size - literal >= tail &&
+        base.blocks.back().strong == strong_hash(data + size - tail, tail))
+    {
+        writer.literal(data + literal, size - tail - literal);
+        writer.copy(base.blocks.size() - 1);
+        literal = size;
+    }
+    writer.literal(data + literal, size - literal);
+    writer.flush();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+save_signature(const char             *path,
+               const song_signature_t &signature)
+{
+    std::vector<uint8_t> data(kSignatureMagic, kSignatureMagic + sizeof(kSignatureMagic));
+    put_u32(signature.block_size, data);
+    put_u32(signature.size,       data);
+    put_u32(signature.crc32,      data);
+    for (const block_hash_t &block : signature.blocks)
+    {
+        put_u32(block.weak, data);
+        put_u32(static_cast<uint32_t>(block.strong),       data);
+        put_u32(static_cast<uint32_t>(block.strong >> 32), data);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(reinterpret_cast<const char *>(data.data()),
+                    static_cast<std::streamsize>(data.size())))
+    {
+        std::cerr << "Error while writing " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+load_signature(const char       *path,
+               song_signature_t *signature)
+{
+    std::vector<uint8_t> data;
+    status_t status = piano_midi::read_file(path, data);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    const uint8_t *pos = data.data() + sizeof(kSignatureMagic);
+    if (data.size() < kSignatureHeaderSize ||
+        memcmp(data.data(), kSignatureMagic, sizeof(kSignatureMagic)) != 0)
+    {
+        std::cerr << "Not a song signature: " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+    signature->block_size = static_cast<uint32_t>(get_le(pos,     4));
+    signature->size       = static_cast<uint32_t>(get_le(pos + 4, 4));
+    signature->crc32      = static_cast<uint32_t>(get_le(pos + 8, 4));
+
+    size_t blocks = (signature->block_size == 0) ? 0 :
+                    (signature->size + signature->block_size - 1) / signature->block_size;
+    if (signature->block_size == 0 ||
+        data.size() != kSignatureHeaderSize + blocks * kBlockHashSize)
+    {
+        std::cerr << "Broken song signature: " << path << "\n";
+        return STATUS_FILE_ERROR;
+    }
+
+    signature->blocks.resize(blocks);
+    pos = data.data() + kSignatureHeaderSize;
+    for (block_hash_t &block : signature->blocks)
+    {
+        block.weak   = static_cast<uint32_t>(get_le(pos, 4));
+        block.strong = get_le(pos + 4, 8);
+        pos += kBlockHashSize;
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
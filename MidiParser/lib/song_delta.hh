@@ -0,0 +1,82 @@
+//================================================================================================//
+
+#ifndef __SONG_DELTA_HH__
+#define __SONG_DELTA_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+
+//================================================================================================//
+
+//
+// Delta of compiled songs. Host keeps signature of the image it sent last: CRC-32 of the image
+// and weak and strong hash of each block. Edited image is matched against it at every offset
+// with rolling weak hash, blocks which are found are sent as copies and only the rest goes as
+// literal bytes (see patch format in song_image.hh). Patch size follows size of edit, not of
+// song, and image itself is not needed on host.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+static const uint32_t kDeltaBlockSize = 64;
+
+//------------------------------------------------------------------------------------------------//
+
+struct block_hash_t
+{
+    //
+    // Rolling checksum of rsync, the pair of 16-bit sums
+    //
+    uint32_t weak   = 0;
+
+    //
+    // FNV-1a, confirms weak match. Its rare false match is caught by CRC-32 of image on device.
+    //
+    uint64_t strong = 0;
+};
+
+struct song_signature_t
+{
+    uint32_t                  block_size = kDeltaBlockSize;
+    uint32_t                  size       = 0;
+    uint32_t                  crc32      = 0;
+    std::vector<block_hash_t> blocks;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+void make_signature(const std::vector<uint8_t> &image,
+                    uint32_t                    block_size,
+                    song_signature_t           *signature);
+
+//
+// Patch which turns image with signature base into image
+//
+void make_patch(const song_signature_t     &base,
+                const std::vector<uint8_t> &image,
+                std::vector<uint8_t>       &patch);
+
+//
+// Signature file:
+//
+//     magic "PSIG" | u32 block_size | u32 size | u32 crc32 | (u32 weak | u64 strong)...
+//
+piano::status_t save_signature(const char *path, const song_signature_t &signature);
+piano::status_t load_signature(const char *path, song_signature_t *signature);
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __SONG_DELTA_HH__
+
+//================================================================================================//
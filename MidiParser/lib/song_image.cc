@@ -0,0 +1,154 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+
+//================================================================================================//
+
+namespace piano_proto
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+status_t
+compile_song(const std::vector<message_t> &messages,
+             std::vector<uint8_t>         &image)
+{
+    image.assign(kSongMagic, kSongMagic + sizeof(kSongMagic));
+    image.push_back(kSongVersion);
+
+    uint8_t raw[kMaxRawFrameSize] = {};
+    for (const message_t &message : messages)
+    {
+        // Device has no use for anything but timed messages
+        if (message.type != MESSAGE_NOTE_BATCH &&
+            message.type != MESSAGE_KEY_FRAME  &&
+            message.type != MESSAGE_TEMPO)
+        {
+            return STATUS_PROTOCOL_MESSAGE_ERROR;
+        }
+
+        size_t   size   = 0;
+        status_t status = encode_raw(message, raw, sizeof(raw), &size);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        image.push_back(static_cast<uint8_t>(size));
+        image.insert(image.end(), raw, raw + size);
+    }
+
+    if (image.size() > kMaxSongSize)
+    {
+        return STATUS_PROTOCOL_OVERFLOW;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+apply_patch(const uint8_t *base,
+            size_t         base_size,
+            size_t         block_size,
+            const uint8_t *patch,
+            size_t         patch_size,
+            uint8_t       *image,
+            size_t         capacity,
+            size_t        *size)
+{
+    const uint8_t *pos    = patch;
+    const uint8_t *end    = patch + patch_size;
+    size_t         blocks = (block_size == 0) ? 0 : (base_size + block_size - 1) / block_size;
+    size_t         done   = 0;
+    while (pos != end)
+    {
+        uint64_t header = 0;
+        uint64_t block  = 0;
+        if (!read_varint(pos, end, &header))
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+
+        // Copy of blocks or literal bytes taken from patch itself
+        uint64_t       count = header >> 1;
+        const uint8_t *src   = pos;
+        uint64_t       bytes = count;
+        if ((header & 1) == 0)
+        {
+            if (!read_varint(pos, end, &block) || count > blocks || block > blocks - count)
+            {
+                return STATUS_SONG_FORMAT_ERROR;
+            }
+            src   = base + block * block_size;
+            bytes = std::min<uint64_t>(count * block_size, base_size - block * block_size);
+        } else if (count > static_cast<uint64_t>(end - pos))
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        } else
+        {
+            pos += count;
+        }
+
+        if (bytes > capacity - done)
+        {
+            return STATUS_SONG_FORMAT_ERROR;
+        }
+        std::memcpy(image + done, src, bytes);
+        done += bytes;
+    }
+    *size = done;
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+status_t
+song_reader_t::open(const uint8_t *image,
+                    size_t         size)
+{
+    if (size < kSongHeaderSize ||
+        std::memcmp(image, kSongMagic, sizeof(kSongMagic)) != 0 ||
+        image[sizeof(kSongMagic)] != kSongVersion)
+    {
+        pos_ = end_ = nullptr;
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+    pos_ = image + kSongHeaderSize;
+    end_ = image + size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+song_reader_t::next(message_t *message)
+{
+    size_t size = *pos_;
+    if (static_cast<size_t>(end_ - pos_) < 1 + size ||
+        decode_message(pos_ + 1, size, message) != STATUS_SUCCESS)
+    {
+        return STATUS_SONG_FORMAT_ERROR;
+    }
+    pos_ += 1 + size;
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_proto
+
+//================================================================================================//
@@ -0,0 +1,100 @@
+//================================================================================================//
+
+#ifndef __SONG_IMAGE_HH__
+#define __SONG_IMAGE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+
+//================================================================================================//
+
+//
+// Compiled song which device stores and plays without host:
+//
+//     magic "PSNG" | u8 version | records
+//     record = u8 size | raw frame (type | payload | crc16, see encode_raw)
+//
+// Records are note batches, key frames and tempo changes in order of time, their time_us is
+// song time. Each record keeps its crc16, so damaged storage is found while playing.
+//
+// Patch (MESSAGE_PATCH_BEGIN) makes new image out of base image the device stores:
+//
+//     patch = op...
+//     op    = varint (count << 1)     | varint block    copy count blocks of base from block on
+//           | varint (count << 1 | 1) | count bytes     literal bytes
+//
+// Base is split into blocks of block_size bytes, the last one may be shorter.
+//
+namespace piano_proto
+{
+
+//================================================================================================//
+
+static const uint8_t kSongMagic[4]   = {'P', 'S', 'N', 'G'};
+static const uint8_t kSongVersion    = 1;
+static const size_t  kSongHeaderSize = sizeof(kSongMagic) + 1;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Compile messages made by make_messages or make_key_frame_messages into image
+//
+piano::status_t compile_song(const std::vector<message_t> &messages,
+                             std::vector<uint8_t>         &image);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Apply patch to base, image must not overlap base. Returns STATUS_SONG_FORMAT_ERROR if patch is
+// broken, refers to blocks out of base or makes image larger than capacity.
+//
+piano::status_t apply_patch(const uint8_t *base,
+                            size_t         base_size,
+                            size_t         block_size,
+                            const uint8_t *patch,
+                            size_t         patch_size,
+                            uint8_t       *image,
+                            size_t         capacity,
+                            size_t        *size);
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Sequential reader of image, does not copy it
+//
+class song_reader_t
+{
+  public:
+    //
+    // Check header, reader is positioned at the first record
+    //
+    piano::status_t open(const uint8_t *image, size_t size);
+
+    bool done() const { return pos_ == end_; }
+
+    //
+    // Decode the next record, done must be false. Returns STATUS_SONG_FORMAT_ERROR if record is
+    // truncated or broken, reader stays at it.
+    //
+    piano::status_t next(message_t *message);
+
+  private:
+    const uint8_t *pos_ = nullptr;
+    const uint8_t *end_ = nullptr;
+};
+
+} // ! namespace piano_proto
+
+//================================================================================================//
+
+#endif // ! __SONG_IMAGE_HH__
+
+//================================================================================================//
@@ -0,0 +1,251 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstring>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+#include "song_store.hh"
+
+//================================================================================================//
+
+namespace piano_device
+{
+
+//================================================================================================//
+
+void
+song_store_t::begin(const piano_proto::upload_begin_t &begin,
+                    uint8_t                           *storage,
+                    size_t                             capacity,
+                    piano_proto::upload_ack_t         *ack)
+{
+    if (!start(begin.size, begin.crc32, 0, storage, capacity, ack))
+    {
+        return;
+    }
+
+    data_      = slot_;
+    data_size_ = size_;
+    if (state_ == piano_proto::UPLOAD_RECEIVING)
+    {
+        chunks_ = (data_size_ + piano_proto::kUploadChunkSize - 1) / piano_proto::kUploadChunkSize;
+    }
+    make_ack(ack);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+song_store_t::begin_patch(const piano_proto::patch_begin_t &begin,
+                          uint8_t                          *storage,
+                          size_t                            capacity,
+                          piano_proto::upload_ack_t        *ack)
+{
+    if (!start(begin.size, begin.crc32, begin.block_size, storage, capacity, ack))
+    {
+        return;
+    }
+
+    if (state_ == piano_proto::UPLOAD_RECEIVING)
+    {
+        if (song_ == nullptr || begin.base_crc32 != song_crc32_)
+        {
+            state_ = piano_proto::UPLOAD_BASE_MISMATCH;
+        } else if (begin.patch_size > slot_size_ - size_ ||
+                   begin.patch_size > piano_proto::kMaxSongSize)
+        {
+            state_ = piano_proto::UPLOAD_TOO_LARGE;
+        } else if (begin.patch_size == 0 || begin.block_size == 0)
+        {
+            state_ = piano_proto::UPLOAD_CRC_ERROR;
+        }
+    }
+
+    if (state_ == piano_proto::UPLOAD_RECEIVING)
+    {
+        data_size_ = begin.patch_size;
+        data_      = slot_ + slot_size_ - data_size_;
+        chunks_    = (data_size_ + piano_proto::kUploadChunkSize - 1) /
+                     piano_proto::kUploadChunkSize;
+    }
+    make_ack(ack);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+song_store_t::start(uint32_t                   size,
+                    uint32_t                   crc32,
+                    uint32_t                   block_size,
+                    uint8_t                   *storage,
+                    size_t                     capacity,
+                    piano_proto::upload_ack_t *ack)
+{
+    if (storage != storage_)
+    {
+        storage_   = storage;
+        slot_size_ = capacity / 2;
+        song_      = nullptr;
+        state_     = piano_proto::UPLOAD_IDLE;
+    }
+
+    // Repeated begin does not lose received chunks, the same song is not uploaded again
+    bool same = size == size_ && crc32 == crc32_;
+    if (storage != nullptr && same && block_size == block_size_ &&
+        state_ == piano_proto::UPLOAD_RECEIVING)
+    {
+        make_ack(ack);
+        return false;
+    }
+
+    size_       = size;
+    crc32_      = crc32;
+    block_size_ = block_size;
+    chunks_     = 0;
+    next_       = 0;
+    memset(received_, 0, sizeof(received_));
+
+    if (song_ != nullptr && size == song_size_ && crc32 == song_crc32_)
+    {
+        state_ = piano_proto::UPLOAD_COMPLETE;
+        make_ack(ack);
+        return false;
+    }
+
+    // New image never goes over the stored song
+    slot_ = (song_ == storage_) ? storage_ + slot_size_ : storage_;
+    if (storage == nullptr || size_ > slot_size_ || size_ > piano_proto::kMaxSongSize)
+    {
+        state_ = piano_proto::UPLOAD_TOO_LARGE;
+    } else
+    {
+        state_ = (size_ == 0) ? piano_proto::UPLOAD_CRC_ERROR : piano_proto::UPLOAD_RECEIVING;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+song_store_t::chunk(const piano_proto::upload_chunk_t &chunk,
+                    piano_proto::upload_ack_t         *ack)
+{
+    // Duplicates and chunks outside of window are only answered, ack tells host what is missing
+    size_t sequence = chunk.sequence;
+    size_t offset   = sequence * piano_proto::kUploadChunkSize;
+    if (state_ == piano_proto::UPLOAD_RECEIVING &&
+        sequence < chunks_ && sequence < next_ + piano_proto::kUploadWindow &&
+        !received(sequence) &&
+        chunk.size == std::min(piano_proto::kUploadChunkSize, data_size_ - offset))
+    {
+        memcpy(data_ + offset, chunk.data, chunk.size);
+        received_[sequence / 8] = static_cast<uint8_t>(received_[sequence / 8] |
+                                                        (1u << (sequence % 8)));
+        while (next_ != chunks_ && received(next_))
+        {
+            ++next_;
+        }
+        if (next_ == chunks_)
+        {
+            finish();
+        }
+    }
+    make_ack(ack);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+song_store_t::finish()
+{
+    // Patch is at the tail of slot, behind capacity given for image
+    size_t size  = size_;
+    bool   valid = true;
+    if (block_size_ != 0)
+    {
+        valid = piano_proto::apply_patch(song_, song_size_, block_size_, data_, data_size_,
+                                         slot_, size_, &size) == piano::STATUS_SUCCESS;
+    }
+    if (!valid || size != size_ || piano_proto::crc32(slot_, size_) != crc32_)
+    {
+        state_ = piano_proto::UPLOAD_CRC_ERROR;
+        return;
+    }
+
+    song_       = slot_;
+    song_size_  = size_;
+    song_crc32_ = crc32_;
+    state_      = piano_proto::UPLOAD_COMPLETE;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+song_store_t::make_ack(piano_proto::upload_ack_t *ack) const
+{
+    ack->crc32  = crc32_;
+    ack->next   = static_cast<uint32_t>(next_);
+    ack->mask   = 0;
+    ack->window = static_cast<uint8_t>(piano_proto::kUploadWindow);
+    ack->state  = state_;
+    for (size_t i = 0; i != 32 && next_ + 1 + i < chunks_; ++i)
+    {
+        ack->mask |= received(next_ + 1 + i) ? 1u << i : 0;
+    }
+}
+
+//================================================================================================//
+
+piano::status_t
+song_player_t::start(const uint8_t *image,
+                     size_t         size,
+                     int64_t        start_us)
+{
+    playing_  = false;
+    image_    = image;
+    start_us_ = start_us;
+    piano::status_t status = reader_.open(image, size);
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return status;
+    }
+    playing_ = true;
+    advance();
+    return piano::STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+song_player_t::due(int64_t                 now_us,
+                   piano_proto::message_t *message)
+{
+    if (!playing_ || next_time_us() > now_us)
+    {
+        return false;
+    }
+    *message = next_;
+    advance();
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+song_player_t::advance()
+{
+    if (reader_.done() || reader_.next(&next_) != piano::STATUS_SUCCESS)
+    {
+        playing_ = false;
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_device
+
+//================================================================================================//
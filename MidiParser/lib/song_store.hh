@@ -0,0 +1,172 @@
+//================================================================================================//
+
+#ifndef __SONG_STORE_HH__
+#define __SONG_STORE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+
+//================================================================================================//
+
+//
+// Uploaded song on device: receiving side of MESSAGE_UPLOAD_* and playback of stored image.
+// Part of portable firmware, memory for image is given by platform.
+//
+namespace piano_device
+{
+
+//================================================================================================//
+
+//
+// Storage platform gives for songs, firmware and simulator alike: two slots of the largest song,
+// the stored one and the one being uploaded or patched. Kept in RAM of ESP32.
+//
+static const size_t kSongStorageSize = 2 * piano_proto::kMaxSongSize;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Storage is split in two slots: one keeps the stored song, upload goes to the other one and
+// replaces the song only when it is complete and matches CRC-32 of its begin. Chunks are written
+// at their offset in any order, bitmap tells which ones came.
+//
+// Patch is received into the tail of the free slot and applied to the stored song at the head
+// of it, so new image and patch together must fit in the slot.
+//
+class song_store_t
+{
+  public:
+    //
+    // Start upload of image or patch. Begin of the upload in progress or of the stored song only
+    // answers it.
+    //
+    void begin(const piano_proto::upload_begin_t &begin,
+               uint8_t                           *storage,
+               size_t                             capacity,
+               piano_proto::upload_ack_t         *ack);
+
+    void begin_patch(const piano_proto::patch_begin_t &begin,
+                     uint8_t                          *storage,
+                     size_t                            capacity,
+                     piano_proto::upload_ack_t        *ack);
+
+    void chunk(const piano_proto::upload_chunk_t &chunk, piano_proto::upload_ack_t *ack);
+
+    //
+    // Stored song, the last complete upload
+    //
+    bool           complete() const { return song_ != nullptr; }
+    const uint8_t *data()     const { return song_;            }
+    size_t         size()     const { return song_size_;       }
+    uint32_t       crc32()    const { return song_crc32_;      }
+
+    //
+    // Upload in progress writes over image, the song before the stored one in the free slot
+    //
+    bool overwrites(const uint8_t *image) const
+    {
+        return state_ == piano_proto::UPLOAD_RECEIVING && image != nullptr && image == slot_;
+    }
+
+  private:
+    //
+    // Common part of both begins, returns false if begin was only answered
+    //
+    bool start(uint32_t                   size,
+               uint32_t                   crc32,
+               uint32_t                   block_size,
+               uint8_t                   *storage,
+               size_t                     capacity,
+               piano_proto::upload_ack_t *ack);
+
+    //
+    // Make image out of received data and replace stored song with it
+    //
+    void finish();
+
+    bool received(size_t sequence) const
+    {
+        return (received_[sequence / 8] >> (sequence % 8)) & 1;
+    }
+
+    void make_ack(piano_proto::upload_ack_t *ack) const;
+
+    uint8_t                    *storage_     = nullptr;
+    size_t                      slot_size_   = 0;
+
+    const uint8_t              *song_        = nullptr;
+    size_t                      song_size_   = 0;
+    uint32_t                    song_crc32_  = 0;
+
+    //
+    // Upload: new image of size_ goes to slot_, chunks are written to data_ (slot_ itself for
+    // image, its tail for patch). Block size is 0 for image.
+    //
+    uint8_t                    *slot_        = nullptr;
+    uint8_t                    *data_        = nullptr;
+    size_t                      data_size_   = 0;
+    size_t                      size_        = 0;
+    uint32_t                    crc32_       = 0;
+    uint32_t                    block_size_  = 0;
+    size_t                      chunks_      = 0;
+    size_t                      next_        = 0;
+    piano_proto::upload_state_t state_       = piano_proto::UPLOAD_IDLE;
+    uint8_t                     received_[(piano_proto::kMaxSongChunks + 7) / 8] = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Playback of image: song time 0 is at device time start_us
+//
+class song_player_t
+{
+  public:
+    piano::status_t start(const uint8_t *image, size_t size, int64_t start_us);
+    void            stop() { playing_ = false; }
+
+    //
+    // Image being played, nullptr when stopped
+    //
+    const uint8_t *image() const { return playing_ ? image_ : nullptr; }
+
+    //
+    // Device time of the next record, playing must be true
+    //
+    bool    playing()      const { return playing_; }
+    int64_t next_time_us() const
+    {
+        return start_us_ + static_cast<int64_t>(piano_proto::message_time(next_));
+    }
+
+    //
+    // Take the next record if it is due at now_us. Playback stops at the end of image and at
+    // broken record.
+    //
+    bool due(int64_t now_us, piano_proto::message_t *message);
+
+  private:
+    void advance();
+
+    piano_proto::song_reader_t reader_;
+    piano_proto::message_t     next_;
+    const uint8_t             *image_    = nullptr;
+    int64_t                    start_us_ = 0;
+    bool                       playing_  = false;
+};
+
+} // ! namespace piano_device
+
+//================================================================================================//
+
+#endif // ! __SONG_STORE_HH__
+
+//================================================================================================//
@@ -0,0 +1,394 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "clock_sync.hh"
+#include "song_delta.hh"
+#include "song_upload.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Chunk of image on host side of window
+//
+struct chunk_state_t
+{
+    int64_t sent_us = 0;
+    size_t  sends   = 0;
+    bool    acked   = false;
+
+    //
+    // A chunk sent after it has been acked, it has to be sent again at once
+    //
+    bool    lost    = false;
+};
+
+//================================================================================================//
+
+static status_t
+write_message(int                           fd,
+              const piano_proto::message_t &message,
+              size_t                       *wire_bytes)
+{
+    uint8_t  frame[piano_proto::kMaxFrameSize] = {};
+    size_t   size   = 0;
+    status_t status = piano_proto::encode_message(message, frame, sizeof(frame), &size);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    if (write(fd, frame, size) != static_cast<ssize_t>(size))
+    {
+        return STATUS_SERIAL_WRITE_ERROR;
+    }
+    *wire_bytes += size;
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Wait up to deadline_us for ack of upload with given crc. Acks of other uploads and other
+// messages are skipped.
+//
+static status_t
+receive_ack(int                           fd,
+            uint32_t                      crc32,
+            int64_t                       deadline_us,
+            piano_proto::frame_decoder_t *decoder,
+            piano_proto::upload_ack_t    *ack)
+{
+    piano_proto::message_t message;
+    uint8_t                byte = 0;
+
+    int64_t now_us = host_time_us();
+    do
+    {
+        pollfd request = {fd, POLLIN, 0};
+        int    ready   = poll(&request, 1, static_cast<int>((deadline_us - now_us + 999) / 1000));
+        if (ready < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+
+        // Bytes are taken one by one, so that the following acks stay in driver for next call
+        while (ready != 0 && read(fd, &byte, 1) == 1)
+        {
+            if (decoder->push(byte, &message) == STATUS_SUCCESS &&
+                message.type == piano_proto::MESSAGE_UPLOAD_ACK &&
+                message.upload_ack.crc32 == crc32)
+            {
+                *ack = message.upload_ack;
+                return STATUS_SUCCESS;
+            }
+            pollfd more = {fd, POLLIN, 0};
+            ready = poll(&more, 1, 0);
+        }
+        now_us = host_time_us();
+    } while (now_us < deadline_us);
+    return STATUS_UPLOAD_TIMEOUT;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Send begin until device answers, then data in chunks until device completes or rejects upload.
+// Returns state of upload in ack.
+//
+static status_t
+transfer(int                           fd,
+         uint32_t                      baud_rate,
+         const piano_proto::message_t &begin,
+         uint32_t                      crc32,
+         const std::vector<uint8_t>   &data,
+         const upload_config_t        &config,
+         upload_result_t              *result,
+         piano_proto::upload_ack_t    *ack)
+{
+    const size_t kChunk  = piano_proto::kUploadChunkSize;
+    size_t       chunks  = (data.size() + kChunk - 1) / kChunk;
+    int64_t      start   = host_time_us();
+
+    result->chunks += chunks;
+
+    // Until round trip is measured, timeout covers the whole window on the wire
+    double  byte_us = (baud_rate == 0) ? 0. : 10. * 1e6 / baud_rate;
+    int64_t min_us  = static_cast<int64_t>(config.min_retransmit_us);
+    double  srtt_us = 2. * static_cast<double>(piano_proto::kUploadWindow *
+                                                piano_proto::kMaxFrameSize) * byte_us;
+    int64_t rto_us  = std::max(min_us, static_cast<int64_t>(2. * srtt_us));
+
+    piano_proto::frame_decoder_t decoder;
+    piano_proto::message_t       message;
+
+    // Begin is repeated until device answers
+    status_t status = STATUS_UPLOAD_TIMEOUT;
+    for (int64_t now_us = start; status == STATUS_UPLOAD_TIMEOUT &&
+                                 now_us - start < static_cast<int64_t>(config.timeout_us);)
+    {
+        status = write_message(fd, begin, &result->wire_bytes);
+        if (status == STATUS_SUCCESS)
+        {
+            status = receive_ack(fd, crc32, host_time_us() + rto_us, &decoder, ack);
+        }
+        now_us = host_time_us();
+    }
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    std::vector<chunk_state_t> states(chunks);
+    int64_t                    last_ack_us = host_time_us();
+    result->skipped = ack->state == piano_proto::UPLOAD_COMPLETE;
+
+    message.type = piano_proto::MESSAGE_UPLOAD_CHUNK;
+    while (ack->state == piano_proto::UPLOAD_RECEIVING)
+    {
+        // Chunks in window which were never sent, are known to be lost or timed out
+        int64_t now_us      = host_time_us();
+        int64_t deadline_us = last_ack_us + static_cast<int64_t>(config.timeout_us);
+        size_t  end         = std::min<size_t>(chunks, ack->next + ack->window);
+        for (size_t sequence = ack->next; sequence < end; ++sequence)
+        {
+            chunk_state_t &chunk = states[sequence];
+            if (chunk.acked)
+            {
+                continue;
+            }
+            if (chunk.sends != 0 && !chunk.lost && now_us - chunk.sent_us < rto_us)
+            {
+                deadline_us = std::min(deadline_us, chunk.sent_us + rto_us);
+                continue;
+            }
+
+            size_t offset = sequence * kChunk;
+            message.upload_chunk.sequence = static_cast<uint32_t>(sequence);
+            message.upload_chunk.size     = static_cast<uint8_t>(std::min(kChunk,
+                                                                          data.size() - offset));
+            std::copy_n(data.data() + offset, message.upload_chunk.size,
+                        message.upload_chunk.data);
+            status = write_message(fd, message, &result->wire_bytes);
+            if (status != STATUS_SUCCESS)
+            {
+                return status;
+            }
+
+            result->retransmits += (chunk.sends != 0) ? 1 : 0;
+            chunk.sent_us = now_us = host_time_us();
+            chunk.lost    = false;
+            ++chunk.sends;
+            deadline_us = std::min(deadline_us, chunk.sent_us + rto_us);
+        }
+
+        status = receive_ack(fd, crc32, deadline_us, &decoder, ack);
+        now_us = host_time_us();
+        if (status == STATUS_UPLOAD_TIMEOUT)
+        {
+            if (now_us - last_ack_us >= static_cast<int64_t>(config.timeout_us))
+            {
+                return status;
+            }
+            continue;
+        } else if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        last_ack_us = now_us;
+
+        // Round trip is measured on chunks sent once only, so that ack is surely theirs
+        auto acknowledge = [&](size_t sequence)
+        {
+            chunk_state_t &chunk = states[sequence];
+            if (chunk.acked || chunk.sends == 0)
+            {
+                return;
+            }
+            chunk.acked = true;
+            if (chunk.sends == 1)
+            {
+                double sample = static_cast<double>(now_us - chunk.sent_us);
+                result->round_trip_us.add(sample);
+                srtt_us = 0.875 * srtt_us + 0.125 * sample;
+                rto_us  = std::max(min_us, static_cast<int64_t>(2. * srtt_us));
+            }
+        };
+        size_t highest = ack->next;
+        for (size_t sequence = 0; sequence < std::min<size_t>(ack->next, chunks); ++sequence)
+        {
+            acknowledge(sequence);
+        }
+        for (size_t i = 0; i != 32 && ack->next + 1 + i < chunks; ++i)
+        {
+            if ((ack->mask >> i) & 1)
+            {
+                highest = ack->next + 1 + i;
+                acknowledge(highest);
+            }
+        }
+
+        // Device got a chunk sent later, so the missing ones sent before it are lost
+        for (size_t sequence = ack->next; sequence < highest; ++sequence)
+        {
+            chunk_state_t &chunk = states[sequence];
+            if (!chunk.acked && chunk.sends != 0 && chunk.sent_us <= states[highest].sent_us)
+            {
+                chunk.lost = true;
+            }
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static const char *
+state_name(piano_proto::upload_state_t state)
+{
+    switch (state)
+    {
+        case piano_proto::UPLOAD_TOO_LARGE:     return "too large";
+        case piano_proto::UPLOAD_BASE_MISMATCH: return "base of patch is not on device";
+        default:                                return "CRC mismatch";
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+upload_song(int                         fd,
+            uint32_t                    baud_rate,
+            const std::vector<uint8_t> &image,
+            const upload_config_t      &config,
+            upload_result_t            *result,
+            const song_signature_t     *base)
+{
+    uint32_t                  crc32 = piano_proto::crc32(image.data(), image.size());
+    int64_t                   start = host_time_us();
+    piano_proto::upload_ack_t ack;
+    piano_proto::message_t    begin;
+
+    result->image_bytes = image.size();
+
+    // Patch is worth it only if it is smaller than image, device may still refuse it
+    std::vector<uint8_t> patch;
+    if (base != nullptr && base->crc32 != crc32)
+    {
+        make_patch(*base, image, patch);
+    }
+    if (!patch.empty() && patch.size() < image.size())
+    {
+        begin.type                   = piano_proto::MESSAGE_PATCH_BEGIN;
+        begin.patch_begin.size       = static_cast<uint32_t>(image.size());
+        begin.patch_begin.crc32      = crc32;
+        begin.patch_begin.base_crc32 = base->crc32;
+        begin.patch_begin.block_size = base->block_size;
+        begin.patch_begin.patch_size = static_cast<uint32_t>(patch.size());
+        status_t status = transfer(fd, baud_rate, begin, crc32, patch, config, result, &ack);
+        if (status != STATUS_SUCCESS)
+        {
+            return status;
+        }
+        if (ack.state == piano_proto::UPLOAD_COMPLETE)
+        {
+            result->patch_bytes = result->skipped ? 0 : patch.size();
+            result->seconds     = static_cast<double>(host_time_us() - start) * 1e-6;
+            return STATUS_SUCCESS;
+        }
+        std::cerr << "Device did not apply patch (" << state_name(ack.state)
+                  << "), sending whole song\n";
+    }
+
+    begin.type               = piano_proto::MESSAGE_UPLOAD_BEGIN;
+    begin.upload_begin.size  = static_cast<uint32_t>(image.size());
+    begin.upload_begin.crc32 = crc32;
+    status_t status = transfer(fd, baud_rate, begin, crc32, image, config, result, &ack);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    result->seconds = static_cast<double>(host_time_us() - start) * 1e-6;
+    if (ack.state != piano_proto::UPLOAD_COMPLETE)
+    {
+        std::cerr << "Device rejected song: " << state_name(ack.state) << "\n";
+        return STATUS_UPLOAD_REJECTED;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+play_song(int      fd,
+          bool     play,
+          uint64_t start_us)
+{
+    piano_proto::message_t message;
+    message.type          = piano_proto::MESSAGE_PLAY;
+    message.play.play     = play;
+    message.play.start_us = start_us;
+
+    size_t wire_bytes = 0;
+    return write_message(fd, message, &wire_bytes);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+upload_result_t::print(std::ostream &out,
+                       uint32_t      baud_rate) const
+{
+    if (skipped)
+    {
+        out << "device already has this song (" << image_bytes << " bytes)\n";
+        return;
+    }
+
+    size_t sent = (patch_bytes != 0) ? patch_bytes : image_bytes;
+    double rate = (seconds > 0.) ? static_cast<double>(sent) / seconds : 0.;
+    out << std::fixed << std::setprecision(3) << "uploaded   : ";
+    if (patch_bytes != 0)
+    {
+        out << patch_bytes << " bytes patch of " << image_bytes << " bytes image";
+    } else
+    {
+        out << image_bytes << " bytes";
+    }
+    out << " in " << seconds << " s, " << std::setprecision(1) << rate / 1024. << " KiB/s";
+    if (baud_rate != 0)
+    {
+        out << ", " << 100. * rate / (baud_rate / 10.) << "% of " << baud_rate << " baud line";
+    }
+    out << "\n"
+        << "sent       : " << chunks << " chunks, " << retransmits << " retransmitted, "
+        << wire_bytes << " bytes on wire\n";
+    round_trip_us.print(out, "round trip ", "us");
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
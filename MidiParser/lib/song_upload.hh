@@ -0,0 +1,106 @@
+//================================================================================================//
+
+#ifndef __SONG_UPLOAD_HH__
+#define __SONG_UPLOAD_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "stats.hh"
+#include "song_delta.hh"
+
+//================================================================================================//
+
+//
+// Upload of compiled song (see song_image.hh) to device, which then plays it on its own clock
+// without host. Chunks go with sliding window: host keeps at most the window announced by
+// device in flight, so writes are throttled to the speed device takes them off UART and never
+// overrun its buffer. Every chunk is protected by crc16 of frame and whole image by CRC-32.
+// Damaged chunks are dropped by device and sent again:
+//
+//  - at once when ack shows that a chunk sent after it has arrived (UART keeps order)
+//  - after retransmission timeout, which follows measured round trip
+//
+// If host has signature of the song device stores (see song_delta.hh), only patch against it is
+// sent. Device which does not have that song or has no room for patch gets the whole image.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+struct upload_config_t
+{
+    //
+    // Upload fails if device does not answer for this long
+    //
+    uint64_t timeout_us        = 2000000;
+
+    //
+    // Lower bound of retransmission timeout
+    //
+    uint64_t min_retransmit_us = 20000;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct upload_result_t
+{
+    size_t         image_bytes = 0;
+    size_t         wire_bytes  = 0;
+    size_t         chunks      = 0;
+    size_t         retransmits = 0;
+    double         seconds     = 0.;
+
+    //
+    // Size of patch sent instead of image, 0 if image was sent
+    //
+    size_t         patch_bytes = 0;
+
+    //
+    // Device already had the same image, nothing was sent
+    //
+    bool           skipped     = false;
+
+    //
+    // Chunk write to its ack, for chunks sent once
+    //
+    sample_stats_t round_trip_us;
+
+    //
+    // Throughput is compared with the line limit: baud_rate / 10 bytes per second
+    //
+    void print(std::ostream &out, uint32_t baud_rate) const;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Upload image, as patch if base is signature of the song on device
+//
+piano::status_t upload_song(int                         fd,
+                            uint32_t                    baud_rate,
+                            const std::vector<uint8_t> &image,
+                            const upload_config_t      &config,
+                            upload_result_t            *result,
+                            const song_signature_t     *base = nullptr);
+
+//
+// Start playback of uploaded song at device time start_us (0 - at once) or stop it
+//
+piano::status_t play_song(int fd, bool play, uint64_t start_us = 0);
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __SONG_UPLOAD_HH__
+
+//================================================================================================//
@@ -0,0 +1,811 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "soundfont.hh"
+
+//================================================================================================//
+
+namespace piano_audio
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "Samples of SoundFont are little endian and used in place");
+
+//
+// Sizes of records in preset, instrument and sample header chunks
+//
+static const size_t kPresetHeaderSize     = 38;
+static const size_t kBagSize              = 4;
+static const size_t kGeneratorSize        = 4;
+static const size_t kInstrumentHeaderSize = 22;
+static const size_t kSampleHeaderSize     = 46;
+static const size_t kNameSize             = 20;
+
+//
+// Generators which shape zones, others are ignored
+//
+enum generator_t
+{
+    GEN_START_OFFSET        = 0,
+    GEN_END_OFFSET          = 1,
+    GEN_LOOP_START_OFFSET   = 2,
+    GEN_LOOP_END_OFFSET     = 3,
+    GEN_START_COARSE        = 4,
+    GEN_END_COARSE          = 12,
+    GEN_ATTACK              = 34,
+    GEN_HOLD                = 35,
+    GEN_DECAY               = 36,
+    GEN_SUSTAIN             = 37,
+    GEN_RELEASE             = 38,
+    GEN_INSTRUMENT          = 41,
+    GEN_KEY_RANGE           = 43,
+    GEN_VELOCITY_RANGE      = 44,
+    GEN_LOOP_START_COARSE   = 45,
+    GEN_ATTENUATION         = 48,
+    GEN_LOOP_END_COARSE     = 50,
+    GEN_COARSE_TUNE         = 51,
+    GEN_FINE_TUNE           = 52,
+    GEN_SAMPLE_ID           = 53,
+    GEN_SAMPLE_MODES        = 54,
+    GEN_SCALE_TUNING        = 56,
+    GEN_ROOT_KEY            = 58,
+
+    GEN_COUNT               = 61,
+};
+
+//
+// Envelope times in timecents of -12000 and below are instant. Decay and release go down by
+// kEnvelopeRangeDb over their time, voice is silent below kSilence.
+//
+static const int32_t kInstantTimecents = -12000;
+static const double  kEnvelopeRangeDb  = 96.;
+static const float   kSilence          = 1e-4f;
+
+//
+// Output samples resampled at once, one per lane
+//
+static const size_t kLanes = 8;
+
+typedef float lanes_t __attribute__((vector_size(kLanes * sizeof(float))));
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Generators of one zone. Preset zones start from zeros and add to instrument zones, which
+// start from defaults of the specification.
+//
+struct generators_t
+{
+    int32_t value[GEN_COUNT] = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+enum stage_t
+{
+    STAGE_ATTACK,
+    STAGE_HOLD,
+    STAGE_DECAY,
+    STAGE_SUSTAIN,
+    STAGE_RELEASE,
+    STAGE_DONE,
+};
+
+//
+// Voice plays zone from position, in frames with 32 fractional bits, advanced by step per output
+// sample. Envelope level is updated once per kLanes samples and ramps linearly in between.
+//
+struct sampler_t::sf_voice_t
+{
+    const sf_zone_t *zone     = nullptr;
+    uint64_t         position = 0;
+    uint64_t         step     = 0;
+    float            gain     = 0.f;
+    float            level    = 0.f;
+    stage_t          stage    = STAGE_DONE;
+    uint64_t         left     = 0;       // samples of attack or hold
+    float            attack   = 0.f;     // level added per kLanes samples
+    float            decay    = 1.f;     // factor per kLanes samples
+    float            release  = 1.f;
+    uint8_t          note     = 0;
+    bool             held     = false;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static uint16_t
+read_u16(const std::vector<uint8_t> &data,
+         size_t                      offset)
+{
+    return static_cast<uint16_t>(data[offset] | data[offset + 1] << 8);
+}
+
+static uint32_t
+read_u32(const uint8_t *data)
+{
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+           static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+read_exact(int       fd,
+           uint64_t  offset,
+           uint8_t  *dst,
+           size_t    size)
+{
+    size_t done = 0;
+    while (done != size)
+    {
+        ssize_t result = pread(fd, dst + done, size - done, static_cast<off_t>(offset + done));
+        if (result <= 0)
+        {
+            return false;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Defaults of instrument generators which are not zero
+//
+static generators_t
+instrument_defaults()
+{
+    generators_t result;
+    result.value[GEN_ATTACK]         = kInstantTimecents;
+    result.value[GEN_HOLD]           = kInstantTimecents;
+    result.value[GEN_DECAY]          = kInstantTimecents;
+    result.value[GEN_RELEASE]        = kInstantTimecents;
+    result.value[GEN_KEY_RANGE]      = 127 << 8;
+    result.value[GEN_VELOCITY_RANGE] = 127 << 8;
+    result.value[GEN_SCALE_TUNING]   = 100;
+    result.value[GEN_ROOT_KEY]       = -1;
+    return result;
+}
+
+static generators_t
+preset_defaults()
+{
+    generators_t result;
+    result.value[GEN_KEY_RANGE]      = 127 << 8;
+    result.value[GEN_VELOCITY_RANGE] = 127 << 8;
+    return result;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Zones of bags [first, end), each starting from base. The first zone is global if it does not
+// end with terminal generator, its generators then go into base of the others. Zones other than
+// global which lack terminal generator are dropped. Returns false if indices are out of range.
+//
+static bool
+read_zones(const std::vector<uint8_t> &bags,
+           const std::vector<uint8_t> &generators,
+           size_t                      first,
+           size_t                      end,
+           generator_t                 terminal,
+           generators_t                base,
+           std::vector<generators_t>  &zones)
+{
+    zones.clear();
+    if (first > end || (end + 1) * kBagSize > bags.size())
+    {
+        return false;
+    }
+    for (size_t bag = first; bag != end; ++bag)
+    {
+        size_t from = read_u16(bags, bag * kBagSize);
+        size_t to   = read_u16(bags, (bag + 1) * kBagSize);
+        if (from > to || to * kGeneratorSize > generators.size())
+        {
+            return false;
+        }
+
+        generators_t zone = base;
+        bool         last = false;
+        for (size_t i = from; i != to; ++i)
+        {
+            uint16_t type   = read_u16(generators, i * kGeneratorSize);
+            uint16_t amount = read_u16(generators, i * kGeneratorSize + 2);
+            if (type >= GEN_COUNT)
+            {
+                continue;
+            }
+            bool range       = type == GEN_KEY_RANGE || type == GEN_VELOCITY_RANGE;
+            zone.value[type] = range ? amount : static_cast<int16_t>(amount);
+            last             = type == terminal;
+        }
+
+        if (last)
+        {
+            zones.push_back(zone);
+        } else if (bag == first)
+        {
+            base = zone;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static float
+timecents_s(int32_t timecents)
+{
+    return (timecents <= kInstantTimecents) ? 0.f
+         : static_cast<float>(std::exp2(timecents / 1200.));
+}
+
+static float
+centibels_gain(int32_t centibels)
+{
+    return static_cast<float>(std::pow(10., -std::max(centibels, 0) / 200.));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Flatten preset zone with instrument zone, false if they have no key or velocity in common or
+// sample is out of sample chunk
+//
+static bool
+make_zone(const generators_t         &preset,
+          const generators_t         &instrument,
+          const std::vector<uint8_t> &samples,
+          size_t                      sample_count,
+          sf_zone_t                  *zone)
+{
+    auto sum = [&](generator_t type) { return preset.value[type] + instrument.value[type]; };
+    auto low = [&](generator_t type)
+    {
+        return std::max(preset.value[type] & 0xff, instrument.value[type] & 0xff);
+    };
+    auto high = [&](generator_t type)
+    {
+        return std::min(preset.value[type] >> 8, instrument.value[type] >> 8);
+    };
+
+    size_t sample = static_cast<size_t>(instrument.value[GEN_SAMPLE_ID]);
+    if (low(GEN_KEY_RANGE) > high(GEN_KEY_RANGE) ||
+        low(GEN_VELOCITY_RANGE) > high(GEN_VELOCITY_RANGE) ||
+        (sample + 2) * kSampleHeaderSize > samples.size())
+    {
+        return false;
+    }
+
+    // ROM samples are not in file
+    const uint8_t *header = &samples[sample * kSampleHeaderSize];
+    uint16_t       type   = static_cast<uint16_t>(header[44] | header[45] << 8);
+    if ((type & 0x8000) != 0)
+    {
+        return false;
+    }
+
+    // Offsets are relative to sample header and exist in instrument zones only
+    auto at = [&](size_t field, generator_t fine, generator_t coarse)
+    {
+        return static_cast<int64_t>(read_u32(header + field)) + instrument.value[fine] +
+               32768 * static_cast<int64_t>(instrument.value[coarse]);
+    };
+    int64_t start      = at(20, GEN_START_OFFSET,      GEN_START_COARSE);
+    int64_t end        = at(24, GEN_END_OFFSET,        GEN_END_COARSE);
+    int64_t loop_start = at(28, GEN_LOOP_START_OFFSET, GEN_LOOP_START_COARSE);
+    int64_t loop_end   = at(32, GEN_LOOP_END_OFFSET,   GEN_LOOP_END_COARSE);
+    if (start < 0 || start + 2 > end || end > static_cast<int64_t>(sample_count))
+    {
+        return false;
+    }
+
+    zone->key_lo       = static_cast<uint8_t>(low(GEN_KEY_RANGE));
+    zone->key_hi       = static_cast<uint8_t>(high(GEN_KEY_RANGE));
+    zone->velocity_lo  = static_cast<uint8_t>(low(GEN_VELOCITY_RANGE));
+    zone->velocity_hi  = static_cast<uint8_t>(high(GEN_VELOCITY_RANGE));
+    zone->start        = static_cast<uint32_t>(start);
+    zone->end          = static_cast<uint32_t>(end);
+    zone->loop_start   = static_cast<uint32_t>(std::max<int64_t>(loop_start, 0));
+    zone->loop_end     = static_cast<uint32_t>(std::max<int64_t>(loop_end, 0));
+
+    // Interpolation reads one frame past loop end
+    zone->loop         = (instrument.value[GEN_SAMPLE_MODES] & 1) != 0 && start <= loop_start &&
+                         loop_start < loop_end && loop_end < end;
+    zone->sample_rate  = read_u32(header + 36);
+    zone->root_key     = (instrument.value[GEN_ROOT_KEY] >= 0)
+                       ? static_cast<uint8_t>(std::min(instrument.value[GEN_ROOT_KEY], 127))
+                       : ((header[40] <= 127) ? header[40] : 60);
+    zone->tune_cents   = 100 * sum(GEN_COARSE_TUNE) + sum(GEN_FINE_TUNE) +
+                         static_cast<int8_t>(header[41]);
+    zone->scale_tuning = instrument.value[GEN_SCALE_TUNING];
+    zone->gain         = centibels_gain(sum(GEN_ATTENUATION));
+    zone->attack_s     = timecents_s(sum(GEN_ATTACK));
+    zone->hold_s       = timecents_s(sum(GEN_HOLD));
+    zone->decay_s      = timecents_s(sum(GEN_DECAY));
+    zone->sustain      = centibels_gain(std::min(sum(GEN_SUSTAIN), 1440));
+    zone->release_s    = timecents_s(sum(GEN_RELEASE));
+    return zone->sample_rate != 0;
+}
+
+//================================================================================================//
+
+soundfont_t::~soundfont_t()
+{
+    close();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+soundfont_t::close()
+{
+    if (map_ != nullptr)
+    {
+        munmap(map_, map_size_);
+    }
+    map_          = nullptr;
+    map_size_     = 0;
+    samples_      = nullptr;
+    sample_count_ = 0;
+    presets_.clear();
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+soundfont_t::open(const char *path)
+{
+    close();
+
+    int         fd   = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info = {};
+    if (fd == -1 || fstat(fd, &info) != 0)
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+        return STATUS_FILE_ERROR;
+    }
+
+    // RIFF form of sfbk: sample data in LIST sdta, headers in LIST pdta
+    uint64_t             file_size  = static_cast<uint64_t>(info.st_size);
+    uint64_t             smpl       = 0;
+    uint32_t             smpl_size  = 0;
+    std::vector<uint8_t> chunks[7]  = {};
+    static const char   *kHydra[7]  = {"phdr", "pbag", "pgen", "inst", "ibag", "igen", "shdr"};
+    uint8_t              header[12] = {};
+    bool valid = read_exact(fd, 0, header, sizeof(header)) &&
+                 std::memcmp(header, "RIFF", 4) == 0 && std::memcmp(header + 8, "sfbk", 4) == 0;
+    uint64_t end = std::min<uint64_t>(file_size, 8 + static_cast<uint64_t>(read_u32(header + 4)));
+    for (uint64_t list = 12; valid && list + 12 <= end;)
+    {
+        valid            = read_exact(fd, list, header, sizeof(header));
+        uint64_t size    = read_u32(header + 4);
+        uint64_t sub_end = std::min(end, list + 8 + size);
+        bool     is_list = std::memcmp(header, "LIST", 4) == 0;
+        bool     sdta    = is_list && std::memcmp(header + 8, "sdta", 4) == 0;
+        bool     pdta    = is_list && std::memcmp(header + 8, "pdta", 4) == 0;
+        for (uint64_t chunk = list + 12; valid && (sdta || pdta) && chunk + 8 <= sub_end;)
+        {
+            valid               = read_exact(fd, chunk, header, 8);
+            uint32_t chunk_size = read_u32(header + 4);
+            if (chunk + 8 + chunk_size > sub_end)
+            {
+                valid = false;
+                break;
+            }
+            if (sdta && std::memcmp(header, "smpl", 4) == 0)
+            {
+                smpl      = chunk + 8;
+                smpl_size = chunk_size;
+            }
+            for (size_t i = 0; i != 7 && pdta; ++i)
+            {
+                if (std::memcmp(header, kHydra[i], 4) == 0)
+                {
+                    chunks[i].resize(chunk_size);
+                    valid = read_exact(fd, chunk + 8, chunks[i].data(), chunk_size);
+                }
+            }
+            chunk += 8 + chunk_size + (chunk_size & 1);
+        }
+        list += 8 + size + (size & 1);
+    }
+
+    const std::vector<uint8_t> &presets     = chunks[0];
+    const std::vector<uint8_t> &instruments = chunks[3];
+    const std::vector<uint8_t> &samples     = chunks[6];
+    valid = valid && smpl_size >= 2 &&
+            presets.size() >= 2 * kPresetHeaderSize && presets.size() % kPresetHeaderSize == 0 &&
+            instruments.size() % kInstrumentHeaderSize == 0 &&
+            samples.size() % kSampleHeaderSize == 0;
+    if (!valid)
+    {
+        ::close(fd);
+        return STATUS_SOUNDFONT_FORMAT_ERROR;
+    }
+
+    // Sample chunk is mapped from the page it starts in, voices jump around in it
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t base = smpl & ~(page - 1);
+    map_size_     = static_cast<size_t>(smpl + smpl_size - base);
+    void *map     = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(base));
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        map_size_ = 0;
+        return STATUS_FILE_ERROR;
+    }
+    madvise(map, map_size_, MADV_RANDOM);
+    map_          = static_cast<uint8_t *>(map);
+    samples_      = reinterpret_cast<const int16_t *>(map_ + (smpl - base));
+    sample_count_ = smpl_size / sizeof(int16_t);
+
+    // The last preset and instrument are terminal records
+    size_t                    preset_count     = presets.size() / kPresetHeaderSize - 1;
+    size_t                    instrument_count = instruments.size() / kInstrumentHeaderSize;
+    std::vector<generators_t> preset_zones     = {};
+    std::vector<generators_t> instrument_zones = {};
+    for (size_t p = 0; p != preset_count && valid; ++p)
+    {
+        size_t      offset = p * kPresetHeaderSize;
+        sf_preset_t preset;
+        preset.name    = std::string(reinterpret_cast<const char *>(&presets[offset]),
+                                     strnlen(reinterpret_cast<const char *>(&presets[offset]),
+                                             kNameSize));
+        preset.program = read_u16(presets, offset + 20);
+        preset.bank    = read_u16(presets, offset + 22);
+        valid          = read_zones(chunks[1], chunks[2], read_u16(presets, offset + 24),
+                                    read_u16(presets, offset + 24 + kPresetHeaderSize),
+                                    GEN_INSTRUMENT, preset_defaults(), preset_zones);
+        for (size_t z = 0; z != preset_zones.size() && valid; ++z)
+        {
+            size_t instrument = static_cast<size_t>(preset_zones[z].value[GEN_INSTRUMENT]);
+            if (instrument + 1 >= instrument_count)
+            {
+                continue;
+            }
+            size_t at = instrument * kInstrumentHeaderSize + kNameSize;
+            valid     = read_zones(chunks[4], chunks[5], read_u16(instruments, at),
+                                   read_u16(instruments, at + kInstrumentHeaderSize),
+                                   GEN_SAMPLE_ID, instrument_defaults(), instrument_zones);
+            for (const generators_t &zone : instrument_zones)
+            {
+                sf_zone_t flat;
+                if (make_zone(preset_zones[z], zone, samples, sample_count_, &flat))
+                {
+                    preset.zones.push_back(flat);
+                }
+            }
+        }
+        presets_.push_back(std::move(preset));
+    }
+    if (!valid)
+    {
+        close();
+        return STATUS_SOUNDFONT_FORMAT_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+const sf_preset_t *
+soundfont_t::piano_preset(uint8_t program) const
+{
+    const sf_preset_t *result = nullptr;
+    for (const sf_preset_t &preset : presets_)
+    {
+        if (preset.bank != 0 || preset.zones.empty())
+        {
+            continue;
+        }
+        if (preset.program == program)
+        {
+            return &preset;
+        }
+        if (preset.program <= 7 && (result == nullptr || preset.program < result->program))
+        {
+            result = &preset;
+        }
+    }
+    return result;
+}
+
+//================================================================================================//
+
+sampler_t::sampler_t(const soundfont_t &font,
+                     const sf_preset_t &preset,
+                     uint32_t           sample_rate) :
+    font_(font),
+    preset_(preset),
+    sample_rate_(sample_rate),
+    pool_(kSamplerVoices)
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+sampler_t::~sampler_t() = default;
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sampler_t::note_on(uint8_t note,
+                   uint8_t velocity)
+{
+    note_off(note);
+    if (velocity == 0)
+    {
+        return;
+    }
+
+    double samples  = static_cast<double>(sample_rate_);
+    float  loudness = velocity / 127.f;
+    for (const sf_zone_t &zone : preset_.zones)
+    {
+        if (note < zone.key_lo || note > zone.key_hi ||
+            velocity < zone.velocity_lo || velocity > zone.velocity_hi)
+        {
+            continue;
+        }
+
+        // The quietest voice is taken over when all sound
+        size_t slot = active_;
+        if (active_ == pool_.size())
+        {
+            slot = 0;
+            for (size_t i = 1; i != active_; ++i)
+            {
+                const sf_voice_t &voice = pool_[i];
+                const sf_voice_t &worst = pool_[slot];
+                slot = (voice.level * voice.gain < worst.level * worst.gain) ? i : slot;
+            }
+        } else
+        {
+            ++active_;
+        }
+
+        double     cents = (note - zone.root_key) * zone.scale_tuning + zone.tune_cents;
+        double     ratio = std::exp2(cents / 1200.) * zone.sample_rate / samples;
+        double     chunk = static_cast<double>(kLanes);
+        sf_voice_t voice;
+        voice.zone     = &zone;
+        voice.position = static_cast<uint64_t>(zone.start) << 32;
+        voice.step     = static_cast<uint64_t>(std::llround(ratio * 4294967296.));
+        voice.gain     = zone.gain * loudness * loudness / 32768.f;
+        voice.level    = 0.f;
+        voice.stage    = STAGE_ATTACK;
+        voice.left     = static_cast<uint64_t>(zone.attack_s * samples);
+        voice.attack   = static_cast<float>(chunk / std::max(zone.attack_s * samples, chunk));
+        voice.decay    = static_cast<float>(std::pow(10., -kEnvelopeRangeDb / 20. * chunk /
+                                                     std::max(zone.decay_s * samples, chunk)));
+        voice.release  = static_cast<float>(std::pow(10., -kEnvelopeRangeDb / 20. * chunk /
+                                                     std::max(zone.release_s * samples, chunk)));
+        voice.note     = note;
+        voice.held     = true;
+        pool_[slot]    = voice;
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sampler_t::note_off(uint8_t note)
+{
+    for (size_t i = 0; i != active_; ++i)
+    {
+        sf_voice_t &voice = pool_[i];
+        if (voice.held && voice.note == note)
+        {
+            voice.held  = false;
+            voice.stage = STAGE_RELEASE;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sampler_t::render(float  *out,
+                  size_t  count)
+{
+    for (size_t i = 0; i != active_; ++i)
+    {
+        run_voice(&pool_[i], out, count);
+    }
+
+    // Sounding voices are kept at the front of pool
+    for (size_t i = 0; i != active_;)
+    {
+        if (pool_[i].stage == STAGE_DONE)
+        {
+            pool_[i] = pool_[--active_];
+        } else
+        {
+            ++i;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sampler_t::run_voice(sf_voice_t *voice,
+                     float      *out,
+                     size_t      count)
+{
+    static const lanes_t kRamp = {0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f};
+
+    const int16_t   *samples = font_.samples();
+    const sf_zone_t &zone    = *voice->zone;
+    sf_voice_t       v       = *voice;
+
+    // Position stays below limit: loop wraps back into itself, one shot ends there. Step may be
+    // longer than a short loop played far above its root key, so it wraps by remainder.
+    uint64_t limit  = static_cast<uint64_t>(zone.loop ? zone.loop_end : zone.end - 1) << 32;
+    uint64_t first  = static_cast<uint64_t>(zone.loop_start) << 32;
+    uint64_t length = static_cast<uint64_t>(zone.loop_end - zone.loop_start) << 32;
+    for (size_t t = 0; t < count && v.stage != STAGE_DONE; t += kLanes)
+    {
+        // Envelope at the start and end of kLanes samples
+        float from = v.level;
+        switch (v.stage)
+        {
+            case STAGE_ATTACK:
+            {
+                v.level = std::min(1.f, v.level + v.attack);
+                if (v.level == 1.f)
+                {
+                    v.stage = STAGE_HOLD;
+                    v.left  = static_cast<uint64_t>(zone.hold_s * static_cast<float>(sample_rate_));
+                }
+                break;
+            }
+            case STAGE_HOLD:
+            {
+                v.left  = (v.left > kLanes) ? v.left - kLanes : 0;
+                v.stage = (v.left == 0) ? STAGE_DECAY : STAGE_HOLD;
+                break;
+            }
+            case STAGE_DECAY:
+            {
+                v.level = std::max(zone.sustain, v.level * v.decay);
+                v.stage = (v.level == zone.sustain) ? STAGE_SUSTAIN : STAGE_DECAY;
+                break;
+            }
+            case STAGE_RELEASE:
+            {
+                v.level *= v.release;
+                v.stage  = (v.level < kSilence) ? STAGE_DONE : STAGE_RELEASE;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+        v.stage = (v.level < kSilence && v.stage == STAGE_SUSTAIN) ? STAGE_DONE : v.stage;
+
+        // Gather neighbouring frames, interpolate and apply envelope in lanes. When none of
+        // positions reaches limit they need no checks.
+        size_t  n     = std::min(kLanes, count - t);
+        lanes_t a     = {};
+        lanes_t b     = {};
+        lanes_t frac  = {};
+        bool    clear = v.position + kLanes * v.step < limit;
+        for (size_t i = 0; i != n; ++i)
+        {
+            if (!clear && v.position >= limit)
+            {
+                if (!zone.loop)
+                {
+                    v.stage = STAGE_DONE;
+                    break;
+                }
+                v.position = first + (v.position - first) % length;
+            }
+            size_t index = static_cast<size_t>(v.position >> 32);
+            a[i]         = samples[index];
+            b[i]         = samples[index + 1];
+            frac[i]      = static_cast<float>(v.position & 0xffffffffu) * 0x1p-32f;
+            v.position  += v.step;
+        }
+        lanes_t gain  = (from + (v.level - from) * (1.f / kLanes) * kRamp) * v.gain;
+        lanes_t value = (a + frac * (b - a)) * gain;
+        for (size_t i = 0; i != n; ++i)
+        {
+            out[t + i] += value[i];
+        }
+    }
+    *voice = v;
+}
+
+//================================================================================================//
+
+void
+render_song(const std::vector<piano_midi::timed_event_t> &timeline,
+            const soundfont_t                            &font,
+            const sf_preset_t                            &preset,
+            uint32_t                                      sample_rate,
+            std::vector<float>                           &samples)
+{
+    static const size_t kBlock = 1024;
+
+    sampler_t sampler(font, preset, sample_rate);
+    bool      held[128] = {};
+    samples.clear();
+    auto render_until = [&](size_t end)
+    {
+        while (samples.size() < end)
+        {
+            size_t count = std::min(kBlock, end - samples.size());
+            samples.resize(samples.size() + count, 0.f);
+            sampler.render(&samples[samples.size() - count], count);
+        }
+    };
+
+    for (const piano_midi::timed_event_t &event : timeline)
+    {
+        bool press = event.event == EVENT_NOTE_ON && event.velocity != 0;
+        bool lift  = event.event == EVENT_NOTE_OFF ||
+                     (event.event == EVENT_NOTE_ON && event.velocity == 0);
+        render_until(static_cast<size_t>(std::llround(event.time_us * 1e-6 * sample_rate)));
+        if ((!press && !lift) || event.note >= 128)
+        {
+            continue;
+        }
+        if (press)
+        {
+            sampler.note_on(event.note, event.velocity);
+        } else
+        {
+            sampler.note_off(event.note);
+        }
+        held[event.note] = press;
+    }
+
+    // Looped zones ring until released
+    for (uint8_t note = 0; note != 128; ++note)
+    {
+        if (held[note])
+        {
+            sampler.note_off(note);
+        }
+    }
+    while (sampler.voices() != 0)
+    {
+        render_until(samples.size() + kBlock);
+    }
+}
+
+//================================================================================================//
+
+} // ! namespace piano_audio
+
+//================================================================================================//
@@ -0,0 +1,177 @@
+//================================================================================================//
+
+#ifndef __SOUNDFONT_HH__
+#define __SOUNDFONT_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+
+//================================================================================================//
+
+//
+// Preview of songs with sampled piano from SoundFont 2 file.
+//
+// Preset, instrument and sample headers are small and read with pread. Sample chunk, which is
+// most of the file, is mapped read-only and paged in on demand as voices touch it: only samples
+// of notes that sound are resident, and kernel may drop them again under memory pressure.
+//
+// Voices resample at any pitch with linear interpolation between neighbouring source samples,
+// eight output samples at a time in SIMD lanes.
+//
+namespace piano_audio
+{
+
+//================================================================================================//
+
+static const uint32_t kSamplerRate   = 48000;
+static const size_t   kSamplerVoices = 64;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Zone of preset flattened with its instrument zone: which keys and velocities it covers, range
+// of sample chunk it plays and how. Positions are in frames from the start of sample chunk.
+//
+struct sf_zone_t
+{
+    uint8_t  key_lo       = 0;
+    uint8_t  key_hi       = 127;
+    uint8_t  velocity_lo  = 0;
+    uint8_t  velocity_hi  = 127;
+    uint32_t start        = 0;
+    uint32_t end          = 0;
+    uint32_t loop_start   = 0;
+    uint32_t loop_end     = 0;
+    bool     loop         = false;
+    uint32_t sample_rate  = 0;
+    uint8_t  root_key     = 60;
+    int32_t  tune_cents   = 0;      // coarse, fine tune and pitch correction of sample
+    int32_t  scale_tuning = 100;    // cents per key
+    float    gain         = 1.f;    // initial attenuation
+
+    // Volume envelope, times in seconds, sustain level relative to peak
+    float    attack_s     = 0.f;
+    float    hold_s       = 0.f;
+    float    decay_s      = 0.f;
+    float    sustain      = 1.f;
+    float    release_s    = 0.f;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct sf_preset_t
+{
+    std::string            name    = {};
+    uint16_t               bank    = 0;
+    uint16_t               program = 0;
+    std::vector<sf_zone_t> zones   = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+class soundfont_t
+{
+  public:
+    soundfont_t() = default;
+    ~soundfont_t();
+
+    soundfont_t(const soundfont_t &)            = delete;
+    soundfont_t &operator=(const soundfont_t &) = delete;
+
+    //
+    // Returns STATUS_FILE_ERROR if file can't be opened or mapped, STATUS_SOUNDFONT_FORMAT_ERROR
+    // if it is not a SoundFont 2 file with 16-bit samples. Zones which refer to samples outside
+    // of sample chunk are dropped.
+    //
+    piano::status_t open(const char *path);
+
+    //
+    // Preset for program of bank 0, else the lowest of piano programs 0-7 which parse_midi
+    // follows, nullptr if there is none
+    //
+    const sf_preset_t *piano_preset(uint8_t program = 0) const;
+
+    const std::vector<sf_preset_t> &presets() const { return presets_; }
+    const int16_t *samples() const                  { return samples_; }
+    size_t         sample_count() const             { return sample_count_; }
+    size_t         mapped_bytes() const             { return sample_count_ * sizeof(int16_t); }
+
+  private:
+    void close();
+
+    uint8_t                 *map_          = nullptr;
+    size_t                   map_size_     = 0;
+    const int16_t           *samples_      = nullptr;
+    size_t                   sample_count_ = 0;
+    std::vector<sf_preset_t> presets_      = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Voices of one preset, mixed into mono output. Voices are preallocated, the quietest one is
+// taken over when all kSamplerVoices sound.
+//
+class sampler_t
+{
+  public:
+    sampler_t(const soundfont_t &font, const sf_preset_t &preset, uint32_t sample_rate);
+    ~sampler_t();
+
+    sampler_t(const sampler_t &)            = delete;
+    sampler_t &operator=(const sampler_t &) = delete;
+
+    //
+    // Press starts a voice in each zone covering key and velocity, the same key pressed again
+    // releases voices it had
+    //
+    void note_on(uint8_t note, uint8_t velocity);
+    void note_off(uint8_t note);
+
+    //
+    // Add count samples of all voices to out
+    //
+    void render(float *out, size_t count);
+
+    size_t voices() const { return active_; }
+
+  private:
+    struct sf_voice_t;
+
+    void run_voice(sf_voice_t *voice, float *out, size_t count);
+
+    const soundfont_t      &font_;
+    const sf_preset_t      &preset_;
+    uint32_t                sample_rate_;
+    std::vector<sf_voice_t> pool_;
+    size_t                  active_ = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Mono song with preset until its last voice falls silent, keys still held at the end are
+// released by the last event as in render_song
+//
+void render_song(const std::vector<piano_midi::timed_event_t> &timeline,
+                 const soundfont_t                            &font,
+                 const sf_preset_t                            &preset,
+                 uint32_t                                      sample_rate,
+                 std::vector<float>                           &samples);
+
+} // ! namespace piano_audio
+
+//================================================================================================//
+
+#endif // ! __SOUNDFONT_HH__
+
+//================================================================================================//
@@ -0,0 +1,96 @@
+//================================================================================================//
+
+#ifndef __SPSC_QUEUE_HH__
+#define __SPSC_QUEUE_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstddef>
+
+//================================================================================================//
+
+namespace piano
+{
+
+//================================================================================================//
+
+//
+// Bounded lock-free queue for exactly one producer and one consumer thread. Storage is part of
+// the object, so it never allocates and may be used in firmware and on audio threads.
+//
+template <typename T, size_t CAPACITY>
+class spsc_queue_t
+{
+    static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0,
+                  "CAPACITY must be power of two");
+
+  public:
+    //
+    // Called by producer only. Returns false if queue is full.
+    //
+    bool try_push(const T &item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == CAPACITY)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == CAPACITY)
+            {
+                return false;
+            }
+        }
+        items_[tail & (CAPACITY - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //
+    // Called by consumer only. Returns false if queue is empty.
+    //
+    bool try_pop(T *item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+            {
+                return false;
+            }
+        }
+        *item = items_[head & (CAPACITY - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //
+    // Approximate number of items, exact when called by producer or consumer while other
+    // side is idle
+    //
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return CAPACITY; }
+
+  private:
+    //
+    // Indices grow without wrapping, position in items_ is index modulo CAPACITY.
+    // Producer and consumer data are kept on separate cache lines.
+    //
+    alignas(64) std::atomic<size_t> head_       = {0};
+                size_t              tail_cache_ = 0;
+    alignas(64) std::atomic<size_t> tail_       = {0};
+                size_t              head_cache_ = 0;
+    alignas(64) T                   items_[CAPACITY];
+};
+
+} // ! namespace piano
+
+//================================================================================================//
+
+#endif // ! __SPSC_QUEUE_HH__
+
+//================================================================================================//
@@ -0,0 +1,99 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "stats.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+void
+sample_stats_t::add(double value)
+{
+    sorted_ = sorted_ && (samples_.empty() || samples_.back() <= value);
+    samples_.push_back(value);
+    sum_ += value;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sample_stats_t::clear()
+{
+    samples_.clear();
+    sorted_ = true;
+    sum_    = 0.;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+double
+sample_stats_t::min() const
+{
+    return percentile(0.);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+double
+sample_stats_t::max() const
+{
+    return percentile(1.);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+double
+sample_stats_t::mean() const
+{
+    return samples_.empty() ? 0. : sum_ / static_cast<double>(samples_.size());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+double
+sample_stats_t::percentile(double fraction) const
+{
+    if (samples_.empty())
+    {
+        return 0.;
+    }
+    if (!sorted_)
+    {
+        std::sort(samples_.begin(), samples_.end());
+        sorted_ = true;
+    }
+    fraction = std::clamp(fraction, 0., 1.);
+    return samples_[static_cast<size_t>(fraction * static_cast<double>(samples_.size() - 1))];
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+sample_stats_t::print(std::ostream &out,
+                      const char   *name,
+                      const char   *unit) const
+{
+    out << std::fixed << std::setprecision(1)
+        << name << ": n=" << count()
+        << " min="  << min()           << unit
+        << " mean=" << mean()          << unit
+        << " p50="  << percentile(.50) << unit
+        << " p99="  << percentile(.99) << unit
+        << " max="  << max()           << unit << "\n";
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
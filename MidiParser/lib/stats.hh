@@ -0,0 +1,55 @@
+//================================================================================================//
+
+#ifndef __STATS_HH__
+#define __STATS_HH__
+
+//================================================================================================//
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Collection of samples (latencies, queue depths) reported as distribution
+//
+class sample_stats_t
+{
+  public:
+    void   add(double value);
+    void   clear();
+
+    size_t count() const { return samples_.size(); }
+    double min()   const;
+    double max()   const;
+    double mean()  const;
+
+    //
+    // Value below which fraction of samples lies, fraction is in [0, 1]
+    //
+    double percentile(double fraction) const;
+
+    //
+    // One line summary: count, min, mean, p50, p99, max
+    //
+    void   print(std::ostream &out, const char *name, const char *unit) const;
+
+  private:
+    mutable std::vector<double> samples_ = {};
+    mutable bool                sorted_  = true;
+    double                      sum_     = 0.;
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __STATS_HH__
+
+//================================================================================================//
@@ -0,0 +1,720 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "synth.hh"
+
+//================================================================================================//
+
+namespace piano_audio
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Partial k is (k + 1) times fundamental, stretched by stiffness of string
+//
+static const double kInharmonicity = 0.0004;
+
+//
+// Fundamental of A0 rings for kSustainS, notes an octave higher half as long per
+// kSustainOctaves; partial k decays 1 + k * kPartialDamping times faster than fundamental.
+// Damper stops any partial within kReleaseS.
+//
+static const double kSustainS       = 4.;
+static const double kSustainOctaves = 2.;
+static const double kPartialDamping = 0.5;
+static const double kReleaseS       = 0.12;
+
+//
+// Amplitude of fundamental of the loudest note, voice is dropped when all its partials are
+// below kSilence. Partials above kMaxPartialShare of sample rate would alias and are silent.
+//
+static const double kGain            = 0.15;
+static const double kSilence         = 1e-4;
+static const double kMaxPartialShare = 0.45;
+
+//
+// Samples mixed at once, voices start and release at any sample between blocks
+//
+static const size_t kBlockSamples = 64;
+
+static const double kTwoPi = 6.283185307179586;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Value of each partial of voice. Vector extension of GCC and Clang: arithmetic is done lane by
+// lane with SIMD instructions the target has, two SSE operations or one AVX one.
+//
+typedef float lanes_t __attribute__((vector_size(kPartials * sizeof(float))));
+
+//
+// Oscillator bank of one voice, partial k in lane k: phasor (re, im) is rotated by (cos, sin)
+// and amp multiplied by decay every sample. Span is index of note span offline and number of
+// press in real time, where note and held track the key.
+//
+struct voice_t
+{
+    lanes_t re;
+    lanes_t im;
+    lanes_t cos;
+    lanes_t sin;
+    lanes_t amp;
+    lanes_t decay;
+    size_t  span;
+    uint8_t note;
+    bool    held;
+};
+
+//
+// Press or release of span within slice
+//
+struct voice_event_t
+{
+    int64_t sample;
+    size_t  span;
+    bool    press;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct partial_t
+{
+    double omega     = 0.;     // radians per sample
+    double amplitude = 0.;     // at press
+    double decay_s   = 0.;     // time constant while key is held
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static partial_t
+partial(const note_span_t &span,
+        size_t             k,
+        uint32_t           sample_rate)
+{
+    double n           = static_cast<double>(k + 1);
+    double fundamental = 440. * std::exp2((span.note - 69.) / 12.);
+    double frequency   = fundamental * n * std::sqrt(1. + kInharmonicity * n * n);
+    double loudness    = span.velocity / 127.;
+
+    // Loud notes are brighter: their upper partials fall off slower
+    partial_t result;
+    result.omega     = kTwoPi * frequency / sample_rate;
+    result.amplitude = (frequency < kMaxPartialShare * sample_rate)
+                     ? kGain * loudness * std::pow(n, loudness - 2.) : 0.;
+    result.decay_s   = kSustainS * std::exp2(-(span.note - 21.) / (12. * kSustainOctaves)) /
+                       (1. + k * kPartialDamping);
+    return result;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// The first sample at which fundamental, the loudest and slowest partial, is below kSilence
+//
+static int64_t
+silence_sample(const note_span_t &span,
+               uint32_t           sample_rate)
+{
+    partial_t fundamental = partial(span, 0, sample_rate);
+    if (fundamental.amplitude <= kSilence)
+    {
+        return span.on;
+    }
+
+    double decay_samples = fundamental.decay_s * sample_rate;
+    double natural       = decay_samples * std::log(fundamental.amplitude / kSilence);
+    if (span.on + static_cast<int64_t>(natural) <= span.off)
+    {
+        return span.on + static_cast<int64_t>(std::ceil(natural));
+    }
+
+    double at_off = std::log(fundamental.amplitude / kSilence) -
+                    static_cast<double>(span.off - span.on) / decay_samples;
+    return span.off + static_cast<int64_t>(std::ceil(kReleaseS * sample_rate * at_off));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// State of voice of span at sample, which is within the span
+//
+static void
+start_voice(const note_span_t &span,
+            size_t             index,
+            uint32_t           sample_rate,
+            int64_t            sample,
+            voice_t           *voice)
+{
+    double             held    = static_cast<double>(std::min(sample, span.off) - span.on);
+    double             damped  = static_cast<double>(std::max<int64_t>(sample - span.off, 0));
+    double             release = kReleaseS * sample_rate;
+    for (size_t k = 0; k != kPartials; ++k)
+    {
+        partial_t p     = partial(span, k, sample_rate);
+        double    hold  = p.decay_s * sample_rate;
+        double    phase = std::fmod(p.omega * static_cast<double>(sample - span.on), kTwoPi);
+        double    level = p.amplitude * std::exp(-held / hold - damped / release);
+        double    decay = (sample >= span.off) ? release : hold;
+        voice->re[k]    = static_cast<float>(std::cos(phase));
+        voice->im[k]    = static_cast<float>(std::sin(phase));
+        voice->cos[k]   = static_cast<float>(std::cos(p.omega));
+        voice->sin[k]   = static_cast<float>(std::sin(p.omega));
+        voice->amp[k]   = static_cast<float>(level);
+        voice->decay[k] = static_cast<float>(std::exp(-1. / decay));
+    }
+    voice->span = index;
+    voice->note = span.note;
+    voice->held = sample < span.off;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Add count samples of voice to acc, all partials at once. Mix of partials is left to caller.
+//
+static void
+run_voice(voice_t *voice,
+          lanes_t *acc,
+          size_t   count)
+{
+    // State is kept in registers for the whole block
+    lanes_t re  = voice->re;
+    lanes_t im  = voice->im;
+    lanes_t amp = voice->amp;
+    for (size_t t = 0; t != count; ++t)
+    {
+        lanes_t next = re * voice->cos - im * voice->sin;
+        im           = re * voice->sin + im * voice->cos;
+        re           = next;
+        amp         *= voice->decay;
+        acc[t]      += im * amp;
+    }
+
+    // Rounding of rotation changes length of phasor, one Newton step brings it back to 1
+    lanes_t norm = 1.5f - 0.5f * (re * re + im * im);
+    voice->re    = re * norm;
+    voice->im    = im * norm;
+    voice->amp   = amp;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+silent(const voice_t &voice)
+{
+    for (size_t k = 0; k != kPartials; ++k)
+    {
+        if (voice.amp[k] >= kSilence)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Little endian 16-bit samples, clipped to [-1, 1]
+//
+static void
+to_pcm16(const float *samples,
+         size_t       count,
+         uint8_t     *bytes)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        float    clipped = std::min(std::max(samples[i], -1.f), 1.f);
+        int16_t  level   = static_cast<int16_t>(std::lrint(clipped * 32767.f));
+        uint16_t value   = static_cast<uint16_t>(level);
+        bytes[2 * i]     = static_cast<uint8_t>(value);
+        bytes[2 * i + 1] = static_cast<uint8_t>(value >> 8);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// RIFF header of PCM format with data_size bytes of samples
+//
+static bool
+write_wav_header(FILE     *file,
+                 uint32_t  sample_rate,
+                 uint32_t  data_size)
+{
+    uint8_t header[44] = {};
+    size_t  size       = 0;
+    auto put = [&header, &size](uint32_t value, size_t bytes)
+    {
+        for (size_t i = 0; i != bytes; ++i)
+        {
+            header[size++] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    };
+    auto tag = [&header, &size](const char *name)
+    {
+        std::copy(name, name + 4, header + size);
+        size += 4;
+    };
+    tag("RIFF");
+    put(36 + data_size, 4);
+    tag("WAVE");
+    tag("fmt ");
+    put(16, 4);                 // size of format chunk
+    put(1, 2);                  // PCM
+    put(1, 2);                  // mono
+    put(sample_rate, 4);
+    put(sample_rate * 2, 4);    // bytes per second
+    put(2, 2);                  // bytes per frame
+    put(16, 2);                 // bits per sample
+    tag("data");
+    put(data_size, 4);
+    return std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+//================================================================================================//
+
+void
+make_note_spans(const std::vector<piano_midi::timed_event_t> &timeline,
+                uint32_t                                      sample_rate,
+                std::vector<note_span_t>                     &spans)
+{
+    static const size_t kNone = SIZE_MAX;
+
+    spans.clear();
+    size_t  held[128] = {};
+    int64_t last      = 0;
+    std::fill(held, held + 128, kNone);
+    for (const piano_midi::timed_event_t &event : timeline)
+    {
+        int64_t sample = static_cast<int64_t>(std::llround(event.time_us * 1e-6 * sample_rate));
+        bool    press  = event.event == EVENT_NOTE_ON && event.velocity != 0;
+        bool    lift   = event.event == EVENT_NOTE_OFF ||
+                         (event.event == EVENT_NOTE_ON && event.velocity == 0);
+        last = std::max(last, sample);
+        if ((!press && !lift) || event.note >= 128)
+        {
+            continue;
+        }
+        if (held[event.note] != kNone)
+        {
+            spans[held[event.note]].off = sample;
+            held[event.note]            = kNone;
+        }
+        if (press)
+        {
+            note_span_t span;
+            span.note        = event.note;
+            span.velocity    = event.velocity;
+            span.on          = sample;
+            span.off         = INT64_MAX;
+            held[event.note] = spans.size();
+            spans.push_back(span);
+        }
+    }
+
+    // Timeline is sorted by time, so are spans by press
+    for (note_span_t &span : spans)
+    {
+        span.off = std::min(span.off, last);
+        span.end = silence_sample(span, sample_rate);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+render_slice(const std::vector<note_span_t> &spans,
+             uint32_t                        sample_rate,
+             int64_t                         begin,
+             int64_t                         end,
+             float                          *out)
+{
+    // Voices sounding at begin are handed over from state at begin, the rest start later
+    std::vector<voice_t>       voices = {};
+    std::vector<voice_event_t> events = {};
+    for (size_t i = 0; i != spans.size() && spans[i].on < end; ++i)
+    {
+        const note_span_t &span = spans[i];
+        if (span.end <= begin)
+        {
+            continue;
+        }
+        if (span.on < begin)
+        {
+            voices.emplace_back();
+            start_voice(spans[i], i, sample_rate, begin, &voices.back());
+        } else
+        {
+            events.push_back({span.on, i, true});
+        }
+        if (span.off > std::max(span.on, begin) && span.off < end)
+        {
+            events.push_back({span.off, i, false});
+        }
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const voice_event_t &a, const voice_event_t &b)
+                     {
+                         return a.sample < b.sample;
+                     });
+
+    lanes_t release = lanes_t{} + static_cast<float>(std::exp(-1. / (kReleaseS * sample_rate)));
+    lanes_t acc[kBlockSamples];
+    size_t  next    = 0;
+    int64_t sample  = begin;
+    while (sample < end)
+    {
+        for (; next != events.size() && events[next].sample == sample; ++next)
+        {
+            const voice_event_t &event = events[next];
+            if (event.press)
+            {
+                voices.emplace_back();
+                start_voice(spans[event.span], event.span, sample_rate, sample,
+                            &voices.back());
+                continue;
+            }
+            // Voice may have fallen silent before release
+            for (voice_t &voice : voices)
+            {
+                if (voice.span == event.span)
+                {
+                    voice.decay = release;
+                }
+            }
+        }
+
+        int64_t stop = std::min<int64_t>(end, sample + static_cast<int64_t>(kBlockSamples));
+        if (next != events.size())
+        {
+            stop = std::min(stop, events[next].sample);
+        }
+        size_t count = static_cast<size_t>(stop - sample);
+        std::fill(acc, acc + count, lanes_t{});
+        for (voice_t &voice : voices)
+        {
+            run_voice(&voice, acc, count);
+        }
+        for (size_t t = 0; t != count; ++t)
+        {
+            float mix = 0.f;
+            for (size_t k = 0; k != kPartials; ++k)
+            {
+                mix += acc[t][k];
+            }
+            out[sample - begin + static_cast<int64_t>(t)] = mix;
+        }
+
+        voices.erase(std::remove_if(voices.begin(), voices.end(), silent), voices.end());
+        sample = stop;
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+render_song(const std::vector<piano_midi::timed_event_t> &timeline,
+            const synth_config_t                         &config,
+            std::vector<float>                           &samples)
+{
+    std::vector<note_span_t> spans = {};
+    make_note_spans(timeline, config.sample_rate, spans);
+
+    int64_t length = 0;
+    for (const note_span_t &span : spans)
+    {
+        length = std::max(length, span.end);
+    }
+    samples.assign(static_cast<size_t>(length), 0.f);
+
+    // Threads take slices one by one, each slice is written by one thread only
+    size_t              slices  = (samples.size() + kSliceSamples - 1) / kSliceSamples;
+    size_t              threads = (config.threads != 0) ? config.threads
+                                : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::atomic<size_t> taken   = {0};
+    auto worker = [&]()
+    {
+        for (size_t slice = taken++; slice < slices; slice = taken++)
+        {
+            int64_t begin = static_cast<int64_t>(slice * kSliceSamples);
+            int64_t end   = std::min(begin + static_cast<int64_t>(kSliceSamples), length);
+            render_slice(spans, config.sample_rate, begin, end,
+                         &samples[static_cast<size_t>(begin)]);
+        }
+    };
+
+    std::vector<std::thread> pool = {};
+    for (size_t i = 1; i < std::min(threads, slices); ++i)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+write_wav(const char               *path,
+          const std::vector<float> &samples,
+          uint32_t                  sample_rate)
+{
+    wav_sink_t sink;
+    status_t   status = sink.open(path, sample_rate);
+    if (status == STATUS_SUCCESS)
+    {
+        status = sink.write(samples.data(), samples.size());
+    }
+    status_t closed = sink.close();
+    return (status != STATUS_SUCCESS) ? status : closed;
+}
+
+//================================================================================================//
+
+status_t
+raw_pcm_sink_t::write(const float *samples,
+                      size_t       count)
+{
+    for (size_t done = 0; done != count;)
+    {
+        size_t chunk = std::min(count - done, kEngineBlock);
+        to_pcm16(samples + done, chunk, bytes_);
+        for (size_t sent = 0; sent != 2 * chunk;)
+        {
+            ssize_t written = ::write(fd_, bytes_ + sent, 2 * chunk - sent);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return STATUS_FILE_ERROR;
+            }
+            sent += static_cast<size_t>(written);
+        }
+        done += chunk;
+    }
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+wav_sink_t::open(const char *path,
+                 uint32_t    sample_rate)
+{
+    close();
+    file_        = std::fopen(path, "wb");
+    sample_rate_ = sample_rate;
+    data_size_   = 0;
+    failed_      = file_ == nullptr || !write_wav_header(file_, sample_rate_, 0);
+    return failed_ ? STATUS_FILE_ERROR : STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+wav_sink_t::write(const float *samples,
+                  size_t       count)
+{
+    for (size_t done = 0; done != count && !failed_;)
+    {
+        size_t chunk = std::min(count - done, kEngineBlock);
+        to_pcm16(samples + done, chunk, bytes_);
+        failed_     = std::fwrite(bytes_, 2, chunk, file_) != chunk;
+        data_size_ += static_cast<uint32_t>(2 * chunk);
+        done       += chunk;
+    }
+    return failed_ ? STATUS_FILE_ERROR : STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+wav_sink_t::close()
+{
+    if (file_ == nullptr)
+    {
+        return failed_ ? STATUS_FILE_ERROR : STATUS_SUCCESS;
+    }
+
+    // Header is written again with sizes of data
+    bool written = !failed_ && std::fseek(file_, 0, SEEK_SET) == 0 &&
+                   write_wav_header(file_, sample_rate_, data_size_);
+    written &= std::fclose(file_) == 0;
+    file_    = nullptr;
+    failed_  = !written;
+    return failed_ ? STATUS_FILE_ERROR : STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+synth_engine_t::synth_engine_t(uint32_t    sample_rate,
+                               pcm_sink_t *sink) :
+    sample_rate_(sample_rate),
+    sink_(sink),
+    release_(static_cast<float>(std::exp(-1. / (kReleaseS * sample_rate)))),
+    pool_(new voice_t[kEngineVoices])
+{
+}
+
+//------------------------------------------------------------------------------------------------//
+
+synth_engine_t::~synth_engine_t() = default;
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+synth_engine_t::render_block()
+{
+    auto    start  = std::chrono::steady_clock::now();
+    int64_t begin  = rendered_.load(std::memory_order_relaxed);
+    int64_t end    = begin + static_cast<int64_t>(kEngineBlock);
+    int64_t sample = begin;
+    lanes_t acc[kBlockSamples];
+    while (sample < end)
+    {
+        // Commands due by now, late ones included
+        while (next_command() && pending_.sample <= sample)
+        {
+            apply(pending_, sample);
+            has_pending_ = false;
+        }
+
+        int64_t stop = std::min<int64_t>(end, sample + static_cast<int64_t>(kBlockSamples));
+        if (has_pending_)
+        {
+            stop = std::min(stop, pending_.sample);
+        }
+        size_t count = static_cast<size_t>(stop - sample);
+        std::fill(acc, acc + count, lanes_t{});
+        for (size_t i = 0; i != active_; ++i)
+        {
+            run_voice(&pool_[i], acc, count);
+        }
+        for (size_t t = 0; t != count; ++t)
+        {
+            float mix = 0.f;
+            for (size_t k = 0; k != kPartials; ++k)
+            {
+                mix += acc[t][k];
+            }
+            out_[sample - begin + static_cast<int64_t>(t)] = mix;
+        }
+
+        // Sounding voices are kept at the front of pool
+        for (size_t i = 0; i != active_;)
+        {
+            if (silent(pool_[i]))
+            {
+                pool_[i] = pool_[--active_];
+            } else
+            {
+                ++i;
+            }
+        }
+        sample = stop;
+    }
+
+    status_t status = sink_->write(out_, kEngineBlock);
+    rendered_.store(end, std::memory_order_release);
+    voices_.store(active_, std::memory_order_relaxed);
+    stats_.add_run(std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start).count());
+    return status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+bool
+synth_engine_t::next_command()
+{
+    if (!has_pending_)
+    {
+        has_pending_ = commands_.try_pop(&pending_);
+    }
+    return has_pending_;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+synth_engine_t::apply(const synth_command_t &command,
+                      int64_t                sample)
+{
+    // Key pressed again while held releases the previous voice, as offline
+    for (size_t i = 0; i != active_; ++i)
+    {
+        voice_t &voice = pool_[i];
+        if (voice.held && voice.note == command.note)
+        {
+            voice.decay = lanes_t{} + release_;
+            voice.held  = false;
+        }
+    }
+    if (command.velocity == 0 || command.note >= 128)
+    {
+        return;
+    }
+
+    note_span_t span;
+    span.note     = command.note;
+    span.velocity = command.velocity;
+    span.on       = sample;
+    span.off      = INT64_MAX;
+    start_voice(span, presses_++, sample_rate_, sample, &pool_[take_voice()]);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+size_t
+synth_engine_t::take_voice()
+{
+    if (active_ != kEngineVoices)
+    {
+        return active_++;
+    }
+
+    // Released voices go first, the quietest of them, then the oldest held one
+    size_t victim = 0;
+    for (size_t i = 1; i != kEngineVoices; ++i)
+    {
+        const voice_t &voice = pool_[i];
+        const voice_t &worst = pool_[victim];
+        bool better = (voice.held != worst.held) ? !voice.held
+                    : (voice.held ? voice.span < worst.span : voice.amp[0] < worst.amp[0]);
+        victim = better ? i : victim;
+    }
+    stolen_.fetch_add(1, std::memory_order_relaxed);
+    return victim;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_audio
+
+//================================================================================================//
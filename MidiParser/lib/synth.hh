@@ -0,0 +1,255 @@
+//================================================================================================//
+
+#ifndef __SYNTH_HH__
+#define __SYNTH_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+#include "spsc_queue.hh"
+#include "task_stats.hh"
+
+//================================================================================================//
+
+//
+// Offline preview of songs: additive synthesis of piano-like voices from resolved timeline,
+// rendered to WAV on all cores.
+//
+// Voice of note has kPartials slightly inharmonic partials, each a complex phasor rotated once
+// per sample with exponentially decaying amplitude; partials decay faster higher up, and all
+// of them fast after note off, as damper falls. Partial k of voice is lane k of its oscillator
+// bank, so one sample of a voice is one pass over 8 lanes which compiler turns into SIMD.
+//
+// State of a voice at any sample follows from its note span alone, so song is cut into slices
+// of kSliceSamples and each slice starts its voices from state computed at its first sample.
+// Slices are rendered independently in any order, output does not depend on number of threads.
+//
+// In real time the same voices are played by synth_engine_t from a fixed pool, block by block,
+// with notes sent from player thread through a lock-free queue.
+//
+namespace piano_audio
+{
+
+//================================================================================================//
+
+static const size_t   kPartials          = 8;
+static const uint32_t kDefaultSampleRate = 44100;
+static const size_t   kSliceSamples      = 32768;
+
+//------------------------------------------------------------------------------------------------//
+
+struct synth_config_t
+{
+    uint32_t sample_rate = kDefaultSampleRate;
+
+    //
+    // Threads rendering slices, 0 - one per core
+    //
+    size_t   threads     = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Note from key press to silence, in samples. Key pressed again while held releases the
+// previous voice.
+//
+struct note_span_t
+{
+    uint8_t note     = 0;
+    uint8_t velocity = 0;
+    int64_t on       = 0;
+    int64_t off      = 0;
+    int64_t end      = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Note spans of timeline sorted by press. Keys still held at the end of song are released by
+// its last event.
+//
+void make_note_spans(const std::vector<piano_midi::timed_event_t> &timeline,
+                     uint32_t                                      sample_rate,
+                     std::vector<note_span_t>                     &spans);
+
+//
+// Mix samples [begin, end) of spans into out, which has end - begin samples. Voices which sound
+// at begin start from their state at it.
+//
+void render_slice(const std::vector<note_span_t> &spans,
+                  uint32_t                        sample_rate,
+                  int64_t                         begin,
+                  int64_t                         end,
+                  float                          *out);
+
+//
+// Mono song until the last voice falls silent, slices rendered by config.threads
+//
+void render_song(const std::vector<piano_midi::timed_event_t> &timeline,
+                 const synth_config_t                         &config,
+                 std::vector<float>                           &samples);
+
+//
+// 16-bit mono PCM WAV, samples are clipped to [-1, 1]. Returns STATUS_FILE_ERROR if file can't
+// be written.
+//
+piano::status_t write_wav(const char               *path,
+                          const std::vector<float> &samples,
+                          uint32_t                  sample_rate);
+
+//================================================================================================//
+
+//
+// Voices of real time engine, the quietest released one or else the oldest is taken over when
+// all of them sound. Block of kEngineBlock samples is 5.8 ms at 44.1 kHz.
+//
+static const size_t kEngineVoices = 64;
+static const size_t kEngineBlock  = 256;
+static const size_t kEngineQueue  = 1024;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Press of note, velocity 0 releases it. Sample counts from the first sample of engine.
+//
+struct synth_command_t
+{
+    int64_t sample   = 0;
+    uint8_t note     = 0;
+    uint8_t velocity = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Destination of mono samples in [-1, 1], written from audio thread
+//
+class pcm_sink_t
+{
+  public:
+    virtual ~pcm_sink_t() = default;
+
+    virtual piano::status_t write(const float *samples, size_t count) = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Raw 16-bit little endian PCM to file descriptor, e.g. stdout piped to aplay -f S16_LE
+//
+class raw_pcm_sink_t : public pcm_sink_t
+{
+  public:
+    explicit raw_pcm_sink_t(int fd) : fd_(fd) {}
+
+    piano::status_t write(const float *samples, size_t count) override;
+
+  private:
+    int     fd_;
+    uint8_t bytes_[2 * kEngineBlock];
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// 16-bit mono PCM WAV file, sizes in its header are filled in by close()
+//
+class wav_sink_t : public pcm_sink_t
+{
+  public:
+    wav_sink_t() = default;
+    ~wav_sink_t() override { close(); }
+
+    wav_sink_t(const wav_sink_t &)            = delete;
+    wav_sink_t &operator=(const wav_sink_t &) = delete;
+
+    piano::status_t open(const char *path, uint32_t sample_rate);
+    piano::status_t write(const float *samples, size_t count) override;
+    piano::status_t close();
+
+  private:
+    FILE    *file_        = nullptr;
+    uint32_t sample_rate_ = 0;
+    uint32_t data_size_   = 0;
+    bool     failed_      = false;
+    uint8_t  bytes_[2 * kEngineBlock];
+};
+
+//------------------------------------------------------------------------------------------------//
+
+struct voice_t;
+
+//
+// Real time synth: player thread sends commands, audio thread renders blocks into sink. Audio
+// thread takes no locks and allocates nothing, voices are preallocated. Commands take effect at
+// their sample within block, those which come late sound at the start of the next block.
+//
+class synth_engine_t
+{
+  public:
+    synth_engine_t(uint32_t sample_rate, pcm_sink_t *sink);
+    ~synth_engine_t();
+
+    synth_engine_t(const synth_engine_t &)            = delete;
+    synth_engine_t &operator=(const synth_engine_t &) = delete;
+
+    //
+    // Player thread only, commands in order of sample. Returns false if queue is full.
+    //
+    bool command(const synth_command_t &command) { return commands_.try_push(command); }
+
+    //
+    // Audio thread only: next kEngineBlock samples into sink
+    //
+    piano::status_t render_block();
+
+    //
+    // Any thread: samples written to sink, voices sounding after the last block, voices taken
+    // over and time to render a block, whose busy_max_us is the worst case
+    //
+    int64_t                rendered() const    { return rendered_.load(std::memory_order_acquire); }
+    size_t                 voices() const      { return voices_.load(std::memory_order_relaxed); }
+    uint32_t               stolen() const      { return stolen_.load(std::memory_order_relaxed); }
+    piano::task_counters_t block_stats() const { return stats_.snapshot(); }
+
+  private:
+    bool   next_command();
+    void   apply(const synth_command_t &command, int64_t sample);
+    size_t take_voice();
+
+    uint32_t                   sample_rate_;
+    pcm_sink_t                *sink_;
+    float                      release_;
+    std::unique_ptr<voice_t[]> pool_;
+    size_t                     active_      = 0;
+    size_t                     presses_     = 0;
+    synth_command_t            pending_     = {};
+    bool                       has_pending_ = false;
+    float                      out_[kEngineBlock];
+
+    piano::spsc_queue_t<synth_command_t, kEngineQueue> commands_;
+
+    std::atomic<int64_t>  rendered_ = {0};
+    std::atomic<size_t>   voices_   = {0};
+    std::atomic<uint32_t> stolen_   = {0};
+    piano::task_stats_t   stats_;
+};
+
+} // ! namespace piano_audio
+
+//================================================================================================//
+
+#endif // ! __SYNTH_HH__
+
+//================================================================================================//
@@ -0,0 +1,100 @@
+//================================================================================================//
+
+#ifndef __TASK_STATS_HH__
+#define __TASK_STATS_HH__
+
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+
+//================================================================================================//
+
+namespace piano
+{
+
+//================================================================================================//
+
+struct task_counters_t
+{
+    uint32_t runs           = 0;
+    uint32_t busy_us        = 0;
+    uint32_t busy_max_us    = 0;
+    uint32_t latency_count  = 0;
+    uint32_t latency_sum_us = 0;
+    uint32_t latency_max_us = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Load of one task, written by the task itself and read by any other one without locks. Busy
+// time against elapsed time gives its share of CPU, latency is time from when work became
+// available until the task took it. Counters are 32 bit so that they stay lock-free on Xtensa,
+// readers take differences of two snapshots, which survive wrap around.
+//
+class task_stats_t
+{
+  public:
+    //
+    // Task was woken up and worked for busy_us
+    //
+    void add_run(int64_t busy_us)
+    {
+        uint32_t busy = static_cast<uint32_t>((busy_us > 0) ? busy_us : 0);
+        add(&runs_, 1);
+        add(&busy_us_, busy);
+        if (busy > busy_max_us_.load(std::memory_order_relaxed))
+        {
+            busy_max_us_.store(busy, std::memory_order_relaxed);
+        }
+    }
+
+    void add_latency(int64_t latency_us)
+    {
+        uint32_t latency = static_cast<uint32_t>((latency_us > 0) ? latency_us : 0);
+        add(&latency_count_, 1);
+        add(&latency_sum_us_, latency);
+        if (latency > latency_max_us_.load(std::memory_order_relaxed))
+        {
+            latency_max_us_.store(latency, std::memory_order_relaxed);
+        }
+    }
+
+    task_counters_t snapshot() const
+    {
+        task_counters_t counters;
+        counters.runs           = runs_.load(std::memory_order_relaxed);
+        counters.busy_us        = busy_us_.load(std::memory_order_relaxed);
+        counters.busy_max_us    = busy_max_us_.load(std::memory_order_relaxed);
+        counters.latency_count  = latency_count_.load(std::memory_order_relaxed);
+        counters.latency_sum_us = latency_sum_us_.load(std::memory_order_relaxed);
+        counters.latency_max_us = latency_max_us_.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+  private:
+    //
+    // Only the owning task writes, so load and store is enough
+    //
+    static void add(std::atomic<uint32_t> *counter, uint32_t value)
+    {
+        counter->store(counter->load(std::memory_order_relaxed) + value,
+                       std::memory_order_relaxed);
+    }
+
+    std::atomic<uint32_t> runs_           = {0};
+    std::atomic<uint32_t> busy_us_        = {0};
+    std::atomic<uint32_t> busy_max_us_    = {0};
+    std::atomic<uint32_t> latency_count_  = {0};
+    std::atomic<uint32_t> latency_sum_us_ = {0};
+    std::atomic<uint32_t> latency_max_us_ = {0};
+};
+
+} // ! namespace piano
+
+//================================================================================================//
+
+#endif // ! __TASK_STATS_HH__
+
+//================================================================================================//
@@ -0,0 +1,157 @@
+//================================================================================================//
+
+#include <cerrno>
+#include <iomanip>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "clock_sync.hh"
+#include "telemetry.hh"
+
+//================================================================================================//
+
+namespace piano_host
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Totals of report, the rest of its counters are maxima
+//
+static uint32_t piano_proto::telemetry_t::*const kTotals[] =
+{
+    &piano_proto::telemetry_t::messages,
+    &piano_proto::telemetry_t::frame_errors,
+    &piano_proto::telemetry_t::uart_overruns,
+    &piano_proto::telemetry_t::late_count,
+    &piano_proto::telemetry_t::late_sum_us,
+    &piano_proto::telemetry_t::frames_shown,
+    &piano_proto::telemetry_t::frames_dropped,
+    &piano_proto::telemetry_t::strip_busy_us,
+    &piano_proto::telemetry_t::parser_busy_us,
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static double
+per_second(uint32_t count,
+           uint64_t interval_us)
+{
+    return (interval_us == 0) ? 0. : 1e6 * count / static_cast<double>(interval_us);
+}
+
+//================================================================================================//
+
+status_t
+telemetry_reader_t::request(uint64_t period_us)
+{
+    piano_proto::message_t message;
+    message.type                        = piano_proto::MESSAGE_TELEMETRY;
+    message.telemetry_request.period_us = period_us;
+
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    status_t status = piano_proto::encode_message(message, frame, sizeof(frame), &size);
+    if (status != STATUS_SUCCESS)
+    {
+        return status;
+    }
+    return (write(fd_, frame, size) == static_cast<ssize_t>(size))
+         ? STATUS_SUCCESS : STATUS_SERIAL_WRITE_ERROR;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+status_t
+telemetry_reader_t::next(int64_t                   deadline_us,
+                         piano_proto::telemetry_t *report)
+{
+    piano_proto::message_t message;
+    while (true)
+    {
+        // Bytes after report stay in buffer for the next call
+        while (position_ != size_)
+        {
+            if (decoder_.push(buffer_[position_++], &message) == STATUS_SUCCESS &&
+                message.type == piano_proto::MESSAGE_TELEMETRY_REPORT)
+            {
+                *report = message.telemetry;
+                return STATUS_SUCCESS;
+            }
+        }
+
+        int64_t now_us = host_time_us();
+        if (now_us >= deadline_us)
+        {
+            return STATUS_SYNC_TIMEOUT;
+        }
+        pollfd request = {fd_, POLLIN, 0};
+        int    ready   = poll(&request, 1, static_cast<int>((deadline_us - now_us + 999) / 1000));
+        if (ready < 0)
+        {
+            return (errno == EINTR) ? STATUS_SYNC_TIMEOUT : STATUS_SERIAL_READ_ERROR;
+        }
+
+        ssize_t size = (ready == 0) ? 0 : read(fd_, buffer_, sizeof(buffer_));
+        if (size < 0)
+        {
+            return STATUS_SERIAL_READ_ERROR;
+        }
+        position_ = 0;
+        size_     = static_cast<size_t>(size);
+    }
+}
+
+//================================================================================================//
+
+bool
+telemetry_view_t::add(const piano_proto::telemetry_t &report)
+{
+    delta_           = report;
+    delta_.device_us = report.device_us - last_.device_us;
+    for (uint32_t piano_proto::telemetry_t::*total : kTotals)
+    {
+        delta_.*total = report.*total - last_.*total;
+    }
+    last_ = report;
+    return reports_++ != 0;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+telemetry_view_t::print(std::ostream &out) const
+{
+    uint64_t interval_us = delta_.device_us;
+    double   late_us     = (delta_.late_count == 0) ? 0.
+                         : static_cast<double>(delta_.late_sum_us) / delta_.late_count;
+    double   strip       = 100. * per_second(delta_.strip_busy_us, interval_us) / 1e6;
+    double   parser      = 100. * per_second(delta_.parser_busy_us, interval_us) / 1e6;
+
+    out << std::fixed << std::setprecision(1)
+        << "msg " << per_second(delta_.messages, interval_us) << "/s err "
+        << delta_.frame_errors << " ovr " << delta_.uart_overruns
+        << " | queue rx " << delta_.rx_queue_high << " sched " << delta_.schedule_high
+        << " | late mean " << late_us << "us max " << delta_.late_max_us
+        << "us | led " << per_second(delta_.frames_shown, interval_us) << "/s drop "
+        << per_second(delta_.frames_dropped, interval_us) << "/s strip " << strip << "% max "
+        << delta_.strip_max_us << "us | parser " << parser << "% max " << delta_.parser_max_us
+        << "us\n" << std::defaultfloat;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_host
+
+//================================================================================================//
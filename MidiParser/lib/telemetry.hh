@@ -0,0 +1,93 @@
+//================================================================================================//
+
+#ifndef __TELEMETRY_HH__
+#define __TELEMETRY_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+
+//================================================================================================//
+
+//
+// Host side of telemetry channel: device sends MESSAGE_TELEMETRY_REPORT periodically after
+// MESSAGE_TELEMETRY, host turns totals of two reports into rates of the interval between them.
+// Works with device simulator (piano_sim) as with real device.
+//
+namespace piano_host
+{
+
+//================================================================================================//
+
+//
+// Reads reports from device, bytes of other messages are skipped
+//
+class telemetry_reader_t
+{
+  public:
+    explicit telemetry_reader_t(int fd) : fd_(fd) {}
+
+    //
+    // Ask device for a report every period_us, 0 stops reports
+    //
+    piano::status_t request(uint64_t period_us);
+
+    //
+    // Wait until host time deadline_us for the next report. Returns STATUS_SYNC_TIMEOUT if none
+    // came or wait was interrupted by signal.
+    //
+    piano::status_t next(int64_t deadline_us, piano_proto::telemetry_t *report);
+
+  private:
+    int                          fd_           = -1;
+    piano_proto::frame_decoder_t decoder_;
+    uint8_t                      buffer_[256]  = {};
+    size_t                       size_         = 0;
+    size_t                       position_     = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Rates between consecutive reports. Counters are differences of 32-bit totals, so they
+// survive wrap around; maxima are taken as they are, since start of device.
+//
+class telemetry_view_t
+{
+  public:
+    //
+    // Returns false for the first report, which only gives base of the next interval
+    //
+    bool add(const piano_proto::telemetry_t &report);
+
+    //
+    // Counters over the latest interval, device_us is its length
+    //
+    const piano_proto::telemetry_t &delta() const { return delta_; }
+    const piano_proto::telemetry_t &last()  const { return last_;  }
+
+    //
+    // One line with rates of the latest interval
+    //
+    void print(std::ostream &out) const;
+
+  private:
+    piano_proto::telemetry_t last_    = {};
+    piano_proto::telemetry_t delta_   = {};
+    size_t                   reports_ = 0;
+};
+
+} // ! namespace piano_host
+
+//================================================================================================//
+
+#endif // ! __TELEMETRY_HH__
+
+//================================================================================================//
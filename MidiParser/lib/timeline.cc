@@ -0,0 +1,56 @@
+//================================================================================================//
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "timeline.hh"
+
+//================================================================================================//
+
+namespace piano_midi
+{
+
+//================================================================================================//
+
+using namespace piano;
+
+//================================================================================================//
+
+status_t
+resolve_timeline(const std::vector<event_t>  &events,
+                 std::vector<timed_event_t>  &timeline)
+{
+    timeline.reserve(timeline.size() + events.size());
+
+    double tempo   = static_cast<double>(kDefaultTempo);
+    double time_us = 0.;
+    for (const auto &event : events)
+    {
+        // delta_time is measured in quarter notes, so it is scaled by tempo active before event
+        time_us += tempo * event.time_.delta_time;
+
+        timed_event_t timed = {};
+        timed.time_us = static_cast<uint64_t>(time_us);
+        timed.event   = event.event_;
+        if (event.event_ == EVENT_TEMPO_SET)
+        {
+            timed.tempo = event.data_.tempo;
+            tempo       = static_cast<double>(event.data_.tempo);
+        } else
+        {
+            timed.note     = event.data_.note;
+            timed.velocity = event.velocity_;
+        }
+        timeline.push_back(timed);
+    }
+    return STATUS_SUCCESS;
+}
+
+//================================================================================================//
+
+} // ! namespace piano_midi
+
+//================================================================================================//
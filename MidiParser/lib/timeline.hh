@@ -0,0 +1,56 @@
+//================================================================================================//
+
+#ifndef __TIMELINE_HH__
+#define __TIMELINE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+
+//================================================================================================//
+
+namespace piano_midi
+{
+
+//================================================================================================//
+
+//
+// Default MIDI tempo in microseconds per quarter note, used until first Set Tempo event
+//
+static const uint32_t kDefaultTempo = 500000;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Event with absolute time from the beginning of the song
+//
+struct timed_event_t
+{
+    uint64_t           time_us  = 0;
+    piano::event_num_t event    = piano::EVENT_NOTE_OFF;
+    uint8_t            note     = 0;
+    uint8_t            velocity = 0;
+    uint32_t           tempo    = 0;
+};
+
+//================================================================================================//
+
+//
+// Translate delta times produced by parse_midi to absolute times in microseconds, applying
+// tempo changes the same way player does.
+//
+piano::status_t resolve_timeline(const std::vector<piano::event_t> &events,
+                                 std::vector<timed_event_t>        &timeline);
+
+} // ! namespace piano_midi
+
+//================================================================================================//
+
+#endif // ! __TIMELINE_HH__
+
+//================================================================================================//
@@ -0,0 +1,120 @@
+//================================================================================================//
+
+#ifndef __TIMER_QUEUE_HH__
+#define __TIMER_QUEUE_HH__
+
+//================================================================================================//
+
+#include <cstdint>
+#include <cstddef>
+
+//================================================================================================//
+
+namespace piano
+{
+
+//================================================================================================//
+
+//
+// Items ordered by time they are due, earliest first. Binary heap over fixed storage, so it never
+// allocates and may be used in firmware. Items with equal time come out in order of push.
+//
+template <typename T, size_t CAPACITY>
+class timer_queue_t
+{
+  public:
+    //
+    // Returns false if queue is full
+    //
+    bool push(int64_t time_us, const T &item)
+    {
+        if (size_ == CAPACITY)
+        {
+            return false;
+        }
+
+        size_t pos = size_++;
+        entries_[pos] = {time_us, order_++, item};
+        while (pos != 0 && earlier(pos, (pos - 1) / 2))
+        {
+            swap(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+        return true;
+    }
+
+    //
+    // Earliest item, queue must not be empty
+    //
+    const T &top()       const { return entries_[0].item;    }
+    int64_t  next_time() const { return entries_[0].time_us; }
+
+    bool due(int64_t now_us) const { return size_ != 0 && entries_[0].time_us <= now_us; }
+
+    void pop()
+    {
+        entries_[0] = entries_[--size_];
+        size_t pos = 0;
+        while (true)
+        {
+            size_t child = 2 * pos + 1;
+            if (child >= size_)
+            {
+                break;
+            }
+            if (child + 1 < size_ && earlier(child + 1, child))
+            {
+                ++child;
+            }
+            if (!earlier(child, pos))
+            {
+                break;
+            }
+            swap(pos, child);
+            pos = child;
+        }
+    }
+
+    void   clear()       { size_ = 0;            }
+    bool   empty() const { return size_ == 0;    }
+    bool   full()  const { return size_ == CAPACITY; }
+    size_t size()  const { return size_;         }
+
+    static constexpr size_t capacity() { return CAPACITY; }
+
+  private:
+    struct entry_t
+    {
+        int64_t  time_us;
+        uint32_t order;
+        T        item;
+    };
+
+    bool earlier(size_t lhs, size_t rhs) const
+    {
+        const entry_t &a = entries_[lhs];
+        const entry_t &b = entries_[rhs];
+        // Difference of order is correct after wrap around while queue is shorter than 2^31
+        return a.time_us != b.time_us ? a.time_us < b.time_us
+                                      : static_cast<int32_t>(a.order - b.order) < 0;
+    }
+
+    void swap(size_t lhs, size_t rhs)
+    {
+        entry_t entry = entries_[lhs];
+        entries_[lhs] = entries_[rhs];
+        entries_[rhs] = entry;
+    }
+
+    entry_t  entries_[CAPACITY];
+    size_t   size_  = 0;
+    uint32_t order_ = 0;
+};
+
+} // ! namespace piano
+
+//================================================================================================//
+
+#endif // ! __TIMER_QUEUE_HH__
+
+//================================================================================================//
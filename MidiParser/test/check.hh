@@ -0,0 +1,39 @@
+//================================================================================================//
+
+#ifndef __CHECK_HH__
+#define __CHECK_HH__
+
+//================================================================================================//
+
+#include <iostream>
+
+//================================================================================================//
+
+//
+// Number of failed checks in current test executable
+//
+inline int gFailedChecks = 0;
+
+//
+// Report failed condition without stopping the test, so that all failures are visible at once
+//
+#define CHECK(condition)                                                                         \
+    do                                                                                           \
+    {                                                                                            \
+        if (!(condition))                                                                        \
+        {                                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n";      \
+            ++gFailedChecks;                                                                     \
+        }                                                                                        \
+    } while (0)
+
+//
+// Value returned from main of test
+//
+#define CHECK_RESULT() (gFailedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+//================================================================================================//
+
+#endif // ! __CHECK_HH__
+
+//================================================================================================//
@@ -0,0 +1,274 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <poll.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "timer_queue.hh"
+#include "clock_sync.hh"
+#include "serial_sender.hh"
+#include "midi_pipeline.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Clock of simulated device
+//
+static const int64_t kDeviceOffsetUs = 5000000;
+static const double  kDeviceDriftPpm = 80.;
+
+//================================================================================================//
+
+static void
+test_timer_queue()
+{
+    piano::timer_queue_t<int, 8> queue;
+    CHECK(queue.empty() && !queue.due(1000));
+
+    const int64_t times[] = {50, 10, 40, 10, 30, 20, 10, 60};
+    for (int i = 0; i != 8; ++i)
+    {
+        CHECK(queue.push(times[i], i));
+    }
+    CHECK(queue.full() && !queue.push(0, 100));
+    CHECK(!queue.due(9) && queue.due(10));
+
+    // Earliest first, equal times in order of push
+    const int expected[] = {1, 3, 6, 5, 4, 2, 0, 7};
+    for (int i = 0; i != 8; ++i)
+    {
+        CHECK(queue.top() == expected[i]);
+        queue.pop();
+    }
+    CHECK(queue.empty());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Exchange at host time host_us with given one-way delays
+//
+static piano_host::sync_sample_t
+exchange(const piano_host::simulated_clock_t &device,
+         int64_t                              host_us,
+         int64_t                              request_delay_us,
+         int64_t                              response_delay_us)
+{
+    piano_host::sync_sample_t sample = {};
+    sample.host_send_us      = host_us;
+    sample.device_receive_us = device.at(host_us + request_delay_us);
+    sample.device_send_us    = device.at(host_us + request_delay_us + 50);
+    sample.host_receive_us   = host_us + request_delay_us + 50 + response_delay_us;
+    return sample;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static int64_t
+max_error_us(const piano_host::clock_sync_t       &sync,
+             const piano_host::simulated_clock_t  &device,
+             int64_t                               from_us,
+             int64_t                               to_us)
+{
+    int64_t error = 0;
+    for (int64_t host_us = from_us; host_us <= to_us; host_us += (to_us - from_us) / 16)
+    {
+        error = std::max(error, std::abs(sync.to_device(host_us) - device.at(host_us)));
+    }
+    return error;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_estimator()
+{
+    piano_host::simulated_clock_t device(kDeviceOffsetUs, kDeviceDriftPpm);
+
+    // Burst shorter than kMinDriftSpanUs gives offset only, error is bounded by drift over burst
+    piano_host::clock_sync_t burst;
+    CHECK(!burst.synchronized());
+    for (int64_t i = 0; i != 64; ++i)
+    {
+        burst.add(exchange(device, 1000000 + i * 20000, 700, 700));
+    }
+    CHECK(burst.synchronized() && burst.drift_ppm() == 0.);
+    CHECK(max_error_us(burst, device, 1000000, 2260000) <= 1260000 * kDeviceDriftPpm * 1e-6);
+
+    // Symmetric link over a minute: offset and drift are exact. The fastest quarter of exchanges
+    // is spread over the whole span.
+    piano_host::clock_sync_t sync;
+    for (int64_t i = 0; i != 64; ++i)
+    {
+        sync.add(exchange(device, 1000000 + i * 1000000, 700 + i % 4, 700 + i % 4));
+    }
+    CHECK(std::abs(sync.drift_ppm() - kDeviceDriftPpm) < 0.5);
+    CHECK(max_error_us(sync, device, 1000000, 64000000) <= 2);
+    CHECK(std::abs(sync.to_host(sync.to_device(1500000)) - 1500000) <= 1);
+
+    // Queueing delays in both directions: the fastest exchanges are nearly symmetric
+    std::mt19937                            random(7);
+    std::exponential_distribution<double>   queueing(1. / 2000.);
+    piano_host::clock_sync_t                noisy;
+    for (int64_t i = 0; i != 64; ++i)
+    {
+        noisy.add(exchange(device, 1000000 + i * 1000000,
+                           700 + static_cast<int64_t>(queueing(random)),
+                           700 + static_cast<int64_t>(queueing(random))));
+    }
+    CHECK(max_error_us(noisy, device, 1000000, 64000000) < 500);
+    CHECK(noisy.min_delay_us() >= 1400);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Device side of pty: answers sync requests and collects everything else
+//
+static void
+device_loop(int                                  master,
+            const piano_host::simulated_clock_t &device,
+            std::atomic<bool>                   *stop,
+            std::vector<piano_proto::message_t> *received)
+{
+    piano_proto::frame_decoder_t decoder;
+    piano_proto::message_t       message;
+    uint8_t                      buffer[4096] = {};
+    while (!stop->load())
+    {
+        pollfd request = {master, POLLIN, 0};
+        if (poll(&request, 1, 10) <= 0)
+        {
+            continue;
+        }
+        ssize_t size       = read(master, buffer, sizeof(buffer));
+        int64_t receive_us = device.now_us();
+        for (ssize_t i = 0; i < size; ++i)
+        {
+            if (decoder.push(buffer[i], &message) != piano::STATUS_SUCCESS)
+            {
+                continue;
+            }
+            if (message.type != piano_proto::MESSAGE_SYNC_REQUEST)
+            {
+                received->push_back(message);
+                continue;
+            }
+
+            piano_proto::message_t response;
+            response.type                   = piano_proto::MESSAGE_SYNC_RESPONSE;
+            response.sync.host_send_us      = message.sync.host_send_us;
+            response.sync.device_receive_us = static_cast<uint64_t>(receive_us);
+            response.sync.device_send_us    = static_cast<uint64_t>(device.now_us());
+
+            uint8_t frame[piano_proto::kMaxFrameSize] = {};
+            size_t  frame_size = 0;
+            piano_proto::encode_message(response, frame, sizeof(frame), &frame_size);
+            CHECK(write(master, frame, frame_size) == static_cast<ssize_t>(frame_size));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Synchronize with simulated device over pty, then stream song in lookahead mode
+//
+static void
+test_lookahead(const char *path)
+{
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), 115200, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::simulated_clock_t       device(kDeviceOffsetUs, kDeviceDriftPpm);
+    std::atomic<bool>                   stop     = {false};
+    std::vector<piano_proto::message_t> received = {};
+    std::thread device_thread(device_loop, master, std::cref(device), &stop, &received);
+
+    piano_host::clock_tracker_t clock(fd, 0);
+    CHECK(clock.synchronize(32, 2000) == piano::STATUS_SUCCESS);
+    piano_host::clock_sync_t sync = clock.sync();
+    CHECK(sync.synchronized());
+
+    // Pty delivers within a few milliseconds even on loaded machine
+    int64_t now_us = piano_host::host_time_us();
+    CHECK(std::abs(sync.to_device(now_us) - device.at(now_us)) < 5000);
+
+    // Estimate is not tracked during playback, so that intervals can be checked exactly
+    const double                  speed  = 200.;
+    piano_host::pipeline_config_t config = {0, speed, &clock, 100000};
+    piano_host::midi_pipeline_t   pipeline(fd, config);
+    CHECK(pipeline.run(path) == piano::STATUS_SUCCESS);
+
+    // Tracking continues exchanges in background
+    clock.start(1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    clock.stop();
+    CHECK(clock.sync().count() > sync.count());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    // Messages are stamped with device time, intervals follow song
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    expected = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, expected);
+    CHECK(received.size() == expected.size());
+
+    bool follows = received.size() == expected.size() && !received.empty();
+    for (size_t i = 0; follows && i != received.size(); ++i)
+    {
+        double song   = static_cast<double>(piano_proto::message_time(expected[i]) -
+                                            piano_proto::message_time(expected[0]));
+        double device_interval = static_cast<double>(piano_proto::message_time(received[i]) -
+                                                     piano_proto::message_time(received[0]));
+        follows = std::abs(device_interval - song / speed * (1. + sync.drift_ppm() * 1e-6)) < 2.;
+    }
+    CHECK(follows);
+
+    // Everything is sent ahead of its device time
+    int64_t first_device_us = static_cast<int64_t>(piano_proto::message_time(received.front()));
+    CHECK(first_device_us > device.at(now_us));
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    test_timer_queue();
+    test_estimator();
+    if (argc > 1)
+    {
+        test_lookahead(argv[1]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,426 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+#include "song_delta.hh"
+#include "song_upload.hh"
+#include "device.hh"
+#include "device_sim.hh"
+#include "serial_sender.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Port with song storage, keeps acks device sends
+//
+class store_port_t : public piano_device::device_port_t
+{
+  public:
+    int64_t now_us() override { return 0; }
+
+    void send(const uint8_t *data, size_t size) override
+    {
+        piano_proto::message_t message;
+        for (size_t i = 0; i != size; ++i)
+        {
+            if (decoder_.push(data[i], &message) == piano::STATUS_SUCCESS &&
+                message.type == piano_proto::MESSAGE_UPLOAD_ACK)
+            {
+                acks.push_back(message.upload_ack);
+            }
+        }
+    }
+
+    void show(const piano_device::led_frame_t &) override {}
+
+    uint8_t *song_storage(size_t *capacity) override
+    {
+        *capacity = storage.size();
+        return storage.data();
+    }
+
+    std::vector<uint8_t>                   storage = std::vector<uint8_t>(1 << 16);
+    std::vector<piano_proto::upload_ack_t> acks    = {};
+
+  private:
+    piano_proto::frame_decoder_t decoder_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+deliver(piano_device::device_t       *device,
+        const piano_proto::message_t &message)
+{
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    CHECK(piano_proto::encode_message(message, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS);
+    device->receive(frame, size, 0);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Begin and all chunks of data in order
+//
+static void
+deliver_upload(piano_device::device_t       *device,
+               const piano_proto::message_t &begin,
+               const std::vector<uint8_t>   &data)
+{
+    deliver(device, begin);
+
+    piano_proto::message_t message;
+    message.type = piano_proto::MESSAGE_UPLOAD_CHUNK;
+    for (size_t offset = 0; offset < data.size(); offset += piano_proto::kUploadChunkSize)
+    {
+        message.upload_chunk.sequence = static_cast<uint32_t>(offset /
+                                                              piano_proto::kUploadChunkSize);
+        message.upload_chunk.size     = static_cast<uint8_t>(std::min(piano_proto::kUploadChunkSize,
+                                                                      data.size() - offset));
+        std::memcpy(message.upload_chunk.data, data.data() + offset, message.upload_chunk.size);
+        deliver(device, message);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_proto::message_t
+patch_message(const std::vector<uint8_t>         &image,
+              const piano_host::song_signature_t &base,
+              const std::vector<uint8_t>         &patch)
+{
+    piano_proto::message_t message;
+    message.type                   = piano_proto::MESSAGE_PATCH_BEGIN;
+    message.patch_begin.size       = static_cast<uint32_t>(image.size());
+    message.patch_begin.crc32      = piano_proto::crc32(image.data(), image.size());
+    message.patch_begin.base_crc32 = base.crc32;
+    message.patch_begin.block_size = base.block_size;
+    message.patch_begin.patch_size = static_cast<uint32_t>(patch.size());
+    return message;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Song with notes played in [from_us, from_us + length_us) moved a semitone up
+//
+static std::vector<uint8_t>
+compile_edited(const std::vector<piano_midi::timed_event_t> &timeline,
+               uint64_t                                      from_us,
+               uint64_t                                      length_us)
+{
+    std::vector<piano_midi::timed_event_t> edited   = timeline;
+    std::vector<piano_proto::message_t>    messages = {};
+    std::vector<uint8_t>                   image    = {};
+    for (piano_midi::timed_event_t &event : edited)
+    {
+        if (event.event != piano::EVENT_TEMPO_SET && event.note < 127 &&
+            event.time_us >= from_us && event.time_us - from_us < length_us)
+        {
+            ++event.note;
+        }
+    }
+    CHECK(piano_proto::make_messages(edited, messages) == piano::STATUS_SUCCESS);
+    CHECK(piano_proto::compile_song(messages, image) == piano::STATUS_SUCCESS);
+    return image;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Apply patch of new against signature of old and compare with new
+//
+static bool
+round_trip(const std::vector<uint8_t> &old_image,
+           const std::vector<uint8_t> &new_image,
+           uint32_t                    block_size,
+           std::vector<uint8_t>       &patch)
+{
+    piano_host::song_signature_t signature;
+    piano_host::make_signature(old_image, block_size, &signature);
+    piano_host::make_patch(signature, new_image, patch);
+
+    std::vector<uint8_t> image(new_image.size() + 1);
+    size_t               size = 0;
+    return piano_proto::apply_patch(old_image.data(), old_image.size(), block_size,
+                                    patch.data(), patch.size(), image.data(), image.size(),
+                                    &size) == piano::STATUS_SUCCESS &&
+           size == new_image.size() &&
+           (size == 0 || std::memcmp(image.data(), new_image.data(), size) == 0);
+}
+
+//================================================================================================//
+
+//
+// Inserted, removed and replaced bytes at random places and block sizes, unaligned tails
+//
+static void
+test_patch()
+{
+    std::mt19937         random(7);
+    std::vector<uint8_t> base(5000);
+    for (uint8_t &byte : base)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    std::vector<uint8_t> patch;
+    for (uint32_t block_size : {16u, 64u, 100u})
+    {
+        // The same image is one copy op
+        CHECK(round_trip(base, base, block_size, patch) && patch.size() <= 4);
+
+        for (size_t round = 0; round != 20; ++round)
+        {
+            std::vector<uint8_t> edited = base;
+            size_t               pos    = random() % edited.size();
+            size_t               length = 1 + random() % 50;
+            switch (round % 3)
+            {
+                case 0: { edited.insert(edited.begin() + pos, length, 0x55);             break; }
+                case 1: { edited.erase(edited.begin() + pos,
+                                       edited.begin() + std::min(pos + length, edited.size()));
+                          break; }
+                case 2: { edited[pos] ^= 0xff;                                            break; }
+            }
+            CHECK(round_trip(base, edited, block_size, patch));
+
+            // Two damaged blocks and a literal of edit, a few bytes of ops
+            CHECK(patch.size() <= length + 2 * block_size + 16);
+        }
+    }
+
+    // Nothing in common and empty images
+    std::vector<uint8_t> other(777, 0x33);
+    std::vector<uint8_t> empty;
+    CHECK(round_trip(base, other, 64, patch) && patch.size() > other.size());
+    CHECK(round_trip(empty, base, 64, patch));
+    CHECK(round_trip(base, empty, 64, patch) && patch.empty());
+
+    // Broken patches are rejected, not applied past image
+    std::vector<uint8_t> image(base.size());
+    size_t               size = 0;
+    round_trip(base, base, 64, patch);
+    CHECK(piano_proto::apply_patch(base.data(), base.size(), 64, patch.data(), patch.size(),
+                                   image.data(), base.size() - 1, &size) ==
+          piano::STATUS_SONG_FORMAT_ERROR);
+    CHECK(piano_proto::apply_patch(base.data(), base.size() - 64, 64, patch.data(), patch.size(),
+                                   image.data(), image.size(), &size) ==
+          piano::STATUS_SONG_FORMAT_ERROR);
+    CHECK(piano_proto::apply_patch(base.data(), base.size(), 64, patch.data(), patch.size() - 1,
+                                   image.data(), image.size(), &size) ==
+          piano::STATUS_SONG_FORMAT_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Patch of a few edited seconds is a small part of song, signature survives file
+//
+static void
+test_song(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    if (timeline.empty())
+    {
+        return;
+    }
+    uint64_t             length_us = timeline.back().time_us;
+    std::vector<uint8_t> original  = compile_edited(timeline, 0, 0);
+    std::vector<uint8_t> edited    = compile_edited(timeline, timeline[timeline.size() / 2].time_us,
+                                                    2000000);
+    std::vector<uint8_t> patch;
+    CHECK(edited != original);
+    CHECK(round_trip(original, edited, piano_host::kDeltaBlockSize, patch));
+    if (length_us > 20000000)
+    {
+        CHECK(patch.size() * 4 < edited.size());
+    }
+
+    piano_host::song_signature_t signature;
+    piano_host::song_signature_t loaded;
+    piano_host::make_signature(original, piano_host::kDeltaBlockSize, &signature);
+    CHECK(piano_host::save_signature("delta_test.sig", signature) == piano::STATUS_SUCCESS);
+    CHECK(piano_host::load_signature("delta_test.sig", &loaded) == piano::STATUS_SUCCESS);
+    CHECK(loaded.block_size == signature.block_size && loaded.size == signature.size);
+    CHECK(loaded.crc32 == signature.crc32 && loaded.blocks.size() == signature.blocks.size());
+    std::vector<uint8_t> from_file;
+    piano_host::make_patch(loaded, edited, from_file);
+    CHECK(from_file == patch);
+
+    // Truncated file is refused
+    CHECK(truncate("delta_test.sig", 20) == 0);
+    CHECK(piano_host::load_signature("delta_test.sig", &loaded) == piano::STATUS_FILE_ERROR);
+    unlink("delta_test.sig");
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Device builds patched song next to the stored one and keeps it if patch does not apply
+//
+static void
+test_store()
+{
+    std::mt19937         random(3);
+    std::vector<uint8_t> base(3000);
+    for (uint8_t &byte : base)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+    std::vector<uint8_t> edited = base;
+    edited.insert(edited.begin() + 1000, 10, 0xaa);
+
+    store_port_t           port;
+    piano_device::device_t device(&port);
+    piano_host::song_signature_t signature;
+    piano_host::make_signature(base, piano_host::kDeltaBlockSize, &signature);
+    std::vector<uint8_t> patch;
+    piano_host::make_patch(signature, edited, patch);
+
+    // Patch without stored song
+    deliver(&device, patch_message(edited, signature, patch));
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_BASE_MISMATCH);
+
+    piano_proto::message_t begin;
+    begin.type               = piano_proto::MESSAGE_UPLOAD_BEGIN;
+    begin.upload_begin.size  = static_cast<uint32_t>(base.size());
+    begin.upload_begin.crc32 = signature.crc32;
+    deliver_upload(&device, begin, base);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+    const uint8_t *first_slot = device.song().data();
+
+    // Broken patch leaves stored song
+    std::vector<uint8_t> broken = patch;
+    broken.back() ^= 1;
+    deliver_upload(&device, patch_message(edited, signature, broken), broken);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_CRC_ERROR);
+    CHECK(device.song().data() == first_slot && device.song().crc32() == signature.crc32);
+
+    deliver_upload(&device, patch_message(edited, signature, patch), patch);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+    CHECK(port.acks.back().crc32 == piano_proto::crc32(edited.data(), edited.size()));
+    CHECK(device.song().size() == edited.size() && device.song().data() != first_slot);
+    CHECK(std::memcmp(device.song().data(), edited.data(), edited.size()) == 0);
+
+    // Old signature no longer matches, patched song is not sent again
+    deliver(&device, patch_message(base, signature, patch));
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_BASE_MISMATCH);
+    deliver(&device, patch_message(edited, signature, patch));
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+
+    // Patch and new image must fit in slot together
+    piano_host::song_signature_t current;
+    piano_host::make_signature(edited, piano_host::kDeltaBlockSize, &current);
+    std::vector<uint8_t> huge_patch(port.storage.size() / 2);
+    deliver(&device, patch_message(edited, current, huge_patch));
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+    std::vector<uint8_t> other = base;
+    deliver(&device, patch_message(other, current, huge_patch));
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_TOO_LARGE);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Patch over pty to simulator, stale signature falls back to whole image
+//
+static void
+test_upload(const char *path)
+{
+    static const uint32_t kBaudRate = 921600;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    if (timeline.empty())
+    {
+        return;
+    }
+    // Edits start at notes, so that they are not in a pause
+    uint64_t             third_us = timeline[timeline.size() / 3].time_us;
+    uint64_t             half_us  = timeline[timeline.size() / 2].time_us;
+    std::vector<uint8_t> original = compile_edited(timeline, 0, 0);
+    std::vector<uint8_t> edited   = compile_edited(timeline, third_us, 1000000);
+    std::vector<uint8_t> again    = compile_edited(timeline, half_us, 1000000);
+
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate = kBaudRate;
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::song_signature_t signature;
+    piano_host::upload_result_t  full;
+    piano_host::upload_result_t  delta;
+    piano_host::upload_result_t  stale;
+    CHECK(piano_host::upload_song(fd, kBaudRate, original, {}, &full) == piano::STATUS_SUCCESS);
+    piano_host::make_signature(original, piano_host::kDeltaBlockSize, &signature);
+    CHECK(piano_host::upload_song(fd, kBaudRate, edited, {}, &delta, &signature) ==
+          piano::STATUS_SUCCESS);
+
+    // Device has edited song, not the one of signature
+    CHECK(piano_host::upload_song(fd, kBaudRate, again, {}, &stale, &signature) ==
+          piano::STATUS_SUCCESS);
+
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    const piano_device::song_store_t &song = simulator.device().song();
+    CHECK(song.complete() && song.size() == again.size());
+    CHECK(std::memcmp(song.data(), again.data(), again.size()) == 0);
+    CHECK(full.patch_bytes == 0 && stale.patch_bytes == 0);
+    CHECK(delta.patch_bytes != 0 && delta.patch_bytes < edited.size());
+    CHECK(delta.wire_bytes * 4 < full.wire_bytes && stale.chunks > full.chunks);
+    CHECK(!delta.skipped && !stale.skipped);
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_patch();
+    test_store();
+    for (int i = 1; i < argc; ++i)
+    {
+        test_song(argv[i]);
+    }
+    if (argc > 1)
+    {
+        test_upload(argv[1]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
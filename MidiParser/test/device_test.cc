@@ -0,0 +1,804 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "device.hh"
+#include "led_render.hh"
+#include "led_pacer.hh"
+#include "schedule_alarm.hh"
+#include "device_sim.hh"
+#include "clock_sync.hh"
+#include "serial_sender.hh"
+#include "telemetry.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Port with manual clock which keeps everything device sends and shows
+//
+class test_port_t : public piano_device::device_port_t
+{
+  public:
+    int64_t now_us() override { return time_us; }
+
+    void send(const uint8_t *data, size_t size) override
+    {
+        piano_proto::message_t message;
+        for (size_t i = 0; i != size; ++i)
+        {
+            if (decoder_.push(data[i], &message) == piano::STATUS_SUCCESS)
+            {
+                sent.push_back(message);
+            }
+        }
+    }
+
+    void show(const piano_device::led_frame_t &frame) override { shown.push_back(frame); }
+
+    int64_t                                time_us = 0;
+    std::vector<piano_proto::message_t>    sent    = {};
+    std::vector<piano_device::led_frame_t> shown   = {};
+
+  private:
+    piano_proto::frame_decoder_t decoder_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+deliver(piano_device::device_t       *device,
+        const piano_proto::message_t &message,
+        int64_t                       receive_us)
+{
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    CHECK(piano_proto::encode_message(message, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS);
+    device->receive(frame, size, receive_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_proto::message_t
+note_batch(uint64_t time_us,
+           uint8_t  note,
+           bool     on)
+{
+    piano_proto::message_t message;
+    message.type                     = piano_proto::MESSAGE_NOTE_BATCH;
+    message.note_batch.time_us       = time_us;
+    message.note_batch.count         = 1;
+    message.note_batch.notes[0].note = note;
+    message.note_batch.notes[0].on   = on;
+    return message;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+lit(const piano_device::led_frame_t &frame,
+    size_t                           led)
+{
+    const uint8_t *grb = &frame.grb[led * piano_device::kBytesPerLed];
+    return grb[0] != 0 || grb[1] != 0 || grb[2] != 0;
+}
+
+//================================================================================================//
+
+static void
+test_immediate()
+{
+    test_port_t            port;
+    piano_device::device_t device(&port);
+
+    deliver(&device, note_batch(1000000, 60, true), 0);
+    CHECK(device.keys()[60] && port.shown.size() == 1);
+    CHECK(port.shown.back().size == piano_device::kPianoLeds);
+    CHECK(lit(port.shown.back(), 60 - piano_device::kPianoFirstNote));
+
+    // Key frames replace the whole state
+    piano_proto::key_encoder_t encoder;
+    piano_proto::key_state_t   state = {};
+    state.set(21, true);
+    state.set(70, true);
+
+    piano_proto::message_t frame;
+    frame.type               = piano_proto::MESSAGE_KEY_FRAME;
+    frame.key_frame.time_us  = 0;
+    frame.key_frame.size     = static_cast<uint8_t>(encoder.encode(state, frame.key_frame.data));
+    deliver(&device, frame, 0);
+    CHECK(!device.keys()[60] && device.keys()[21] && device.keys()[70]);
+    CHECK(lit(port.shown.back(), 0) && lit(port.shown.back(), 70 - piano_device::kPianoFirstNote));
+    CHECK(!lit(port.shown.back(), 60 - piano_device::kPianoFirstNote));
+
+    // Sync response carries request time and device clock
+    piano_proto::message_t request;
+    request.type              = piano_proto::MESSAGE_SYNC_REQUEST;
+    request.sync.host_send_us = 777;
+    port.time_us              = 5000;
+    deliver(&device, request, 4000);
+    CHECK(port.sent.size() == 1 && port.sent[0].type == piano_proto::MESSAGE_SYNC_RESPONSE);
+    CHECK(port.sent[0].sync.host_send_us      == 777);
+    CHECK(port.sent[0].sync.device_receive_us == 4000);
+    CHECK(port.sent[0].sync.device_send_us    == 5000);
+    CHECK(port.shown.size() == 2);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_scheduled()
+{
+    test_port_t            port;
+    piano_device::device_t device(&port);
+
+    piano_proto::message_t schedule;
+    schedule.type             = piano_proto::MESSAGE_SCHEDULE;
+    schedule.schedule.enabled = true;
+    deliver(&device, schedule, 0);
+    CHECK(device.scheduled());
+
+    // Future messages wait for their time, late ones are played at once
+    port.time_us = 1000;
+    deliver(&device, note_batch(3000, 1, true), 1000);
+    deliver(&device, note_batch(2000, 2, true), 1000);
+    deliver(&device, note_batch(500,  3, true), 1000);
+    CHECK(device.keys()[3] && !device.keys()[1] && !device.keys()[2]);
+    CHECK(device.has_scheduled() && device.next_time_us() == 2000);
+
+    device.update(1999);
+    CHECK(!device.keys()[2] && port.shown.size() == 1);
+    device.update(2500);
+    CHECK(device.keys()[2] && !device.keys()[1] && port.shown.size() == 2);
+    device.update(3000);
+    CHECK(device.keys()[1] && !device.has_scheduled() && port.shown.size() == 3);
+
+    // Full queue plays its earliest message early
+    for (size_t i = 0; i != piano_device::kScheduleCapacity + 1; ++i)
+    {
+        deliver(&device, note_batch(10000 + i, static_cast<uint8_t>(10 + i), true), 1000);
+    }
+    CHECK(device.keys()[10] && !device.keys()[11]);
+
+    // Reset drops schedule
+    piano_proto::message_t reset;
+    reset.type = piano_proto::MESSAGE_RESET;
+    deliver(&device, reset, 1000);
+    CHECK(!device.scheduled() && !device.has_scheduled() && !device.keys()[10]);
+    for (size_t i = 0; i != port.shown.back().size; ++i)
+    {
+        CHECK(!lit(port.shown.back(), i));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Reports on virtual clock: the first one at once, then every period, counters of device and
+// port in each. Reports are kept over reset.
+//
+static void
+test_telemetry()
+{
+    struct telemetry_port_t : public test_port_t
+    {
+        void telemetry(piano_proto::telemetry_t *report) override { report->frames_shown = 7; }
+    };
+
+    telemetry_port_t       port;
+    piano_device::device_t device(&port);
+    CHECK(!device.has_scheduled());
+
+    piano_proto::message_t request;
+    request.type                        = piano_proto::MESSAGE_TELEMETRY;
+    request.telemetry_request.period_us = 10000;
+    port.time_us = 1000;
+    deliver(&device, request, 1000);
+    CHECK(port.sent.size() == 1 && port.sent[0].type == piano_proto::MESSAGE_TELEMETRY_REPORT);
+    CHECK(port.sent[0].telemetry.device_us == 1000 && port.sent[0].telemetry.messages == 1);
+    CHECK(port.sent[0].telemetry.frames_shown == 7);
+    CHECK(device.has_scheduled() && device.next_time_us() == 11000);
+
+    // Two scheduled messages, one of them played late, one message late on arrival, broken frame
+    piano_proto::message_t schedule;
+    schedule.type             = piano_proto::MESSAGE_SCHEDULE;
+    schedule.schedule.enabled = true;
+    deliver(&device, schedule, 1000);
+    deliver(&device, note_batch(5000, 1, true), 1000);
+    deliver(&device, note_batch(6000, 2, true), 1000);
+    deliver(&device, note_batch(400,  3, true), 1000);
+    const uint8_t garbage[] = {0x05, 0x01, 0x02, 0x03, 0x04, 0x00};
+    device.receive(garbage, sizeof(garbage), 1000);
+    CHECK(device.next_time_us() == 5000);
+
+    device.update(5000);
+    device.update(6250);
+    CHECK(device.keys()[1] && device.keys()[2] && port.sent.size() == 1);
+
+    const piano_proto::telemetry_t &counters = device.counters();
+    CHECK(counters.messages == 5 && counters.frame_errors == 1 && counters.schedule_high == 2);
+    CHECK(counters.late_count == 3 && counters.late_sum_us == 850 && counters.late_max_us == 600);
+
+    // Report which is due is sent by update, the next one keeps the period
+    CHECK(device.next_time_us() == 11000);
+    device.update(11500);
+    CHECK(port.sent.size() == 2 && port.sent[1].telemetry.device_us == 11500);
+    CHECK(port.sent[1].telemetry.messages == 5 && port.sent[1].telemetry.late_count == 3);
+    CHECK(device.next_time_us() == 21000);
+
+    // Device busy for several periods sends one report
+    device.update(45000);
+    CHECK(port.sent.size() == 3 && device.next_time_us() == 55000);
+    device.update(45000);
+    CHECK(port.sent.size() == 3);
+
+    piano_proto::message_t reset;
+    reset.type = piano_proto::MESSAGE_RESET;
+    deliver(&device, reset, 46000);
+    CHECK(device.has_scheduled() && device.next_time_us() == 55000);
+
+    request.telemetry_request.period_us = 0;
+    deliver(&device, request, 46000);
+    CHECK(!device.has_scheduled() && port.sent.size() == 3);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Device loop of firmware on virtual clock: it wakes up for UART bytes and for one-shot timer
+// armed by schedule_alarm_t, messages are played exactly at their time
+//
+static void
+test_alarm()
+{
+    struct arrival_t
+    {
+        int64_t  receive_us;
+        uint64_t time_us;
+        uint8_t  note;
+        bool     on;
+    };
+
+    // Earlier message restarts armed timer, later one keeps it
+    static const arrival_t kArrivals[] =
+    {
+        {100,  5000, 60, true },
+        {200,  3000, 61, true },
+        {300,  8000, 62, true },
+        {4000, 4500, 61, false},
+    };
+    static const size_t kArrivalsNumber = sizeof(kArrivals) / sizeof(kArrivals[0]);
+
+    test_port_t                    port;
+    piano_device::device_t         device(&port);
+    piano_device::schedule_alarm_t alarm;
+
+    piano_proto::message_t schedule;
+    schedule.type             = piano_proto::MESSAGE_SCHEDULE;
+    schedule.schedule.enabled = true;
+    deliver(&device, schedule, 0);
+
+    int64_t changed_us[piano_proto::kKeysNumber] = {};
+    bool    keys[piano_proto::kKeysNumber]       = {};
+    size_t  next_arrival                         = 0;
+    size_t  timer_wakes                          = 0;
+    while (next_arrival != kArrivalsNumber || alarm.armed())
+    {
+        // Virtual clock jumps to whatever wakes the loop first
+        bool by_timer = alarm.armed() &&
+                        (next_arrival == kArrivalsNumber ||
+                         alarm.deadline_us() < kArrivals[next_arrival].receive_us);
+        int64_t now_us = by_timer ? alarm.deadline_us() : kArrivals[next_arrival].receive_us;
+        port.time_us   = now_us;
+        if (by_timer)
+        {
+            alarm.fired();
+            ++timer_wakes;
+        } else
+        {
+            const arrival_t &arrival = kArrivals[next_arrival++];
+            deliver(&device, note_batch(arrival.time_us, arrival.note, arrival.on), now_us);
+        }
+        device.update(now_us);
+
+        int64_t delay_us = 0;
+        bool    has_next = device.has_scheduled();
+        if (alarm.arm(has_next, has_next ? device.next_time_us() : 0, now_us, &delay_us))
+        {
+            CHECK(alarm.deadline_us() == now_us + delay_us);
+        }
+
+        for (size_t note = 0; note != piano_proto::kKeysNumber; ++note)
+        {
+            if (device.keys()[note] != keys[note])
+            {
+                keys[note]       = device.keys()[note];
+                changed_us[note] = now_us;
+            }
+        }
+    }
+
+    CHECK(keys[60] && !keys[61] && keys[62]);
+    CHECK(changed_us[60] == 5000 && changed_us[61] == 4500 && changed_us[62] == 8000);
+    CHECK(port.shown.size() == 4 && !device.has_scheduled());
+
+    // Timer woke the loop only for messages, restarted for each new earliest one
+    CHECK(timer_wakes == 4 && alarm.restarts() == 6);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Wake of timer is lost, as when it could not be posted: the next pass of device loop, here for
+// UART bytes, arms timer again instead of keeping the one which already expired
+//
+static void
+test_alarm_lost_wake()
+{
+    test_port_t                    port;
+    piano_device::device_t         device(&port);
+    piano_device::schedule_alarm_t alarm;
+    int64_t                        delay_us = 0;
+
+    piano_proto::message_t schedule;
+    schedule.type             = piano_proto::MESSAGE_SCHEDULE;
+    schedule.schedule.enabled = true;
+    deliver(&device, schedule, 0);
+
+    deliver(&device, note_batch(1000, 60, true), 100);
+    device.update(100);
+    CHECK(alarm.arm(device.has_scheduled(), device.next_time_us(), 100, &delay_us));
+    CHECK(delay_us == 900);
+
+    // Timer fires at 1000 but loop is not woken, until bytes arrive at 2000
+    deliver(&device, note_batch(3000, 61, true), 2000);
+    port.time_us = 2000;
+    device.update(2000);
+    CHECK(device.keys()[60] && !device.keys()[61]);
+    CHECK(alarm.arm(device.has_scheduled(), device.next_time_us(), 2000, &delay_us));
+    CHECK(delay_us == 1000 && alarm.deadline_us() == 3000 && alarm.restarts() == 2);
+
+    // Timer armed again is kept until it fires
+    CHECK(!alarm.arm(device.has_scheduled(), device.next_time_us(), 2500, &delay_us));
+    CHECK(!alarm.arm(device.has_scheduled(), device.next_time_us(), 3000, &delay_us));
+    alarm.fired();
+    port.time_us = 3000;
+    device.update(3000);
+    CHECK(device.keys()[61] && !device.has_scheduled());
+    CHECK(!alarm.arm(device.has_scheduled(), 0, 3000, &delay_us) && !alarm.armed());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Pressed keys change only their own pixels, colour follows velocity from blue to red
+//
+static void
+test_render()
+{
+    static_assert(piano_device::kPianoPixels.pixels[20]  == piano_device::kNoPixel &&
+                  piano_device::kPianoPixels.pixels[21]  == 0                      &&
+                  piano_device::kPianoPixels.pixels[108] == 87                     &&
+                  piano_device::kPianoPixels.pixels[109] == piano_device::kNoPixel,
+                  "piano strip from A0 to C8");
+
+    piano_device::led_renderer_t renderer;
+    uint8_t expected[piano_device::kPianoLeds * piano_device::kBytesPerLed] = {};
+    CHECK(renderer.frame().size == piano_device::kPianoLeds);
+    CHECK(std::memcmp(renderer.frame().grb, expected, sizeof(expected)) == 0);
+
+    // Loudest is red, middle green, softest blue, keys outside of strip are not shown. Channel
+    // of kLedBrightness 160 is 80 after gamma 2.5.
+    renderer.set_key(21,  127);
+    renderer.set_key(60,  64);
+    renderer.set_key(108, 1);
+    renderer.set_key(20,  127);
+    renderer.set_key(109, 127);
+    expected[0 * 3 + 1]  = 80;
+    expected[39 * 3 + 0] = 80;
+    expected[87 * 3 + 2] = 80;
+    CHECK(std::memcmp(renderer.frame().grb, expected, sizeof(expected)) == 0);
+
+    renderer.set_key(60, 0);
+    expected[39 * 3 + 0] = 0;
+    CHECK(std::memcmp(renderer.frame().grb, expected, sizeof(expected)) == 0);
+    renderer.clear();
+    std::memset(expected, 0, sizeof(expected));
+    CHECK(std::memcmp(renderer.frame().grb, expected, sizeof(expected)) == 0);
+
+    // Red grows and blue fades with velocity
+    uint8_t red  = 0;
+    uint8_t blue = 255;
+    for (uint8_t velocity = 1; velocity != 128; ++velocity)
+    {
+        renderer.set_key(21, velocity);
+        CHECK(renderer.frame().grb[1] >= red && renderer.frame().grb[2] <= blue);
+        CHECK(renderer.frame().grb[0] != 0 || renderer.frame().grb[1] != 0 ||
+              renderer.frame().grb[2] != 0);
+        red  = renderer.frame().grb[1];
+        blue = renderer.frame().grb[2];
+    }
+
+    // The whole MIDI range, strip longer than it, strip running past the last note
+    piano_device::pixel_map_t midi({128, 0});
+    CHECK(midi.leds == 128 && midi.pixels[0] == 0 && midi.pixels[127] == 127);
+    piano_device::pixel_map_t longer({300, 0});
+    CHECK(longer.leds == piano_device::kMaxLeds && longer.pixels[127] == 127);
+    piano_device::pixel_map_t top({61, 100});
+    CHECK(top.leds == 61 && top.pixels[99] == piano_device::kNoPixel);
+    CHECK(top.pixels[108] == 8 && top.pixels[127] == 27);
+
+    // Refresh of full strip is a few milliseconds
+    CHECK(piano_device::strip_refresh_us(1)   < 400);
+    CHECK(piano_device::strip_refresh_us(88)  < 3000);
+    CHECK(piano_device::strip_refresh_us(128) < 5000);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_device::led_frame_t
+lit_frame(size_t led)
+{
+    piano_device::led_frame_t frame;
+    frame.size                                  = piano_device::kPianoLeds;
+    frame.grb[led * piano_device::kBytesPerLed] = 64;
+    return frame;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Strips refreshed in parallel: segments cover frame one after another, the first ones take
+// what is left of even split, each strip sends its part of frame buffer
+//
+static void
+test_split()
+{
+    static constexpr piano_device::strip_split_t kSplit(piano_device::kPianoLeds, 3);
+    static_assert(kSplit.count == 3 && kSplit.segments[0].leds == 30, "split at compile time");
+    CHECK(kSplit.segments[1].first == 30 && kSplit.segments[1].leds == 29);
+    CHECK(kSplit.segments[2].first == 59 && kSplit.segments[2].leds == 29);
+    CHECK(kSplit.refresh_us() == piano_device::strip_refresh_us(30));
+
+    piano_device::led_frame_t frame = lit_frame(59);
+    CHECK(kSplit.data(frame, 2) == &frame.grb[59 * piano_device::kBytesPerLed]);
+    CHECK(kSplit.data(frame, 2)[0] == 64);
+    size_t bytes = 0;
+    for (size_t i = 0; i != kSplit.count; ++i)
+    {
+        CHECK(kSplit.data(frame, i) == frame.grb + bytes);
+        bytes += kSplit.size(frame, i);
+    }
+    CHECK(bytes == piano_device::kPianoLeds * piano_device::kBytesPerLed);
+
+    // Shorter frame leaves the last strips short or empty
+    frame.size = 40;
+    CHECK(kSplit.size(frame, 0) == 30 * piano_device::kBytesPerLed);
+    CHECK(kSplit.size(frame, 1) == 10 * piano_device::kBytesPerLed);
+    CHECK(kSplit.size(frame, 2) == 0 && kSplit.data(frame, 2) == frame.grb + 40 * 3);
+
+    // Strips are cut to RMT channels and to LEDs, refresh stays flat as strips are added
+    piano_device::strip_split_t many(128, 8);
+    CHECK(many.count == piano_device::kMaxStrips && many.segments[3].leds == 32);
+    CHECK(many.refresh_us() < piano_device::strip_refresh_us(88) / 2);
+    piano_device::strip_split_t few(2, 4);
+    CHECK(few.count == 2 && few.segments[1].first == 1 && few.segments[1].leds == 1);
+    CHECK(piano_device::strip_split_t(88, 0).count == 1);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Frames within one period make one refresh with the latest of them, frame equal to the shown
+// one makes none
+//
+static void
+test_pacer()
+{
+    piano_device::led_pacer_t pacer(200);
+    int64_t                   wait_us = 0;
+    CHECK(pacer.period_us() == 5000);
+    CHECK(!pacer.poll(0, &wait_us) && wait_us == -1);
+
+    // The first change after idle goes at once
+    pacer.publish(lit_frame(1), 50);
+    CHECK(pacer.poll(100, &wait_us) && lit(pacer.frame(), 1) && pacer.published_us() == 50);
+    CHECK(!pacer.poll(100, &wait_us) && wait_us == -1);
+
+    // Changes within period wait for its end, the latest one is shown
+    pacer.publish(lit_frame(2), 1000);
+    pacer.publish(lit_frame(3), 1050);
+    CHECK(!pacer.poll(1100, &wait_us) && wait_us == 4000);
+    CHECK(!pacer.poll(5099, &wait_us) && wait_us == 1);
+    CHECK(pacer.poll(5100, &wait_us));
+    CHECK(lit(pacer.frame(), 3) && !lit(pacer.frame(), 2) && pacer.published_us() == 1050);
+    CHECK(pacer.replaced() == 1 && pacer.unchanged() == 0);
+
+    // Key pressed and released within period: strip already shows the result
+    pacer.publish(lit_frame(4), 6000);
+    pacer.publish(lit_frame(3), 7000);
+    CHECK(!pacer.poll(10100, &wait_us) && wait_us == -1 && !pacer.pending());
+    CHECK(pacer.replaced() == 2 && pacer.unchanged() == 1);
+
+    // Long after the last refresh
+    pacer.publish(lit_frame(5), 50000);
+    CHECK(pacer.poll(50000, &wait_us) && lit(pacer.frame(), 5));
+
+    // Without rate every change is shown at once, repeated frame is not
+    piano_device::led_pacer_t every(0);
+    every.publish(lit_frame(1), 0);
+    CHECK(every.poll(0, &wait_us));
+    every.publish(lit_frame(2), 1);
+    CHECK(every.poll(1, &wait_us) && lit(every.frame(), 2));
+    every.publish(lit_frame(2), 2);
+    CHECK(!every.poll(2, &wait_us) && every.unchanged() == 1);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_uart_line()
+{
+    // 10 bits per byte at 10000 baud: 1 ms per byte
+    piano_host::uart_line_t line(10000);
+    const uint8_t data[] = {1, 2, 3, 4, 5};
+    line.push(data, 3, 0);
+    line.push(data + 3, 2, 1500);
+    CHECK(line.size() == 5 && line.next_us() == 1000);
+
+    uint8_t received[8] = {};
+    int64_t first_us    = 0;
+    CHECK(line.pop(999, received, sizeof(received), &first_us) == 0);
+    CHECK(line.pop(3500, received, sizeof(received), &first_us) == 3 && first_us == 1000);
+    CHECK(received[0] == 1 && received[2] == 3);
+
+    // Line was busy when the last bytes were written
+    CHECK(line.next_us() == 4000);
+    CHECK(line.pop(10000, received, sizeof(received), &first_us) == 2 && first_us == 4000);
+    CHECK(line.empty());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Host synchronizes with simulator over pty and writes a burst of note batches, which takes
+// as long as modelled UART needs for it
+//
+static void
+test_simulator()
+{
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {115200, 5000000, 80.};
+    std::ostringstream             log;
+    std::atomic<bool>              stop   = {false};
+    piano_host::device_simulator_t simulator(master, config, &log);
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), config.baud_rate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::clock_tracker_t clock(fd, config.baud_rate);
+    CHECK(clock.synchronize(16, 2000) == piano::STATUS_SUCCESS);
+
+    piano_host::simulated_clock_t device(config.clock_offset_us, config.clock_drift_ppm);
+    int64_t now_us = piano_host::host_time_us();
+    CHECK(std::abs(clock.sync().to_device(now_us) - device.at(now_us)) < 5000);
+
+    // Keys are pressed and released, so strip is dark at the end
+    piano_host::serial_sender_t sender(fd);
+    size_t bytes = 0;
+    for (size_t i = 0; i != 2 * piano_host::kMaxQueuedFrames; ++i)
+    {
+        uint8_t frame[piano_proto::kMaxFrameSize] = {};
+        size_t  size = 0;
+        piano_proto::message_t message =
+            note_batch(0, static_cast<uint8_t>(i % 32), i < piano_host::kMaxQueuedFrames);
+        piano_proto::encode_message(message, frame, sizeof(frame), &size);
+        bytes += size;
+        CHECK(sender.enqueue(message) == piano::STATUS_SUCCESS);
+    }
+    int64_t start_us = piano_host::host_time_us();
+    CHECK(sender.flush() == piano::STATUS_SUCCESS);
+
+    int64_t transfer_us = static_cast<int64_t>(static_cast<double>(bytes) * 10. * 1e6 / 115200.);
+    std::this_thread::sleep_for(std::chrono::microseconds(transfer_us + 200000));
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    // Every LED frame is logged, the last one comes when the whole burst crossed the line
+    std::istringstream lines(log.str());
+    std::string        line      = {};
+    std::string        pixels    = {};
+    size_t             count     = 0;
+    int64_t            host_us   = 0;
+    int64_t            device_us = 0;
+    while (std::getline(lines, line))
+    {
+        std::istringstream fields(line);
+        fields >> host_us >> device_us >> pixels;
+        ++count;
+    }
+    CHECK(count == simulator.frames_shown() && count != 0);
+    CHECK(pixels == std::string(6 * piano_device::kPianoLeds, '0'));
+    CHECK(host_us - start_us >= transfer_us * 9 / 10);
+    CHECK(std::abs(device_us - device.at(host_us)) <= 1);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Burst of note batches while strip takes long to refresh. Refresh in receive loop holds UART
+// bytes back, LED thread takes the latest frame and device keeps up with the line.
+//
+static void
+test_leds(bool blocking)
+{
+    static const int64_t kRefreshUs = 4000;
+
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate      = 921600;
+    config.led_refresh_us = kRefreshUs;
+    config.blocking_leds  = blocking;
+    std::ostringstream             log;
+    std::atomic<bool>              stop   = {false};
+    piano_host::device_simulator_t simulator(master, config, &log);
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), config.baud_rate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::serial_sender_t sender(fd);
+    size_t batches = 2 * piano_host::kMaxQueuedFrames;
+    for (size_t i = 0; i != batches; ++i)
+    {
+        CHECK(sender.enqueue(note_batch(0, static_cast<uint8_t>(i % 32),
+                                        i < piano_host::kMaxQueuedFrames)) ==
+              piano::STATUS_SUCCESS);
+    }
+    CHECK(sender.flush() == piano::STATUS_SUCCESS);
+
+    std::this_thread::sleep_for(std::chrono::microseconds(200000));
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    // Strip ends dark either way. Device shows one frame per chunk of bytes it takes, so the
+    // blocking loop shows few frames, each for many batches.
+    std::string last = log.str();
+    last = last.substr(last.rfind(' ', last.size() - 2) + 1);
+    CHECK(last == std::string(6 * piano_device::kPianoLeds, '0') + "\n");
+    CHECK(simulator.frames_shown() + simulator.frames_dropped() <= batches);
+
+    const piano_host::sample_stats_t &delay_us = simulator.receive_delay_us();
+    if (blocking)
+    {
+        CHECK(simulator.frames_dropped() == 0 && delay_us.max() > kRefreshUs / 2);
+    } else
+    {
+        CHECK(simulator.frames_dropped() != 0 && delay_us.percentile(0.9) < kRefreshUs / 2);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Host reads reports of simulator while burst of note batches is played
+//
+static void
+test_simulator_telemetry()
+{
+    static const uint64_t kPeriodUs = 20000;
+
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate      = 921600;
+    config.led_refresh_us = 1000;
+    std::atomic<bool>              stop   = {false};
+    piano_host::device_simulator_t simulator(master, config);
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), config.baud_rate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::telemetry_reader_t reader(fd);
+    piano_host::telemetry_view_t   view;
+    piano_proto::telemetry_t       report = {};
+    CHECK(reader.request(kPeriodUs) == piano::STATUS_SUCCESS);
+    CHECK(reader.next(piano_host::host_time_us() + 100000, &report) == piano::STATUS_SUCCESS);
+    CHECK(!view.add(report) && report.messages == 1);
+
+    piano_host::serial_sender_t sender(fd);
+    size_t batches = 2 * piano_host::kMaxQueuedFrames;
+    for (size_t i = 0; i != batches; ++i)
+    {
+        CHECK(sender.enqueue(note_batch(0, static_cast<uint8_t>(i % 32),
+                                        i < piano_host::kMaxQueuedFrames)) ==
+              piano::STATUS_SUCCESS);
+    }
+    CHECK(sender.flush() == piano::STATUS_SUCCESS);
+
+    // Totals of intervals add up to what simulator counted itself
+    int64_t  deadline_us = piano_host::host_time_us() + 10 * kPeriodUs;
+    uint32_t messages    = 0;
+    uint32_t shown       = 0;
+    size_t   reports     = 0;
+    while (reader.next(deadline_us, &report) == piano::STATUS_SUCCESS)
+    {
+        CHECK(view.add(report));
+        CHECK(view.delta().device_us > 0);
+        messages += view.delta().messages;
+        shown    += view.delta().frames_shown;
+        ++reports;
+    }
+    CHECK(reports >= 5 && messages == batches);
+    CHECK(shown == simulator.frames_shown() && shown != 0);
+    CHECK(report.frame_errors == 0 && report.parser_busy_us != 0 && report.strip_max_us >= 1000);
+
+    std::ostringstream line;
+    view.print(line);
+    CHECK(line.str().find("msg ") == 0 && line.str().back() == '\n');
+
+    CHECK(reader.request(0) == piano::STATUS_SUCCESS);
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+}
+
+//================================================================================================//
+
+int
+main()
+{
+    test_immediate();
+    test_scheduled();
+    test_telemetry();
+    test_alarm();
+    test_alarm_lost_wake();
+    test_render();
+    test_split();
+    test_pacer();
+    test_uart_line();
+    test_simulator();
+    test_leds(true);
+    test_leds(false);
+    test_simulator_telemetry();
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,217 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "event_export.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+static const char *kExportPath = "event_export_test.out";
+static const char *kOtherPath  = "event_export_test_other.out";
+
+//------------------------------------------------------------------------------------------------//
+
+static std::string
+read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static std::string
+format(piano_host::export_format_t                   format,
+       const std::string                            &song,
+       const std::vector<piano_midi::timed_event_t> &timeline)
+{
+    std::vector<char> out(piano_host::export_bound(format, song, timeline.size()));
+    size_t            size = piano_host::format_song(format, song, timeline, out.data());
+    CHECK(size <= out.size());
+    return std::string(out.data(), size);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static uint64_t
+get_le(const std::string &data,
+       size_t             offset,
+       size_t             bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i != bytes; ++i)
+    {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(data[offset + i])) << (8 * i);
+    }
+    return value;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static std::vector<piano_midi::timed_event_t>
+small_song()
+{
+    std::vector<piano_midi::timed_event_t> timeline(3);
+    timeline[0].event    = piano::EVENT_TEMPO_SET;
+    timeline[0].tempo    = 400000;
+    timeline[1].time_us  = 18446744073709551615ull;
+    timeline[1].event    = piano::EVENT_NOTE_ON;
+    timeline[1].note     = 60;
+    timeline[1].velocity = 127;
+    timeline[2].time_us  = 1000;
+    timeline[2].event    = piano::EVENT_NOTE_OFF;
+    timeline[2].note     = 108;
+    return timeline;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_csv()
+{
+    CHECK(format(piano_host::EXPORT_CSV, "a.mid", small_song()) ==
+          "a.mid,0,0,tempo,,,400000\n"
+          "a.mid,1,18446744073709551615,note_on,60,127,\n"
+          "a.mid,2,1000,note_off,108,0,\n");
+    CHECK(format(piano_host::EXPORT_CSV, "a,\"b\".mid", {small_song()[2]}) ==
+          "\"a,\"\"b\"\".mid\",0,1000,note_off,108,0,\n");
+    CHECK(format(piano_host::EXPORT_CSV, "a.mid", {}).empty());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_jsonl()
+{
+    CHECK(format(piano_host::EXPORT_JSONL, "a.mid", small_song()) ==
+          "{\"song\":\"a.mid\",\"index\":0,\"time_us\":0,\"event\":\"tempo\",\"tempo\":400000}\n"
+          "{\"song\":\"a.mid\",\"index\":1,\"time_us\":18446744073709551615,"
+          "\"event\":\"note_on\",\"note\":60,\"velocity\":127}\n"
+          "{\"song\":\"a.mid\",\"index\":2,\"time_us\":1000,"
+          "\"event\":\"note_off\",\"note\":108,\"velocity\":0}\n");
+    CHECK(format(piano_host::EXPORT_JSONL, "a\"\\\n.mid", {small_song()[0]}) ==
+          "{\"song\":\"a\\\"\\\\\\u000a.mid\",\"index\":0,\"time_us\":0,\"event\":\"tempo\","
+          "\"tempo\":400000}\n");
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_columnar()
+{
+    std::string block = format(piano_host::EXPORT_COLUMNAR, "song.mid", small_song());
+    CHECK(block.size() == 16 + 8 + 24 + 3 * 8 + 16);
+    CHECK(block.size() == piano_host::export_bound(piano_host::EXPORT_COLUMNAR, "song.mid", 3));
+    CHECK(get_le(block, 0, 4) == 8 && block.compare(4, 8, "song.mid") == 0);
+    CHECK(get_le(block, 12, 4) == 0);
+    CHECK(get_le(block, 16, 8) == 3);
+    CHECK(get_le(block, 24, 8) == 0);
+    CHECK(get_le(block, 32, 8) == 18446744073709551615ull);
+    CHECK(get_le(block, 40, 8) == 1000);
+    CHECK(get_le(block, 48, 3) == (piano::EVENT_TEMPO_SET | piano::EVENT_NOTE_ON << 8 |
+                                   piano::EVENT_NOTE_OFF << 16));
+    CHECK(get_le(block, 51, 5) == 0);
+    CHECK(get_le(block, 56, 3) == (60 << 8 | 108 << 16));
+    CHECK(get_le(block, 64, 3) == 127 << 8);
+    CHECK(get_le(block, 72, 4) == 400000 && get_le(block, 76, 8) == 0);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Corpus of songs with a missing one in the middle
+//
+static void
+test_export(const std::vector<std::string> &songs)
+{
+    std::vector<std::string>               paths    = songs;
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    size_t                                 rows     = 0;
+    std::string                            expect   = "song,index,time_us,event,note,velocity,"
+                                                      "tempo\n";
+    paths.insert(paths.begin() + static_cast<long>(paths.size() / 2), "no/such/song.mid");
+    for (const std::string &path : paths)
+    {
+        timeline.clear();
+        if (piano_midi::load_timeline(path.c_str(), timeline) == piano::STATUS_SUCCESS)
+        {
+            rows   += timeline.size();
+            expect += format(piano_host::EXPORT_CSV, path, timeline);
+        }
+    }
+
+    piano_host::export_config_t  config = {};
+    piano_host::stage_stats_t    stats  = {};
+    piano_host::stage_stats_t    write  = {};
+    std::vector<piano::status_t> status = {};
+    config.threads = 1;
+    CHECK(piano_host::export_events(paths, config, kExportPath, &stats, &write, status) ==
+          piano::STATUS_SUCCESS);
+    CHECK(read_file(kExportPath) == expect);
+    CHECK(write.items == paths.size() && stats.items == paths.size());
+    CHECK(status.size() == paths.size());
+    for (size_t i = 0; i != paths.size(); ++i)
+    {
+        CHECK((status[i] == piano::STATUS_SUCCESS) == (paths[i] != "no/such/song.mid"));
+    }
+
+    // Other formats, and output of several threads is the same as of one
+    for (piano_host::export_format_t kind : {piano_host::EXPORT_CSV, piano_host::EXPORT_JSONL,
+                                             piano_host::EXPORT_COLUMNAR})
+    {
+        config.format  = kind;
+        config.threads = 1;
+        CHECK(piano_host::export_events(paths, config, kExportPath, &stats, &write, status) ==
+              piano::STATUS_SUCCESS);
+        config.threads = 3;
+        CHECK(piano_host::export_events(paths, config, kOtherPath, &stats, &write, status) ==
+              piano::STATUS_SUCCESS);
+        std::string output = read_file(kExportPath);
+        CHECK(output == read_file(kOtherPath));
+        if (kind == piano_host::EXPORT_JSONL)
+        {
+            CHECK(static_cast<size_t>(std::count(output.begin(), output.end(), '\n')) == rows);
+        }
+        if (kind == piano_host::EXPORT_COLUMNAR)
+        {
+            CHECK(output.compare(0, 8, piano_host::kColumnarMagic, 8) == 0);
+            CHECK(get_le(output, 8, 4) == paths[0].size());
+        }
+    }
+    unlink(kExportPath);
+    unlink(kOtherPath);
+
+    CHECK(piano_host::export_events(paths, config, "no/such/dir.csv", &stats, &write, status) ==
+          piano::STATUS_FILE_ERROR);
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_csv();
+    test_jsonl();
+    test_columnar();
+    test_export(std::vector<std::string>(argv + 1, argv + argc));
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,178 @@
+//================================================================================================//
+
+#include <iostream>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "key_codec.hh"
+#include "protocol.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+using namespace piano_proto;
+
+//================================================================================================//
+
+static void
+test_random_states()
+{
+    std::mt19937_64 random(42);
+    key_encoder_t   encoder(16);
+    key_decoder_t   decoder;
+    key_state_t     state = {};
+
+    for (int frame = 0; frame != 10000; ++frame)
+    {
+        // Mix of small changes and completely new states to hit both list and bitmap bodies
+        if (frame % 10 == 0)
+        {
+            state.words[0] = random();
+            state.words[1] = random();
+        } else
+        {
+            for (int i = random() % 5; i != 0; --i)
+            {
+                uint8_t key = random() % kKeysNumber;
+                state.set(key, !state.test(key));
+            }
+        }
+
+        uint8_t frame_data[kMaxKeyFrameSize] = {};
+        size_t  size = encoder.encode(state, frame_data);
+        CHECK(size <= kMaxKeyFrameSize);
+        if (size == 0)
+        {
+            continue;
+        }
+
+        key_state_t decoded = {};
+        CHECK(decoder.decode(frame_data, size, &decoded) == piano::STATUS_SUCCESS);
+        CHECK(decoded == state);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_resync()
+{
+    key_encoder_t encoder(8);
+    key_decoder_t decoder;
+    key_state_t   state   = {};
+    key_state_t   decoded = {};
+    uint8_t       frame_data[kMaxKeyFrameSize] = {};
+
+    // Decoder does not know state until it gets keyframe
+    state.set(60, true);
+    size_t size = encoder.encode(state, frame_data);
+    CHECK(decoder.decode(frame_data, size, &decoded) == piano::STATUS_SUCCESS);
+    CHECK(decoded == state);
+
+    // Unchanged state is not sent
+    CHECK(encoder.encode(state, frame_data) == 0);
+
+    // Lost frame
+    state.set(64, true);
+    CHECK(encoder.encode(state, frame_data) != 0);
+
+    bool resynced = false;
+    for (int frame = 0; frame != 8; ++frame)
+    {
+        state.set(static_cast<uint8_t>(frame), true);
+        size = encoder.encode(state, frame_data);
+        piano::status_t status = decoder.decode(frame_data, size, &decoded);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            CHECK(decoded == state);
+            resynced = true;
+        } else
+        {
+            CHECK(status == piano::STATUS_CODEC_DESYNC);
+            CHECK(!resynced);
+        }
+    }
+    CHECK(resynced);
+    CHECK(decoder.synchronized());
+
+    // Receiver may ask for keyframe explicitly
+    key_decoder_t late_decoder;
+    encoder.request_keyframe();
+    size = encoder.encode(state, frame_data);
+    CHECK(late_decoder.decode(frame_data, size, &decoded) == piano::STATUS_SUCCESS);
+    CHECK(decoded == state);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_malformed()
+{
+    key_decoder_t decoder;
+    key_state_t   decoded = {};
+
+    // Gap list going past last key
+    const uint8_t list[] = {0x80, 100, 30};
+    CHECK(decoder.decode(list, sizeof(list), &decoded) == piano::STATUS_CODEC_FORMAT_ERROR);
+
+    // Bitmap of wrong length
+    const uint8_t bitmap[] = {0xc0, 1, 2, 3};
+    CHECK(decoder.decode(bitmap, sizeof(bitmap), &decoded) == piano::STATUS_CODEC_FORMAT_ERROR);
+    CHECK(decoder.decode(bitmap, 0, &decoded) == piano::STATUS_CODEC_FORMAT_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_song(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+
+    key_encoder_t          encoder;
+    std::vector<message_t> messages = {};
+    CHECK(make_key_frame_messages(timeline, 10000, encoder, messages) == piano::STATUS_SUCCESS);
+    CHECK(!messages.empty());
+
+    // Final state after all frames must match the state after all events
+    key_state_t expected = {};
+    for (const auto &event : timeline)
+    {
+        if (event.event != piano::EVENT_TEMPO_SET)
+        {
+            expected.set(event.note, event.event == piano::EVENT_NOTE_ON);
+        }
+    }
+
+    key_decoder_t decoder;
+    key_state_t   state = {};
+    for (const auto &message : messages)
+    {
+        CHECK(message.type == MESSAGE_KEY_FRAME);
+        CHECK(decoder.decode(message.key_frame.data, message.key_frame.size, &state) ==
+              piano::STATUS_SUCCESS);
+    }
+    CHECK(state == expected);
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    test_random_states();
+    test_resync();
+    test_malformed();
+    for (int i = 1; i < argc; ++i)
+    {
+        test_song(argv[i]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,113 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "device_sim.hh"
+#include "latency_probe.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+static const uint32_t kBaudRate = 115200;
+
+//================================================================================================//
+
+static size_t
+frame_size(const piano_proto::message_t &message)
+{
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    piano_proto::encode_message(message, frame, sizeof(frame), &size);
+    return size;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Probe simulator with modelled UART: latencies can not be shorter than the wire
+//
+static void
+test_probe()
+{
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {kBaudRate, 7000000, -50.};
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::clock_sync_t sync;
+    CHECK(piano_host::sync_clock(fd, kBaudRate, 16, 2000, &sync) == piano::STATUS_SUCCESS);
+
+    piano_host::probe_config_t probe = {};
+    probe.samples     = 100;
+    probe.interval_us = 1000;
+    probe.padding     = 32;
+    piano_host::probe_result_t result;
+    CHECK(piano_host::probe_latency(fd, kBaudRate, probe, &sync, &result) ==
+          piano::STATUS_SUCCESS);
+
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    // Frames of the same size as probe sent and received
+    int64_t                now_us = piano_host::host_time_us();
+    piano_proto::message_t ping;
+    ping.type              = piano_proto::MESSAGE_PING;
+    ping.ping              = {};
+    ping.ping.sequence     = static_cast<uint32_t>(probe.samples - 1);
+    ping.ping.host_send_us = static_cast<uint64_t>(now_us);
+    ping.ping.show         = true;
+    ping.ping.padding      = probe.padding;
+
+    piano_proto::message_t echo = ping;
+    echo.type                   = piano_proto::MESSAGE_ECHO;
+    echo.ping.device_receive_us = static_cast<uint64_t>(now_us + config.clock_offset_us);
+    echo.ping.device_shown_us   = echo.ping.device_receive_us;
+    echo.ping.device_send_us    = echo.ping.device_receive_us;
+
+    double byte_us = 10. * 1e6 / kBaudRate;
+    CHECK(result.lost == 0 && result.round_trip_us.count() == probe.samples);
+    CHECK(result.round_trip_us.min() >=
+          static_cast<double>(frame_size(ping) + frame_size(echo)) * byte_us * 0.95);
+
+    // Device gets the first byte after one byte time and LEDs change after the whole frame
+    CHECK(result.led_us.min() >= static_cast<double>(frame_size(ping)) * byte_us * 0.9);
+    CHECK(result.uplink_us.percentile(.5) < result.led_us.percentile(.5));
+    CHECK(result.uplink_us.min() > -200. && result.downlink_us.min() > -200.);
+    CHECK(simulator.frames_shown() == probe.samples);
+}
+
+//================================================================================================//
+
+int
+main()
+{
+    test_probe();
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
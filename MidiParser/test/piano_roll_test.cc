@@ -0,0 +1,279 @@
+//================================================================================================//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "piano_roll.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+static const char *kVideoPath = "piano_roll_test.y4m";
+static const char *kOtherPath = "piano_roll_test_other.y4m";
+static const char *kPpmPrefix = "piano_roll_test_";
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_midi::timed_event_t
+note(uint64_t time_us,
+     uint8_t  key,
+     uint8_t  velocity)
+{
+    piano_midi::timed_event_t event;
+    event.time_us  = time_us;
+    event.event    = (velocity != 0) ? piano::EVENT_NOTE_ON : piano::EVENT_NOTE_OFF;
+    event.note     = key;
+    event.velocity = velocity;
+    return event;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static std::string
+read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+pixel_is(const std::vector<uint8_t> &rgb,
+         uint32_t                    width,
+         uint32_t                    x,
+         uint32_t                    y,
+         uint8_t                     r,
+         uint8_t                     g,
+         uint8_t                     b)
+{
+    const uint8_t *pixel = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+    return pixel[0] == r && pixel[1] == g && pixel[2] == b;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Width of 20 pixels per white key
+//
+static void
+test_geometry()
+{
+    piano_host::roll_config_t config = {};
+    config.width  = 52 * 20;
+    config.height = 601;
+    piano_host::roll_renderer_t renderer({}, config);
+
+    CHECK(renderer.width() == 1040);
+    CHECK(renderer.height() == 600);
+    CHECK(renderer.keyboard_top() == 500);
+    CHECK(renderer.frames() == 1);
+    CHECK(renderer.key_x0(21) == 0);
+    CHECK(renderer.key_x1(21) == 20);
+    CHECK(renderer.key_x0(22) == 14);
+    CHECK(renderer.key_x1(22) == 26);
+    CHECK(renderer.key_x0(108) == 1020);
+    CHECK(renderer.key_x1(108) == 1040);
+    CHECK(renderer.key_x1(20) == 0);
+    CHECK(renderer.key_x1(109) == 0);
+    for (uint8_t key = 23; key <= 108; ++key)
+    {
+        CHECK(renderer.key_x1(key) - renderer.key_x0(key) == 20 ||
+              renderer.key_x1(key) - renderer.key_x0(key) == 12);
+        CHECK(renderer.key_x0(key) > renderer.key_x0(key - 1));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Loud C4 held for the first second, soft E4 from 2 s to 2.5 s
+//
+static void
+test_frame()
+{
+    std::vector<piano_midi::timed_event_t> timeline = {note(0, 60, 127), note(1000000, 60, 0),
+                                                       note(2000000, 64, 1),
+                                                       note(2500000, 64, 0)};
+    piano_host::roll_config_t config = {};
+    config.width    = 52 * 20;
+    config.height   = 600;
+    config.fps      = 10;
+    config.window_s = 3.;
+    piano_host::roll_renderer_t renderer(timeline, config);
+    CHECK(renderer.frames() == 26);
+
+    std::vector<uint8_t> rgb(static_cast<size_t>(renderer.width()) * renderer.height() * 3);
+    uint32_t c4  = (renderer.key_x0(60) + renderer.key_x1(60)) / 2;
+    uint32_t e4  = (renderer.key_x0(64) + renderer.key_x1(64)) / 2;
+    uint32_t top = renderer.keyboard_top();
+
+    // At 0.5 s C4 is lit and its bar reaches keyboard, E4 falls from a third of window
+    renderer.render(5, rgb.data());
+    CHECK(pixel_is(rgb, renderer.width(), c4, renderer.height() - 2, 255, 40, 40));
+    CHECK(pixel_is(rgb, renderer.width(), c4, top - 1, 255, 40, 40));
+    CHECK(pixel_is(rgb, renderer.width(), c4, top * 5 / 6 + 2, 255, 40, 40));
+    CHECK(!pixel_is(rgb, renderer.width(), c4, top * 5 / 6 - 2, 255, 40, 40));
+    CHECK(pixel_is(rgb, renderer.width(), e4, top / 2 - top / 12, 40, 40, 255));
+    CHECK(!pixel_is(rgb, renderer.width(), e4, top / 2 + 2, 40, 40, 255));
+    CHECK(!pixel_is(rgb, renderer.width(), e4, renderer.height() - 2, 40, 40, 255));
+    CHECK(!pixel_is(rgb, renderer.width(), renderer.key_x1(60) - 1, top - 1, 255, 40, 40));
+
+    // At 2.2 s only E4 is lit, C4 is back to white
+    renderer.render(22, rgb.data());
+    CHECK(pixel_is(rgb, renderer.width(), e4, renderer.height() - 2, 40, 40, 255));
+    CHECK(pixel_is(rgb, renderer.width(), c4, renderer.height() - 2, 236, 236, 232));
+
+    // Last frame is after every key is released, the same as frame of empty timeline
+    std::vector<uint8_t>        empty(rgb.size());
+    piano_host::roll_renderer_t nothing({}, config);
+    renderer.render(renderer.frames() - 1, rgb.data());
+    nothing.render(0, empty.data());
+    CHECK(rgb == empty);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_yuv()
+{
+    // White, black, red and blue blocks of 2x2
+    std::vector<uint8_t> rgb(8 * 2 * 3, 0);
+    const uint8_t        colours[4][3] = {{255, 255, 255}, {0, 0, 0}, {255, 0, 0}, {0, 0, 255}};
+    for (uint32_t y = 0; y != 2; ++y)
+    {
+        for (uint32_t x = 0; x != 8; ++x)
+        {
+            std::memcpy(&rgb[(y * 8 + x) * 3], colours[x / 2], 3);
+        }
+    }
+
+    std::vector<uint8_t> yuv(8 * 2 * 3 / 2);
+    piano_host::rgb_to_yuv420(rgb.data(), 8, 2, yuv.data());
+    const uint8_t *luma = yuv.data();
+    const uint8_t *cb   = luma + 16;
+    const uint8_t *cr   = cb + 4;
+    CHECK(luma[0] == 255 && luma[9] == 255 && cb[0] == 128 && cr[0] == 128);
+    CHECK(luma[2] == 0 && luma[11] == 0 && cb[1] == 128 && cr[1] == 128);
+    CHECK(luma[4] == 76 && cb[2] == 85 && cr[2] == 255);
+    CHECK(luma[6] == 29 && cb[3] == 255 && cr[3] == 107);
+
+    // Row pair repeating the one above, then one differing from it in a single pixel
+    std::vector<uint8_t> rows = rgb;
+    rows.insert(rows.end(), rgb.begin(), rgb.end());
+    rows.insert(rows.end(), rgb.begin(), rgb.end());
+    rows[(5 * 8 + 7) * 3] = 255;
+    std::vector<uint8_t> planes(8 * 6 * 3 / 2);
+    piano_host::rgb_to_yuv420(rows.data(), 8, 6, planes.data());
+    CHECK(std::memcmp(&planes[16], &planes[0], 16) == 0);
+    CHECK(std::memcmp(&planes[48 + 4], &planes[48], 4) == 0);
+    CHECK(std::memcmp(&planes[60 + 4], &planes[60], 4) == 0);
+    CHECK(std::memcmp(&planes[32], &planes[0], 15) == 0 && planes[47] == 105);
+    CHECK(planes[48 + 11] == 245 && planes[60 + 11] == 139);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_export(const std::vector<piano_midi::timed_event_t> &timeline)
+{
+    piano_host::roll_config_t config = {};
+    config.width   = 64;
+    config.height  = 36;
+    config.fps     = 10;
+    config.threads = 1;
+    piano_host::roll_renderer_t renderer(timeline, config);
+    piano_host::stage_stats_t   render = {};
+    piano_host::stage_stats_t   write  = {};
+    CHECK(piano_host::export_roll(timeline, config, kVideoPath, &render, &write) ==
+          piano::STATUS_SUCCESS);
+    CHECK(render.items == renderer.frames() && write.items == renderer.frames());
+
+    std::string video  = read_file(kVideoPath);
+    std::string header = "YUV4MPEG2 W64 H36 F10:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+    CHECK(video.compare(0, header.size(), header) == 0);
+    CHECK(video.size() == header.size() + renderer.frames() * (6 + 64 * 36 * 3 / 2));
+    CHECK(video.compare(header.size(), 6, "FRAME\n") == 0);
+
+    // Frames of several threads come out in order, byte for byte the same
+    config.threads = 3;
+    CHECK(piano_host::export_roll(timeline, config, kOtherPath, &render, &write) ==
+          piano::STATUS_SUCCESS);
+    CHECK(read_file(kOtherPath) == video);
+    unlink(kVideoPath);
+    unlink(kOtherPath);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_ppm()
+{
+    std::vector<piano_midi::timed_event_t> timeline = {note(0, 60, 100), note(400000, 60, 0)};
+    piano_host::roll_config_t              config   = {};
+    config.width   = 64;
+    config.height  = 36;
+    config.fps     = 10;
+    config.threads = 2;
+    config.format  = piano_host::VIDEO_PPM;
+    piano_host::roll_renderer_t renderer(timeline, config);
+    piano_host::stage_stats_t   render = {};
+    piano_host::stage_stats_t   write  = {};
+    CHECK(renderer.frames() == 5);
+    CHECK(piano_host::export_roll(timeline, config, kPpmPrefix, &render, &write) ==
+          piano::STATUS_SUCCESS);
+
+    std::vector<uint8_t> rgb(64 * 36 * 3);
+    for (size_t frame = 0; frame != renderer.frames(); ++frame)
+    {
+        std::string path  = kPpmPrefix + std::string("00000") + std::to_string(frame) + ".ppm";
+        std::string image = read_file(path);
+        renderer.render(frame, rgb.data());
+        CHECK(image == "P6\n64 36\n255\n" + std::string(rgb.begin(), rgb.end()));
+        unlink(path.c_str());
+    }
+    CHECK(access((kPpmPrefix + std::string("000005.ppm")).c_str(), F_OK) != 0);
+
+    // Output that can't be created
+    config.format = piano_host::VIDEO_Y4M;
+    CHECK(piano_host::export_roll(timeline, config, "no/such/dir.y4m", &render, &write) ==
+          piano::STATUS_FILE_ERROR);
+    config.format = piano_host::VIDEO_PPM;
+    CHECK(piano_host::export_roll(timeline, config, "no/such/dir_", &render, &write) ==
+          piano::STATUS_FILE_ERROR);
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_geometry();
+    test_frame();
+    test_yuv();
+    test_ppm();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        CHECK(piano_midi::load_timeline(argv[i], timeline) == piano::STATUS_SUCCESS);
+        test_export(timeline);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
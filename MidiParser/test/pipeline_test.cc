@@ -0,0 +1,614 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "spsc_queue.hh"
+#include "mailbox.hh"
+#include "task_stats.hh"
+#include "led_render.hh"
+#include "led_pacer.hh"
+#include "midi_file.hh"
+#include "midi_stream.hh"
+#include "key_codec.hh"
+#include "protocol.hh"
+#include "midi_pipeline.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Content of message which does not depend on order of events with equal time
+//
+using item_t = std::tuple<uint64_t, uint8_t, uint32_t, uint32_t>;
+
+//================================================================================================//
+
+static void
+test_spsc_queue()
+{
+    static const uint32_t kItems = 1 << 18;
+
+    piano::spsc_queue_t<uint32_t, 256> queue;
+    std::thread producer([&]()
+    {
+        for (uint32_t i = 0; i != kItems; ++i)
+        {
+            while (!queue.try_push(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    bool     ordered  = true;
+    while (expected != kItems)
+    {
+        uint32_t item = 0;
+        if (queue.try_pop(&item))
+        {
+            ordered &= item == expected++;
+        } else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    CHECK(ordered);
+    CHECK(queue.size() == 0);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Consumer sees only newer values and always gets the last one
+//
+static void
+test_mailbox()
+{
+    static const uint32_t kValues = 1 << 18;
+
+    piano::mailbox_t<uint32_t> mailbox;
+    uint32_t                   value = 0;
+    CHECK(!mailbox.take(&value) && !mailbox.pending());
+    CHECK(mailbox.publish(1) && !mailbox.publish(2) && mailbox.pending());
+    CHECK(mailbox.take(&value) && value == 2 && !mailbox.take(&value));
+
+    std::atomic<bool> done     = {false};
+    std::thread       producer([&]()
+    {
+        for (uint32_t i = 3; i != kValues; ++i)
+        {
+            mailbox.publish(i);
+        }
+        done = true;
+    });
+
+    uint32_t last    = value;
+    bool     ordered = true;
+    while (!done.load() || mailbox.pending())
+    {
+        if (mailbox.take(&value))
+        {
+            ordered &= value > last;
+            last     = value;
+        } else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    CHECK(ordered);
+    CHECK(last == kValues - 1);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Handoff between device cores: decode thread publishes LED frames, LED thread refreshes the
+// latest one and counts its load, a third thread reads counters as telemetry would
+//
+static void
+test_led_handoff()
+{
+    static const uint32_t kFrames = 1 << 16;
+
+    auto now_us = []()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+
+    piano_device::led_pacer_t pacer(0);
+    piano::task_stats_t       stats;
+    std::atomic<bool>         done = {false};
+    std::thread               decoder([&]()
+    {
+        piano_device::led_frame_t frame;
+        frame.size = piano_device::kPianoLeds;
+        for (uint32_t i = 1; i != kFrames + 1; ++i)
+        {
+            std::memcpy(frame.grb, &i, sizeof(i));
+            pacer.publish(frame, now_us());
+        }
+        done = true;
+    });
+
+    bool        monotonic = true;
+    std::thread reader([&]()
+    {
+        piano::task_counters_t last = {};
+        while (!done.load())
+        {
+            piano::task_counters_t counters = stats.snapshot();
+            monotonic &= counters.runs >= last.runs && counters.latency_count >= last.latency_count;
+            last       = counters;
+        }
+    });
+
+    uint32_t last    = 0;
+    uint32_t shown   = 0;
+    bool     ordered = true;
+    int64_t  wait_us = 0;
+    while (!done.load() || pacer.pending())
+    {
+        int64_t start_us = now_us();
+        if (pacer.poll(start_us, &wait_us))
+        {
+            uint32_t value = 0;
+            std::memcpy(&value, pacer.frame().grb, sizeof(value));
+            ordered &= value > last;
+            last     = value;
+            ++shown;
+            stats.add_latency(start_us - pacer.published_us());
+            stats.add_run(now_us() - start_us);
+        } else
+        {
+            std::this_thread::yield();
+        }
+    }
+    decoder.join();
+    reader.join();
+
+    // Every frame was either shown or replaced by a newer one
+    piano::task_counters_t counters = stats.snapshot();
+    CHECK(ordered && monotonic);
+    CHECK(last == kFrames);
+    CHECK(shown + pacer.replaced() == kFrames && pacer.unchanged() == 0);
+    CHECK(counters.runs == shown && counters.latency_count == shown);
+    CHECK(counters.latency_max_us * static_cast<uint64_t>(counters.latency_count) >=
+          counters.latency_sum_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static std::vector<piano_midi::timed_event_t>
+stream_timeline(const std::vector<uint8_t> &data, piano::status_t *status)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    piano_midi::memory_source_t            source(data.data(), data.size());
+    piano_midi::midi_layout_t              layout = {};
+    *status = piano_midi::read_midi_layout(source, &layout);
+    if (*status != piano::STATUS_SUCCESS)
+    {
+        return timeline;
+    }
+
+    std::vector<piano_midi::source_stream_t> streams  = {};
+    std::vector<piano_midi::byte_stream_t *> pointers = {};
+    for (const auto &track : layout.tracks)
+    {
+        streams.emplace_back(&source, track.offset, track.length);
+    }
+    for (auto &stream : streams)
+    {
+        pointers.push_back(&stream);
+    }
+
+    piano_midi::midi_stream_t  stream = {};
+    piano_midi::timed_event_t  event  = {};
+    *status = stream.open(layout, pointers.data());
+    while (*status == piano::STATUS_SUCCESS &&
+           (*status = stream.next(&event)) == piano::STATUS_SUCCESS)
+    {
+        timeline.push_back(event);
+    }
+    return timeline;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_stream(const char *path)
+{
+    std::vector<uint8_t> data = {};
+    CHECK(piano_midi::read_file(path, data) == piano::STATUS_SUCCESS);
+
+    std::vector<piano_midi::timed_event_t> expected = {};
+    CHECK(piano_midi::load_timeline(path, expected) == piano::STATUS_SUCCESS);
+
+    piano::status_t status   = piano::STATUS_SUCCESS;
+    auto            timeline = stream_timeline(data, &status);
+    CHECK(status == piano::STATUS_MIDI_STREAM_END);
+    CHECK(timeline.size() == expected.size());
+
+    auto key = [](const piano_midi::timed_event_t &event)
+    {
+        return std::make_tuple(event.time_us, event.event, event.note, event.velocity, event.tempo);
+    };
+    auto less = [&](const auto &lhs, const auto &rhs) { return key(lhs) < key(rhs); };
+    std::stable_sort(timeline.begin(), timeline.end(), less);
+    std::stable_sort(expected.begin(), expected.end(), less);
+
+    bool equal = timeline.size() == expected.size();
+    for (size_t i = 0; equal && i != timeline.size(); ++i)
+    {
+        equal = key(timeline[i]) == key(expected[i]);
+    }
+    CHECK(equal);
+
+    // Truncated file must end with error, not with partial song
+    data.resize(data.size() / 2);
+    stream_timeline(data, &status);
+    CHECK(status != piano::STATUS_SUCCESS && status != piano::STATUS_MIDI_STREAM_END);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+flatten(const piano_proto::message_t &message,
+        std::vector<item_t>          &items)
+{
+    uint64_t time_us = piano_proto::message_time(message);
+    switch (message.type)
+    {
+        case piano_proto::MESSAGE_NOTE_BATCH:
+            for (size_t i = 0; i != message.note_batch.count; ++i)
+            {
+                const auto &note = message.note_batch.notes[i];
+                items.emplace_back(time_us, message.type, note.note,
+                                   note.on ? 0x100u | note.velocity : 0u);
+            }
+            break;
+        case piano_proto::MESSAGE_TEMPO:
+            items.emplace_back(time_us, message.type, message.tempo.tempo, 0);
+            break;
+        default:
+            items.emplace_back(time_us, message.type, message.key_frame.size, 0);
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Run pipeline into pipe and decode everything that comes out of it
+//
+static void
+run_pipeline(const char                          *path,
+             const piano_host::pipeline_config_t &config,
+             piano::status_t                     *status,
+             std::vector<piano_proto::message_t> *received)
+{
+    int ends[2] = {-1, -1};
+    CHECK(pipe(ends) == 0);
+
+    size_t errors = 0;
+    std::thread reader([&]()
+    {
+        piano_proto::frame_decoder_t decoder;
+        uint8_t                      buffer[4096] = {};
+        ssize_t                      size         = 0;
+        while ((size = read(ends[0], buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t i = 0; i != size; ++i)
+            {
+                piano_proto::message_t message = {};
+                piano::status_t        result  = decoder.push(buffer[i], &message);
+                if (result == piano::STATUS_SUCCESS)
+                {
+                    received->push_back(message);
+                } else if (result != piano::STATUS_PROTOCOL_PENDING)
+                {
+                    ++errors;
+                }
+            }
+        }
+    });
+
+    piano_host::midi_pipeline_t pipeline(ends[1], config);
+    *status = pipeline.run(path);
+    close(ends[1]);
+    reader.join();
+    close(ends[0]);
+
+    CHECK(errors == 0);
+    CHECK(pipeline.sender().frames_sent() == received->size());
+    CHECK(pipeline.stats(piano_host::STAGE_TRANSMIT).items == received->size());
+    CHECK(*status != piano::STATUS_SUCCESS ||
+          pipeline.stats(piano_host::STAGE_PARSE).items ==
+          pipeline.stats(piano_host::STAGE_ENCODE).items);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_pipeline(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+
+    // Note batches: same notes at the same times
+    {
+        std::vector<piano_proto::message_t> expected = {};
+        std::vector<piano_proto::message_t> received = {};
+        piano_proto::make_messages(timeline, expected);
+
+        piano::status_t status = piano::STATUS_SUCCESS;
+        run_pipeline(path, {0, 0.}, &status, &received);
+        CHECK(status == piano::STATUS_SUCCESS);
+
+        std::vector<item_t> expected_items = {};
+        std::vector<item_t> received_items = {};
+        for (const auto &message : expected)
+        {
+            flatten(message, expected_items);
+        }
+        for (const auto &message : received)
+        {
+            flatten(message, received_items);
+        }
+        std::sort(expected_items.begin(), expected_items.end());
+        std::sort(received_items.begin(), received_items.end());
+        CHECK(expected_items == received_items);
+    }
+
+    // Key frames: same frames, decoded to the same states. parse_midi does not keep order of
+    // events with equal time, while state of key depends on it, so streamed timeline is used.
+    {
+        std::vector<uint8_t> data = {};
+        CHECK(piano_midi::read_file(path, data) == piano::STATUS_SUCCESS);
+        piano::status_t status   = piano::STATUS_SUCCESS;
+        auto            streamed = stream_timeline(data, &status);
+
+        std::vector<piano_proto::message_t> expected = {};
+        std::vector<piano_proto::message_t> received = {};
+        piano_proto::key_encoder_t          encoder;
+        piano_proto::make_key_frame_messages(streamed, 10000, encoder, expected);
+
+        run_pipeline(path, {100, 0.}, &status, &received);
+        CHECK(status == piano::STATUS_SUCCESS);
+        CHECK(received.size() == expected.size());
+
+        piano_proto::key_decoder_t expected_decoder;
+        piano_proto::key_decoder_t received_decoder;
+        piano_proto::key_state_t   expected_state = {};
+        piano_proto::key_state_t   received_state = {};
+        bool                       equal          = received.size() == expected.size();
+        for (size_t i = 0; equal && i != received.size(); ++i)
+        {
+            const auto &lhs = expected[i].key_frame;
+            const auto &rhs = received[i].key_frame;
+            expected_decoder.decode(lhs.data, lhs.size, &expected_state);
+            received_decoder.decode(rhs.data, rhs.size, &received_state);
+            equal = lhs.time_us == rhs.time_us && expected_state == received_state;
+        }
+        CHECK(equal);
+    }
+
+    // Paced playback keeps order of frames
+    {
+        std::vector<piano_proto::message_t> received = {};
+        piano::status_t status = piano::STATUS_SUCCESS;
+        run_pipeline(path, {0, 500.}, &status, &received);
+        CHECK(status == piano::STATUS_SUCCESS);
+        CHECK(std::is_sorted(received.begin(), received.end(), [](const auto &lhs, const auto &rhs)
+        {
+            return piano_proto::message_time(lhs) < piano_proto::message_time(rhs);
+        }));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_key_shards()
+{
+    // 88 piano keys over 4 devices
+    piano_host::key_shards_t shards = piano_host::key_shards_t::ranges(4, 21, 108);
+    CHECK(shards.count == 4);
+    CHECK(shards.shard[0] == 0 && shards.shard[21] == 0 && shards.shard[42] == 0);
+    CHECK(shards.shard[43] == 1 && shards.shard[108] == 3 && shards.shard[127] == 3);
+
+    size_t sizes[4] = {};
+    bool   sorted   = true;
+    for (size_t key = 21; key <= 108; ++key)
+    {
+        ++sizes[shards.shard[key]];
+        sorted &= key == 21 || shards.shard[key - 1] <= shards.shard[key];
+    }
+    CHECK(sorted && sizes[0] == 22 && sizes[1] == 22 && sizes[2] == 22 && sizes[3] == 22);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Song split over several pipes: together they carry the same notes, each one only its keys
+//
+static void
+test_sharded(const char *path)
+{
+    static const size_t kShards = 3;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    expected = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, expected);
+
+    piano_host::key_shards_t shards = piano_host::key_shards_t::ranges(kShards);
+    for (uint32_t frame_rate : {0u, 100u})
+    {
+        std::vector<piano_host::pipeline_link_t>         links    = {};
+        std::vector<int>                                 readers  = {};
+        std::vector<std::vector<piano_proto::message_t>> received(kShards);
+        std::vector<std::thread>                         threads  = {};
+        for (size_t shard = 0; shard != kShards; ++shard)
+        {
+            int ends[2] = {-1, -1};
+            CHECK(pipe(ends) == 0);
+            links.push_back({ends[1], nullptr});
+            readers.push_back(ends[0]);
+        }
+        for (size_t shard = 0; shard != kShards; ++shard)
+        {
+            threads.emplace_back([&, shard]()
+            {
+                piano_proto::frame_decoder_t decoder;
+                piano_proto::message_t       message;
+                uint8_t                      buffer[4096] = {};
+                ssize_t                      size         = 0;
+                while ((size = read(readers[shard], buffer, sizeof(buffer))) > 0)
+                {
+                    for (ssize_t i = 0; i != size; ++i)
+                    {
+                        if (decoder.push(buffer[i], &message) == piano::STATUS_SUCCESS)
+                        {
+                            received[shard].push_back(message);
+                        }
+                    }
+                }
+            });
+        }
+
+        piano_host::midi_pipeline_t pipeline(links, shards, {frame_rate, 0.});
+        CHECK(pipeline.run(path) == piano::STATUS_SUCCESS);
+        for (size_t shard = 0; shard != kShards; ++shard)
+        {
+            close(links[shard].fd);
+            threads[shard].join();
+            close(readers[shard]);
+            CHECK(pipeline.sender(shard).frames_sent() == received[shard].size());
+        }
+
+        if (frame_rate != 0)
+        {
+            // Each device sees only its keys
+            bool own = true;
+            for (size_t shard = 0; shard != kShards; ++shard)
+            {
+                piano_proto::key_decoder_t decoder;
+                piano_proto::key_state_t   state = {};
+                for (const auto &message : received[shard])
+                {
+                    decoder.decode(message.key_frame.data, message.key_frame.size, &state);
+                    for (size_t key = 0; key != piano_proto::kKeysNumber; ++key)
+                    {
+                        own &= !state.test(static_cast<uint8_t>(key)) || shards.shard[key] == shard;
+                    }
+                }
+            }
+            CHECK(own);
+            continue;
+        }
+
+        // Notes are split, tempo goes to every device
+        std::vector<item_t> expected_items = {};
+        std::vector<item_t> received_items = {};
+        for (const auto &message : expected)
+        {
+            if (message.type == piano_proto::MESSAGE_NOTE_BATCH)
+            {
+                flatten(message, expected_items);
+            }
+        }
+        size_t tempos = std::count_if(expected.begin(), expected.end(), [](const auto &message)
+        {
+            return message.type == piano_proto::MESSAGE_TEMPO;
+        });
+        bool own = true;
+        for (size_t shard = 0; shard != kShards; ++shard)
+        {
+            size_t shard_tempos = 0;
+            for (const auto &message : received[shard])
+            {
+                if (message.type == piano_proto::MESSAGE_TEMPO)
+                {
+                    ++shard_tempos;
+                    continue;
+                }
+                for (size_t i = 0; i != message.note_batch.count; ++i)
+                {
+                    own &= shards.shard[message.note_batch.notes[i].note] == shard;
+                }
+                flatten(message, received_items);
+            }
+            CHECK(shard_tempos == tempos);
+        }
+        std::sort(expected_items.begin(), expected_items.end());
+        std::sort(received_items.begin(), received_items.end());
+        CHECK(own);
+        CHECK(expected_items == received_items);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Error in the middle of song stops all stages
+//
+static void
+test_truncated(const char *path)
+{
+    std::vector<uint8_t> data = {};
+    CHECK(piano_midi::read_file(path, data) == piano::STATUS_SUCCESS);
+
+    const char *truncated = "pipeline_test_truncated.mid";
+    FILE       *file      = std::fopen(truncated, "wb");
+    CHECK(file != nullptr);
+    std::fwrite(data.data(), 1, data.size() / 2, file);
+    std::fclose(file);
+
+    std::vector<piano_proto::message_t> received = {};
+    piano::status_t status = piano::STATUS_SUCCESS;
+    run_pipeline(truncated, {0, 0.}, &status, &received);
+    CHECK(status != piano::STATUS_SUCCESS);
+    std::remove(truncated);
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    test_spsc_queue();
+    test_mailbox();
+    test_led_handoff();
+    test_key_shards();
+    for (int i = 1; i < argc; ++i)
+    {
+        test_stream(argv[i]);
+        test_pipeline(argv[i]);
+        test_sharded(argv[i]);
+        test_truncated(argv[i]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,350 @@
+//================================================================================================//
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+using namespace piano_proto;
+
+//================================================================================================//
+
+static std::vector<uint8_t>
+encode(const message_t &message)
+{
+    std::vector<uint8_t> frame(kMaxFrameSize);
+    size_t size = 0;
+    CHECK(encode_message(message, frame.data(), frame.size(), &size) == piano::STATUS_SUCCESS);
+    frame.resize(size);
+    return frame;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static std::vector<message_t>
+decode(const std::vector<uint8_t> &stream, size_t *errors)
+{
+    std::vector<message_t> result = {};
+    frame_decoder_t        decoder;
+    *errors = 0;
+    for (uint8_t byte : stream)
+    {
+        message_t       message = {};
+        piano::status_t status  = decoder.push(byte, &message);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            result.push_back(message);
+        } else if (status != piano::STATUS_PROTOCOL_PENDING)
+        {
+            ++*errors;
+        }
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static bool
+same_batch(const note_batch_t &a, const note_batch_t &b)
+{
+    if (a.time_us != b.time_us || a.count != b.count)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i != a.count; ++i)
+    {
+        if (a.notes[i].note != b.notes[i].note || a.notes[i].on != b.notes[i].on ||
+            (a.notes[i].on && a.notes[i].velocity != b.notes[i].velocity))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//================================================================================================//
+
+static void
+test_cobs()
+{
+    // Zeros everywhere and blocks longer than 254 bytes
+    std::vector<uint8_t> data(700);
+    for (size_t i = 0; i != data.size(); ++i)
+    {
+        data[i] = (i % 97 == 0) ? 0 : static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> encoded(data.size() + data.size() / 254 + 1);
+    size_t encoded_size = cobs_encode(data.data(), data.size(), encoded.data());
+    CHECK(encoded_size <= encoded.size());
+    CHECK(std::memchr(encoded.data(), 0, encoded_size) == nullptr);
+
+    std::vector<uint8_t> decoded(data.size());
+    size_t decoded_size = 0;
+    CHECK(cobs_decode(encoded.data(), encoded_size, decoded.data(), &decoded_size) ==
+          piano::STATUS_SUCCESS);
+    CHECK(decoded_size == data.size());
+    CHECK(decoded == data);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_round_trip()
+{
+    message_t batch = {};
+    batch.type = MESSAGE_NOTE_BATCH;
+    batch.note_batch.time_us = 123456789012ull;
+    batch.note_batch.count   = kMaxBatchNotes;
+    for (size_t i = 0; i != kMaxBatchNotes; ++i)
+    {
+        batch.note_batch.notes[i].note     = static_cast<uint8_t>(i);
+        batch.note_batch.notes[i].on       = true;
+        batch.note_batch.notes[i].velocity = static_cast<uint8_t>(i % 2 ? 0 : 127);
+    }
+
+    message_t tempo = {};
+    tempo.type          = MESSAGE_TEMPO;
+    tempo.tempo.time_us = 42;
+    tempo.tempo.tempo   = 500000;
+
+    message_t timestamp = {};
+    timestamp.type              = MESSAGE_TIMESTAMP;
+    timestamp.timestamp.time_us = 0;
+
+    message_t reset = {};
+    reset.type = MESSAGE_RESET;
+
+    message_t sync = {};
+    sync.type                   = MESSAGE_SYNC_RESPONSE;
+    sync.sync.host_send_us      = 1ull << 40;
+    sync.sync.device_receive_us = 7;
+    sync.sync.device_send_us    = 1000007;
+
+    message_t schedule = {};
+    schedule.type             = MESSAGE_SCHEDULE;
+    schedule.schedule.enabled = true;
+
+    message_t ping = {};
+    ping.type              = MESSAGE_PING;
+    ping.ping.sequence     = 300;
+    ping.ping.host_send_us = 1ull << 41;
+    ping.ping.show         = true;
+    ping.ping.padding      = 200;
+
+    message_t echo = {};
+    echo.type                   = MESSAGE_ECHO;
+    echo.ping.sequence          = 300;
+    echo.ping.host_send_us      = 1ull << 41;
+    echo.ping.device_receive_us = 10;
+    echo.ping.device_shown_us   = 20;
+    echo.ping.device_send_us    = 30;
+
+    message_t begin = {};
+    begin.type               = MESSAGE_UPLOAD_BEGIN;
+    begin.upload_begin.size  = 100000;
+    begin.upload_begin.crc32 = 0xdeadbeef;
+
+    // Full chunk of zeros is the longest COBS case
+    message_t chunk = {};
+    chunk.type                  = MESSAGE_UPLOAD_CHUNK;
+    chunk.upload_chunk.sequence = 499;
+    chunk.upload_chunk.size     = kUploadChunkSize;
+    std::memset(chunk.upload_chunk.data, 0, kUploadChunkSize);
+
+    message_t ack = {};
+    ack.type              = MESSAGE_UPLOAD_ACK;
+    ack.upload_ack.crc32  = 0xdeadbeef;
+    ack.upload_ack.next   = 300;
+    ack.upload_ack.mask   = 0x80000001;
+    ack.upload_ack.window = 8;
+    ack.upload_ack.state  = UPLOAD_RECEIVING;
+
+    message_t play = {};
+    play.type          = MESSAGE_PLAY;
+    play.play.play     = true;
+    play.play.start_us = 1ull << 40;
+
+    message_t telemetry = {};
+    telemetry.type                        = MESSAGE_TELEMETRY;
+    telemetry.telemetry_request.period_us = 500000;
+
+    // Every counter differs and the largest ones take all 5 bytes of varint
+    message_t report = {};
+    report.type                     = MESSAGE_TELEMETRY_REPORT;
+    report.telemetry.device_us      = 1ull << 45;
+    report.telemetry.messages       = UINT32_MAX;
+    report.telemetry.frame_errors   = 2;
+    report.telemetry.uart_overruns  = 3;
+    report.telemetry.rx_queue_high  = 4;
+    report.telemetry.schedule_high  = 5;
+    report.telemetry.late_count     = 6;
+    report.telemetry.late_sum_us    = 7;
+    report.telemetry.late_max_us    = 8;
+    report.telemetry.frames_shown   = 9;
+    report.telemetry.frames_dropped = 10;
+    report.telemetry.strip_busy_us  = 11;
+    report.telemetry.strip_max_us   = 12;
+    report.telemetry.parser_busy_us = 13;
+    report.telemetry.parser_max_us  = 0x80000000;
+
+    std::vector<uint8_t> stream = {};
+    for (const message_t *message : {&batch, &tempo, &timestamp, &reset, &sync, &schedule,
+                                     &ping, &echo, &begin, &chunk, &ack, &play, &telemetry,
+                                     &report})
+    {
+        std::vector<uint8_t> frame = encode(*message);
+        CHECK(frame.size() <= kMaxFrameSize);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+
+    size_t errors = 0;
+    std::vector<message_t> decoded = decode(stream, &errors);
+    CHECK(errors == 0);
+    CHECK(decoded.size() == 14);
+    if (decoded.size() != 14)
+    {
+        return;
+    }
+    CHECK(decoded[0].type == MESSAGE_NOTE_BATCH);
+    CHECK(same_batch(decoded[0].note_batch, batch.note_batch));
+    CHECK(decoded[1].type == MESSAGE_TEMPO);
+    CHECK(decoded[1].tempo.time_us == 42 && decoded[1].tempo.tempo == 500000);
+    CHECK(decoded[2].type == MESSAGE_TIMESTAMP);
+    CHECK(decoded[3].type == MESSAGE_RESET);
+    CHECK(decoded[4].type == MESSAGE_SYNC_RESPONSE);
+    CHECK(decoded[4].sync.host_send_us      == sync.sync.host_send_us);
+    CHECK(decoded[4].sync.device_receive_us == sync.sync.device_receive_us);
+    CHECK(decoded[4].sync.device_send_us    == sync.sync.device_send_us);
+    CHECK(decoded[5].type == MESSAGE_SCHEDULE && decoded[5].schedule.enabled);
+    CHECK(decoded[6].type == MESSAGE_PING && decoded[6].ping.show);
+    CHECK(decoded[6].ping.sequence == 300 && decoded[6].ping.host_send_us == 1ull << 41);
+    CHECK(decoded[6].ping.padding  == 200);
+    CHECK(decoded[7].type == MESSAGE_ECHO && decoded[7].ping.sequence == 300);
+    CHECK(decoded[7].ping.device_receive_us == 10);
+    CHECK(decoded[7].ping.device_shown_us   == 20);
+    CHECK(decoded[7].ping.device_send_us    == 30);
+    CHECK(decoded[8].type == MESSAGE_UPLOAD_BEGIN && decoded[8].upload_begin.size == 100000);
+    CHECK(decoded[8].upload_begin.crc32 == 0xdeadbeef);
+    CHECK(decoded[9].type == MESSAGE_UPLOAD_CHUNK && decoded[9].upload_chunk.sequence == 499);
+    CHECK(decoded[9].upload_chunk.size == kUploadChunkSize && decoded[9].upload_chunk.data[0] == 0);
+    CHECK(decoded[10].type == MESSAGE_UPLOAD_ACK && decoded[10].upload_ack.crc32 == 0xdeadbeef);
+    CHECK(decoded[10].upload_ack.next   == 300 && decoded[10].upload_ack.mask == 0x80000001);
+    CHECK(decoded[10].upload_ack.window == 8   && decoded[10].upload_ack.state == UPLOAD_RECEIVING);
+    CHECK(decoded[11].type == MESSAGE_PLAY && decoded[11].play.play);
+    CHECK(decoded[11].play.start_us == 1ull << 40);
+    CHECK(decoded[12].type == MESSAGE_TELEMETRY);
+    CHECK(decoded[12].telemetry_request.period_us == 500000);
+    CHECK(decoded[13].type == MESSAGE_TELEMETRY_REPORT);
+    CHECK(std::memcmp(&decoded[13].telemetry, &report.telemetry, sizeof(telemetry_t)) == 0);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Check values of both CRCs, CRC-32 is computed in parts the same as at once
+//
+static void
+test_crc()
+{
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    CHECK(crc16(check, sizeof(check)) == 0x29b1);
+    CHECK(crc32(check, sizeof(check)) == 0xcbf43926);
+    CHECK(crc32(check + 4, 5, crc32(check, 4)) == 0xcbf43926);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_corruption()
+{
+    message_t tempo = {};
+    tempo.type          = MESSAGE_TEMPO;
+    tempo.tempo.time_us = 1000;
+    tempo.tempo.tempo   = 400000;
+
+    std::vector<uint8_t> frame = encode(tempo);
+
+    // Garbage before frame, flipped bit in frame, then good frame again
+    std::vector<uint8_t> stream = {0x13, 0x37, 0xff};
+    stream.insert(stream.end(), frame.begin(), frame.end());
+    std::vector<uint8_t> broken = frame;
+    broken[2] ^= 0x04;
+    stream.insert(stream.end(), broken.begin(), broken.end());
+    stream.insert(stream.end(), frame.begin(), frame.end());
+
+    // Frame without delimiter longer than any valid frame
+    stream.insert(stream.end(), kMaxFrameSize * 2, 0x55);
+    stream.push_back(kFrameDelimiter);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+
+    size_t errors = 0;
+    std::vector<message_t> decoded = decode(stream, &errors);
+    CHECK(decoded.size() == 2);
+    CHECK(errors == 3);
+    for (const auto &message : decoded)
+    {
+        CHECK(message.type == MESSAGE_TEMPO && message.tempo.tempo == 400000);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_song(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+
+    std::vector<message_t> messages = {};
+    CHECK(make_messages(timeline, messages) == piano::STATUS_SUCCESS);
+
+    std::vector<uint8_t> stream = {};
+    size_t notes = 0;
+    for (const auto &message : messages)
+    {
+        std::vector<uint8_t> frame = encode(message);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        notes += (message.type == MESSAGE_NOTE_BATCH) ? message.note_batch.count : 1;
+    }
+    CHECK(notes == timeline.size());
+
+    size_t errors = 0;
+    std::vector<message_t> decoded = decode(stream, &errors);
+    CHECK(errors == 0);
+    CHECK(decoded.size() == messages.size());
+    for (size_t i = 0; i != std::min(decoded.size(), messages.size()); ++i)
+    {
+        CHECK(decoded[i].type == messages[i].type);
+        if (decoded[i].type == MESSAGE_NOTE_BATCH)
+        {
+            CHECK(same_batch(decoded[i].note_batch, messages[i].note_batch));
+        }
+    }
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    test_cobs();
+    test_round_trip();
+    test_crc();
+    test_corruption();
+    for (int i = 1; i < argc; ++i)
+    {
+        test_song(argv[i]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,132 @@
+//================================================================================================//
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "key_codec.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Songs are played this many times faster than real time
+//
+static const double kSpeed = 500.;
+
+//================================================================================================//
+
+//
+// Read frames from master side of pty until expected number of messages is received
+//
+static void
+receive(int                                  master,
+        size_t                               expected,
+        std::vector<piano_proto::message_t> *received,
+        size_t                              *errors)
+{
+    piano_proto::frame_decoder_t decoder;
+    uint8_t                      buffer[4096] = {};
+    while (received->size() != expected)
+    {
+        ssize_t size = read(master, buffer, sizeof(buffer));
+        if (size <= 0)
+        {
+            return;
+        }
+        for (ssize_t i = 0; i != size; ++i)
+        {
+            piano_proto::message_t message = {};
+            piano::status_t        status  = decoder.push(buffer[i], &message);
+            if (status == piano::STATUS_SUCCESS)
+            {
+                received->push_back(message);
+            } else if (status != piano::STATUS_PROTOCOL_PENDING)
+            {
+                ++*errors;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_play(const std::vector<piano_proto::message_t> &messages)
+{
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), 115200, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    std::vector<piano_proto::message_t> received = {};
+    size_t errors = 0;
+    std::thread reader(receive, master, messages.size(), &received, &errors);
+
+    piano_host::serial_sender_t sender(fd);
+    CHECK(sender.play(messages, kSpeed) == piano::STATUS_SUCCESS);
+    reader.join();
+    close(fd);
+    close(master);
+
+    CHECK(errors == 0);
+    CHECK(received.size() == messages.size());
+    CHECK(sender.frames_sent() == messages.size());
+    CHECK(sender.queue_depth().count() != 0);
+    CHECK(sender.queue_depth().max() <= piano_host::kMaxQueuedFrames);
+    CHECK(sender.write_latency().count() == sender.queue_depth().count());
+
+    for (size_t i = 0; i != std::min(received.size(), messages.size()); ++i)
+    {
+        CHECK(received[i].type == messages[i].type);
+        CHECK(piano_proto::message_time(received[i]) == piano_proto::message_time(messages[i]));
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_song(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+
+    std::vector<piano_proto::message_t> batches = {};
+    piano_proto::make_messages(timeline, batches);
+    test_play(batches);
+
+    std::vector<piano_proto::message_t> frames = {};
+    piano_proto::key_encoder_t encoder;
+    piano_proto::make_key_frame_messages(timeline, 10000, encoder, frames);
+    test_play(frames);
+}
+
+//================================================================================================//
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        test_song(argv[i]);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,476 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "soundfont.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+static const uint32_t kRate = 16000;
+
+//
+// Generators used by tests
+//
+static const uint16_t kGenAttenuation = 48;
+static const uint16_t kGenInstrument  = 41;
+static const uint16_t kGenKeyRange    = 43;
+static const uint16_t kGenSampleId    = 53;
+static const uint16_t kGenSampleModes = 54;
+static const uint16_t kGenRelease     = 38;
+static const uint16_t kGenRootKey     = 58;
+
+typedef std::vector<std::pair<uint16_t, uint16_t>> generator_list_t;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// SoundFont 2 file put together from samples, instruments and presets
+//
+class sf_builder_t
+{
+  public:
+    uint16_t sample(const std::vector<int16_t> &frames,
+                    uint32_t                    rate,
+                    uint8_t                     root,
+                    uint32_t                    loop_start,
+                    uint32_t                    loop_end)
+    {
+        uint32_t start = static_cast<uint32_t>(data_.size());
+        data_.insert(data_.end(), frames.begin(), frames.end());
+        data_.insert(data_.end(), 46, 0);
+        name(shdr_, "sample");
+        for (uint32_t value : {start, start + static_cast<uint32_t>(frames.size()),
+                               start + loop_start, start + loop_end, rate})
+        {
+            put(shdr_, value, 4);
+        }
+        put(shdr_, root, 1);
+        put(shdr_, 0, 1);
+        put(shdr_, 0, 2);
+        put(shdr_, 1, 2);
+        return static_cast<uint16_t>(shdr_.size() / 46 - 1);
+    }
+
+    uint16_t instrument(const std::vector<generator_list_t> &zones)
+    {
+        name(inst_, "instrument");
+        put(inst_, ibag_.size() / 4, 2);
+        bags(ibag_, igen_, zones);
+        return static_cast<uint16_t>(inst_.size() / 22 - 1);
+    }
+
+    void preset(const char                          *title,
+                uint16_t                             program,
+                uint16_t                             bank,
+                const std::vector<generator_list_t> &zones)
+    {
+        name(phdr_, title);
+        put(phdr_, program, 2);
+        put(phdr_, bank, 2);
+        put(phdr_, pbag_.size() / 4, 2);
+        put(phdr_, 0, 12);
+        bags(pbag_, pgen_, zones);
+    }
+
+    std::vector<uint8_t> build() const
+    {
+        // Terminal records close every list
+        std::vector<uint8_t> phdr = phdr_, pbag = pbag_, pgen = pgen_;
+        std::vector<uint8_t> inst = inst_, ibag = ibag_, igen = igen_, shdr = shdr_;
+        name(phdr, "EOP");
+        put(phdr, 0, 4);
+        put(phdr, pbag.size() / 4, 2);
+        put(phdr, 0, 12);
+        put(pbag, pgen.size() / 4, 2);
+        put(pbag, 0, 2);
+        put(pgen, 0, 4);
+        name(inst, "EOI");
+        put(inst, ibag.size() / 4, 2);
+        put(ibag, igen.size() / 4, 2);
+        put(ibag, 0, 2);
+        put(igen, 0, 4);
+        name(shdr, "EOS");
+        put(shdr, 0, 26);
+
+        std::vector<uint8_t> smpl(data_.size() * 2);
+        std::memcpy(smpl.data(), data_.data(), smpl.size());
+        std::vector<uint8_t> info  = chunk("ifil", {2, 0, 1, 0});
+        std::vector<uint8_t> sdta  = chunk("smpl", smpl);
+        std::vector<uint8_t> pdta  = {};
+        const std::pair<const char *, const std::vector<uint8_t> *> hydra[] =
+        {
+            {"phdr", &phdr}, {"pbag", &pbag}, {"pmod", nullptr}, {"pgen", &pgen},
+            {"inst", &inst}, {"ibag", &ibag}, {"imod", nullptr}, {"igen", &igen},
+            {"shdr", &shdr},
+        };
+        for (const auto &sub : hydra)
+        {
+            std::vector<uint8_t> modulators(10, 0);
+            std::vector<uint8_t> bytes = chunk(sub.first, sub.second ? *sub.second : modulators);
+            pdta.insert(pdta.end(), bytes.begin(), bytes.end());
+        }
+
+        std::vector<uint8_t> body = {'s', 'f', 'b', 'k'};
+        for (const auto &list : {std::make_pair("INFO", &info), std::make_pair("sdta", &sdta),
+                                 std::make_pair("pdta", &pdta)})
+        {
+            std::vector<uint8_t> content(list.first, list.first + 4);
+            content.insert(content.end(), list.second->begin(), list.second->end());
+            std::vector<uint8_t> bytes = chunk("LIST", content);
+            body.insert(body.end(), bytes.begin(), bytes.end());
+        }
+        return chunk("RIFF", body);
+    }
+
+  private:
+    static void put(std::vector<uint8_t> &out, uint64_t value, size_t bytes)
+    {
+        for (size_t i = 0; i != bytes; ++i)
+        {
+            out.push_back(static_cast<uint8_t>(i < 8 ? value >> (8 * i) : 0));
+        }
+    }
+
+    static void name(std::vector<uint8_t> &out, const char *text)
+    {
+        size_t length = std::strlen(text);
+        out.insert(out.end(), text, text + length);
+        out.insert(out.end(), 20 - length, 0);
+    }
+
+    static std::vector<uint8_t> chunk(const char *id, const std::vector<uint8_t> &content)
+    {
+        std::vector<uint8_t> out(id, id + 4);
+        put(out, content.size(), 4);
+        out.insert(out.end(), content.begin(), content.end());
+        if (content.size() % 2 != 0)
+        {
+            out.push_back(0);
+        }
+        return out;
+    }
+
+    static void bags(std::vector<uint8_t>                &bag,
+                     std::vector<uint8_t>                &gen,
+                     const std::vector<generator_list_t> &zones)
+    {
+        for (const generator_list_t &zone : zones)
+        {
+            put(bag, gen.size() / 4, 2);
+            put(bag, 0, 2);
+            for (const auto &generator : zone)
+            {
+                put(gen, generator.first, 2);
+                put(gen, generator.second, 2);
+            }
+        }
+    }
+
+    std::vector<int16_t> data_ = {};
+    std::vector<uint8_t> phdr_ = {}, pbag_ = {}, pgen_ = {};
+    std::vector<uint8_t> inst_ = {}, ibag_ = {}, igen_ = {}, shdr_ = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static std::string
+write_temp(const std::vector<uint8_t> &bytes)
+{
+    std::string path = "soundfont_test_" + std::to_string(getpid()) + ".sf2";
+    FILE       *file = std::fopen(path.c_str(), "wb");
+    if (file != nullptr)
+    {
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+    }
+    return path;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Ramp which makes interpolation easy to check, and one period of sine for looping
+//
+static std::vector<int16_t>
+ramp(size_t length)
+{
+    std::vector<int16_t> frames(length);
+    for (size_t i = 0; i != length; ++i)
+    {
+        frames[i] = static_cast<int16_t>(100 * i);
+    }
+    return frames;
+}
+
+static std::vector<int16_t>
+sine(size_t period)
+{
+    std::vector<int16_t> frames(period + 1);
+    for (size_t i = 0; i != frames.size(); ++i)
+    {
+        frames[i] = static_cast<int16_t>(std::lrint(16000. * std::sin(6.283185307179586 * i /
+                                                                      period)));
+    }
+    return frames;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Piano preset of two zones, lower keys play ramp once at half output rate, upper ones loop a
+// sine with root key of zone instead of sample. Organ preset and drum bank are not piano.
+//
+static std::vector<uint8_t>
+make_font()
+{
+    sf_builder_t builder;
+    uint16_t     once  = builder.sample(ramp(200), kRate / 2, 60, 0, 0);
+    uint16_t     loop  = builder.sample(sine(40), kRate, 60, 0, 40);
+    uint16_t     piano = builder.instrument(
+    {
+        {{kGenRelease, static_cast<uint16_t>(-3600)}},
+        {{kGenKeyRange, 64 << 8}, {kGenSampleId, once}},
+        {{kGenKeyRange, 127 << 8 | 65}, {kGenSampleModes, 1}, {kGenRootKey, 72},
+         {kGenSampleId, loop}},
+    });
+    builder.preset("Organ", 16, 0, {{{kGenInstrument, piano}}});
+    builder.preset("Drums", 0, 128, {{{kGenInstrument, piano}}});
+    builder.preset("Piano", 2, 0, {{{kGenAttenuation, 60}}, {{kGenInstrument, piano}}});
+    builder.preset("Broken", 3, 0, {{{kGenInstrument, 99}}});
+    return builder.build();
+}
+
+//================================================================================================//
+
+static void
+test_presets()
+{
+    std::string              path = write_temp(make_font());
+    piano_audio::soundfont_t font;
+    CHECK(font.open(path.c_str()) == piano::STATUS_SUCCESS);
+    unlink(path.c_str());
+    CHECK(font.presets().size() == 4 && font.mapped_bytes() == 2 * (200 + 46 + 41 + 46));
+
+    // Missing program falls back to the lowest piano program with zones
+    const piano_audio::sf_preset_t *piano = font.piano_preset(0);
+    CHECK(piano != nullptr && piano->name == "Piano" && piano->program == 2);
+    CHECK(font.piano_preset(16) != nullptr && font.piano_preset(16)->name == "Organ");
+    if (piano == nullptr || piano->zones.size() != 2)
+    {
+        CHECK(false);
+        return;
+    }
+
+    const piano_audio::sf_zone_t &low  = piano->zones[0];
+    const piano_audio::sf_zone_t &high = piano->zones[1];
+    CHECK(low.key_lo == 0 && low.key_hi == 64 && !low.loop && low.root_key == 60);
+    CHECK(low.start == 0 && low.end == 200 && low.sample_rate == kRate / 2);
+    CHECK(high.key_lo == 65 && high.key_hi == 127 && high.loop && high.root_key == 72);
+    CHECK(high.start == 246 && high.loop_start == 246 && high.loop_end == 286);
+
+    // Preset attenuation of 6 dB adds to instrument, global release goes to both zones
+    CHECK(std::fabs(low.gain - 0.501f) < 1e-3f && std::fabs(low.release_s - 0.125f) < 1e-3f);
+    CHECK(high.attack_s == 0.f && high.sustain == 1.f);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Voice steps through sample at pitch ratio and interpolates between frames, one shot stops at
+// the end of sample, looped zone sounds until released
+//
+static void
+test_voices()
+{
+    std::string              path = write_temp(make_font());
+    piano_audio::soundfont_t font;
+    CHECK(font.open(path.c_str()) == piano::STATUS_SUCCESS);
+    unlink(path.c_str());
+    const piano_audio::sf_preset_t *piano = font.piano_preset(0);
+    if (piano == nullptr)
+    {
+        CHECK(false);
+        return;
+    }
+
+    // Root key at half rate is a quarter frame per sample, an octave higher half a frame
+    piano_audio::sampler_t sampler(font, *piano, kRate);
+    std::vector<float>     out(1024, 0.f);
+    sampler.note_on(48, 127);
+    sampler.render(out.data(), 8);
+    float gain = piano->zones[0].gain / 32768.f;
+    CHECK(std::fabs(out[7] - 100.f * 7 / 4 * gain * 7 / 8) < 1e-4f);
+
+    std::fill(out.begin(), out.end(), 0.f);
+    sampler.note_on(48, 0);
+    sampler.render(out.data(), out.size());
+    CHECK(sampler.voices() == 0);
+
+    std::fill(out.begin(), out.end(), 0.f);
+    sampler.note_on(60, 127);
+    sampler.render(out.data(), 16);
+    CHECK(std::fabs(out[9] - 100.f * 9 / 2 * gain) < 1e-4f);
+    for (size_t i = 0; i != 4 && sampler.voices() != 0; ++i)
+    {
+        sampler.render(out.data(), out.size());
+    }
+    CHECK(sampler.voices() == 0);
+
+    // Loop plays 400 Hz sine for as long as key is held, and fades within release after
+    std::fill(out.begin(), out.end(), 0.f);
+    sampler.note_on(72, 100);
+    for (size_t i = 0; i != 20; ++i)
+    {
+        std::fill(out.begin(), out.end(), 0.f);
+        sampler.render(out.data(), out.size());
+    }
+    CHECK(sampler.voices() == 1);
+    size_t crossings = 0;
+    for (size_t i = 1; i != out.size(); ++i)
+    {
+        crossings += (out[i - 1] < 0.f && out[i] >= 0.f) ? 1 : 0;
+    }
+    CHECK(crossings >= 25 && crossings <= 26);
+
+    sampler.note_off(72);
+    sampler.render(out.data(), out.size());
+    CHECK(sampler.voices() == 1);
+    for (size_t i = 0; i != 40 && sampler.voices() != 0; ++i)
+    {
+        sampler.render(out.data(), out.size());
+    }
+    CHECK(sampler.voices() == 0);
+
+    // Pool is never exceeded
+    for (uint8_t key = 0; key != 128; ++key)
+    {
+        sampler.note_on(key, 90);
+    }
+    CHECK(sampler.voices() == piano_audio::kSamplerVoices);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Loop of 4 frames played 10 octaves above its root key steps over the whole loop at every
+// sample, position still stays in it: level of flat loop is all that is heard
+//
+static void
+test_short_loop()
+{
+    sf_builder_t builder;
+    uint16_t     flat       = builder.sample(std::vector<int16_t>(8, 1000), kRate, 0, 2, 6);
+    uint16_t     instrument = builder.instrument({{{kGenSampleModes, 1}, {kGenSampleId, flat}}});
+    builder.preset("Piano", 0, 0, {{{kGenInstrument, instrument}}});
+
+    std::string              path = write_temp(builder.build());
+    piano_audio::soundfont_t font;
+    CHECK(font.open(path.c_str()) == piano::STATUS_SUCCESS);
+    unlink(path.c_str());
+    const piano_audio::sf_preset_t *piano = font.piano_preset(0);
+    if (piano == nullptr || piano->zones.size() != 1 || !piano->zones[0].loop)
+    {
+        CHECK(false);
+        return;
+    }
+
+    piano_audio::sampler_t sampler(font, *piano, kRate);
+    std::vector<float>     out(1024, 0.f);
+    sampler.note_on(120, 127);
+    sampler.render(out.data(), out.size());
+    std::fill(out.begin(), out.end(), 0.f);
+    sampler.render(out.data(), out.size());
+    CHECK(sampler.voices() == 1 && out[0] > 0.f);
+    for (float sample : out)
+    {
+        CHECK(std::fabs(sample - out[0]) < 1e-6f);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_errors()
+{
+    piano_audio::soundfont_t font;
+    CHECK(font.open("/nonexistent/font.sf2") == piano::STATUS_FILE_ERROR);
+
+    std::vector<uint8_t> bytes = make_font();
+    bytes[8]                   = 'x';
+    std::string path           = write_temp(bytes);
+    CHECK(font.open(path.c_str()) == piano::STATUS_SOUNDFONT_FORMAT_ERROR);
+
+    bytes = make_font();
+    bytes.resize(bytes.size() - 60);
+    path  = write_temp(bytes);
+    CHECK(font.open(path.c_str()) == piano::STATUS_SOUNDFONT_FORMAT_ERROR);
+    unlink(path.c_str());
+    CHECK(font.presets().empty() && font.samples() == nullptr);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Whole song ends once released voices fade
+//
+static void
+test_song(const std::vector<piano_midi::timed_event_t> &timeline)
+{
+    std::string              path = write_temp(make_font());
+    piano_audio::soundfont_t font;
+    CHECK(font.open(path.c_str()) == piano::STATUS_SUCCESS);
+    unlink(path.c_str());
+    if (font.piano_preset(0) == nullptr)
+    {
+        CHECK(false);
+        return;
+    }
+
+    std::vector<float> samples = {};
+    piano_audio::render_song(timeline, font, *font.piano_preset(0), kRate, samples);
+    CHECK(!samples.empty() && !timeline.empty());
+    CHECK(samples.size() >= timeline.back().time_us * kRate / 1000000);
+    CHECK(samples.size() < timeline.back().time_us * kRate / 1000000 + kRate);
+    for (float sample : samples)
+    {
+        CHECK(std::isfinite(sample));
+    }
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_presets();
+    test_voices();
+    test_short_loop();
+    test_errors();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        CHECK(piano_midi::load_timeline(argv[i], timeline) == piano::STATUS_SUCCESS);
+        test_song(timeline);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
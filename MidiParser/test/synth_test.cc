@@ -0,0 +1,364 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "synth.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+static const uint32_t kRate = 8000;
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_midi::timed_event_t
+note(uint64_t time_us,
+     uint8_t  key,
+     uint8_t  velocity)
+{
+    piano_midi::timed_event_t event;
+    event.time_us  = time_us;
+    event.event    = (velocity != 0) ? piano::EVENT_NOTE_ON : piano::EVENT_NOTE_OFF;
+    event.note     = key;
+    event.velocity = velocity;
+    return event;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static double
+energy(const std::vector<float> &samples,
+       size_t                    begin,
+       size_t                    end)
+{
+    double sum = 0.;
+    for (size_t i = begin; i != end && i < samples.size(); ++i)
+    {
+        sum += static_cast<double>(samples[i]) * samples[i];
+    }
+    return sum;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+class memory_sink_t : public piano_audio::pcm_sink_t
+{
+  public:
+    piano::status_t write(const float *data, size_t count) override
+    {
+        samples.insert(samples.end(), data, data + count);
+        return piano::STATUS_SUCCESS;
+    }
+
+    std::vector<float> samples = {};
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_audio::synth_command_t
+command(int64_t sample,
+        uint8_t key,
+        uint8_t velocity)
+{
+    piano_audio::synth_command_t result;
+    result.sample   = sample;
+    result.note     = key;
+    result.velocity = velocity;
+    return result;
+}
+
+//================================================================================================//
+
+//
+// Presses, releases, key pressed again while held, note on with velocity 0 and key held at end
+//
+static void
+test_spans()
+{
+    std::vector<piano_midi::timed_event_t> timeline =
+    {
+        note(0,       60, 100),
+        note(500000,  60, 0),
+        note(500000,  64, 80),
+        note(750000,  64, 90),
+        note(1000000, 64, 0),
+        note(1000000, 67, 50),
+    };
+    timeline[4].event = piano::EVENT_NOTE_ON;
+
+    std::vector<piano_audio::note_span_t> spans = {};
+    piano_audio::make_note_spans(timeline, kRate, spans);
+    CHECK(spans.size() == 4);
+    if (spans.size() != 4)
+    {
+        return;
+    }
+    CHECK(spans[0].note == 60 && spans[0].on == 0 && spans[0].off == 4000);
+    CHECK(spans[1].note == 64 && spans[1].on == 4000 && spans[1].off == 6000);
+    CHECK(spans[2].velocity == 90 && spans[2].on == 6000 && spans[2].off == 8000);
+    CHECK(spans[3].note == 67 && spans[3].on == 8000 && spans[3].off == 8000);
+
+    // Damper stops note within fraction of second, louder one rings longer
+    for (const piano_audio::note_span_t &span : spans)
+    {
+        CHECK(span.end > span.off && span.end < span.off + kRate);
+    }
+    CHECK(spans[2].end - spans[2].off > spans[1].end - spans[1].off);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Single note: silence before press, pitch of fundamental, decay after release
+//
+static void
+test_note()
+{
+    std::vector<piano_midi::timed_event_t> timeline = {note(100000, 69, 127), note(600000, 69, 0)};
+    piano_audio::synth_config_t config = {};
+    config.sample_rate = kRate;
+    config.threads     = 1;
+
+    std::vector<float> samples = {};
+    piano_audio::render_song(timeline, config, samples);
+    CHECK(samples.size() > kRate * 6 / 10 && samples.size() < kRate * 2);
+    CHECK(energy(samples, 0, kRate / 10) == 0.);
+
+    // A4 repeats every 8000 / 440 = 18.2 samples, the strongest autocorrelation within an
+    // octave either side lies there; upper partials repeat in it too
+    size_t period = 0;
+    double best   = 0.;
+    for (size_t lag = 10; lag != 37; ++lag)
+    {
+        double sum = 0.;
+        for (size_t i = kRate / 5; i != kRate * 2 / 5; ++i)
+        {
+            sum += static_cast<double>(samples[i]) * samples[i + lag];
+        }
+        if (sum > best)
+        {
+            best   = sum;
+            period = lag;
+        }
+    }
+    CHECK(period == 18);
+
+    double held     = energy(samples, kRate / 2, kRate * 6 / 10);
+    double released = energy(samples, kRate * 9 / 10, kRate);
+    CHECK(held > 0. && released < held / 100.);
+    for (float sample : samples)
+    {
+        CHECK(std::fabs(sample) < 1.f);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Voices handed over at slice boundaries continue as if slice went on, and output does not
+// depend on number of threads
+//
+static void
+test_slices(const std::vector<piano_midi::timed_event_t> &timeline)
+{
+    piano_audio::synth_config_t config = {};
+    config.sample_rate = kRate;
+    config.threads     = 1;
+
+    std::vector<float> one  = {};
+    std::vector<float> many = {};
+    piano_audio::render_song(timeline, config, one);
+    config.threads = 4;
+    piano_audio::render_song(timeline, config, many);
+    CHECK(!one.empty() && one.size() == many.size());
+    CHECK(std::memcmp(one.data(), many.data(), one.size() * sizeof(float)) == 0);
+
+    std::vector<piano_audio::note_span_t> spans = {};
+    piano_audio::make_note_spans(timeline, kRate, spans);
+    int64_t            length = std::min<int64_t>(static_cast<int64_t>(one.size()),
+                                                  4 * piano_audio::kSliceSamples);
+    std::vector<float> whole(static_cast<size_t>(length));
+    piano_audio::render_slice(spans, kRate, 0, length, whole.data());
+
+    float error = 0.f;
+    for (int64_t i = 0; i != length; ++i)
+    {
+        error = std::max(error, std::fabs(whole[static_cast<size_t>(i)] -
+                                          one[static_cast<size_t>(i)]));
+    }
+    CHECK(error < 1e-3f);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+test_wav()
+{
+    std::vector<float> samples = {0.f, 0.5f, -1.f, 2.f};
+    std::string        path    = "synth_test_" + std::to_string(getpid()) + ".wav";
+    CHECK(piano_audio::write_wav(path.c_str(), samples, kRate) == piano::STATUS_SUCCESS);
+
+    std::vector<uint8_t> file = {};
+    CHECK(piano_midi::read_file(path.c_str(), file) == piano::STATUS_SUCCESS);
+    unlink(path.c_str());
+    CHECK(file.size() == 44 + 2 * samples.size());
+    if (file.size() != 44 + 2 * samples.size())
+    {
+        return;
+    }
+
+    CHECK(std::memcmp(&file[0], "RIFF", 4) == 0 && std::memcmp(&file[8], "WAVEfmt ", 8) == 0);
+    CHECK(file[4] == 44 && file[22] == 1 && file[34] == 16);
+    CHECK((file[24] | file[25] << 8) == kRate && std::memcmp(&file[36], "data", 4) == 0);
+    CHECK(file[44] == 0 && file[45] == 0);
+    CHECK((file[46] | file[47] << 8) == 16384 && (file[48] | file[49] << 8) == 0x8001);
+    CHECK((file[50] | file[51] << 8) == 0x7fff);
+
+    CHECK(piano_audio::write_wav("/nonexistent/synth_test.wav", samples, kRate) ==
+          piano::STATUS_FILE_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Engine places notes at their sample within block and sounds as offline renderer of the same
+// notes, up to voices dropped as silent a few samples apart
+//
+static void
+test_engine()
+{
+    std::vector<piano_audio::note_span_t> spans = {};
+    for (int64_t i = 0; i != 12; ++i)
+    {
+        piano_audio::note_span_t span;
+        span.note     = static_cast<uint8_t>(48 + 5 * i);
+        span.velocity = static_cast<uint8_t>(40 + 7 * i);
+        span.on       = 1000 + 333 * i;
+        span.off      = span.on + 700 + 91 * i;
+        spans.push_back(span);
+    }
+
+    memory_sink_t               sink;
+    piano_audio::synth_engine_t engine(kRate, &sink);
+    std::vector<piano_audio::synth_command_t> commands = {};
+    for (const piano_audio::note_span_t &span : spans)
+    {
+        commands.push_back(command(span.on, span.note, span.velocity));
+        commands.push_back(command(span.off, span.note, 0));
+    }
+    std::stable_sort(commands.begin(), commands.end(),
+                     [](const piano_audio::synth_command_t &a,
+                        const piano_audio::synth_command_t &b)
+                     {
+                         return a.sample < b.sample;
+                     });
+    for (const piano_audio::synth_command_t &item : commands)
+    {
+        CHECK(engine.command(item));
+    }
+
+    size_t blocks = 0;
+    while (engine.rendered() < 2000 || engine.voices() != 0)
+    {
+        CHECK(engine.render_block() == piano::STATUS_SUCCESS);
+        ++blocks;
+    }
+    CHECK(sink.samples.size() == blocks * piano_audio::kEngineBlock);
+    CHECK(engine.block_stats().runs == blocks && engine.stolen() == 0);
+    CHECK(energy(sink.samples, 0, 1000) == 0. && sink.samples[1000] != 0.f);
+
+    // Offline renderer needs ends of spans only to know when voices may be dropped
+    for (piano_audio::note_span_t &span : spans)
+    {
+        span.end = static_cast<int64_t>(sink.samples.size());
+    }
+    std::vector<float> offline(sink.samples.size());
+    piano_audio::render_slice(spans, kRate, 0, static_cast<int64_t>(offline.size()),
+                              offline.data());
+    float error = 0.f;
+    for (size_t i = 0; i != offline.size(); ++i)
+    {
+        error = std::max(error, std::fabs(offline[i] - sink.samples[i]));
+    }
+    CHECK(error < 1e-3f);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Full queue refuses commands, late ones sound at the start of the next block, full pool takes
+// over voices
+//
+static void
+test_engine_limits()
+{
+    memory_sink_t               sink;
+    piano_audio::synth_engine_t engine(kRate, &sink);
+    for (size_t i = 0; i != piano_audio::kEngineQueue; ++i)
+    {
+        CHECK(engine.command(command(0, 60, 0)));
+    }
+    CHECK(!engine.command(command(0, 60, 0)));
+    engine.render_block();
+    engine.render_block();
+    CHECK(engine.command(command(0, 60, 100)));
+    engine.render_block();
+
+    size_t late = 2 * piano_audio::kEngineBlock;
+    CHECK(energy(sink.samples, 0, late) == 0. && sink.samples[late] != 0.f);
+
+    // Released voice is taken over first, then the oldest held ones
+    CHECK(engine.command(command(0, 60, 0)));
+    for (uint8_t key = 0; key != piano_audio::kEngineVoices + 8; ++key)
+    {
+        CHECK(engine.command(command(0, static_cast<uint8_t>(20 + key), 64)));
+    }
+    engine.render_block();
+    CHECK(engine.voices() == piano_audio::kEngineVoices && engine.stolen() == 9);
+
+    for (uint8_t key = 0; key != 128; ++key)
+    {
+        engine.command(command(0, key, 0));
+    }
+    for (size_t i = 0; i != 100 && engine.voices() != 0; ++i)
+    {
+        engine.render_block();
+    }
+    CHECK(engine.voices() == 0);
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_spans();
+    test_note();
+    test_wav();
+    test_engine();
+    test_engine_limits();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        CHECK(piano_midi::load_timeline(argv[i], timeline) == piano::STATUS_SUCCESS);
+        test_slices(timeline);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,543 @@
+//================================================================================================//
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "song_image.hh"
+#include "song_store.hh"
+#include "song_upload.hh"
+#include "smf_player.hh"
+#include "song_bank.hh"
+#include "device.hh"
+#include "device_sim.hh"
+#include "serial_sender.hh"
+#include "check.hh"
+
+//================================================================================================//
+
+//
+// Port with manual clock and song storage, keeps acks device sends
+//
+class store_port_t : public piano_device::device_port_t
+{
+  public:
+    int64_t now_us() override { return 0; }
+
+    void send(const uint8_t *data, size_t size) override
+    {
+        piano_proto::message_t message;
+        for (size_t i = 0; i != size; ++i)
+        {
+            if (decoder_.push(data[i], &message) == piano::STATUS_SUCCESS &&
+                message.type == piano_proto::MESSAGE_UPLOAD_ACK)
+            {
+                acks.push_back(message.upload_ack);
+            }
+        }
+    }
+
+    void show(const piano_device::led_frame_t &) override {}
+
+    uint8_t *song_storage(size_t *capacity) override
+    {
+        *capacity = storage.size();
+        return storage.data();
+    }
+
+    std::vector<uint8_t>                   storage = std::vector<uint8_t>(1 << 16);
+    std::vector<piano_proto::upload_ack_t> acks    = {};
+
+  private:
+    piano_proto::frame_decoder_t decoder_;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+deliver(piano_device::device_t       *device,
+        const piano_proto::message_t &message,
+        int64_t                       receive_us)
+{
+    uint8_t frame[piano_proto::kMaxFrameSize] = {};
+    size_t  size = 0;
+    CHECK(piano_proto::encode_message(message, frame, sizeof(frame), &size) == piano::STATUS_SUCCESS);
+    device->receive(frame, size, receive_us);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_proto::message_t
+chunk_message(const std::vector<uint8_t> &image,
+              size_t                      sequence)
+{
+    size_t offset = sequence * piano_proto::kUploadChunkSize;
+
+    piano_proto::message_t message;
+    message.type                  = piano_proto::MESSAGE_UPLOAD_CHUNK;
+    message.upload_chunk.sequence = static_cast<uint32_t>(sequence);
+    message.upload_chunk.size     = static_cast<uint8_t>(std::min(piano_proto::kUploadChunkSize,
+                                                                  image.size() - offset));
+    std::memcpy(message.upload_chunk.data, image.data() + offset, message.upload_chunk.size);
+    return message;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano_proto::message_t
+begin_message(const std::vector<uint8_t> &image)
+{
+    piano_proto::message_t message;
+    message.type               = piano_proto::MESSAGE_UPLOAD_BEGIN;
+    message.upload_begin.size  = static_cast<uint32_t>(image.size());
+    message.upload_begin.crc32 = piano_proto::crc32(image.data(), image.size());
+    return message;
+}
+
+//================================================================================================//
+
+//
+// Image holds the same messages, damaged record is found by its crc
+//
+static void
+test_image(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    std::vector<uint8_t>                   image    = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, messages);
+    CHECK(piano_proto::compile_song(messages, image) == piano::STATUS_SUCCESS);
+
+    piano_proto::song_reader_t reader;
+    piano_proto::message_t     message;
+    CHECK(reader.open(image.data(), image.size()) == piano::STATUS_SUCCESS);
+    size_t same = 0;
+    for (size_t i = 0; i != messages.size() && !reader.done(); ++i)
+    {
+        uint8_t expected[piano_proto::kMaxFrameSize] = {};
+        uint8_t actual[piano_proto::kMaxFrameSize]   = {};
+        size_t  expected_size = 0;
+        size_t  actual_size   = 0;
+        CHECK(reader.next(&message) == piano::STATUS_SUCCESS);
+        piano_proto::encode_message(messages[i], expected, sizeof(expected), &expected_size);
+        piano_proto::encode_message(message,     actual,   sizeof(actual),   &actual_size);
+        same += (expected_size == actual_size &&
+                 std::memcmp(expected, actual, actual_size) == 0) ? 1 : 0;
+    }
+    CHECK(same == messages.size() && reader.done());
+
+    image[image.size() / 2] ^= 0x10;
+    piano::status_t status = reader.open(image.data(), image.size());
+    while (status == piano::STATUS_SUCCESS && !reader.done())
+    {
+        status = reader.next(&message);
+    }
+    CHECK(status == piano::STATUS_SONG_FORMAT_ERROR);
+
+    image[0] = 'X';
+    CHECK(reader.open(image.data(), image.size()) == piano::STATUS_SONG_FORMAT_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Chunks in any order, duplicates, chunks outside of window, broken and oversized images
+//
+static void
+test_store()
+{
+    std::vector<uint8_t> image(950);
+    for (size_t i = 0; i != image.size(); ++i)
+    {
+        image[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    store_port_t           port;
+    piano_device::device_t device(&port);
+    deliver(&device, begin_message(image), 0);
+    CHECK(port.acks.size() == 1 && port.acks[0].state == piano_proto::UPLOAD_RECEIVING);
+    CHECK(port.acks[0].next == 0 && port.acks[0].window == piano_proto::kUploadWindow);
+
+    // Chunk 2 before 0: mask tells which chunks after the first missing one came
+    deliver(&device, chunk_message(image, 2), 0);
+    CHECK(port.acks.back().next == 0 && port.acks.back().mask == 0x2);
+    deliver(&device, chunk_message(image, 0), 0);
+    CHECK(port.acks.back().next == 1 && port.acks.back().mask == 0x1);
+    deliver(&device, chunk_message(image, 0), 0);
+    CHECK(port.acks.size() == 4 && port.acks.back().next == 1);
+
+    // Last chunk is shorter, chunk of wrong size is dropped
+    piano_proto::message_t wrong = chunk_message(image, 4);
+    wrong.upload_chunk.size = piano_proto::kUploadChunkSize;
+    deliver(&device, wrong, 0);
+    CHECK(port.acks.back().mask == 0x1);
+
+    deliver(&device, chunk_message(image, 4), 0);
+    deliver(&device, chunk_message(image, 1), 0);
+    CHECK(port.acks.back().next == 3 && port.acks.back().mask == 0x1);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_RECEIVING && !device.song().complete());
+    deliver(&device, chunk_message(image, 3), 0);
+    CHECK(port.acks.back().next == 5 && port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+    CHECK(device.song().complete() && device.song().size() == image.size());
+    CHECK(std::memcmp(port.storage.data(), image.data(), image.size()) == 0);
+
+    // The same song is not uploaded again
+    deliver(&device, begin_message(image), 0);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_COMPLETE);
+
+    // Image does not match its CRC, stored song stays
+    piano_proto::message_t broken = begin_message(image);
+    broken.upload_begin.crc32 ^= 1;
+    deliver(&device, broken, 0);
+    CHECK(port.acks.back().next == 0 && port.acks.back().state == piano_proto::UPLOAD_RECEIVING);
+    for (size_t sequence = 0; sequence != 5; ++sequence)
+    {
+        deliver(&device, chunk_message(image, sequence), 0);
+    }
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_CRC_ERROR && device.song().complete());
+    CHECK(device.song().crc32() == begin_message(image).upload_begin.crc32);
+
+    // Chunk beyond window is dropped
+    std::vector<uint8_t> longer(3000);
+    deliver(&device, begin_message(longer), 0);
+    deliver(&device, chunk_message(longer, piano_proto::kUploadWindow), 0);
+    CHECK(port.acks.back().next == 0 && port.acks.back().mask == 0);
+    deliver(&device, chunk_message(longer, piano_proto::kUploadWindow - 1), 0);
+    CHECK(port.acks.back().mask == 1u << (piano_proto::kUploadWindow - 2));
+
+    // Device without storage or too small storage rejects upload
+    std::vector<uint8_t> huge(piano_proto::kMaxSongSize + 1);
+    deliver(&device, begin_message(huge), 0);
+    CHECK(port.acks.back().state == piano_proto::UPLOAD_TOO_LARGE);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Uploaded song played on device clock leaves keys as live messages do
+//
+static void
+test_player(const char *path)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    std::vector<uint8_t>                   image    = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, messages);
+    CHECK(piano_proto::compile_song(messages, image) == piano::STATUS_SUCCESS);
+
+    store_port_t           port;
+    piano_device::device_t device(&port);
+    piano_proto::message_t play;
+    play.type          = piano_proto::MESSAGE_PLAY;
+    play.play.play     = true;
+    play.play.start_us = 1000;
+
+    // Nothing to play before upload
+    deliver(&device, play, 0);
+    CHECK(!device.playing());
+
+    deliver(&device, begin_message(image), 0);
+    for (size_t sequence = 0; sequence * piano_proto::kUploadChunkSize < image.size(); ++sequence)
+    {
+        deliver(&device, chunk_message(image, sequence), 0);
+    }
+    CHECK(device.song().complete());
+    deliver(&device, play, 0);
+    CHECK(device.playing() && device.has_scheduled());
+
+    store_port_t           reference_port;
+    piano_device::device_t reference(&reference_port);
+    size_t                 same = 0;
+    for (size_t i = 0; i != messages.size(); ++i)
+    {
+        deliver(&reference, messages[i], 0);
+        uint64_t time_us = piano_proto::message_time(messages[i]);
+        if (i + 1 != messages.size() && piano_proto::message_time(messages[i + 1]) == time_us)
+        {
+            continue;
+        }
+        CHECK(device.next_time_us() == 1000 + static_cast<int64_t>(time_us));
+        device.update(1000 + static_cast<int64_t>(time_us));
+        same += (std::memcmp(device.keys(), reference.keys(), piano_proto::kKeysNumber) == 0);
+    }
+    CHECK(!device.playing() && same != 0);
+    CHECK(std::memcmp(device.keys(), reference.keys(), piano_proto::kKeysNumber) == 0);
+
+    // Reset stops playback
+    deliver(&device, play, 0);
+    CHECK(device.playing());
+    piano_proto::message_t reset;
+    reset.type = piano_proto::MESSAGE_RESET;
+    deliver(&device, reset, 0);
+    CHECK(!device.playing());
+
+    // Upload of another song, begin repeated included, goes to the free slot and leaves the
+    // playing one alone. It keeps playing after the new one is stored, and stops when the next
+    // upload goes to its slot.
+    std::vector<uint8_t> other = {};
+    messages.pop_back();
+    CHECK(piano_proto::compile_song(messages, other) == piano::STATUS_SUCCESS);
+    deliver(&device, play, 0);
+    deliver(&device, begin_message(other), 0);
+    deliver(&device, begin_message(other), 0);
+    CHECK(device.playing());
+    for (size_t sequence = 0; sequence * piano_proto::kUploadChunkSize < other.size(); ++sequence)
+    {
+        deliver(&device, chunk_message(other, sequence), 0);
+    }
+    CHECK(device.playing() && device.song().size() == other.size());
+    deliver(&device, begin_message(image), 0);
+    CHECK(!device.playing());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// MIDI file played in place, as firmware plays it from flash, leaves keys as live messages do
+//
+static void
+test_file_player(const char *path)
+{
+    std::vector<uint8_t>                   file     = {};
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    CHECK(piano_midi::read_file(path, file) == piano::STATUS_SUCCESS);
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, messages);
+
+    store_port_t           port;
+    piano_device::device_t device(&port);
+    CHECK(device.play_file(file.data(), file.size(), 1000) == piano::STATUS_SUCCESS);
+    CHECK(device.playing_file() && device.has_scheduled());
+
+    store_port_t           reference_port;
+    piano_device::device_t reference(&reference_port);
+    size_t                 same = 0;
+    for (size_t i = 0; i != messages.size(); ++i)
+    {
+        deliver(&reference, messages[i], 0);
+        uint64_t time_us = piano_proto::message_time(messages[i]);
+        if (i + 1 != messages.size() && piano_proto::message_time(messages[i + 1]) == time_us)
+        {
+            continue;
+        }
+        CHECK(device.next_time_us() == 1000 + static_cast<int64_t>(time_us));
+        device.update(1000 + static_cast<int64_t>(time_us));
+        same += (std::memcmp(device.keys(), reference.keys(), piano_proto::kKeysNumber) == 0);
+    }
+    CHECK(!device.playing_file() && !device.has_scheduled() && same != 0);
+    CHECK(std::memcmp(device.keys(), reference.keys(), piano_proto::kKeysNumber) == 0);
+
+    // Reset stops playback, truncated file plays up to the broken event
+    CHECK(device.play_file(file.data(), file.size(), 1000) == piano::STATUS_SUCCESS);
+    piano_proto::message_t reset;
+    reset.type = piano_proto::MESSAGE_RESET;
+    deliver(&device, reset, 0);
+    CHECK(!device.playing_file());
+
+    CHECK(device.play_file(file.data(), file.size() - 1, 1000) == piano::STATUS_SUCCESS);
+    device.update(INT64_MAX);
+    CHECK(!device.playing_file());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Files with more tracks than device keeps are rejected
+//
+static void
+test_file_tracks()
+{
+    static const uint8_t kHeader[] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 0, 0, 96};
+    static const uint8_t kTrack[]  = {'M', 'T', 'r', 'k', 0, 0, 0, 4, 0, 0xff, 0x2f, 0};
+
+    auto make_file = [](uint8_t tracks)
+    {
+        std::vector<uint8_t> file(kHeader, kHeader + sizeof(kHeader));
+        file[11] = tracks;
+        for (uint8_t i = 0; i != tracks; ++i)
+        {
+            file.insert(file.end(), kTrack, kTrack + sizeof(kTrack));
+        }
+        return file;
+    };
+
+    store_port_t           port;
+    piano_device::device_t device(&port);
+    std::vector<uint8_t>   fits   = make_file(piano_device::kMaxSmfTracks);
+    std::vector<uint8_t>   longer = make_file(piano_device::kMaxSmfTracks + 1);
+    CHECK(device.play_file(fits.data(), fits.size(), 0) == piano::STATUS_SUCCESS);
+    CHECK(!device.playing_file());
+    CHECK(device.play_file(longer.data(), longer.size(), 0) ==
+          piano::STATUS_MIDI_HEADER_NTRACKS_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Host reader and reader of firmware see the same songs in bank, damage is found by both
+//
+static void
+test_bank(const std::vector<const char *> &paths)
+{
+    std::vector<piano_proto::bank_song_t> songs = {};
+    for (const char *path : paths)
+    {
+        std::vector<piano_midi::timed_event_t> timeline = {};
+        std::vector<piano_proto::message_t>    messages = {};
+        piano_proto::bank_song_t               song;
+        CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+        piano_proto::make_messages(timeline, messages);
+        CHECK(piano_proto::compile_song(messages, song.image) == piano::STATUS_SUCCESS);
+        song.name        = path;
+        song.duration_ms = static_cast<uint32_t>(
+            piano_proto::message_time(messages.back()) / 1000);
+        songs.push_back(song);
+    }
+
+    std::vector<uint8_t> bank  = {};
+    std::vector<uint8_t> again = {};
+    CHECK(piano_proto::build_song_bank(songs, bank) == piano::STATUS_SUCCESS);
+    CHECK(piano_proto::build_song_bank(songs, again) == piano::STATUS_SUCCESS && again == bank);
+
+    std::vector<piano_proto::bank_song_t> host = {};
+    piano_proto::song_bank_t              device;
+    CHECK(piano_proto::read_song_bank(bank, host) == piano::STATUS_SUCCESS);
+    CHECK(device.open(bank.data(), bank.size()) == piano::STATUS_SUCCESS);
+    CHECK(host.size() == songs.size() && device.count() == songs.size());
+    for (size_t i = 0; i != songs.size() && i != device.count() && i != host.size(); ++i)
+    {
+        const piano_proto::bank_entry_t &entry = device.entry(i);
+        std::string name = songs[i].name.substr(0, piano_proto::kBankNameSize - 1);
+        CHECK(host[i].name == name && std::string(entry.name) == name);
+        CHECK(host[i].image == songs[i].image && entry.size == songs[i].image.size());
+        CHECK(std::memcmp(device.song(i), songs[i].image.data(), entry.size) == 0);
+        CHECK(host[i].duration_ms == songs[i].duration_ms &&
+              entry.duration_ms == songs[i].duration_ms);
+        CHECK(entry.offset % piano_proto::kBankAlign == 0 && device.check(i));
+    }
+
+    // Song of bank is played in place
+    store_port_t           port;
+    piano_device::device_t player(&port);
+    CHECK(player.play_song(device.song(0), device.entry(0).size, 0) == piano::STATUS_SUCCESS);
+    while (player.has_scheduled())
+    {
+        player.update(player.next_time_us());
+    }
+    CHECK(!player.playing());
+
+    // Damaged entry breaks the whole bank, damaged song only itself
+    std::vector<uint8_t> damaged = bank;
+    damaged[sizeof(piano_proto::bank_header_t)] ^= 1;
+    CHECK(piano_proto::read_song_bank(damaged, host) == piano::STATUS_SONG_FORMAT_ERROR);
+    CHECK(device.open(damaged.data(), damaged.size()) == piano::STATUS_SONG_FORMAT_ERROR);
+
+    damaged = bank;
+    damaged.back() ^= 1;
+    CHECK(piano_proto::read_song_bank(damaged, host) == piano::STATUS_SONG_FORMAT_ERROR);
+    CHECK(device.open(damaged.data(), damaged.size()) == piano::STATUS_SUCCESS);
+    CHECK(!device.check(device.count() - 1));
+
+    // Reader of firmware needs bank aligned as mapped flash is
+    std::vector<uint8_t> shifted(bank.size() + piano_proto::kBankAlign);
+    std::memcpy(shifted.data() + 1, bank.data(), bank.size());
+    CHECK(device.open(shifted.data() + 1, bank.size()) == piano::STATUS_SONG_FORMAT_ERROR);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Upload over pty to simulator, damaged bytes are recovered by retransmission
+//
+static void
+test_upload(const char *path,
+            double      error_rate)
+{
+    static const uint32_t kBaudRate = 921600;
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    std::vector<uint8_t>                   image    = {};
+    CHECK(piano_midi::load_timeline(path, timeline) == piano::STATUS_SUCCESS);
+    piano_proto::make_messages(timeline, messages);
+    CHECK(piano_proto::compile_song(messages, image) == piano::STATUS_SUCCESS);
+
+    int         master = -1;
+    std::string slave  = {};
+    CHECK(piano_host::open_pty(&master, &slave) == piano::STATUS_SUCCESS);
+
+    piano_host::simulator_config_t config = {};
+    config.baud_rate  = kBaudRate;
+    config.error_rate = error_rate;
+    piano_host::device_simulator_t simulator(master, config);
+    std::atomic<bool>              stop   = {false};
+    std::thread device_thread([&]() { CHECK(simulator.run(&stop) == piano::STATUS_SUCCESS); });
+
+    int  fd          = -1;
+    bool low_latency = true;
+    CHECK(piano_host::open_serial(slave.c_str(), kBaudRate, &fd, &low_latency) ==
+          piano::STATUS_SUCCESS);
+
+    piano_host::upload_result_t result;
+    CHECK(piano_host::upload_song(fd, kBaudRate, image, {}, &result) == piano::STATUS_SUCCESS);
+
+    // Uploading the same song again sends only begin
+    piano_host::upload_result_t again;
+    CHECK(piano_host::upload_song(fd, kBaudRate, image, {}, &again) == piano::STATUS_SUCCESS);
+    CHECK(again.skipped && again.retransmits == 0);
+
+    stop = true;
+    device_thread.join();
+    close(fd);
+    close(master);
+
+    const piano_device::song_store_t &song = simulator.device().song();
+    CHECK(song.complete() && song.size() == image.size());
+    CHECK(std::memcmp(song.data(), image.data(), image.size()) == 0);
+    CHECK((error_rate == 0.) == (result.retransmits == 0));
+    CHECK(!result.skipped && result.wire_bytes > image.size());
+
+    // Line can not be faster than baud rate
+    CHECK(result.seconds >= static_cast<double>(image.size()) * 10. / kBaudRate);
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    test_store();
+    test_file_tracks();
+    for (int i = 1; i < argc; ++i)
+    {
+        test_image(argv[i]);
+        test_player(argv[i]);
+        test_file_player(argv[i]);
+    }
+    if (argc > 1)
+    {
+        test_bank(std::vector<const char *>(argv + 1, argv + argc));
+        test_upload(argv[1], 0.);
+        test_upload(argv[1], 1e-3);
+    }
+    return CHECK_RESULT();
+}
+
+//================================================================================================//
@@ -0,0 +1,180 @@
+//================================================================================================//
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "song_image.hh"
+#include "song_bank.hh"
+
+//================================================================================================//
+
+//
+// Size of partition "song" of firmware, see esp/partitions.csv
+//
+static const size_t kDefaultMaxSize = 0x80000;
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-f frame_rate] [-m max_size] -o <bank.bin> <file.mid>...\n"
+              << "       " << name << " -l <bank.bin>\n"
+              << "  -f frame_rate  store key frames at this rate instead of note batches\n"
+              << "  -m max_size    size of flash partition (default 524288)\n"
+              << "  -o bank.bin    write bank of songs, the same songs give the same bank\n"
+              << "  -l bank.bin    check bank and list its songs\n";
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Name of song is name of its file without directory and extension
+//
+static std::string
+song_name(const std::string &path)
+{
+    size_t begin = path.find_last_of('/');
+    begin = (begin == std::string::npos) ? 0 : begin + 1;
+    size_t end = path.find_last_of('.');
+    end = (end == std::string::npos || end < begin) ? path.size() : end;
+    return path.substr(begin, end - begin);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static piano::status_t
+compile(const char               *path,
+        uint32_t                  frame_rate,
+        piano_proto::bank_song_t *song)
+{
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    piano_proto::key_encoder_t             encoder;
+    piano::status_t status = piano_midi::load_timeline(path, timeline);
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = (frame_rate == 0)
+               ? piano_proto::make_messages(timeline, messages)
+               : piano_proto::make_key_frame_messages(timeline, 1000000 / frame_rate, encoder,
+                                                      messages);
+    }
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = piano_proto::compile_song(messages, song->image);
+    }
+    song->name = song_name(path);
+    return status;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static int
+list(const char *path)
+{
+    std::vector<uint8_t>                  bank  = {};
+    std::vector<piano_proto::bank_song_t> songs = {};
+    if (piano_midi::read_file(path, bank) != piano::STATUS_SUCCESS ||
+        piano_proto::read_song_bank(bank, songs) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while reading " << path << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << path << ": " << bank.size() << " bytes, " << songs.size() << " songs\n";
+    for (size_t i = 0; i != songs.size(); ++i)
+    {
+        std::cout << "  " << i << ": " << songs[i].name << ", " << songs[i].image.size()
+                  << " bytes, " << songs[i].duration_ms / 1000 << "."
+                  << std::to_string(1000 + songs[i].duration_ms % 1000).substr(1) << " s\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t    frame_rate = 0;
+    size_t      max_size   = kDefaultMaxSize;
+    const char *output     = nullptr;
+    const char *listed     = nullptr;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "f:m:o:l:")) != -1)
+    {
+        switch (option)
+        {
+            case 'f': { frame_rate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'm': { max_size   = std::strtoul(optarg, nullptr, 0);                        break; }
+            case 'o': { output     = optarg;                                                  break; }
+            case 'l': { listed     = optarg;                                                  break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (listed != nullptr)
+    {
+        return list(listed);
+    }
+    if (output == nullptr || optind == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Songs keep order of arguments, device plays the first one
+    std::vector<piano_proto::bank_song_t> songs(static_cast<size_t>(argc - optind));
+    for (int i = optind; i < argc; ++i)
+    {
+        if (compile(argv[i], frame_rate, &songs[static_cast<size_t>(i - optind)]) !=
+            piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error while compiling " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<uint8_t> bank = {};
+    if (piano_proto::build_song_bank(songs, bank) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while building bank\n";
+        return EXIT_FAILURE;
+    }
+    if (bank.size() > max_size)
+    {
+        std::cerr << "Bank of " << bank.size() << " bytes does not fit into " << max_size
+                  << " bytes\n";
+        return EXIT_FAILURE;
+    }
+
+    FILE *file    = std::fopen(output, "wb");
+    bool  written = file != nullptr &&
+                    std::fwrite(bank.data(), 1, bank.size(), file) == bank.size();
+    if (file != nullptr)
+    {
+        written &= std::fclose(file) == 0;
+    }
+    if (!written)
+    {
+        std::cerr << "Error while writing " << output << "\n";
+        return EXIT_FAILURE;
+    }
+    return list(output);
+}
+
+//================================================================================================//
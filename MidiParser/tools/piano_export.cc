@@ -0,0 +1,102 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "pipeline.hh"
+#include "event_export.hh"
+
+//================================================================================================//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-f csv|jsonl|columnar] [-j threads] -o <out> <file.mid>...\n"
+              << "  -f format       CSV with header (default), JSON object per line, or columnar\n"
+              << "                  binary described in MidiParser/lib/event_export.hh\n"
+              << "  -j threads      threads loading and formatting songs (default one per core)\n"
+              << "  -o out          output file, - for stdout\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    piano_host::export_config_t config = {};
+    const char                 *output = nullptr;
+    bool                        valid  = true;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "f:j:o:")) != -1)
+    {
+        switch (option)
+        {
+            case 'f':
+            {
+                valid &= std::strcmp(optarg, "csv") == 0 || std::strcmp(optarg, "jsonl") == 0 ||
+                         std::strcmp(optarg, "columnar") == 0;
+                config.format = (std::strcmp(optarg, "jsonl") == 0)    ? piano_host::EXPORT_JSONL
+                              : (std::strcmp(optarg, "columnar") == 0) ? piano_host::EXPORT_COLUMNAR
+                                                                       : piano_host::EXPORT_CSV;
+                break;
+            }
+            case 'j': { config.threads = std::strtoul(optarg, nullptr, 10); break; }
+            case 'o': { output         = optarg;                            break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (!valid || output == nullptr || optind == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string>     paths(argv + optind, argv + argc);
+    std::vector<piano::status_t> status = {};
+    piano_host::stage_stats_t    format = {};
+    piano_host::stage_stats_t    write  = {};
+    auto                         start  = std::chrono::steady_clock::now();
+    if (piano_host::export_events(paths, config, output, &format, &write, status) !=
+        piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while writing " << output << "\n";
+        return EXIT_FAILURE;
+    }
+    double export_s = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                    start).count();
+
+    // Report goes to stderr, events may be on stdout
+    size_t failed = 0;
+    for (size_t i = 0; i != paths.size(); ++i)
+    {
+        if (status[i] != piano::STATUS_SUCCESS)
+        {
+            std::cerr << "Error " << status[i] << " while loading " << paths[i] << ", skipped\n";
+            ++failed;
+        }
+    }
+    piano_host::print_stage_stats(std::cerr, format);
+    piano_host::print_stage_stats(std::cerr, write);
+    std::cerr << std::fixed << std::setprecision(1) << output << ": " << paths.size() - failed
+              << " of " << paths.size() << " songs, " << static_cast<double>(write.bytes) / 1e6
+              << " MB in " << export_s * 1e3 << " ms, "
+              << static_cast<double>(write.bytes) / 1e6 / std::max(export_s, 1e-9) << " MB/s\n";
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//================================================================================================//
@@ -0,0 +1,96 @@
+//================================================================================================//
+
+#include <cstdlib>
+#include <iostream>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "latency_probe.hh"
+
+//================================================================================================//
+
+//
+// Clock synchronization before probe, same as piano_send
+//
+static const size_t   kSyncExchanges  = 64;
+static const uint64_t kSyncIntervalUs = 20000;
+
+//================================================================================================//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-b baud] [-n samples] [-i interval_us] [-p padding] [-q] <tty>\n"
+              << "  -b baud         baud rate of device (default 115200)\n"
+              << "  -n samples      number of pings (default 1000)\n"
+              << "  -i interval_us  time between pings (default 5000)\n"
+              << "  -p padding      extra bytes in each ping, up to 200\n"
+              << "  -q              do not refresh LEDs on ping\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t                   baud_rate = piano_host::kDefaultBaudRate;
+    piano_host::probe_config_t config    = {};
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "b:n:i:p:q")) != -1)
+    {
+        switch (option)
+        {
+            case 'b': { baud_rate          = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'n': { config.samples     = std::strtoul(optarg, nullptr, 10);                        break; }
+            case 'i': { config.interval_us = std::strtoull(optarg, nullptr, 10);                       break; }
+            case 'p': { config.padding     = static_cast<uint8_t>(std::strtoul(optarg, nullptr, 10));  break; }
+            case 'q': { config.show        = false;                                                    break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (argc - optind != 1 || config.padding > 200)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int  fd          = -1;
+    bool low_latency = false;
+    if (piano_host::open_serial(argv[optind], baud_rate, &fd, &low_latency) != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    if (!low_latency)
+    {
+        std::cerr << "Warning: " << argv[optind] << " does not support low latency mode\n";
+    }
+
+    // One-way latencies need device clock mapped to host clock
+    piano_host::clock_sync_t   sync;
+    piano_host::probe_result_t result;
+    piano::status_t status = piano_host::sync_clock(fd, baud_rate, kSyncExchanges,
+                                                    kSyncIntervalUs, &sync);
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = piano_host::probe_latency(fd, baud_rate, config, &sync, &result);
+    }
+    close(fd);
+
+    if (status != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    result.print(std::cout);
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
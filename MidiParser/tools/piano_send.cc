@@ -0,0 +1,224 @@
+//================================================================================================//
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <termios.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "protocol.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "midi_pipeline.hh"
+
+//================================================================================================//
+
+//
+// Clock synchronization before playback in lookahead mode, then tracking during playback
+//
+static const size_t   kSyncExchanges   = 64;
+static const uint64_t kSyncIntervalUs  = 20000;
+static const uint64_t kTrackIntervalUs = 1000000;
+
+//
+// Keys of 88-key piano are split over devices, keys outside go to the first and the last one
+//
+static const size_t   kMaxDevices      = 16;
+static const uint8_t  kFirstKey        = 21;
+static const uint8_t  kLastKey         = 108;
+
+//================================================================================================//
+
+//
+// Connection to one device, it is reset before and after song. In lookahead mode its clock is
+// estimated before playback, then device is switched to scheduled mode.
+//
+struct device_link_t
+{
+    int                                          fd     = -1;
+    std::unique_ptr<piano_host::serial_sender_t> sender = nullptr;
+    std::unique_ptr<piano_host::clock_tracker_t> clock  = nullptr;
+
+    piano::status_t open(const char *tty, uint32_t baud_rate, uint64_t lookahead)
+    {
+        bool            low_latency = false;
+        piano::status_t status      = piano_host::open_serial(tty, baud_rate, &fd, &low_latency);
+        if (status != piano::STATUS_SUCCESS)
+        {
+            return status;
+        }
+        if (!low_latency)
+        {
+            std::cerr << "Warning: " << tty << " does not support low latency mode\n";
+        }
+        sender = std::make_unique<piano_host::serial_sender_t>(fd);
+        clock  = std::make_unique<piano_host::clock_tracker_t>(fd, baud_rate);
+
+        piano_proto::message_t reset = {};
+        reset.type = piano_proto::MESSAGE_RESET;
+        status = sender->enqueue(reset);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = sender->flush();
+        }
+        if (status != piano::STATUS_SUCCESS || lookahead == 0)
+        {
+            return status;
+        }
+
+        status = clock->synchronize(kSyncExchanges, kSyncIntervalUs);
+        if (status != piano::STATUS_SUCCESS)
+        {
+            return status;
+        }
+        piano_host::clock_sync_t sync = clock->sync();
+        std::cout << tty << ": clock offset " << sync.offset_us() << " us, min round trip "
+                  << sync.min_delay_us() << " us\n";
+
+        piano_proto::message_t schedule = {};
+        schedule.type             = piano_proto::MESSAGE_SCHEDULE;
+        schedule.schedule.enabled = true;
+        status = sender->enqueue(schedule);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = sender->flush();
+        }
+        clock->start(kTrackIntervalUs);
+        return status;
+    }
+
+    piano::status_t close()
+    {
+        if (fd < 0)
+        {
+            return piano::STATUS_SUCCESS;
+        }
+        clock->stop();
+
+        piano_proto::message_t reset = {};
+        reset.type = piano_proto::MESSAGE_RESET;
+        piano::status_t status = sender->enqueue(reset);
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = sender->flush();
+        }
+        tcdrain(fd);
+        ::close(fd);
+        return status;
+    }
+};
+
+//================================================================================================//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-b baud] [-f frame_rate] [-s speed] [-l lookahead_ms]"
+              << " <tty[,tty...]> <file.mid>\n"
+              << "  -b baud          baud rate of device (default 115200)\n"
+              << "  -f frame_rate    send key frames at this rate instead of note batches\n"
+              << "  -s speed         playback speed multiplier (default 1)\n"
+              << "  -l lookahead_ms  synchronize clocks and send events this much ahead,\n"
+              << "                   device plays them on schedule\n"
+              << "  several ttys split keys of the piano into ranges, one for each device\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t baud_rate  = piano_host::kDefaultBaudRate;
+    uint32_t frame_rate = 0;
+    double   speed      = 1.;
+    uint64_t lookahead  = 0;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "b:f:s:l:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b': { baud_rate  = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'f': { frame_rate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 's': { speed      = std::strtod(optarg, nullptr);                            break; }
+            case 'l': { lookahead  = 1000 * std::strtoull(optarg, nullptr, 10);               break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (argc - optind != 2 || speed <= 0.)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Several devices: song is split over them by key
+    std::vector<std::string> ttys  = {};
+    std::stringstream        list(argv[optind]);
+    for (std::string tty; std::getline(list, tty, ',');)
+    {
+        ttys.push_back(tty);
+    }
+    if (ttys.empty() || ttys.size() > kMaxDevices)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<device_link_t>> devices = {};
+    piano::status_t                             status  = piano::STATUS_SUCCESS;
+    for (size_t i = 0; i != ttys.size() && status == piano::STATUS_SUCCESS; ++i)
+    {
+        devices.push_back(std::make_unique<device_link_t>());
+        status = devices.back()->open(ttys[i].c_str(), baud_rate, lookahead);
+    }
+
+    // Song is streamed from file, playback starts before it is read to the end
+    std::vector<piano_host::pipeline_link_t> links = {};
+    for (const auto &device : devices)
+    {
+        links.push_back({device->fd, (lookahead != 0) ? device->clock.get() : nullptr});
+    }
+    piano_host::pipeline_config_t config = {frame_rate, speed};
+    config.lookahead_us = lookahead;
+    piano_host::midi_pipeline_t pipeline(links,
+                                         piano_host::key_shards_t::ranges(links.size(),
+                                                                          kFirstKey, kLastKey),
+                                         config);
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = pipeline.run(argv[optind + 1]);
+    }
+
+    // Reset would drop events which are still queued on device
+    if (status == piano::STATUS_SUCCESS)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(lookahead));
+    }
+
+    // Devices are reset even if song was not sent to the end
+    for (const auto &device : devices)
+    {
+        piano::status_t reset_status = device->close();
+        if (status == piano::STATUS_SUCCESS)
+        {
+            status = reset_status;
+        }
+    }
+
+    pipeline.print_stats(std::cout);
+    return (status == piano::STATUS_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//================================================================================================//
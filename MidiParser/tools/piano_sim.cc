@@ -0,0 +1,131 @@
+//================================================================================================//
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "serial_sender.hh"
+#include "device.hh"
+#include "device_sim.hh"
+
+//================================================================================================//
+
+static std::atomic<bool> gStop = {false};
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+handle_signal(int)
+{
+    gStop = true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-b baud] [-o offset_us] [-d drift_ppm] [-n leds] [-s strips] [-r rate] [-L link]"
+              << " [-l log]\n"
+              << "  -b baud       modelled UART speed, 0 - unlimited (default 115200)\n"
+              << "  -o offset_us  offset of device clock from host clock\n"
+              << "  -d drift_ppm  drift of device clock\n"
+              << "  -n leds       LEDs of strip from A0 (default 88), refreshed as long as WS2812\n"
+              << "  -s strips     LEDs are split among this many strips refreshed at once (default 1)\n"
+              << "  -r rate       most LED frames per second, 0 - every change (default)\n"
+              << "  -L link       create symlink to pty with this path\n"
+              << "  -l log        write LED frames to file instead of stdout\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    piano_host::simulator_config_t config = {};
+    config.baud_rate = piano_host::kDefaultBaudRate;
+
+    const char *link      = nullptr;
+    const char *log_path  = nullptr;
+    size_t      strips    = 1;
+    bool        has_strip = false;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "b:o:d:n:s:r:L:l:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b': { config.baud_rate       = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'o': { config.clock_offset_us = std::strtoll(optarg, nullptr, 10);                        break; }
+            case 'd': { config.clock_drift_ppm = std::strtod(optarg, nullptr);                             break; }
+            case 'n': { config.strip.leds      = std::strtoul(optarg, nullptr, 10); has_strip = true;         break; }
+            case 's': { strips                 = std::strtoul(optarg, nullptr, 10); has_strip = true;         break; }
+            case 'r': { config.led_rate_hz     = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'L': { link                   = optarg;                                                   break; }
+            case 'l': { log_path               = optarg;                                                   break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (argc != optind)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (has_strip)
+    {
+        config.led_refresh_us = piano_device::strip_split_t(config.strip.leds, strips).refresh_us();
+    }
+
+    std::ofstream log_file;
+    if (log_path != nullptr)
+    {
+        log_file.open(log_path);
+        if (!log_file)
+        {
+            std::cerr << "Error while opening " << log_path << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    int         master = -1;
+    std::string slave  = {};
+    if (piano_host::open_pty(&master, &slave) != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    if (link != nullptr && (unlink(link), symlink(slave.c_str(), link)) != 0)
+    {
+        std::cerr << "Error while creating link " << link << " to " << slave << "\n";
+        close(master);
+        return EXIT_FAILURE;
+    }
+    std::cerr << "device on " << ((link != nullptr) ? link : slave.c_str()) << "\n";
+
+    std::signal(SIGINT,  handle_signal);
+    std::signal(SIGTERM, handle_signal);
+
+    piano_host::device_simulator_t simulator(master, config,
+                                             log_file.is_open() ? &log_file : &std::cout);
+    piano::status_t status = simulator.run(&gStop);
+    simulator.print_stats(std::cerr);
+
+    if (link != nullptr)
+    {
+        unlink(link);
+    }
+    close(master);
+    return (status == piano::STATUS_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//================================================================================================//
@@ -0,0 +1,215 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "synth.hh"
+#include "soundfont.hh"
+
+//================================================================================================//
+
+//
+// Audio thread runs kLookaheadUs behind player thread, more than a block, so that notes land on
+// their sample
+//
+static const int64_t kLookaheadUs = 50000;
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-r sample_rate] [-j threads] [-f font.sf2] (-o <out.wav> | -l) <file.mid>\n"
+              << "  -r sample_rate  samples per second (default 44100)\n"
+              << "  -j threads      threads rendering slices of song (default one per core)\n"
+              << "  -f font.sf2     piano of SoundFont instead of additive voices, with -o only\n"
+              << "  -o out.wav      16-bit mono WAV preview of song\n"
+              << "  -l              play in real time as raw S16_LE PCM on stdout, e.g. into\n"
+              << "                  aplay -f S16_LE -r 44100\n";
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Audio thread renders blocks as their time comes, main thread is the player
+//
+static int
+play_live(const std::vector<piano_midi::timed_event_t> &timeline,
+          uint32_t                                      sample_rate)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    piano_audio::raw_pcm_sink_t sink(STDOUT_FILENO);
+    piano_audio::synth_engine_t engine(sample_rate, &sink);
+    std::atomic<bool>           stop     = {false};
+    std::atomic<bool>           failed   = {false};
+    auto                        start    = clock_t::now();
+    double                      block_us = 1e6 * piano_audio::kEngineBlock / sample_rate;
+    auto at = [start](double time_us)
+    {
+        return start + std::chrono::duration_cast<clock_t::duration>(
+                           std::chrono::duration<double, std::micro>(time_us));
+    };
+
+    std::thread audio([&]()
+    {
+        for (size_t block = 0; !stop && !failed; ++block)
+        {
+            std::this_thread::sleep_until(at(kLookaheadUs + static_cast<double>(block) * block_us));
+            failed = engine.render_block() != piano::STATUS_SUCCESS;
+        }
+    });
+
+    // Keys still held at the end of song are released by its last event, as offline
+    bool    held[128] = {};
+    int64_t last      = 0;
+    for (const piano_midi::timed_event_t &event : timeline)
+    {
+        bool press = event.event == piano::EVENT_NOTE_ON && event.velocity != 0;
+        bool lift  = event.event == piano::EVENT_NOTE_OFF ||
+                     (event.event == piano::EVENT_NOTE_ON && event.velocity == 0);
+        last = static_cast<int64_t>(std::llround(event.time_us * 1e-6 * sample_rate));
+        if ((!press && !lift) || event.note >= 128)
+        {
+            continue;
+        }
+
+        std::this_thread::sleep_until(at(static_cast<double>(event.time_us)));
+        piano_audio::synth_command_t command;
+        command.sample   = last;
+        command.note     = event.note;
+        command.velocity = press ? event.velocity : 0;
+        while (!engine.command(command) && !failed)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        held[event.note] = press;
+    }
+    for (uint8_t note = 0; note != 128; ++note)
+    {
+        piano_audio::synth_command_t command;
+        command.sample = last;
+        command.note   = note;
+        while (held[note] && !engine.command(command) && !failed)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // Song ends when the last voice falls silent
+    while (!failed && (engine.rendered() <= last || engine.voices() != 0))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    stop = true;
+    audio.join();
+
+    piano::task_counters_t stats = engine.block_stats();
+    std::cerr << std::fixed << std::setprecision(1) << stats.runs << " blocks of "
+              << piano_audio::kEngineBlock << " samples, render time mean "
+              << static_cast<double>(stats.busy_us) / std::max<uint32_t>(stats.runs, 1)
+              << " us, worst " << stats.busy_max_us << " us of " << block_us << " us budget, "
+              << engine.stolen() << " voices taken over\n";
+    if (failed)
+    {
+        std::cerr << "Error while writing samples\n";
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    piano_audio::synth_config_t config = {};
+    const char                 *output = nullptr;
+    const char                 *font   = nullptr;
+    bool                        live   = false;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "r:j:f:o:l")) != -1)
+    {
+        switch (option)
+        {
+            case 'r': { config.sample_rate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'j': { config.threads     = std::strtoul(optarg, nullptr, 10);                        break; }
+            case 'f': { font               = optarg;                                                   break; }
+            case 'o': { output             = optarg;                                                   break; }
+            case 'l': { live               = true;                                                     break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if ((output == nullptr) == !live || (live && font != nullptr) || argc - optind != 1 ||
+        config.sample_rate == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(argv[optind], timeline) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while loading " << argv[optind] << "\n";
+        return EXIT_FAILURE;
+    }
+    if (live)
+    {
+        return play_live(timeline, config.sample_rate);
+    }
+
+    // Sampled piano is rendered on one thread, its voices have no state to start slices from
+    piano_audio::soundfont_t soundfont;
+    if (font != nullptr && soundfont.open(font) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while opening " << font << "\n";
+        return EXIT_FAILURE;
+    }
+    if (font != nullptr && soundfont.piano_preset() == nullptr)
+    {
+        std::cerr << font << " has no piano preset\n";
+        return EXIT_FAILURE;
+    }
+
+    auto               start   = std::chrono::steady_clock::now();
+    std::vector<float> samples = {};
+    if (font != nullptr)
+    {
+        piano_audio::render_song(timeline, soundfont, *soundfont.piano_preset(),
+                                 config.sample_rate, samples);
+    } else
+    {
+        piano_audio::render_song(timeline, config, samples);
+    }
+    double render_s = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                    start).count();
+
+    if (piano_audio::write_wav(output, samples, config.sample_rate) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while writing " << output << "\n";
+        return EXIT_FAILURE;
+    }
+
+    double song_s = static_cast<double>(samples.size()) / config.sample_rate;
+    std::cout << std::fixed << std::setprecision(1) << output << ": " << song_s << " s rendered in "
+              << render_s << " s, " << song_s / std::max(render_s, 1e-9) << "x real time\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
@@ -0,0 +1,111 @@
+//================================================================================================//
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "serial_sender.hh"
+#include "clock_sync.hh"
+#include "telemetry.hh"
+
+//================================================================================================//
+
+static std::atomic<bool> gStop = {false};
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+handle_signal(int)
+{
+    gStop = true;
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name << " [-b baud] [-p period_ms] [-n reports] <tty>\n"
+              << "  -b baud       baud rate of device (default 115200)\n"
+              << "  -p period_ms  time between reports (default 1000)\n"
+              << "  -n reports    stop after this many lines, 0 - until interrupted (default)\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t baud_rate = piano_host::kDefaultBaudRate;
+    uint64_t period_ms = 1000;
+    size_t   lines     = 0;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "b:p:n:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b': { baud_rate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'p': { period_ms = std::strtoull(optarg, nullptr, 10);                       break; }
+            case 'n': { lines     = std::strtoul(optarg, nullptr, 10);                        break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (argc - optind != 1 || period_ms == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int  fd          = -1;
+    bool low_latency = false;
+    if (piano_host::open_serial(argv[optind], baud_rate, &fd, &low_latency) != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGINT,  handle_signal);
+    std::signal(SIGTERM, handle_signal);
+
+    // Device which stops reporting for several periods is treated as gone
+    piano_host::telemetry_reader_t reader(fd);
+    piano_host::telemetry_view_t   view;
+    piano_proto::telemetry_t       report = {};
+    int64_t         timeout_us = static_cast<int64_t>(4 * period_ms * 1000);
+    piano::status_t status     = reader.request(period_ms * 1000);
+    size_t          printed    = 0;
+    while (status == piano::STATUS_SUCCESS && !gStop && (lines == 0 || printed != lines))
+    {
+        status = reader.next(piano_host::host_time_us() + timeout_us, &report);
+        if (status == piano::STATUS_SYNC_TIMEOUT && gStop)
+        {
+            status = piano::STATUS_SUCCESS;
+        } else if (status == piano::STATUS_SUCCESS && view.add(report))
+        {
+            std::cout << report.device_us / 1000000 << "." << report.device_us / 100000 % 10
+                      << "s  ";
+            view.print(std::cout);
+            std::cout.flush();
+            ++printed;
+        }
+    }
+    if (status == piano::STATUS_SYNC_TIMEOUT)
+    {
+        std::cerr << "Device does not send reports\n";
+    }
+
+    // Device keeps reporting until asked to stop
+    reader.request(0);
+    close(fd);
+    return (status == piano::STATUS_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//================================================================================================//
@@ -0,0 +1,121 @@
+//================================================================================================//
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "protocol.hh"
+#include "key_codec.hh"
+#include "serial_sender.hh"
+#include "song_image.hh"
+#include "song_delta.hh"
+#include "song_upload.hh"
+
+//================================================================================================//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-b baud] [-f frame_rate] [-s signature] [-p] <tty> <file.mid>\n"
+              << "  -b baud        baud rate of device (default 115200)\n"
+              << "  -f frame_rate  store key frames at this rate instead of note batches\n"
+              << "  -s signature   signature of the song on device: only changes against it are\n"
+              << "                 sent, then it is replaced with signature of this song\n"
+              << "  -p             play song on device after upload\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t baud_rate  = piano_host::kDefaultBaudRate;
+    uint32_t frame_rate = 0;
+    bool     play       = false;
+    char    *signature  = nullptr;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "b:f:s:p")) != -1)
+    {
+        switch (option)
+        {
+            case 'b': { baud_rate  = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'f': { frame_rate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 's': { signature  = optarg;                                                  break; }
+            case 'p': { play       = true;                                                    break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Song is compiled on host, device only stores and plays records
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    std::vector<piano_proto::message_t>    messages = {};
+    std::vector<uint8_t>                   image    = {};
+    piano_proto::key_encoder_t             encoder;
+    piano::status_t status = piano_midi::load_timeline(argv[optind + 1], timeline);
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = (frame_rate == 0)
+               ? piano_proto::make_messages(timeline, messages)
+               : piano_proto::make_key_frame_messages(timeline, 1000000 / frame_rate, encoder,
+                                                      messages);
+    }
+    if (status == piano::STATUS_SUCCESS)
+    {
+        status = piano_proto::compile_song(messages, image);
+    }
+    if (status != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while compiling " << argv[optind + 1] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    int  fd          = -1;
+    bool low_latency = false;
+    if (piano_host::open_serial(argv[optind], baud_rate, &fd, &low_latency) != piano::STATUS_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Song sent last time is the base of patch, whole song goes if signature is missing or broken
+    piano_host::song_signature_t base;
+    bool has_base = signature != nullptr && access(signature, F_OK) == 0 &&
+                    piano_host::load_signature(signature, &base) == piano::STATUS_SUCCESS;
+
+    piano_host::upload_result_t result;
+    status = piano_host::upload_song(fd, baud_rate, image, {}, &result, has_base ? &base : nullptr);
+    if (status == piano::STATUS_SUCCESS && signature != nullptr)
+    {
+        piano_host::make_signature(image, piano_host::kDeltaBlockSize, &base);
+        status = piano_host::save_signature(signature, base);
+    }
+    if (status == piano::STATUS_SUCCESS && play)
+    {
+        status = piano_host::play_song(fd, true);
+    }
+    close(fd);
+
+    if (status != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while uploading song: " << status << "\n";
+        return EXIT_FAILURE;
+    }
+    result.print(std::cout, baud_rate);
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
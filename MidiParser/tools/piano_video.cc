@@ -0,0 +1,99 @@
+//================================================================================================//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------//
+
+#include <unistd.h>
+
+//------------------------------------------------------------------------------------------------//
+
+#include "piano.hh"
+#include "midi_file.hh"
+#include "timeline.hh"
+#include "pipeline.hh"
+#include "piano_roll.hh"
+
+//================================================================================================//
+
+static void
+usage(const char *name)
+{
+    std::cerr << name << ": usage: " << name
+              << " [-s WxH] [-f fps] [-w window_s] [-j threads] [-p] -o <out> <file.mid>\n"
+              << "  -s WxH          frame size (default 1920x1080)\n"
+              << "  -f fps          frames per second (default 60)\n"
+              << "  -w window_s     seconds of notes above keyboard (default 3)\n"
+              << "  -j threads      threads rendering frames (default one per core)\n"
+              << "  -p              PPM file per frame named <out>NNNNNN.ppm instead of Y4M\n"
+              << "  -o out          Y4M video, - for stdout, e.g. into\n"
+              << "                  ffmpeg -i - -c:v libx264 song.mp4\n";
+}
+
+//================================================================================================//
+
+int
+main(int argc, char *argv[])
+{
+    piano_host::roll_config_t config = {};
+    const char               *output = nullptr;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "s:f:w:j:po:")) != -1)
+    {
+        switch (option)
+        {
+            case 's': { std::sscanf(optarg, "%ux%u", &config.width, &config.height);             break; }
+            case 'f': { config.fps      = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break; }
+            case 'w': { config.window_s = std::strtod(optarg, nullptr);                             break; }
+            case 'j': { config.threads  = std::strtoul(optarg, nullptr, 10);                        break; }
+            case 'p': { config.format   = piano_host::VIDEO_PPM;                                    break; }
+            case 'o': { output          = optarg;                                                   break; }
+            default:  { usage(argv[0]); return EXIT_FAILURE; }
+        }
+    }
+    if (output == nullptr || argc - optind != 1 || config.width < 2 || config.height < 2 ||
+        config.fps == 0 || !(config.window_s > 0.))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<piano_midi::timed_event_t> timeline = {};
+    if (piano_midi::load_timeline(argv[optind], timeline) != piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while loading " << argv[optind] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    piano_host::stage_stats_t render = {};
+    piano_host::stage_stats_t write  = {};
+    auto                      start  = std::chrono::steady_clock::now();
+    if (piano_host::export_roll(timeline, config, output, &render, &write) !=
+        piano::STATUS_SUCCESS)
+    {
+        std::cerr << "Error while writing " << output << "\n";
+        return EXIT_FAILURE;
+    }
+    double export_s = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                    start).count();
+
+    // Report goes to stderr, video may be on stdout
+    double frames = static_cast<double>(write.items);
+    double song_s = frames / config.fps;
+    piano_host::print_stage_stats(std::cerr, render);
+    piano_host::print_stage_stats(std::cerr, write);
+    std::cerr << std::fixed << std::setprecision(1) << output << ": " << write.items
+              << " frames, " << song_s << " s of video in " << export_s << " s, "
+              << frames / std::max(export_s, 1e-9) << " fps, "
+              << song_s / std::max(export_s, 1e-9) << "x real time\n";
+    return EXIT_SUCCESS;
+}
+
+//================================================================================================//
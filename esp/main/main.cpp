@@ -3,76 +3,424 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <algorithm>
 #include <portmacro.h>
 
 //------------------------------------------------------------------------------------------------//
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
+#include "driver/rmt_tx.h"
+#include "driver/rmt_encoder.h"
 #include "sdkconfig.h"
-#include "led_strip.h"
-#include "led_strip_types.h"
-#include "led_strip_rmt.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_partition.h"
+
+//------------------------------------------------------------------------------------------------//
+
+#include "protocol.hh"
+#include "device.hh"
+#include "led_render.hh"
+#include "led_pacer.hh"
+#include "task_stats.hh"
+#include "schedule_alarm.hh"
+#include "song_bank.hh"
 
 //================================================================================================//
 
-static const size_t kRxBufferSize = 1024;
+static const size_t   kRxBufferSize     = 1024;
+static const uint32_t kBaudRate         = 115200;
 
-void uart_init(void);
-void receive_task(void *arg);
+//
+// UART driver reports data after this many symbols of silence on the line, or when its FIFO
+// holds kRxFullThreshold bytes. Events wait in queue of kUartQueueSize.
+//
+static const uint8_t  kRxTimeoutSymbols = 2;
+static const int      kRxFullThreshold  = 64;
+static const int      kUartQueueSize    = 32;
+static const int64_t  kByteUs           = 10 * 1000000 / kBaudRate;
 
-//================================================================================================//
+//
+// Parser task sleeps on a set of UART queue and of semaphore which esp_timer gives when the
+// next scheduled message is due, room for every event of both
+//
+static const int      kWakeSetSize      = kUartQueueSize + 1;
 
-extern "C" void
-app_main(void)
+//
+// Bank of songs made by piano_bank, or a single MIDI file, written to partition "song" (see
+// partitions.csv) is played kSongDelayUs after start: the first song of bank, or the file.
+// Partition is mapped into address space and read in place through flash cache, so it takes no
+// RAM whatever its size.
+//
+static const char   *kSongPartition = "song";
+static const int64_t kSongDelayUs   = 1000000;
+
+//
+// Reception and decoding run on one core, LED pacing and RMT output on the other, so that
+// neither waits for the other's CPU. They share only led_pacer_t, which is lock-free.
+//
+static const BaseType_t kParserCore = 0;
+static const BaseType_t kLedCore    = 1;
+
+//
+// LED per key from A0, keys split into ranges among strips on GPIOs of kStripGpios, each on its
+// own RMT channel (see strip_split_t). Strips start together, so refresh takes as long as the
+// longest of them: about 3 ms for 88 LEDs on one strip, 1 ms on four, see strip_refresh_us.
+//
+static const int      kStripGpios[]    = {48, 47, 21, 14};
+static const size_t   kStrips          = sizeof(kStripGpios) / sizeof(kStripGpios[0]);
+static const size_t   kStripLeds       = piano_device::kPianoLeds;
+
+//
+// Only one RMT TX channel of ESP32-S3 has DMA, the first strip takes it: it is fed from blocks of
+// kRmtDmaSymbols (one per bit) without an interrupt per 48 bits. The others refill their
+// kRmtBlockSymbols of RMT memory from interrupt, which is short while CPU is free.
+//
+static const size_t   kRmtDmaSymbols   = 1024;
+static const size_t   kRmtBlockSymbols = 48;
+
+//
+// Pixel of each key and part of frame of each strip, generated at compile time
+//
+static constexpr piano_device::pixel_map_t kStripPixels =
+    piano_device::pixel_map_t({kStripLeds, piano_device::kPianoFirstNote});
+static constexpr piano_device::strip_split_t kStripSplit =
+    piano_device::strip_split_t(kStripLeds, kStrips);
+
+static_assert(kStrips <= piano_device::kMaxStrips && kStripSplit.count == kStrips,
+              "every strip has RMT channel and LEDs");
+
+//
+// WS2812 bits in ticks of 0.1 us: 0 is 0.3 us high and 0.9 us low, 1 the other way round
+//
+static const uint32_t kRmtResolutionHz = 10 * 1000 * 1000;
+static const uint16_t kShortTicks      = 3;
+static const uint16_t kLongTicks       = 9;
+
+//
+// Rate of LED frames, notes within one period are shown by one refresh
+//
+static const uint32_t kLedRateHz       = piano_device::kLedRateHz;
+
+//
+// Refreshes timed at start
+//
+static const int      kRefreshProbes   = 16;
+static const char    *kTag             = "piano";
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// WS2812 strips on RMT channels. Bytes encoder of each channel turns each bit of its part of GRB
+// frame into one symbol, so frame goes to the wire in place as renderer wrote it. Sync manager
+// holds transmissions back until all channels have theirs, then starts them at once.
+//
+class strip_t
 {
-    // Strip common config info
-    led_strip_config_t strip_config =
-    {
-        .strip_gpio_num         = 48,
-        .max_leds               = 1,
-        .led_model              = LED_MODEL_WS2812,
-        .color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB,
-        .flags                  =
-        {
-            .invert_out = false,
-        }
-    };
+  public:
+    void init();
+
+    //
+    // Sends frame and waits until it is on the wire. Strips latch colours after kLedResetUs of
+    // low line, the next frame waits for that.
+    //
+    void write(const piano_device::led_frame_t &frame);
+
+  private:
+    rmt_channel_handle_t      channels_[kStrips] = {};
+    rmt_encoder_handle_t      encoders_[kStrips] = {};
+    rmt_sync_manager_handle_t sync_              = NULL;
+    int64_t                   ready_us_          = 0;
+};
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Load of parser task: time spent on each wake up, latency from the first byte of a chunk until
+// it is decoded. Read by other tasks without locks.
+//
+static piano::task_stats_t parser_load;
+
+//
+// Receiving side counters, written and read by parser task only
+//
+static uint32_t uart_overruns = 0;
+static uint32_t rx_queue_high = 0;
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// ESP32 platform of portable device logic: esp_timer clock, UART0 and RMT LED strip. Frames go
+// to LED task through led_pacer_t, so that strip refresh never holds up reception.
+//
+class esp_port_t : public piano_device::device_port_t
+{
+  public:
+    explicit esp_port_t(strip_t *strip) : strip_(strip), pacer_(kLedRateHz) {}
+
+    void set_led_task(TaskHandle_t led_task) { led_task_ = led_task; }
+
+    int64_t now_us() override
+    {
+        return esp_timer_get_time();
+    }
+
+    void send(const uint8_t *data, size_t size) override
+    {
+        uart_write_bytes(UART_NUM_0, data, size);
+    }
 
-    // RMT backend specific config info
-    led_strip_rmt_config_t rmt_config =
+    void show(const piano_device::led_frame_t &frame) override
     {
-        .clk_src           = RMT_CLK_SRC_DEFAULT,
-        .resolution_hz     = 10 * 1000 * 1000,
-        .mem_block_symbols = 64,
-        .flags             =
+        pacer_.publish(frame, esp_timer_get_time());
+        xTaskNotifyGive(led_task_);
+    }
+
+    uint8_t *song_storage(size_t *capacity) override
+    {
+        static uint8_t storage[piano_device::kSongStorageSize];
+        *capacity = sizeof(storage);
+        return storage;
+    }
+
+    //
+    // Called by parser task, LED task counters are atomics of pacer and leds_load_
+    //
+    void telemetry(piano_proto::telemetry_t *report) override
+    {
+        piano::task_counters_t strip  = leds_load_.snapshot();
+        piano::task_counters_t parser = parser_load.snapshot();
+        report->uart_overruns  = uart_overruns;
+        report->rx_queue_high  = rx_queue_high;
+        report->frames_shown   = strip.runs;
+        report->frames_dropped = pacer_.replaced() + pacer_.unchanged();
+        report->strip_busy_us  = strip.busy_us;
+        report->strip_max_us   = strip.busy_max_us;
+        report->parser_busy_us = parser.busy_us;
+        report->parser_max_us  = parser.busy_max_us;
+    }
+
+    //
+    // Called by LED task: refresh strip with the latest frame if it is time to. Returns time
+    // until the next call, -1 - until the next frame. Latency of a frame is time from its
+    // publishing until its refresh starts.
+    //
+    int64_t refresh()
+    {
+        int64_t wait_us = -1;
+        int64_t now_us  = esp_timer_get_time();
+        while (pacer_.poll(now_us, &wait_us))
         {
-            .with_dma = false,
+            leds_load_.add_latency(now_us - pacer_.published_us());
+            strip_->write(pacer_.frame());
+            int64_t done_us = esp_timer_get_time();
+            leds_load_.add_run(done_us - now_us);
+            now_us = done_us;
         }
-    };
+        return wait_us;
+    }
+
+    const piano_device::led_pacer_t &pacer()     const { return pacer_;     }
+    const piano::task_stats_t       &leds_load() const { return leds_load_; }
 
-    // Creating led strip handler
-    led_strip_handle_t led_strip = NULL;
-    ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip));
-    led_strip_clear(led_strip);
+  private:
+    strip_t                   *strip_    = NULL;
+    TaskHandle_t               led_task_ = NULL;
+    piano_device::led_pacer_t  pacer_;
+    piano::task_stats_t        leds_load_;
+};
 
-    // Initializing UART
-    uart_init();
+//------------------------------------------------------------------------------------------------//
 
-    // Creating task to receive data from UART
-    xTaskCreate(receive_task, "uart_rx_task", 2048, &led_strip, 5, NULL);
+void measure_refresh(strip_t *strip);
+void play_song_partition(piano_device::device_t *device);
+void uart_init(QueueHandle_t *uart_queue, QueueSetHandle_t *wake_set);
+void parser_task(void *arg);
+void led_task(void *arg);
+
+//================================================================================================//
+
+extern "C" void
+app_main(void)
+{
+    // Strip is dark until the first frame
+    static strip_t strip;
+    strip.init();
+    measure_refresh(&strip);
+
+    // Initializing UART, its driver posts events to uart_queue, parser waits on wake_set
+    static QueueHandle_t    uart_queue = NULL;
+    static QueueSetHandle_t wake_set   = NULL;
+    uart_init(&uart_queue, &wake_set);
+
+    // Port and device are too large for task stack. Tasks are pinned to cores of their own,
+    // parser still has higher priority, so that it takes bytes as soon as they come.
+    static esp_port_t             port(&strip);
+    static piano_device::device_t device(&port, kStripPixels);
+    static void                  *parser_args[] = {&device, &uart_queue, &wake_set};
+    TaskHandle_t                  leds          = NULL;
+    play_song_partition(&device);
+    xTaskCreatePinnedToCore(led_task, "led_task", 4096, &port, 4, &leds, kLedCore);
+    port.set_led_task(leds);
+    xTaskCreatePinnedToCore(parser_task, "uart_parser_task", 4096, parser_args, 6, NULL,
+                            kParserCore);
 }
 
 //================================================================================================//
 
 void
-uart_init(void)
+strip_t::init()
+{
+    rmt_bytes_encoder_config_t bits = {};
+    bits.bit0.level0     = 1;
+    bits.bit0.duration0  = kShortTicks;
+    bits.bit0.level1     = 0;
+    bits.bit0.duration1  = kLongTicks;
+    bits.bit1.level0     = 1;
+    bits.bit1.duration0  = kLongTicks;
+    bits.bit1.level1     = 0;
+    bits.bit1.duration1  = kShortTicks;
+    bits.flags.msb_first = 1;
+
+    // Channels are enabled before sync manager takes them
+    for (size_t i = 0; i != kStrips; ++i)
+    {
+        rmt_tx_channel_config_t channel = {};
+        channel.gpio_num          = static_cast<gpio_num_t>(kStripGpios[i]);
+        channel.clk_src           = RMT_CLK_SRC_DEFAULT;
+        channel.resolution_hz     = kRmtResolutionHz;
+        channel.mem_block_symbols = (i == 0) ? kRmtDmaSymbols : kRmtBlockSymbols;
+        channel.trans_queue_depth = 1;
+        channel.flags.with_dma    = (i == 0);
+        ESP_ERROR_CHECK(rmt_new_tx_channel(&channel, &channels_[i]));
+        ESP_ERROR_CHECK(rmt_new_bytes_encoder(&bits, &encoders_[i]));
+        ESP_ERROR_CHECK(rmt_enable(channels_[i]));
+    }
+    if (kStrips > 1)
+    {
+        const rmt_sync_manager_config_t sync = {channels_, kStrips};
+        ESP_ERROR_CHECK(rmt_new_sync_manager(&sync, &sync_));
+    }
+
+    write(piano_device::led_renderer_t(kStripPixels).frame());
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+strip_t::write(const piano_device::led_frame_t &frame)
+{
+    // Reset pulse is shorter than a tick, a busy wait is cheaper than anything else
+    int64_t now_us = esp_timer_get_time();
+    if (now_us < ready_us_)
+    {
+        esp_rom_delay_us(static_cast<uint32_t>(ready_us_ - now_us));
+    }
+
+    // Lines stay low after the last bit. Strips start when the last of them gets its part, every
+    // part has LEDs as frames of kStripPixels cover all of them.
+    const rmt_transmit_config_t transmit = {};
+    for (size_t i = 0; i != kStrips; ++i)
+    {
+        rmt_transmit(channels_[i], encoders_[i], kStripSplit.data(frame, i),
+                     kStripSplit.size(frame, i), &transmit);
+    }
+    for (size_t i = 0; i != kStrips; ++i)
+    {
+        rmt_tx_wait_all_done(channels_[i], -1);
+    }
+    ready_us_ = esp_timer_get_time() + piano_device::kLedResetUs;
+
+    // Sync manager starts channels once, it is armed again for the next frame
+    if (sync_ != NULL)
+    {
+        rmt_sync_reset(sync_);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Logs time of strip refresh before UART is taken by protocol. It is the shortest period of LED
+// frames, frames coming faster replace each other in LED task.
+//
+void
+measure_refresh(strip_t *strip)
+{
+    piano_device::led_renderer_t dark(kStripPixels);
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i != kRefreshProbes; ++i)
+    {
+        strip->write(dark.frame());
+    }
+    int64_t refresh_us = (esp_timer_get_time() - start_us) / kRefreshProbes;
+    ESP_LOGI(kTag, "%u LEDs on %u strips: refresh %lld us (%lld expected), up to %lld frames/s",
+             static_cast<unsigned>(kStripLeds), static_cast<unsigned>(kStrips),
+             static_cast<long long>(refresh_us),
+             static_cast<long long>(kStripSplit.refresh_us()),
+             static_cast<long long>(1000000 / std::max<int64_t>(refresh_us, 1)));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+play_song_partition(piano_device::device_t *device)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY,
+                                                                kSongPartition);
+    if (partition == NULL)
+    {
+        return;
+    }
+
+    // Mapping is kept for the whole run, player reads file from it
+    const void                 *data   = NULL;
+    esp_partition_mmap_handle_t handle = 0;
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data,
+                           &handle) != ESP_OK)
+    {
+        ESP_LOGI(kTag, "song partition: can't be mapped");
+        return;
+    }
+
+    const uint8_t           *song     = static_cast<const uint8_t *>(data);
+    int64_t                  start_us = esp_timer_get_time();
+    piano_proto::song_bank_t bank;
+    piano::status_t          status   = piano::STATUS_SONG_FORMAT_ERROR;
+    if (bank.open(song, partition->size) == piano::STATUS_SUCCESS)
+    {
+        if (bank.count() != 0 && bank.check(0))
+        {
+            status = device->play_song(bank.song(0), bank.entry(0).size, start_us + kSongDelayUs);
+        }
+        ESP_LOGI(kTag, "song partition: bank of %u songs, %s", static_cast<unsigned>(bank.count()),
+                 (status == piano::STATUS_SUCCESS) ? bank.entry(0).name : "nothing to play");
+        return;
+    }
+
+    status = device->play_file(song, partition->size, start_us + kSongDelayUs);
+    ESP_LOGI(kTag, "song partition: %s, started in %lld us",
+             (status == piano::STATUS_SUCCESS) ? "playing MIDI file" : "empty",
+             static_cast<long long>(esp_timer_get_time() - start_us));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+void
+uart_init(QueueHandle_t    *uart_queue,
+          QueueSetHandle_t *wake_set)
 {
     const uart_config_t uart_config =
     {
-        .baud_rate  = 115200,
+        .baud_rate  = kBaudRate,
         .data_bits  = UART_DATA_8_BITS,
         .parity     = UART_PARITY_DISABLE,
         .stop_bits  = UART_STOP_BITS_1,
@@ -86,62 +434,175 @@ uart_init(void)
                  UART_PIN_NO_CHANGE,
                  UART_PIN_NO_CHANGE,
                  UART_PIN_NO_CHANGE);
-    uart_driver_install(UART_NUM_0, kRxBufferSize * 2, 0, 0, NULL, 0);
+    uart_driver_install(UART_NUM_0, kRxBufferSize * 2, 0, kUartQueueSize, uart_queue, 0);
+    uart_set_rx_timeout(UART_NUM_0, kRxTimeoutSymbols);
+    uart_set_rx_full_threshold(UART_NUM_0, kRxFullThreshold);
+
+    // Queue may join the set only while empty, so anything the driver got since install is
+    // dropped
+    *wake_set = xQueueCreateSet(kWakeSetSize);
+    uart_flush_input(UART_NUM_0);
+    xQueueReset(*uart_queue);
+    ESP_ERROR_CHECK(xQueueAddToSet(*uart_queue, *wake_set) == pdPASS ? ESP_OK : ESP_FAIL);
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Give of semaphore which is already given fails, but then a wake is pending anyway
+//
+static void
+wake_parser_task(void *arg)
+{
+    xSemaphoreGive(static_cast<SemaphoreHandle_t>(arg));
 }
 
 //------------------------------------------------------------------------------------------------//
 
+//
+// Sleeps on set of UART event queue and schedule semaphore, wakes up for data and for scheduled
+// messages. One-shot esp_timer gives the semaphore when the next message is due, so it is
+// played within tens of microseconds of its time rather than on the next tick. Timer never
+// posts to queue of UART driver, so it can't crowd out driver events or be dropped when the
+// queue is full. Never touches the strip, so bytes are taken while LED task refreshes it.
+//
 void
-receive_task(void *arg)
+parser_task(void *arg)
 {
-    led_strip_handle_t led_strip = *(led_strip_handle_t *)arg;
+    void                  **args       = static_cast<void **>(arg);
+    piano_device::device_t *device     = static_cast<piano_device::device_t *>(args[0]);
+    QueueHandle_t           uart_queue = *static_cast<QueueHandle_t *>(args[1]);
+    QueueSetHandle_t        wake_set   = *static_cast<QueueSetHandle_t *>(args[2]);
 
-    struct res_t
-    {
-        char     symbol;
-        uint32_t red;
-        uint32_t green;
-        uint32_t blue;
-    };
+    // Semaphore is empty when created, so it may join the set
+    SemaphoreHandle_t schedule_wake = xSemaphoreCreateBinary();
+    ESP_ERROR_CHECK(xQueueAddToSet(schedule_wake, wake_set) == pdPASS ? ESP_OK : ESP_FAIL);
 
-    res_t res[] =
+    esp_timer_handle_t             timer = NULL;
+    piano_device::schedule_alarm_t alarm;
+    const esp_timer_create_args_t  timer_args =
     {
-        {'r', 255,   0,   0},
-        {'g',   0, 255,   0},
-        {'b',   0,   0, 255},
+        .callback              = wake_parser_task,
+        .arg                   = schedule_wake,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "schedule",
+        .skip_unhandled_events = true,
     };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
 
-    uint8_t data[kRxBufferSize] = {};
+    // The first pass arms timer for song from flash
+    wake_parser_task(schedule_wake);
+
+    uint8_t      data[kRxBufferSize] = {};
+    uart_event_t event               = {};
     while (true)
     {
-        // FIXME Blinking LED
-        led_strip_set_pixel(led_strip, 0, 5, 5, 5);
-        led_strip_refresh(led_strip);
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        led_strip_set_pixel(led_strip, 0, 0, 0, 0);
-        led_strip_refresh(led_strip);
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-
-        // Reading bytes from UART
-        int len = uart_read_bytes(UART_NUM_0, data, kRxBufferSize, 20 / portTICK_PERIOD_MS);
-        //
-        // Handling received data
-        // Drawing colors if got ascii 'r', 'g' or 'b'
-        if (len > 0)
+        QueueSetMemberHandle_t member   = xQueueSelectFromSet(wake_set, portMAX_DELAY);
+        int64_t                start_us = esp_timer_get_time();
+        if (member == schedule_wake && xSemaphoreTake(schedule_wake, 0) == pdTRUE)
+        {
+            alarm.fired();
+        } else if (member == uart_queue && xQueueReceive(uart_queue, &event, 0) == pdTRUE)
         {
-            for (int i = 0; i < len; ++i)
+            // Events which were waiting, the one taken included
+            rx_queue_high = std::max(rx_queue_high,
+                                     static_cast<uint32_t>(uxQueueMessagesWaiting(uart_queue)) + 1);
+            int64_t now_us = start_us;
+            switch (event.type)
             {
-                for (int j = 0; j < sizeof(res) / sizeof(res[0]); ++j)
+                case UART_DATA:
                 {
-                    if (data[i] == res[j].symbol)
+                    // Event on timeout comes kRxTimeoutSymbols after the last byte, on full
+                    // FIFO right after it, the first byte came size bytes earlier
+                    int64_t silence    = event.timeout_flag ? kRxTimeoutSymbols : 0;
+                    int64_t receive_us = now_us - (static_cast<int64_t>(event.size) + silence) *
+                                                  kByteUs;
+                    size_t  left       = event.size;
+                    while (left != 0)
                     {
-                        led_strip_set_pixel(led_strip, 0, res[j].red, res[j].green, res[j].blue);
-                        led_strip_refresh(led_strip);
-                        vTaskDelay(1000 / portTICK_PERIOD_MS);
+                        int len = uart_read_bytes(UART_NUM_0, data, std::min(left, kRxBufferSize),
+                                                  0);
+                        if (len <= 0)
+                        {
+                            break;
+                        }
+                        device->receive(data, static_cast<size_t>(len), receive_us);
+                        left -= static_cast<size_t>(len);
                     }
+                    parser_load.add_latency(esp_timer_get_time() - receive_us);
+                    break;
+                }
+                case UART_FIFO_OVF:
+                case UART_BUFFER_FULL:
+                {
+                    // Bytes are lost anyway, decoder finds the next frame by its delimiter. Queue
+                    // is not reset, which would leave its events counted in the set: data events
+                    // still in it find nothing to read.
+                    ++uart_overruns;
+                    uart_flush_input(UART_NUM_0);
+                    break;
+                }
+                default:
+                {
+                    break;
                 }
             }
         }
+
+        // Scheduled messages which are due, then timer for the next one
+        int64_t now_us   = esp_timer_get_time();
+        int64_t delay_us = 0;
+        device->update(now_us);
+        bool    has_next = device->has_scheduled();
+        if (alarm.arm(has_next, has_next ? device->next_time_us() : 0, now_us, &delay_us))
+        {
+            esp_timer_stop(timer);
+            esp_timer_start_once(timer, static_cast<uint64_t>(delay_us));
+        }
+        parser_load.add_run(esp_timer_get_time() - start_us);
+    }
+}
+
+//------------------------------------------------------------------------------------------------//
+
+static void
+wake_led_task(void *arg)
+{
+    xTaskNotifyGive(static_cast<TaskHandle_t>(arg));
+}
+
+//------------------------------------------------------------------------------------------------//
+
+//
+// Refreshes strip when parser publishes a frame. Period of kLedRateHz is shorter than a tick,
+// so esp_timer wakes the task when frames held back by led_pacer_t are due.
+//
+void
+led_task(void *arg)
+{
+    esp_port_t *port = static_cast<esp_port_t *>(arg);
+
+    esp_timer_handle_t            wake = NULL;
+    const esp_timer_create_args_t args =
+    {
+        .callback              = wake_led_task,
+        .arg                   = xTaskGetCurrentTaskHandle(),
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "led_wake",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &wake));
+
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t wait_us = port->refresh();
+        if (wait_us >= 0)
+        {
+            // Timer may be armed by the previous call, restart it for the current deadline
+            esp_timer_stop(wake);
+            esp_timer_start_once(wake, static_cast<uint64_t>(wait_us));
+        }
     }
 }
 